@@ -0,0 +1,66 @@
+#ifndef ADC_FRONT_END_H
+#define ADC_FRONT_END_H
+
+#include <Arduino.h>
+
+/*
+Cleans up the dial readings before they get to the smoothing filter.
+
+The ADC readings have abrupt spikes in them, most likely from the power
+supply, and the fix so far has been heavy smoothing in SmoothAnalogInput.
+That works, but smoothing is lag.  Here we knock the spikes out first, so
+the smoothing afterwards can be lighter and the dials feel quicker:
+------
+1. Take a quick burst of readings (ADC_OVERSAMPLE of them, a few tens of
+microseconds in all) and keep the middle one.  A spike, or even two, in
+the burst ends up at one end after sorting and never gets used.
+2. The ESP32's ADC isn't quite a straight line, especially near the ends.
+Each chip has calibration numbers burned in at the factory (eFuse), and
+esp_adc_cal turns those into a correction curve.  We run the curve once at
+startup into a small table, then each reading is just a lookup.  The result
+stays on the same 0-4095 scale as the raw reading, so nothing downstream
+has to change.
+------
+Each reading in the burst also waits for a quiet moment between the lights'
+PWM edges (see PwmPhase.h), so there are fewer spikes to knock out.
+
+Only ADC1 pins get the burst and the correction (that's all the dials,
+A0-A3).  Anything else, or reading before adc_front_end_begin(), falls back
+to a plain analogRead().
+*/
+
+const uint8_t ADC_OVERSAMPLE = 5;  // odd, so there's a middle one
+
+// What the correction table was built from
+enum class AdcCalibration : uint8_t {
+  NO_TABLE,       // the readings are used as they come
+  DEFAULT_CURVE,  // no factory calibration on this chip, esp_adc_cal's default curve
+  FACTORY         // this chip's own calibration, from the eFuse
+};
+
+/**
+ * Read the calibration and build the correction table
+ * Call this once from setup(), before the dials are set up
+ *
+ * @return What the table was built from, if it was built at all
+ */
+AdcCalibration adc_front_end_begin();
+
+/**
+ * Take a burst of readings and return the corrected middle one
+ *
+ * @param pin The analog pin to read
+ * @return The reading, 0-4095
+ */
+uint16_t adc_front_end_read(uint8_t pin);
+
+/**
+ * Take one reading, timed like the burst's but with nothing else done to it
+ * For measuring the noise itself, see AdcNoiseBench.h
+ *
+ * @param pin The analog pin to read
+ * @return The raw reading, 0-4095
+ */
+uint16_t adc_front_end_read_raw(uint8_t pin);
+
+#endif
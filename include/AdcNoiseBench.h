@@ -0,0 +1,47 @@
+#ifndef ADC_NOISE_BENCH_H
+#define ADC_NOISE_BENCH_H
+
+#include <Arduino.h>
+
+/*
+How noisy the raw dial readings are with the lights on, before and after
+staggering the PWM and reading between its edges (see PwmPhase.h).
+
+Leave the red dial (A0) alone and the lights plugged in.  All three lights
+are put at the same brightness, and we take a couple of thousand single
+readings (adc_front_end_read_raw(), no burst, no smoothing), each at a
+random point in the PWM cycle, three ways:
+------
+  aligned    all three lights switch on at the same count, read any time (before)
+  staggered  the lights start a third of a period apart, read any time
+  synced     staggered, and each reading waits for a gap between edges (after)
+------
+at 0, 10, 25, 50, 75 and 100 percent.  Each one is printed like the quality
+checks, so tools/check_benchmarks.py shows them and saves them with --report:
+------
+  QUALITY,adc_noise_<way>_<percent>,sd,<counts>
+  QUALITY,adc_noise_<way>_<percent>,p2p,<counts>
+  QUALITY,adc_noise_<way>_<percent>,spike_pct,<percent>
+------
+sd is the standard deviation, p2p the highest reading less the lowest, and
+spike_pct how many readings were more than 50 counts off the median.  At 0
+and 100 percent nothing is switching, so those are the floor.
+
+Then, synced, it sweeps how far ahead of the sampling the quiet check looks
+(PWM_ADC_LEAD_COUNTS in PwmPhase.cpp, which is only a guess at how long
+adc1_get_raw() takes to get to the sampling) from 0 to 8 us, at 25, 50 and
+75 percent, as adc_noise_lead<us>us_<percent>, and says which lead had the
+lowest sd over the three:
+------
+  QUALITY,adc_noise_lead,quietest_us,<us>
+------
+That's the number to put in PwmPhase.cpp.
+*/
+
+/**
+ * Measure the noise and print the results, leaving the lights off
+ * Called from run_benchmarks(), before the dithering has started
+ */
+void run_adc_noise_benchmarks();
+
+#endif
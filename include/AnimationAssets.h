@@ -0,0 +1,128 @@
+#ifndef ANIMATION_ASSETS_H
+#define ANIMATION_ASSETS_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include "ColorMath.h"
+
+/*
+Animations kept in their own flash partition ("assets" in partitions.csv),
+so they can be as long as we like without being code or taking RAM.
+
+The partition is mapped into the address space with esp_partition_mmap(),
+and after that it's read like any other memory: the flash cache fetches
+it as needed, and nothing is ever copied out.  The image is built on the
+computer by tools/pack_assets.py and written with esptool, separately from
+the firmware, so changing an animation doesn't need a rebuild.
+
+The image, all little-endian:
+------
+  AssetHeader                    magic "LTAS", version, count, size, CRC
+  AssetEntry x count             the directory, one per animation
+  frame or keyframe arrays       wherever the directory says
+------
+An animation is either evenly spaced frames (a color every frame_ms), or
+keyframes at given times with straight-line fades between them.  Colors
+are the usual 16-bit levels.  Either kind can loop or hold its last color.
+
+If the partition is missing, empty, or the image doesn't check out, there
+are simply no animations, and everything else carries on as before.  When
+a CUSTOM mode has no program loaded (see LightVM.h), it plays the animation
+named after it ("custom1" to "custom8"), if there is one.
+*/
+
+const uint32_t ASSET_MAGIC = 0x5341544C;  // "LTAS"
+const uint16_t ASSET_VERSION = 1;
+const uint8_t ASSET_NAME_LENGTH = 16;
+const uint8_t ASSET_PARTITION_SUBTYPE = 0x40;
+
+enum class AssetKind : uint8_t {
+  FRAMES,
+  KEYFRAMES
+};
+
+const uint8_t ASSET_FLAG_LOOP = 0x01;
+
+struct AssetHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;       // directory entries
+  uint32_t size;        // the whole image, header included
+  uint32_t crc;         // CRC-32 (zlib's) of everything after the header
+};
+
+struct AssetEntry {
+  char name[ASSET_NAME_LENGTH];  // NUL-padded
+  uint32_t offset;      // from the start of the image
+  uint32_t count;       // frames or keyframes
+  uint32_t duration_ms; // one time through
+  uint8_t kind;         // AssetKind
+  uint8_t flags;
+  uint16_t frame_ms;    // FRAMES only
+};
+
+struct AssetFrame {
+  uint16_t red;
+  uint16_t green;
+  uint16_t blue;
+};
+
+struct AssetKeyframe {
+  uint32_t time_ms;     // from the start, in order
+  uint16_t red;
+  uint16_t green;
+  uint16_t blue;
+  uint16_t reserved;
+};
+
+class AnimationAssets {
+private:
+  const uint8_t* _image;  // mapped flash, or nullptr
+  const AssetEntry* _entries;
+  uint16_t _count;
+  spi_flash_mmap_handle_t _mmap_handle;
+
+public:
+  AnimationAssets();
+
+  /**
+   * Find the assets partition and map it
+   * Call this once from setup()
+   *
+   * @return true if there's a good image in it
+   */
+  bool begin();
+
+  /**
+   * Use an image that's already in memory (begin() does, once it's mapped)
+   *
+   * @return true if it checks out
+   */
+  bool open(const uint8_t* image, uint32_t size);
+
+  /**
+   * Look an animation up by name
+   *
+   * @return Its index, or -1
+   */
+  int16_t find(const char* name) const;
+
+  /**
+   * Work out the color of an animation at a moment
+   * Reads straight out of the mapped flash, nothing is copied
+   *
+   * @param index Which animation
+   * @param time_ms Time since it started
+   * @param color Set to the color
+   */
+  void sample(uint16_t index, uint32_t time_ms, RgbColor &color) const;
+
+  inline uint16_t count() const {
+    return _count;
+  };
+  inline const AssetEntry& entry(uint16_t index) const {
+    return _entries[index];
+  };
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef AUDIO_ANALYZER_H
+#define AUDIO_ANALYZER_H
+
+#include <Arduino.h>
+
+/*
+Listens to a microphone on the spare analog pin (A4) and works out how loud
+the bass, middle and treble are, so the lights can dance to music.
+
+The microphone is sampled at 8 kHz by the ADC's DMA controller, which fills
+a buffer in the background without the CPU touching each sample.  A task
+pinned to the other core (the Arduino loop() runs on core 1, we run on
+core 0) pulls the samples out and runs them through a bank of Goertzel
+filters.  A Goertzel filter measures the strength of a single frequency,
+and for a handful of bands it is much cheaper than a full FFT.  Each block
+is windowed on the way in, so a loud tone in one band doesn't leak into
+the others.  It's all integer math, so no floats in the sample loop.
+
+The loop() only ever reads the finished band levels, so the buttons stay
+just as responsive as before.
+
+A4 is on the second ADC unit, and that's a known weak spot: Espressif
+lists the second unit in continuous (DMA) mode as unsupported on the
+ESP32-S3, with unstable readings, and it is shared with the Wi-Fi radio
+besides (we don't use Wi-Fi, see the README).  This hasn't been tried on
+a board yet.  It can't simply move: the first unit's pins (GPIO1-10) are
+all taken by the dials, the lights and the buttons, and the dials read the
+first unit one reading at a time, which doesn't mix with DMA on the same
+unit.  begin() checks the first samples come back from the right pin and
+gives up otherwise, which lights the no-microphone error and leaves the
+special buttons on their usual mode.  If the bands flicker for no reason
+on a board, set AUDIO_ENABLED to false in main.cpp.
+
+A small electret microphone module with a built-in amplifier, biased to
+the middle of the 3.3V range, is what it's meant for.
+*/
+
+enum class AudioBand : uint8_t {
+  BASS,
+  MID,
+  TREBLE,
+  COUNT
+};
+
+const uint8_t AUDIO_BAND_COUNT = static_cast<uint8_t>(AudioBand::COUNT);
+const uint8_t AUDIO_FILTERS_PER_BAND = 4;
+const uint16_t AUDIO_BLOCK_SAMPLES = 256; // 32ms of sound at 8 kHz
+
+class GoertzelFilter {
+/*
+One Goertzel filter in Q14 fixed point.  Feed it a block of samples, then
+ask for the power at its frequency and reset it for the next block.
+*/
+private:
+  int32_t _coeff;  // 2*cos(2*pi*f/fs) in Q14
+  int32_t _s1;
+  int32_t _s2;
+
+public:
+  GoertzelFilter();
+  void set_frequency(uint16_t frequency_hz, uint32_t sample_rate_hz);
+
+  // The hot loop, kept inline
+  inline void add_sample(int32_t sample) {
+    int32_t s0 = sample + static_cast<int32_t>((static_cast<int64_t>(_coeff) * _s1) >> 14) - _s2;
+    _s2 = _s1;
+    _s1 = s0;
+  };
+
+  /**
+   * Finish the block
+   *
+   * @return The power at this filter's frequency (arbitrary units)
+   */
+  uint64_t finish_block();
+};
+
+class AudioAnalyzer {
+private:
+  uint8_t _pin;
+  uint32_t _sample_rate_hz;
+  bool _running;
+  GoertzelFilter _filters[AUDIO_BAND_COUNT][AUDIO_FILTERS_PER_BAND];
+  int32_t _dc_level;  // running average of the input, Q8
+  uint16_t _samples_in_block;
+  int32_t _peak_log[AUDIO_BAND_COUNT];  // for the automatic gain, Q8 log2
+  uint16_t _levels[AUDIO_BAND_COUNT];   // published band levels, 0-1023
+  unsigned long _blocks_analyzed;
+
+  static void task_entry(void* analyzer);
+  void run();
+  void finish_block();
+
+public:
+  /**
+   * Constructor for the audio analyzer
+   *
+   * @param pin The analog pin the microphone is on (default A4)
+   * @param sample_rate_hz How fast to sample (default 8 kHz)
+   */
+  AudioAnalyzer(uint8_t pin = A4, uint32_t sample_rate_hz = 8000);
+
+  /**
+   * Start the ADC DMA and the analysis task
+   * Call this once from setup()
+   *
+   * @return true if everything started
+   */
+  bool begin();
+
+  /**
+   * Whether begin() got the ADC and the task going
+   */
+  inline bool running() const {
+    return _running;
+  };
+
+  /**
+   * Get the latest band levels
+   *
+   * @param bass, mid, treble Set to levels from 0 to 1023
+   */
+  void get_levels(uint16_t &bass, uint16_t &mid, uint16_t &treble);
+
+  /**
+   * How many blocks of samples have been analyzed so far
+   */
+  unsigned long blocks_analyzed() const;
+
+  /**
+   * Take in one microphone sample, 0-4095
+   * Called from the task, but public so it can be driven by hand
+   */
+  void add_sample(int32_t sample);
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <Arduino.h>
+#include "OutputController.h"
+#include "ProgramState.h"
+
+/*
+Microbenchmarks that run on the Arduino itself, to see what each piece of
+the loop actually costs on the ESP32-S3, and to catch it when a change
+makes one of them slower.
+
+These run as the on-device tests in test/embedded (pio test -e embedded,
+which defines LIGHT_BENCHMARK), so the normal firmware doesn't carry them.
+Each benchmark times single calls with the CPU cycle counter, many times
+over, with a few different input patterns where the input matters (a
+steady dial, a dial being turned, a noisy dial with spikes).  Results are
+printed over serial, one line each, easy for a script to pick apart:
+------
+  BENCH,<name>,<samples>,<min cycles>,<median cycles>
+  BENCH_CHECK,<name>,<runs>,<failures>
+  BENCH_INFO,<name>,<value>
+  BENCH_DONE,<cpu MHz>
+------
+BENCH_CHECK lines are correctness checks rather than timings, like
+hammering the snapshot hand-off between the two cores (see SeqLock.h) and
+counting any torn reads, and the test fails if any of them did.  BENCH_INFO
+is just for people to read.  The median is what gets compared, since now
+and then an interrupt lands in the middle of a call and makes it look slow.
+tools/check_benchmarks.py reads these lines from the test's output,
+compares them with the saved baseline in tools/benchmark_baseline.json,
+and fails if anything got slower by more than the tolerance, or has no
+baseline to go by.
+*/
+
+/**
+ * Run all the benchmarks and print the results
+ * Called from the on-device test, see test/embedded
+ *
+ * @param state The program state, copied so the benchmarks can't disturb it
+ * @param output The only output controller, never started
+ * @return How many of the correctness checks failed
+ */
+uint32_t run_benchmarks(const ProgramState &state, OutputController &output);
+
+#endif
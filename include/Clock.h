@@ -0,0 +1,49 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <Arduino.h>
+
+/*
+The one clock everything tells the time by.
+
+millis() and micros() are 32 bits, so they wrap: micros() every 71 minutes
+and millis() every 49.7 days.  The box is never switched off, so it sees
+both, and the old mix of unsigned long, long and int timestamps each went
+wrong in its own way when they did.  esp_timer_get_time() counts
+microseconds since boot in 64 bits, which won't wrap in anyone's lifetime,
+and everything reads the time from here.
+
+Anything that keeps a time of day (when the mode started, when there was
+last motion) keeps the whole 64 bits, so a difference is always just a
+subtraction.  Things that only ever time short intervals (a dial reading,
+a loop pass, a stream frame) can keep the low 32 bits, clock_us32() and
+clock_ms32(), and subtract those as unsigned; that's right across a wrap
+as long as the interval itself is shorter than the wrap.
+
+On this computer the made-up board's clock is behind
+esp_timer_get_time() (see lib/host_arduino), so the soak test
+(test/native/test_soak) can get through months in seconds and start just
+short of the 32-bit wraps.
+*/
+
+/**
+ * Microseconds since boot
+ */
+uint64_t clock_us();
+
+/**
+ * Milliseconds since boot
+ */
+inline uint64_t clock_ms() {
+  return clock_us() / 1000;
+}
+
+// The low 32 bits, for short intervals only, see above
+inline uint32_t clock_us32() {
+  return static_cast<uint32_t>(clock_us());
+}
+inline uint32_t clock_ms32() {
+  return static_cast<uint32_t>(clock_ms());
+}
+
+#endif
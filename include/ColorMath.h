@@ -0,0 +1,111 @@
+#ifndef COLOR_MATH_H
+#define COLOR_MATH_H
+
+#include <Arduino.h>
+
+/*
+Fixed-point color conversions, for rainbows and for turning the dials into
+hue, saturation and brightness.
+
+Hue goes around the color wheel in 1536 steps: six sectors (red, yellow,
+green, cyan, blue, magenta) of 256 steps each.  That makes the sector a
+shift and the position within it a mask, so there are no divisions and no
+floats when converting to RGB.  Saturation is 0-255, and value (brightness)
+and the RGB channels are 16-bit, the same fine levels the light outputs take.
+*/
+
+const uint16_t HUE_STEPS = 1536;
+const uint16_t HUE_SECTOR_STEPS = 256;
+
+struct HsvColor {
+  uint16_t hue;  // 0-1535
+  uint8_t sat;   // 0-255
+  uint16_t val;  // 0-65535
+};
+
+struct RgbColor {
+  uint16_t red;  // 0-65535
+  uint16_t green;
+  uint16_t blue;
+};
+
+/**
+ * Convert one HSV color to RGB, no divisions
+ */
+inline RgbColor hsv_to_rgb(const HsvColor &hsv) {
+  uint16_t hue = hsv.hue < HUE_STEPS ? hsv.hue : hsv.hue % HUE_STEPS;
+  uint8_t sector = hue >> 8;
+  uint32_t fraction = hue & 0xFF;
+  // Stretch 0-255 to 0-256 so full saturation really is full
+  uint32_t sat = hsv.sat + (hsv.sat >> 7);
+  uint32_t val = hsv.val;
+
+  // The three levels every sector is made from
+  uint16_t low = (val * (256 - sat)) >> 8;
+  uint16_t falling = (val * (256 - ((sat * fraction) >> 8))) >> 8;
+  uint16_t rising = (val * (256 - ((sat * (256 - fraction)) >> 8))) >> 8;
+
+  RgbColor rgb;
+  switch (sector) {
+    case 0: rgb.red = val; rgb.green = rising; rgb.blue = low; break;
+    case 1: rgb.red = falling; rgb.green = val; rgb.blue = low; break;
+    case 2: rgb.red = low; rgb.green = val; rgb.blue = rising; break;
+    case 3: rgb.red = low; rgb.green = falling; rgb.blue = val; break;
+    case 4: rgb.red = rising; rgb.green = low; rgb.blue = val; break;
+    default: rgb.red = val; rgb.green = low; rgb.blue = falling; break;
+  }
+  return rgb;
+}
+
+/**
+ * Convert a whole array of HSV colors to RGB
+ */
+void hsv_to_rgb_batch(const HsvColor* hsv, RgbColor* rgb, size_t count);
+
+/**
+ * Convert one RGB color to HSV
+ * Uses a reciprocal table instead of dividing, accurate to about a step.
+ */
+HsvColor rgb_to_hsv(const RgbColor &rgb);
+
+class HueBrightness {
+/*
+Makes every hue look about as bright as every other one.
+
+A fully saturated yellow has both red and green on, and green looks far
+brighter to the eye than blue does at the same duty.  So a plain trip
+around the color wheel pulses bright and dim.  Here we work out, for each
+hue, how bright it looks (a weighted sum of the channels), and scale it
+down to match the dimmest hue.  The table is built once with floats at
+startup, and after that it's just a lookup and a multiply.
+
+The default weights are gentler than the usual video luma weights, since
+on our LED strip green isn't nearly ten times as bright as blue.  Adjust
+them to suit your strip.
+*/
+private:
+  // 32 hue steps apart, so table entries land on the sector edges
+  static const uint8_t TABLE_SHIFT = 5;
+  static const uint8_t TABLE_STEPS = HUE_STEPS >> TABLE_SHIFT;
+  uint16_t _gains[TABLE_STEPS + 1];  // Q15, 32768 is no change
+
+public:
+  /**
+   * Constructor, builds the gain table
+   *
+   * @param red_weight, green_weight, blue_weight How bright each channel looks
+   */
+  HueBrightness(float red_weight = 0.33, float green_weight = 0.47, float blue_weight = 0.20);
+
+  /**
+   * Convert to RGB, scaled so all hues look equally bright at the same value
+   */
+  RgbColor to_rgb(const HsvColor &hsv) const;
+
+  /**
+   * Batch version of to_rgb()
+   */
+  void to_rgb_batch(const HsvColor* hsv, RgbColor* rgb, size_t count) const;
+};
+
+#endif
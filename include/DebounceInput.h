@@ -11,16 +11,14 @@ when the button bounces a bit when pressed.
 */
 private:
 // underscores start the private variable names
-  uint8_t _pin;  // GPIO pin number
+// Packed tight, there are a dozen of these counting the motion sensors
+  const char* _buttonName;    // Button name for debugging, the text itself stays in flash
   uint16_t _debounceDelay;  // in milliseconds
-  bool _lastStableState;
-  bool _currentState;
-  unsigned long _lastDebounceTime;
-  uint8_t _mode;
-  bool _activeLow;  // some inputs are "activated" when they input is low
-  
-  // Button function stuff
-  const char* _buttonName;    // Button name for debugging
+  uint16_t _lastDebounceTime;  // Low 16 bits of clock_ms(), we only need the difference
+  uint8_t _pin;  // GPIO pin number
+  bool _lastStableState : 1;
+  bool _currentState : 1;
+  bool _activeLow : 1;  // some inputs are "activated" when they input is low
 
 public:
   /**
@@ -64,8 +62,18 @@ public:
    */
   bool isActive() const;
 
+  /**
+   * Check whether the pin agrees with the debounced state
+   *
+   * @return false while a change is still being debounced
+   */
+  bool isSettled() const;
+
   // Get the button name
   const char* getButtonName() const;
+
+  // Get the GPIO pin number
+  uint8_t getPin() const;
   
 };
 
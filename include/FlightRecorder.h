@@ -0,0 +1,76 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <Arduino.h>
+
+/*
+A flight recorder: remembers the last few hundred things that happened, so
+when the lights go dark or flip modes out of nowhere, we can find out why
+after the fact.
+
+Every mode change, sleep step, button edge and motion change goes in as one
+small fixed-size event (what, when, and a couple of numbers).  They go into
+a ring buffer in RTC memory, which isn't cleared by a watchdog reset, a
+crash or a brownout, only by losing power altogether.  Each boot adds a
+BOOT event with the reset reason, so the log reads as one timeline across
+resets.  Recording an event is a handful of stores, well under a
+microsecond, so it's always on.
+
+To read it back, run tools/flight_log.py, which pulls the events over the
+serial protocol (GET_FLIGHT_LOG) and prints them as a timeline.
+
+Everything that records runs in loop() on core 1, so there's no locking.
+Keep it that way: the sensing task on core 0 mustn't record directly.
+*/
+
+enum class FlightEventType : uint8_t {
+  BOOT,         // a = esp_reset_reason(), b = boot number
+  MODE_CHANGE,  // a = new mode, b = old mode
+  SLEEP,        // a = FlightSleepStep, b = mode at the time
+  BUTTON,       // a = Button, b = 1 pressed, 0 released
+  MOTION,       // a = sensors now (bit each), b = sensors before
+  COUNT
+};
+
+enum class FlightSleepStep : uint8_t {
+  DOZE,         // no motion for a while, dimming down
+  SLEEP,        // still nothing, lights off
+  WAKE          // motion during the doze, back to the last mode
+};
+
+// One event, 8 bytes.  Laid out the same in tools/flight_log.py.
+struct FlightEvent {
+  uint32_t time_ms;  // clock_ms() since that boot, the low 32 bits
+  uint8_t type;      // FlightEventType
+  uint8_t a;
+  uint16_t b;
+};
+
+const uint16_t FLIGHT_LOG_EVENTS = 256;  // power of two, 2 KB of RTC memory
+
+/**
+ * Pick up the log from before the reset, or start a fresh one after a power-on
+ * Call this once, early in setup()
+ *
+ * @return How many events were kept from before
+ */
+uint32_t flight_recorder_begin();
+
+/**
+ * Record one event
+ */
+void flight_record(FlightEventType type, uint8_t a = 0, uint16_t b = 0);
+
+/**
+ * How many events are in the log, up to FLIGHT_LOG_EVENTS
+ */
+uint16_t flight_recorder_count();
+
+/**
+ * Get one event, counting from the oldest still in the log
+ *
+ * @return false if there's no event at that index
+ */
+bool flight_recorder_get(uint16_t index, FlightEvent &event);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef INPUT_SNAPSHOT_H
+#define INPUT_SNAPSHOT_H
+
+#include <Arduino.h>
+
+/*
+Everything the sensing task knows about the inputs at one moment: the
+dials, the buttons and whether anyone is in the room.  The sensing task
+fills one in every pass and publishes it (see SensingTask.h), and loop()
+works from the latest one.  It's a plain struct so it can be copied in one
+go, no pointers and nothing that needs constructing.
+
+Buttons aren't just "down or not".  A quick tap could come and go between
+two loop() passes if the loop is slow, so each button also counts its
+presses and releases.  loop() remembers the counts it last saw, and any
+difference is an edge it hasn't handled yet.  The counts wrap, that's fine,
+only the difference matters.
+*/
+
+enum class Dial : uint8_t {
+  RED,
+  GREEN,
+  BLUE,
+  WHITE,
+  COUNT
+};
+
+// In the same order as the buttons are listed in main.cpp
+enum class Button : uint8_t {
+  RGB,
+  WHITE,
+  CYCLE,
+  OFF,
+  S1,
+  S2,
+  S3,
+  S4,
+  COUNT
+};
+
+const uint8_t DIAL_COUNT = static_cast<uint8_t>(Dial::COUNT);
+const uint8_t BUTTON_COUNT = static_cast<uint8_t>(Button::COUNT);
+
+struct InputSnapshot {
+  uint32_t pass;                      // which sensing pass this came from
+  uint32_t taken_us;                  // clock_us32() when the readings were done
+  float dial_speed[DIAL_COUNT];       // smoothed change per millisecond
+  float dial_velocity[DIAL_COUNT];    // fitted change per millisecond (SlidingVelocity)
+  uint16_t dial_value[DIAL_COUNT];    // smoothed, 0-4095
+  uint16_t dial_fine[DIAL_COUNT];     // smoothed, 16-bit
+  float dial_noise_sigma[DIAL_COUNT]; // noise at rest, counts per reading (NoiseFloor)
+  float dial_noise_scale[DIAL_COUNT]; // how much the smoothing is stretched for it
+  uint8_t presses[BUTTON_COUNT];      // count of presses, wraps
+  uint8_t releases[BUTTON_COUNT];     // count of releases, wraps
+  uint8_t buttons_down;               // bit per Button
+  uint8_t motion_sensors;             // bit per motion sensor (a, b, c), cooldown included
+  bool occupied;                      // any of them
+
+  inline uint16_t value(Dial dial) const {
+    return dial_value[static_cast<uint8_t>(dial)];
+  };
+  inline uint16_t fine(Dial dial) const {
+    return dial_fine[static_cast<uint8_t>(dial)];
+  };
+  inline float speed(Dial dial) const {
+    return dial_speed[static_cast<uint8_t>(dial)];
+  };
+  inline float velocity(Dial dial) const {
+    return dial_velocity[static_cast<uint8_t>(dial)];
+  };
+  inline float noise_sigma(Dial dial) const {
+    return dial_noise_sigma[static_cast<uint8_t>(dial)];
+  };
+  inline float noise_scale(Dial dial) const {
+    return dial_noise_scale[static_cast<uint8_t>(dial)];
+  };
+  inline bool down(Button button) const {
+    return buttons_down & (1 << static_cast<uint8_t>(button));
+  };
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef LATENCY_BENCH_H
+#define LATENCY_BENCH_H
+
+#include <Arduino.h>
+#include "DebounceInput.h"
+#include "ProgramState.h"
+#include "OutputController.h"
+
+/*
+How long it takes from a button press (or a motion sensor seeing someone)
+to the lights changing, measured on the real thing.
+
+The press has to get through the debouncing (50 ms for the buttons, 20 ms
+for the motion sensors), wait for the sensing task to publish it, wait for
+loop() to come around, go through enter_mode(), and then wait for the
+dithering timer to write the new duty.  Nothing times the whole of that, so
+this does, in the benchmark firmware, once the benchmarks are done and
+everything is running like normal.
+
+Run a jumper from LATENCY_INJECT_PIN to one button's pin, or to a motion
+sensor's pin (with that sensor unplugged).  At startup we wiggle the spare
+pin and see which input follows it, so there's nothing to set.  Then a task
+on core 0 presses it, over and over:
+------
+1. Ask loop() to go to a starting mode (latency_bench_poll()).  For a
+button, each mode it would change away from; for a motion sensor, dozing
+(SLEEP_PREP) after each of a few modes, since motion only matters there.
+2. Wait a moment, then drive the spare pin at a random point in the
+millisecond, and note the time.
+3. The dithering notes the time of its first PWM write after the new mode
+changed the lights (see TemporalDither::mark()).  The difference is the
+latency.  If the lights didn't change (WHITE with the dial all the way
+down), that press counts as unchanged.
+4. Let go, and wait out the debouncing (and the motion sensor's cooldown).
+------
+Results are printed one line per input and starting mode (for motion, the
+mode it woke back up to), in microseconds:
+------
+  LATENCY,<input>,<mode number>,<samples>,<unchanged>,<min>,<median>,<p90>,<max>
+------
+ending with LATENCY_DONE.  tools/latency_report.py reads them and prints a
+table, and can run the same scenarios through this firmware built for the
+computer, on a made-up clock, so a debounce or loop change can be tried
+before flashing.  test/native/test_latency keeps an eye on it every build.
+*/
+
+// D1 (TX) isn't used, Serial goes over USB
+const uint8_t LATENCY_INJECT_PIN = D1;
+
+/**
+ * Find the looped back input, and start measuring if there is one
+ * Called at the end of setup() in the benchmark firmware, once everything has started
+ *
+ * @param state The program state loop() uses, for the motion sensors
+ * @param buttons BUTTON_COUNT buttons, in Button order
+ * @param output The output controller loop() uses, for its dithering
+ */
+void latency_bench_begin(ProgramState &state, DebounceInput* buttons, OutputController &output);
+
+/**
+ * Go to the next starting mode, if one has been asked for
+ * Called from loop(), since the mode belongs to it
+ *
+ * @param state The program state
+ * @return true if the mode was changed
+ */
+bool latency_bench_poll(ProgramState &state);
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef LIGHT_VM_H
+#define LIGHT_VM_H
+
+#include <Arduino.h>
+#include "ColorMath.h"
+#include "InputSnapshot.h"
+
+/*
+A tiny programmable light, so new routines don't need a reflash.
+
+Programs are written in a little assembly language on the computer,
+turned into bytecode by tools/light_asm.py, and sent over the serial
+protocol into one of eight slots, one per CUSTOM mode.  They're kept in
+flash (NVS), so they survive a power-off.  While a CUSTOM mode whose slot
+has a program in it is on, that program runs instead of the built-in color.
+
+The machine is a stack machine, like an old calculator: numbers are pushed
+onto a stack, and each instruction takes its inputs off the top and puts
+its answer back.  Everything is a 32-bit whole number.  For example, this
+makes the red dial set the red light, with green and blue off:
+------
+  dial 0       ; red dial, 0-4095
+  push 4
+  div          ; 0-1023, a PWM duty
+  push 0
+  push 0
+  rgb          ; red, green, blue off the stack
+  end
+------
+The program runs from the top once per loop() pass, and `end` finishes
+that pass.  There are eight variables that are kept from one pass to the
+next (cleared when the mode is entered), for counters and the like.  `time`
+gives the milliseconds since the mode was entered, for animations.
+
+To keep a bad program from hanging the lights, the buttons and everything
+else, each pass may run at most VM_TICK_BUDGET instructions.  Past that the
+pass is cut short, the lights keep their last color, and it starts over
+from the top next time.  A program is checked as it's loaded, so that it
+can't jump into the middle of an instruction, read a variable or dial that
+doesn't exist, or push more than the stack holds.  That way the interpreter
+itself needs no checks at all, and runs fast.
+
+Each instruction is one byte, some followed by a one- or two-byte operand.
+The interpreter jumps straight from one instruction's code to the next
+through a table of label addresses (GCC's computed goto), rather than
+going round a switch.  The opcodes are listed in tools/light_asm.py too,
+keep the two the same.
+*/
+
+const uint8_t VM_SLOTS = 8;             // one per CUSTOM mode
+const uint16_t VM_PROGRAM_SIZE = 256;   // bytes per program
+const uint8_t VM_STACK_SIZE = 16;
+const uint8_t VM_VARIABLES = 8;
+const uint16_t VM_TICK_BUDGET = 1000;   // instructions per pass, tens of microseconds
+
+enum class Op : uint8_t {
+  END,      // finish this pass
+  PUSH8,    // push the signed byte that follows
+  PUSH16,   // push the signed 16-bit number that follows
+  DUP,      // a -> a a
+  DROP,     // a ->
+  SWAP,     // a b -> b a
+  OVER,     // a b -> a b a
+  ADD,      // a b -> a+b
+  SUB,      // a b -> a-b
+  MUL,      // a b -> a*b
+  DIV,      // a b -> a/b, 0 if b is 0
+  MOD,      // a b -> a%b, 0 if b is 0
+  MIN,
+  MAX,
+  AND,
+  OR,
+  XOR,
+  SHL,      // a b -> a<<b
+  SHR,      // a b -> a>>b
+  LT,       // a b -> 1 if a<b, else 0
+  GT,
+  EQ,
+  NOT,      // a -> 1 if a is 0, else 0
+  NEG,      // a -> -a
+  SIN,      // a -> sine, 1024 steps a turn, -1023 to 1023
+  RANDOM,   // a -> a random number from 0 to a-1
+  LOAD,     // push the variable numbered by the byte that follows
+  STORE,    // pop into that variable
+  JMP,      // go to the 16-bit address that follows
+  JZ,       // pop, and go there if it was 0
+  DIAL,     // push the dial numbered by the byte that follows, 0-4095
+  BUTTON,   // push 1 if that button (Button order) is down, else 0
+  TIME,     // push milliseconds since the mode was entered
+  RGB,      // r g b ->, set the lights, each 0-1023
+  HSV,      // h s v ->, hue 0-1535, saturation 0-255, brightness 0-1023
+  COUNT
+};
+
+const uint8_t VM_OP_COUNT = static_cast<uint8_t>(Op::COUNT);
+
+// Why a program was turned down when loading
+enum class VmCheck : uint8_t {
+  OK,
+  TOO_BIG,
+  BAD_OPCODE,
+  TRUNCATED,        // an operand runs past the end
+  BAD_OPERAND,      // no such variable, dial or button
+  BAD_JUMP,         // not to the start of an instruction
+  STACK_UNDERFLOW,
+  STACK_OVERFLOW,
+  STACK_MISMATCH,   // two ways into one spot with different stack depths
+  FALLS_OFF_END     // runs past the last instruction without an end or jmp
+};
+
+struct VmStats {
+  uint32_t passes;
+  uint32_t overruns;      // passes cut short by the budget
+  uint32_t instructions;  // run in all, wraps
+};
+
+class LightVM {
+private:
+  uint8_t _programs[VM_SLOTS][VM_PROGRAM_SIZE];
+  uint16_t _lengths[VM_SLOTS];  // 0 for an empty slot
+  VmStats _stats[VM_SLOTS];
+  uint8_t _staging[VM_PROGRAM_SIZE];  // a program on its way in over serial
+  int32_t _variables[VM_VARIABLES];
+  RgbColor _color;
+  uint32_t _random_state;
+
+public:
+  LightVM();
+
+  /**
+   * Load the saved programs from flash
+   * Call this once from setup()
+   */
+  void begin();
+
+  /**
+   * Check a program without loading it
+   *
+   * @param code, length The bytecode
+   * @param position Set to where the problem is, if there is one
+   * @return OK if it's safe to run
+   */
+  static VmCheck check(const uint8_t* code, uint16_t length, uint16_t &position);
+
+  /**
+   * Check a program and put it in a slot, in memory only
+   *
+   * @return OK if it was loaded, otherwise the slot is left as it was
+   */
+  VmCheck load(uint8_t slot, const uint8_t* code, uint16_t length, uint16_t &position);
+
+  /**
+   * Copy part of a program into the staging area, for programs that
+   * arrive in pieces over serial
+   *
+   * @return false if it doesn't fit
+   */
+  bool stage(uint16_t offset, const uint8_t* data, uint8_t length);
+
+  /**
+   * Load the staged program into a slot and save it to flash
+   * A length of 0 empties the slot, back to the built-in color.
+   */
+  VmCheck commit(uint8_t slot, uint16_t length, uint16_t &position);
+
+  /**
+   * Clear the variables and color, for when the mode is entered
+   */
+  void restart();
+
+  /**
+   * Run one pass of a program
+   *
+   * @param slot Which program
+   * @param inputs The dials and buttons
+   * @param time_ms Milliseconds since the mode was entered
+   * @return false if the pass was cut short by the budget
+   */
+  bool run(uint8_t slot, const InputSnapshot &inputs, uint32_t time_ms);
+
+  inline bool loaded(uint8_t slot) const {
+    return slot < VM_SLOTS && _lengths[slot] > 0;
+  };
+  inline uint16_t length(uint8_t slot) const {
+    return _lengths[slot];
+  };
+  inline const VmStats& stats(uint8_t slot) const {
+    return _stats[slot];
+  };
+  // The color the program set last, as 16-bit levels
+  inline const RgbColor& color() const {
+    return _color;
+  };
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef LOOP_MONITOR_H
+#define LOOP_MONITOR_H
+
+#include <Arduino.h>
+
+/*
+Keeps an eye on how long each trip through loop() takes.
+
+A lot of the code expects the loop to come around about every millisecond:
+each pass picks up the latest inputs from the sensing task, works out the
+mode, writes the lights, and so on.  If something holds the loop up (a long Serial print
+while the USB buffer is full, or a heavy new mode), the lights get laggy
+and buttons get missed, and nothing would tell us.
+
+So loop() marks which stage it's in as it goes (buttons, dials, lights...),
+and at the end of each iteration we compare the total time against a
+budget.  When it runs over, we count it, and remember when it happened and
+which stage took the most time.  The worst iteration is kept as well.
+
+This also feeds the ESP32 task watchdog.  If the loop truly hangs, the
+watchdog resets the board after a few seconds rather than leaving the
+lights stuck.  The record lives in RTC memory, which survives that reset,
+so after the restart we can still see which stage it was stuck in.
+*/
+
+enum class LoopStage : uint8_t {
+  IDLE,
+  BUTTONS,
+  ANALOG,
+  SLEEP,
+  SERIAL_IO,
+  LIGHTS,
+  DEBUG_PRINT,
+  STAGE_COUNT
+};
+
+// What we know about overruns.  Lives in RTC memory, so keep it plain.
+struct LoopOverrunRecord {
+  uint32_t magic;           // tells a kept record from power-on garbage
+  uint32_t boot_count;
+  uint32_t iterations;
+  uint32_t overruns;
+  uint32_t last_overrun_ms;
+  uint32_t last_overrun_us; // how long that iteration took
+  uint32_t worst_us;
+  uint8_t last_overrun_stage;
+  uint8_t worst_stage;
+  uint8_t current_stage;    // where we are right now, or were at a hang
+  uint8_t reset_reason;     // esp_reset_reason() at the start of this boot
+};
+
+class LoopMonitor {
+private:
+  uint32_t _budget_us;
+  uint8_t _watchdog_timeout_s;
+  bool _watchdog_running;
+  bool _started;  // whether there's an iteration to wrap up
+  uint32_t _iteration_start_us;
+  uint32_t _stage_start_us;
+  uint32_t _stage_us[static_cast<uint8_t>(LoopStage::STAGE_COUNT)];
+  LoopOverrunRecord _previous;  // what the last boot left behind
+  bool _have_previous;
+
+  void close_stage(uint32_t now_us);
+
+public:
+  /**
+   * Constructor for the loop monitor
+   *
+   * @param budget_us How long one loop() iteration may take
+   * @param watchdog_timeout_s How long a hang lasts before the board resets (0 for no watchdog)
+   */
+  LoopMonitor(uint32_t budget_us = 2000, uint8_t watchdog_timeout_s = 5);
+
+  /**
+   * Pick up the record from before the last reset and start the watchdog
+   * Call this once from setup()
+   *
+   * @return true if the last reset was the watchdog catching a hung loop
+   */
+  bool begin();
+
+  /**
+   * Finish the last iteration and start the next one
+   * Call this at the very top of loop(), it also feeds the watchdog
+   */
+  void start_iteration();
+
+  /**
+   * Mark that loop() has moved on to a new stage
+   */
+  void stage(LoopStage stage);
+
+  // The overrun record for this boot
+  const LoopOverrunRecord& get_record() const;
+  // The record from before the last reset, if there was one
+  inline bool get_previous(LoopOverrunRecord &record) const {
+    record = _previous;
+    return _have_previous;
+  };
+  inline uint32_t get_budget_us() const {
+    return _budget_us;
+  };
+  inline void set_budget_us(uint32_t budget_us) {
+    _budget_us = budget_us;
+  };
+};
+
+// A short name for a stage, for printing
+const char* loop_stage_name(uint8_t stage);
+
+#endif
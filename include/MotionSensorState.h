@@ -6,16 +6,17 @@
 
 class MotionSensorState {
   private:
-    unsigned int _motion_pin;
-    DebounceInput _motion_input;
-    unsigned long _last_motion_detected;
-    unsigned long _cooldown_time;
+    DebounceInput _motion_input;  // knows its own pin
+    uint64_t _last_motion_detected;  // clock_ms()
+    uint16_t _cooldown_time;
     bool _enabled;
   public:
     MotionSensorState(unsigned int motion_pin, bool enabled = true);
     MotionSensorState(); // Default will have it off
     bool update();
     bool occupied();
+    uint8_t pin() const;
+    bool enabled() const;
     
 };
 
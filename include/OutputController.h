@@ -3,45 +3,77 @@
 
 #include <Arduino.h>
 #include "ProgramState.h"
-
-// These are a binary mask for RGB
-enum class JingleColors {
-  OFF,
-  RED,
-  GREEN,
-  YELLOW,
-  BLUE,
-  MAGENTA,
-  CYAN,
-  WHITE
-};
+#include "TemporalDither.h"
+#include "ColorMath.h"
+#include "PowerBudget.h"
+#include "LightVM.h"
+#include "AnimationAssets.h"
+#include "StatusLed.h"
 
 class OutputController {
   private:
-    unsigned int _red_output_pwm_pin;
-    unsigned int _green_output_pwm_pin;
-    unsigned int _blue_output_pwm_pin;
-    unsigned int _red_pwm_channel;
-    unsigned int _green_pwm_channel;
-    unsigned int _blue_pwm_channel;
-    unsigned long _last_jingle_time;
-    unsigned long _jingle_duration;
-    JingleColors _jingle_color_1;
-    JingleColors _jingle_color_2;
-    JingleColors _jingle_color_3;
+    uint8_t _red_output_pwm_pin;
+    uint8_t _green_output_pwm_pin;
+    uint8_t _blue_output_pwm_pin;
+    uint8_t _red_pwm_channel;
+    uint8_t _green_pwm_channel;
+    uint8_t _blue_pwm_channel;
     unsigned long _rainbow_duration;
-    unsigned long _rainbow_start_time;
+    uint64_t _rainbow_start_time;  // clock_ms()
+    uint32_t _rainbow_hue_per_ms;
+    HueBrightness _hue_brightness;
+    TemporalDither _dither;
+    PowerBudget _power;
+    LightVM _vm;
+    AnimationAssets _assets;
+    int16_t _animation;  // the asset the current CUSTOM mode plays, or -1
+    StatusLed _status;
+
+    // Set the light colors as 10-bit PWM duties
+    void write_color(unsigned int red, unsigned int green, unsigned int blue);
+    // Set the light colors as 16-bit levels, finer than the PWM can do alone
+    void write_color_fine(uint16_t red, uint16_t green, uint16_t blue);
+    // Treat the red, green and blue dials as hue, saturation and brightness
+    void write_color_from_dials_hsv(ProgramState &state);
   public:
     OutputController(unsigned int red_output_pwm_pin=D3, 
                      unsigned int green_output_pwm_pin=D2, 
                      unsigned int blue_output_pwm_pin=D4,
-                     unsigned long rainbow_duration=20000);
+                     unsigned long rainbow_duration=20000,
+                     uint32_t power_budget_mw=0);
     
+    // Start the background parts, call once from setup()
+    void begin();
     void enter_mode(ProgramState &state);
     void process_mode(ProgramState &state);
     void run_color_jingle(JingleColors color1, JingleColors color2, 
       JingleColors color3, int duration_ms = 1500);
-    void set_rainbow(unsigned long time_diff, uint16_t max_brightness = 900);
+    void set_rainbow(uint64_t time_diff, uint16_t max_brightness = 900);
+
+    // Power use and limiting, see PowerBudget
+    inline PowerBudget& power() {
+      return _power;
+    };
+
+    // The programs for the CUSTOM modes, see LightVM
+    inline LightVM& vm() {
+      return _vm;
+    };
+
+    // The animations in flash, see AnimationAssets
+    inline const AnimationAssets& assets() const {
+      return _assets;
+    };
+
+    // The onboard status LED, see StatusLed
+    inline StatusLed& status() {
+      return _status;
+    };
+
+    // The dithering, so the benchmarks can tick it by hand
+    inline TemporalDither& dither() {
+      return _dither;
+    };
 };
 
 #endif
\ No newline at end of file
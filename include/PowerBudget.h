@@ -0,0 +1,90 @@
+#ifndef POWER_BUDGET_H
+#define POWER_BUDGET_H
+
+#include <Arduino.h>
+#include "ProgramState.h"
+
+/*
+Keeps track of how much power the light strip is drawing, and keeps it
+under a budget.
+
+The strip's draw is very close to proportional to the PWM duty on each
+channel, so the model is just watts-at-full-duty for each color.  With the
+defaults, white at our 90% dial limit comes to about 27W, which matches
+what the power meter showed (see the README).  That doesn't count the
+power brick itself or the Arduino, which are about a watt on their own.
+
+If the colors asked for would draw more than the budget, all three
+channels are scaled down by the same fraction, so the color stays the
+same and only the brightness drops.  That means a smaller 12V supply can
+be used safely, at the cost of the very brightest settings.
+
+We also add up the energy used since boot, overall and per mode, which is
+fun to look at ("the rainbow used 3 Wh today!").  It's all integer math,
+cheap enough to run every loop.
+*/
+
+const uint8_t POWER_CHANNELS = 3;
+
+class PowerBudget {
+private:
+  uint16_t _full_duty_mw[POWER_CHANNELS];  // draw at 100% duty, per channel
+  uint32_t _budget_mw;  // 0 means no limit
+  uint32_t _draw_mw;    // what we're commanding right now
+  bool _limiting;
+  unsigned long _limit_events;
+  uint32_t _last_account_us;
+  uint64_t _energy_nj;  // nanojoules (mW * us), lasts for centuries
+  uint64_t _mode_energy_nj[MODE_COUNT];
+
+public:
+  /**
+   * Constructor for the power model
+   *
+   * @param budget_mw Most the strip may draw, in milliwatts (0 for no limit)
+   * @param red_full_mw, green_full_mw, blue_full_mw Draw at full duty, in milliwatts
+   */
+  PowerBudget(uint32_t budget_mw = 0,
+              uint16_t red_full_mw = 10000,
+              uint16_t green_full_mw = 10000,
+              uint16_t blue_full_mw = 10000);
+
+  /**
+   * Scale the levels down if they would go over the budget
+   * Also remembers the resulting draw for the energy count
+   *
+   * @param red, green, blue 16-bit levels, adjusted in place
+   * @return true if the levels had to be scaled down
+   */
+  bool limit(uint16_t &red, uint16_t &green, uint16_t &blue);
+
+  /**
+   * Add up the energy used since the last call
+   * Should be called in each loop iteration
+   *
+   * @param mode Which mode to charge the energy to
+   * @param now_us The current time in microseconds
+   */
+  void account(Mode mode, uint32_t now_us);
+
+  // Change the budget, 0 for no limit
+  inline void set_budget_mw(uint32_t budget_mw) {
+    _budget_mw = budget_mw;
+  };
+  inline uint32_t get_budget_mw() const {
+    return _budget_mw;
+  };
+  inline uint32_t get_draw_mw() const {
+    return _draw_mw;
+  };
+  // How many times we've started limiting
+  inline unsigned long get_limit_events() const {
+    return _limit_events;
+  };
+
+  // Energy used since boot, in milliwatt-hours
+  uint32_t get_energy_mwh() const;
+  uint32_t get_mode_energy_mwh(Mode mode) const;
+};
+
+#endif
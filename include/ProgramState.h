@@ -2,8 +2,10 @@
 #define PROGRAM_STATE_H
 
 #include <Arduino.h>
+#include "InputSnapshot.h"
 #include "MotionSensorState.h"
 #include "SmoothAnalogInput.h"
+#include "StreamPlayer.h"
 
 enum class Mode {
   OFF,
@@ -18,15 +20,28 @@ enum class Mode {
   CUSTOM_6,
   CUSTOM_7,
   CUSTOM_8,
+  REMOTE, // Colors set by a computer over serial
+  STREAM, // Timed frames streamed from a computer over serial
+  AUDIO, // Dance to the music from the microphone
+  HSV, // Dials are hue, saturation and brightness
   INVALID
 };
 
+const uint8_t MODE_COUNT = static_cast<uint8_t>(Mode::INVALID);
+
+// Which filter each dial uses, see SmoothAnalogInput.h.  Swap in
+// OneEuroAnalogInput or MedianSmoothAnalogInput to try a different feel.
+typedef SmoothAnalogInput RedPotInput;
+typedef SmoothAnalogInput GreenPotInput;
+typedef SmoothAnalogInput BluePotInput;
+typedef SmoothAnalogInput WhitePotInput;
+
 class ProgramState {
   private:
-    unsigned int _red_pot_pin;
-    unsigned int _green_pot_pin;
-    unsigned int _blue_pot_pin;
-    unsigned int _white_pot_pin;
+    uint8_t _red_pot_pin;
+    uint8_t _green_pot_pin;
+    uint8_t _blue_pot_pin;
+    uint8_t _white_pot_pin;
     Mode _max_usable_mode;
     unsigned int _wake_to_doze_time;
     unsigned int _doze_to_sleep_time;
@@ -38,17 +53,31 @@ class ProgramState {
                  Mode max_usable_mode=Mode::CUSTOM_6,
                  unsigned int wake_to_doze_time=10000,
                  unsigned int doze_to_sleep_time=5000);
-    unsigned long last_cycle_start;
-    unsigned long last_motion_detected;
-    unsigned long last_mode_start;
+    // Times are clock_ms(), see Clock.h
+    uint64_t last_motion_detected;
+    uint64_t last_mode_start;
     unsigned int red_pot_val;
     unsigned int green_pot_val;
     unsigned int blue_pot_val;
     unsigned int white_pot_val;
-    SmoothAnalogInput red_pot;
-    SmoothAnalogInput green_pot;
-    SmoothAnalogInput blue_pot;
-    SmoothAnalogInput white_pot;
+    // Colors sent over serial for REMOTE mode, as 10-bit PWM duties
+    unsigned int remote_red_val;
+    unsigned int remote_green_val;
+    unsigned int remote_blue_val;
+    // Band levels from the microphone for AUDIO mode, 0-1023
+    uint16_t audio_bass_val;
+    uint16_t audio_mid_val;
+    uint16_t audio_treble_val;
+    unsigned long mode_change_count;
+    StreamPlayer stream_player;
+    // The latest inputs from the sensing task, taken at the top of loop()
+    InputSnapshot inputs;
+    // The dials and motion sensors themselves belong to the sensing task
+    // once it's running, see SensingTask.h.  Use inputs instead.
+    RedPotInput red_pot;
+    GreenPotInput green_pot;
+    BluePotInput blue_pot;
+    WhitePotInput white_pot;
     
 
     // Mode data
@@ -60,7 +89,7 @@ class ProgramState {
     MotionSensorState motion_detector_c;
     
     Mode update_mode(Mode new_mode);
-    bool read_pot_values();
+    void take_inputs(const InputSnapshot &snapshot);
     bool update_motion_sensors();
     Mode cycle_mode();
     void manual_motion_update();
@@ -68,9 +97,19 @@ class ProgramState {
     /**
      * * Handle sleep mode
      * 
+     * * @param occupied Whether the motion sensors see anyone
+     * * @return true if mode was changed
+     */
+    bool handle_sleep(bool occupied);
+
+    /**
+     * * Keep awake and grab the mode from the dials in inputs
+     * 
+     * * @param wake_speed Smoothed dial speed that counts as someone being there
+     * * @param grab_speed Fitted dial speed that takes the mode over
      * * @return true if mode was changed
      */
-    bool handle_sleep();
+    bool check_dials(float wake_speed, float grab_speed);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+#ifndef PWM_PHASE_H
+#define PWM_PHASE_H
+
+#include <Arduino.h>
+
+/*
+Where in the PWM cycle each light switches, and keeping the dial readings
+away from the switching.
+
+The ADC noise that the dial smoothing has to fight comes from the supply,
+and a good part of it is the lights themselves.  All three channels used to
+start their pulse at the same count, so red, green and blue switched on at
+the same instant, 20,000 times a second, and their current steps stacked up
+into one big kick.  Two things help:
+------
+1. Stagger the channels.  Each LEDC channel has an hpoint, the count where
+its pulse starts.  Red starts at 0, green a third of the way through the
+50 us period and blue two thirds, so the rising edges are spread out, and
+the falling edges (hpoint + duty, wrapping past the end of the period) are
+too, for most colors.  The light is exactly the same, just shifted.
+2. Read the ADC between the edges.  A reading taken right on an edge catches
+the ringing.  The timer counter says where in the cycle we are, and we know
+every channel's duty, so before each reading we wait (briefly, usually not
+at all) until the next sample won't land within a couple of microseconds
+of any edge.  The edges move with the duty, so there isn't one fixed quiet
+point for every color; this finds the quiet part of the cycle for the
+colors showing right now.
+------
+The lights use channels 0 to 2, and the Arduino core puts channels in
+pairs on the LEDC timers, so blue runs off a different timer from red and
+green.  pwm_phase_begin() restarts the two timers together, so they count
+in step and the hpoints line up.
+
+The benchmark firmware measures the raw ADC noise with and without all
+this, at several brightness levels, and against how far ahead of the
+sampling the quiet check looks (see AdcNoiseBench.h).
+*/
+
+// The lights' PWM, 20 kHz is above hearing and 10 bits at that is within
+// the 40 MHz the LEDC counts at
+const uint32_t LIGHT_PWM_FREQ = 20000;
+const uint8_t LIGHT_PWM_BITS = 10;
+const uint16_t LIGHT_PWM_PERIOD = 1 << LIGHT_PWM_BITS;  // counts
+const uint8_t LIGHT_PWM_CHANNELS = 3;
+
+/**
+ * Line the lights' LEDC timers up, so the hpoints mean the same thing on all three
+ * Call from setup(), after the channels are set up and before the dithering starts
+ */
+void pwm_phase_begin();
+
+/**
+ * Write one light's duty, at that light's place in the cycle
+ * Everything writing the lights' duties goes through here, so the edges are known
+ *
+ * @param light 0, 1 or 2 for red, green or blue
+ * @param channel The LEDC channel it's on
+ * @param duty 0-1023 (or 1024), 1023 and up is full on
+ */
+void pwm_phase_write(uint8_t light, uint8_t channel, uint16_t duty);
+
+/**
+ * Wait until an ADC reading started now won't land on a PWM edge
+ * Never waits more than one PWM period, and not at all before pwm_phase_begin()
+ */
+void pwm_phase_wait_quiet();
+
+/**
+ * Turn the staggering and the quiet-phase reading on or off, both on to start with
+ * For the before and after in the benchmark firmware; the staggering takes
+ * effect on each light's next write
+ */
+void pwm_phase_configure(bool stagger, bool sync);
+
+/**
+ * How far ahead the quiet check looks, for the time adc1_get_raw() takes to
+ * get to the sampling.  For the lead sweep in the benchmark firmware.
+ *
+ * @param us The lead, in microseconds
+ */
+void pwm_phase_set_adc_lead_us(uint8_t us);
+
+/**
+ * Back to the built-in lead
+ */
+void pwm_phase_reset_adc_lead();
+
+#endif
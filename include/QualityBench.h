@@ -0,0 +1,54 @@
+#ifndef QUALITY_BENCH_H
+#define QUALITY_BENCH_H
+
+#include <Arduino.h>
+#include "ProgramState.h"
+#include "OutputController.h"
+
+/*
+Quality checks for the whole dial-to-light chain, to go with the speed
+benchmarks in Benchmark.h.  We used to tune the dial smoothing by eye, and
+how much it flickers depends on the power supply, so here it gets numbers.
+
+A made-up dial reading goes through the white dial's real filter, then
+OutputController in WHITE mode, then the dithering, one reading per
+millisecond like the sensing task does it.  The dithering is ticked by hand
+and every duty it writes is logged, so the log is exactly what the PWM
+showed.  (The lights really do show the patterns for a few seconds.)
+
+The patterns:
+  step          dial jumps from 1000 to 3000
+  ramp          dial turned from 1000 to 3000 over a second
+  noise_burst   dial still, with short bursts of heavy noise
+  spikes        dial still, with a single-reading spike every 97 ms
+  noisy_supply  dial still, with 100 Hz ripple and dips, like a cheap supply
+
+And what gets measured, from the log:
+  flicker_index   IES flicker index while the dial is still, 0 is steady
+  modulation_pct  percent modulation, (max - min) / (max + min)
+  rise_ms         10-90% step response time
+  overshoot_pct   how far past the new level it went, of the step size
+  lag_ms          how far the light trails the dial halfway up the ramp
+  spike_leak_pct  the biggest blip from a spike, of the spike size
+
+The flicker numbers are taken over whole dither patterns (16 ticks), since
+the dithering's own fast wobble is invisible and is meant to be there.
+The noise is from a fixed seed, so the same firmware always gives the same
+numbers.  Results are printed one per line:
+------
+  QUALITY,<pattern>,<metric>,<value>
+------
+tools/check_benchmarks.py prints them and can save them with the timings
+as a JSON report (--report), so two builds can be compared on numbers.
+*/
+
+/**
+ * Run the quality checks and print the results
+ * Called from run_benchmarks(), with its copy of the program state
+ *
+ * @param state Program state to use, its white dial and mode are changed
+ * @param output Output controller to use, never started
+ */
+void run_quality_benchmarks(ProgramState &state, OutputController &output);
+
+#endif
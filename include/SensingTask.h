@@ -0,0 +1,181 @@
+#ifndef SENSING_TASK_H
+#define SENSING_TASK_H
+
+#include <Arduino.h>
+#include "DebounceInput.h"
+#include "InputSnapshot.h"
+#include "ProgramState.h"
+#include "SeqLock.h"
+
+/*
+Reads all the inputs on the other core, so loop() doesn't have to.
+
+Before, loop() did everything in turn on core 1: debounce the buttons, read
+and filter the dials, poll the motion sensors, then work out the mode and
+write the lights, with the serial prints in between.  A slow print or a
+heavy mode meant the dials got read late, and the other core sat mostly
+idle (only the audio analysis runs there).
+
+Now there are two stages, one per core:
+------
+1. The sensing task, pinned to core 0, wakes up every millisecond.  It
+debounces the buttons, reads and filters the dials, checks the motion
+sensors, and publishes the lot as an InputSnapshot.
+2. loop() on core 1 picks up the latest snapshot at the top of each pass
+and does the mode logic and the lights from that alone.
+------
+The snapshot goes across through a SeqLock, so neither side ever waits for
+the other.  The sensing task runs at a higher priority than the audio
+analysis, which has its DMA buffer to fall back on, so the dials keep their
+pace.
+
+Once begin() has been called, the dials and motion sensors inside the
+ProgramState belong to the sensing task; loop() only looks at
+ProgramState::inputs.  Even SET_FILTER doesn't change the dials itself:
+it leaves the new half-lives with request_filter(), and the next sensing
+pass puts them in between readings, so only the sensing task ever changes
+a filter (the noise floor stretches the same half-lives as it goes).  If
+the task couldn't be started, latest() does a sensing pass itself,
+single-core like before.
+
+Nobody touches the inputs for hours at a time, so they aren't all read
+flat out forever.  A dial that has been still for a couple of seconds drops
+to 40 readings a second (see BasicSmoothAnalogInput), and once no button has
+been pressed or bounced for a second, the buttons are only polled every
+20 ms.  A button press has to be held for the 50 ms of debouncing anyway, so
+it's always seen, and the first poll that sees it puts the buttons back on
+every pass.  The stats count the dial readings and button polls, so the
+saving shows up on the real thing; tools/sampling_replay.py works it out
+for a whole day, along with the latency it adds.
+
+We also measure how long it takes an input to reach the lights: the time
+from when a snapshot was taken to when loop() has finished writing the
+lights from it.  See get_stats(), or the "sensing" command in
+tools/light_protocol.py.
+*/
+
+struct SensingStats {
+  uint32_t passes;             // sensing passes published
+  uint32_t worst_pass_us;      // longest a sensing pass has taken
+  uint32_t reads;              // snapshots picked up by loop()
+  uint32_t read_retries;       // times loop() caught a write in progress
+  uint32_t last_latency_us;    // input to lights, most recent
+  uint32_t average_latency_us;
+  uint32_t worst_latency_us;
+  bool running;                // false if we fell back to single-core
+  uint32_t dial_reads;         // dial readings taken, all four together
+  uint32_t button_polls;       // passes that polled the buttons
+  uint8_t idle_inputs;         // bit per Dial that's idle, and bit 4 for the buttons
+};
+
+// The buttons go idle after this long with nothing going on, then get polled at 50 Hz
+const uint16_t BUTTON_IDLE_AFTER_MS = 1000;
+const uint16_t BUTTON_IDLE_PERIOD_MS = 20;
+
+// Dial half-lives asked for by SET_FILTER, for the sensing task to put in
+struct FilterRequest {
+  uint16_t long_half_life_ms[DIAL_COUNT];   // 0 to leave the dial as it is
+  uint16_t short_half_life_ms[DIAL_COUNT];
+};
+
+class SensingTask {
+private:
+  ProgramState &_state;  // the dials and motion sensors live in here
+  DebounceInput* _buttons;  // BUTTON_COUNT of them, in Button order
+  uint8_t _period_ms;
+  bool _running;
+  SeqLock<InputSnapshot> _published;
+  SeqLock<FilterRequest> _filter_requested;
+
+  // Only touched by the sensing task
+  InputSnapshot _working;
+  uint32_t _worst_pass_us;
+  uint32_t _dial_reads;
+  uint32_t _button_polls;
+  uint64_t _buttons_busy_ms;  // clock_ms() when a button last changed or bounced
+  uint64_t _last_button_poll_ms;
+  uint8_t _idle_inputs;
+  FilterRequest _filter_applied;
+  uint32_t _filter_requests_seen;
+
+  // Only touched by loop()
+  uint32_t _reads;
+  uint32_t _read_retries;
+  uint32_t _last_latency_pass;  // so each snapshot is only timed once
+  uint32_t _last_latency_us;
+  uint32_t _worst_latency_us;
+  uint32_t _latency_count;
+  uint64_t _latency_total_us;
+  FilterRequest _filter_wanted;  // everything asked for so far
+
+  static void task_entry(void* sensing);
+  void run();
+  void apply_filter_request();
+
+public:
+  /**
+   * Constructor for the sensing task
+   *
+   * @param state The program state holding the dials and motion sensors
+   * @param buttons BUTTON_COUNT buttons, in the same order as the Button enum
+   * @param period_ms How often to read everything (default every millisecond)
+   */
+  SensingTask(ProgramState &state, DebounceInput* buttons, uint8_t period_ms = 1);
+
+  /**
+   * Start the task on core 0
+   * Call this once from setup(), after the program state is set up
+   *
+   * @return true if the task is running
+   */
+  bool begin();
+
+  /**
+   * Read everything once and publish it
+   * The task calls this every period, it's public for the single-core fallback
+   */
+  void sense();
+
+  /**
+   * Whether a sensing pass polls the buttons: every pass while anything's
+   * going on, otherwise every BUTTON_IDLE_PERIOD_MS
+   *
+   * @param now_ms clock_ms() now
+   * @param busy_ms clock_ms() when a button last changed or bounced
+   * @param last_poll_ms clock_ms() at the last poll
+   * @param idle Set to whether the buttons have gone idle
+   * @return true if it's time to poll them
+   */
+  static bool buttons_due(uint64_t now_ms, uint64_t busy_ms, uint64_t last_poll_ms, bool &idle);
+
+  /**
+   * Get the latest snapshot, from loop()
+   *
+   * @param snapshot Set to the latest inputs
+   */
+  void latest(InputSnapshot &snapshot);
+
+  /**
+   * Change dials' half-lives, from loop()
+   * The sensing task puts them in on its next pass, between readings
+   *
+   * @param dials Bit per Dial to change
+   * @param long_half_life_ms The new long half-life
+   * @param short_half_life_ms The new short half-life
+   */
+  void request_filter(uint8_t dials, uint16_t long_half_life_ms, uint16_t short_half_life_ms);
+
+  /**
+   * Tell us the lights are written from this snapshot, from loop()
+   * Used to measure the input-to-output latency
+   */
+  void lights_updated(const InputSnapshot &snapshot);
+
+  void get_stats(SensingStats &stats) const;
+
+  inline bool running() const {
+    return _running;
+  };
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+
+/*
+Hands a small struct from one task to another, across cores, without a
+lock.  One task writes, any number read, and the writer never waits.
+
+The trick is a sequence number next to the value.  The writer bumps it to
+odd, copies the new value in, then bumps it to even again.  A reader notes
+the number, copies the value out, and checks the number again: if it was
+odd, or changed while copying, the writer was in the middle of it and the
+copy might be half old and half new (torn), so the reader just tries again.
+A write is a few dozen bytes, well under a microsecond, so a retry is rare
+and short.
+
+Compared to a critical section (like AudioAnalyzer uses), nobody ever
+turns interrupts off, and a slow reader can't hold up the writer.
+
+Only one task may ever write.  T has to be plain old data, since it gets
+copied with memcpy.
+*/
+
+template <class T>
+class SeqLock {
+private:
+  std::atomic<uint32_t> _sequence;
+  T _value;
+
+public:
+  SeqLock() : _sequence(0) {
+    memset(&_value, 0, sizeof(_value));
+  };
+
+  /**
+   * Publish a new value, from the one writing task only
+   */
+  void write(const T &value) {
+    uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&_value, &value, sizeof(T));
+    _sequence.store(sequence + 2, std::memory_order_release);
+  };
+
+  /**
+   * Copy out the latest value, retrying until the copy is whole
+   *
+   * @param value Set to the latest value
+   * @return How many tries it took past the first, usually 0
+   */
+  uint32_t read(T &value) const {
+    uint32_t retries = 0;
+    while (true) {
+      uint32_t before = _sequence.load(std::memory_order_acquire);
+      if (!(before & 1)) {
+        memcpy(&value, &_value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) == before) {
+          return retries;
+        }
+      }
+      retries++;
+    }
+  };
+
+  // How many values have been written
+  inline uint32_t writes() const {
+    return _sequence.load(std::memory_order_relaxed) >> 1;
+  };
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef SERIAL_PROTOCOL_H
+#define SERIAL_PROTOCOL_H
+
+#include <Arduino.h>
+#include "ProgramState.h"
+#include "OutputController.h"
+#include "LoopMonitor.h"
+#include "SensingTask.h"
+
+/*
+A small binary control protocol over the USB serial link, so a computer
+can set colors, switch modes, and read the state without reflashing.
+
+Every frame looks like this (multi-byte fields are little-endian):
+------
+  0xA5 | length | command | payload (length bytes) | crc low | crc high
+------
+The CRC is CRC-16/CCITT-FALSE over the length, command and payload bytes.
+Replies use the same framing, with the command byte or'd with 0x80.  If
+something goes wrong, the reply is a NACK frame holding the command that
+failed and an error code.
+
+The debug text printed with Serial.println() shares the same link.  That's
+fine: the parser throws away anything until it sees the sync byte, and a
+text byte that happens to look like a sync byte will fail the CRC check.
+The host side (tools/light_protocol.py) does the same thing.
+*/
+
+const uint8_t PROTOCOL_SYNC_BYTE = 0xA5;
+const uint8_t PROTOCOL_MAX_PAYLOAD = 64;
+const uint8_t PROTOCOL_REPLY_FLAG = 0x80;
+// sync + length + command + payload + 2 CRC bytes
+const uint8_t PROTOCOL_MAX_FRAME = PROTOCOL_MAX_PAYLOAD + 5;
+
+enum class Command : uint8_t {
+  PING = 0x01,
+  GET_STATE = 0x02,
+  SET_MODE = 0x03,
+  SET_RGB = 0x04,
+  SET_WHITE = 0x05,
+  GET_COUNTERS = 0x06,
+  SET_FILTER = 0x07,
+  STREAM_FRAMES = 0x08,
+  GET_STREAM_STATS = 0x09,
+  GET_POWER = 0x0A,
+  SET_POWER_BUDGET = 0x0B,
+  GET_MODE_ENERGY = 0x0C,
+  GET_LOOP_STATS = 0x0D,
+  GET_SENSING_STATS = 0x0E,
+  GET_FLIGHT_LOG = 0x0F,
+  WRITE_PROGRAM = 0x10,
+  COMMIT_PROGRAM = 0x11,
+  GET_PROGRAM_STATS = 0x12,
+  NACK = 0x7F
+};
+
+enum class ProtocolError : uint8_t {
+  NONE,
+  UNKNOWN_COMMAND,
+  BAD_LENGTH,
+  BAD_VALUE
+};
+
+// A parsed frame.  The payload points straight into the parser's receive
+// buffer, so it is only valid until the parser is given more bytes.
+struct Frame {
+  uint8_t command;
+  uint8_t length;
+  const uint8_t* payload;
+};
+
+class FrameParser {
+/*
+An incremental parser that never allocates.  Bytes from the serial port are
+read directly into _buffer (see write_space()/commit()), and the state machine
+walks over them in place.  When a frame completes, we hand back a pointer
+to its payload inside the buffer instead of copying it out.
+*/
+private:
+  enum class ParseState : uint8_t {
+    WAIT_SYNC,
+    LENGTH,
+    COMMAND,
+    PAYLOAD,
+    CRC_LOW,
+    CRC_HIGH
+  };
+  // Room for a frame in progress and a full frame behind it
+  uint8_t _buffer[2 * PROTOCOL_MAX_FRAME];
+  uint16_t _scan;  // next byte to look at
+  uint16_t _end;   // one past the last byte received
+  uint16_t _frame_start;  // where the frame being parsed begins
+  ParseState _state;
+  uint8_t _length;
+  uint8_t _command;
+  uint8_t _payload_seen;
+  uint16_t _crc;
+  uint16_t _received_crc;
+
+  // Drop bytes that belong to nothing, or to frames already handed out
+  void compact();
+
+public:
+  FrameParser();
+
+  unsigned long frames_ok;
+  unsigned long crc_errors;
+  unsigned long length_errors;
+
+  /**
+   * Get a spot in the receive buffer for new bytes
+   *
+   * @param space Set to the number of bytes that can be written
+   * @return Pointer to write the new bytes to
+   */
+  uint8_t* write_space(size_t &space);
+
+  /**
+   * Tell the parser how many bytes were written into write_space()
+   */
+  void commit(size_t count);
+
+  /**
+   * Run the state machine over the bytes received so far
+   *
+   * @param frame Filled in when a complete, CRC-checked frame is found
+   * @return true if a frame was found
+   */
+  bool next_frame(Frame &frame);
+};
+
+class SerialProtocol {
+private:
+  FrameParser _parser;
+  unsigned long _unknown_commands;
+  uint8_t _tx_buffer[PROTOCOL_MAX_FRAME];
+
+  bool handle_frame(const Frame &frame, ProgramState &state, OutputController &output,
+                    const LoopMonitor &monitor, SensingTask &sensing);
+  void send_reply(uint8_t command, const uint8_t* payload, uint8_t length);
+  void send_nack(uint8_t command, ProtocolError error);
+
+public:
+  SerialProtocol();
+
+  /**
+   * Read whatever has arrived on Serial and handle any complete frames
+   * Should be called in each loop iteration
+   *
+   * @return true if the mode was changed by a command
+   */
+  bool poll(ProgramState &state, OutputController &output, const LoopMonitor &monitor,
+            SensingTask &sensing);
+};
+
+/**
+ * CRC-16/CCITT-FALSE, continued from a previous value
+ * Start with 0xFFFF for a new frame.
+ */
+uint16_t crc16_update(uint16_t crc, uint8_t data);
+
+#endif
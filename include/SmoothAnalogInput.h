@@ -3,29 +3,56 @@
 
 #include <Arduino.h>
 
-class SmoothAnalogInput {
+// Don't read a dial more often than this, each reading is a burst (see AdcFrontEnd)
+const uint16_t SMOOTH_MIN_INTERVAL_US = 500;
+// Once a dial has sat still for a while it's only read this often (40 Hz),
+// see BasicSmoothAnalogInput
+const uint32_t SMOOTH_IDLE_INTERVAL_US = 25000;
+const uint32_t SMOOTH_IDLE_AFTER_US = 2000000;
+
 /*
-We have found that the ADC inputs are not nearly as smooth as they
-should be.  Probably noise from the power supply.  The voltage from
-the potentiometers shouldn't have abrupt spikes.  Here we have a class
-to dramatically smooth out the abrupt spikes while still being highly
-responsive.
+The filters.  Each dial picks one at compile time (see ProgramState.h), so
+there's no virtual call in the way of reading a dial.  They all look the
+same from the outside:
+------
+  static const uint16_t DEFAULT_LONG_HALF_LIFE_MS, DEFAULT_SHORT_HALF_LIFE_MS;
+  Filter(uint16_t long_half_life_ms, uint16_t short_half_life_ms);
+  void init(uint16_t first_reading, uint8_t adc_resolution);
+  void set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms);
+  float add(uint16_t reading, uint32_t time_since_last_read_us);  // new value
+  float value() const;
+  void set_noise_scale(float scale);  // see NoiseFloor
+------
+What the two half-lives mean is up to each filter, but long is always "how
+much smoothing" and short is always the quicker helper.  Each filter has
+its own defaults, which is what a dial gets unless it asks otherwise.  The noise scale
+stretches the smoothing to suit how noisy this dial turns out to be: 1 is
+the half-lives as given, 2 is twice as long.  The time steps are
+in microseconds and come in however uneven the loop happens to be; each
+filter decays by exactly the right amount for the real step.  The exact
+decay for a time step dt is 2^(-dt / half-life).  Calling exp() for every
+reading of every dial adds up, so that comes from a small table of powers
+of two instead, which is plenty accurate.
+*/
+
+class DualEmaFilter {
+/*
+The original dial filter.
 
 Some basic assumptions: The potentiometer shouldn't be changing by more
 than 50% per second, thus it shouldn't be changing by more than 0.5/1000
 = 0.0005 per millisecond.  With the 12-bit ADC, that comes to about 2 units
 out of 4096 per millisecond.
 
-We're going to do a few things to make this work:
+We're going to do a couple of things to make this work:
 ------
-1. We're only going to take one reading per millisecond.  I don't think
-anyone will notice.  The goal is to keep the behavior of this algorithm
-independent of the program loop rate.
-2. We're going to use an exponential moving average to provide a smoothed
+1. We're going to use an exponential moving average to provide a smoothed
 output without needing to carry around a huge buffer.  The goal is to
 make it strongly affected by values from the most recent 50ms.  That should
-more or less be the half-life of the exponential.
-3. But we're going to add in an extra step!  The thing I most want to avoid
+more or less be the half-life of the exponential.  (AdcFrontEnd knocks
+the worst spikes out before they get here now, so a shorter half-life may
+well do, but it stays at 50ms until that's been tried on real dials.)
+2. But we're going to add in an extra step!  The thing I most want to avoid
 is brief and abrupt spikes.  Those make very annoying flashes and flicker
 is awful.  So, the amount that a particular reading will change the
 exponential moving average will be inversely proportional to how far
@@ -33,74 +60,340 @@ the reading is from a separate moving average, which will have a half-life
 of around 5 ms.  I might adjust these values.  Point is, if we have a huge
 spike for a few milliseconds, I don't want it to affect the output much.
 ------
-It might be nice to be able to run this more consistently than once per
-millisecond (especially because I'm not sure how even millis() is), but
-let's be honest, millisecond, nobody can tell.
+*/
+private:
+  float _long_rate; // Long-term EMA half-lives per microsecond
+  float _long_ema; // Long-term exponential moving average
+  float _short_rate; // Spike reduction EMA half-lives per microsecond
+  float _short_ema; // Short-term exponential moving average
+  float _ordinary_change_wide_sigma; // Expect ordinary change between readings within this
+  float _noise_scale; // Both the long half-life and the sigma are stretched by this
+  uint16_t _last_read; // Last reading from the ADC
+
+public:
+  static const uint16_t DEFAULT_LONG_HALF_LIFE_MS = 50;
+  static const uint16_t DEFAULT_SHORT_HALF_LIFE_MS = 5;
+
+  DualEmaFilter(uint16_t long_half_life_ms = DEFAULT_LONG_HALF_LIFE_MS,
+                uint16_t short_half_life_ms = DEFAULT_SHORT_HALF_LIFE_MS);
+  void init(uint16_t first_reading, uint8_t adc_resolution);
+  void set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms);
+  float add(uint16_t reading, uint32_t time_since_last_read_us);
+  void set_noise_scale(float scale);
+  inline float value() const {
+    return _long_ema;
+  };
+};
+
+class OneEuroFilter {
+/*
+The "1 Euro filter" (Casiez, Roussel and Vogel, 2012), popular for mice and
+VR controllers, and a good match for dials.  It's an EMA whose cutoff
+frequency goes up with how fast the input is moving.  Sitting still, the
+cutoff is low, so the light doesn't shimmer.  Turning the dial, the cutoff
+jumps up, so the light keeps up with your hand.
+
+The long half-life sets the cutoff at rest, and the short one sets how
+smoothly the speed is tracked.  _beta is how much the cutoff rises per unit
+of speed (hertz per ADC count per millisecond).
+*/
+private:
+  float _value; // Filtered reading
+  float _speed; // Filtered speed, ADC counts per millisecond
+  float _min_cutoff_rate; // Cutoff at rest, as half-lives per microsecond
+  float _speed_cutoff_rate; // Same, for the speed
+  float _beta;
+  float _noise_scale; // The cutoff at rest is stretched by this
+
+public:
+  // Longer than DualEmaFilter's, the cutoff only sits this low at rest
+  static const uint16_t DEFAULT_LONG_HALF_LIFE_MS = 100;
+  static const uint16_t DEFAULT_SHORT_HALF_LIFE_MS = 5;
+
+  OneEuroFilter(uint16_t long_half_life_ms = DEFAULT_LONG_HALF_LIFE_MS,
+                uint16_t short_half_life_ms = DEFAULT_SHORT_HALF_LIFE_MS,
+                float beta = 0.5f);
+  void init(uint16_t first_reading, uint8_t adc_resolution);
+  void set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms);
+  float add(uint16_t reading, uint32_t time_since_last_read_us);
+  void set_noise_scale(float scale);
+  inline float value() const {
+    return _value;
+  };
+};
+
+template <class Next>
+class Median3Filter {
+/*
+Takes the middle of the last three readings, then hands that to another
+filter.  One stray reading can never get through, at the cost of one
+reading's worth of lag.  For a dial that's still spiky after AdcFrontEnd's
+own burst median.
+*/
+private:
+  Next _next;
+  uint16_t _history[2];
+
+public:
+  // Whatever the next filter would have
+  static const uint16_t DEFAULT_LONG_HALF_LIFE_MS = Next::DEFAULT_LONG_HALF_LIFE_MS;
+  static const uint16_t DEFAULT_SHORT_HALF_LIFE_MS = Next::DEFAULT_SHORT_HALF_LIFE_MS;
+
+  Median3Filter(uint16_t long_half_life_ms = DEFAULT_LONG_HALF_LIFE_MS,
+                uint16_t short_half_life_ms = DEFAULT_SHORT_HALF_LIFE_MS)
+    : _next(long_half_life_ms, short_half_life_ms) {
+    _history[0] = 0;
+    _history[1] = 0;
+  };
+  inline void init(uint16_t first_reading, uint8_t adc_resolution) {
+    _history[0] = first_reading;
+    _history[1] = first_reading;
+    _next.init(first_reading, adc_resolution);
+  };
+  inline void set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms) {
+    _next.set_half_lives(long_half_life_ms, short_half_life_ms);
+  };
+  inline float add(uint16_t reading, uint32_t time_since_last_read_us) {
+    uint16_t a = _history[0];
+    uint16_t b = _history[1];
+    _history[0] = b;
+    _history[1] = reading;
+    uint16_t middle = max(min(a, b), min(max(a, b), reading));
+    return _next.add(middle, time_since_last_read_us);
+  };
+  inline void set_noise_scale(float scale) {
+    _next.set_noise_scale(scale);
+  };
+  inline float value() const {
+    return _next.value();
+  };
+};
+
+// Readings in the velocity window, odd so there's a middle one
+const uint8_t VELOCITY_WINDOW = 17;
+
+class SlidingVelocity {
+/*
+How fast the dial is being turned, as the slope of a straight line fitted
+through the last VELOCITY_WINDOW readings by least squares (the
+Savitzky-Golay first derivative, which comes out the same for a straight
+line or a parabola).  The EMA derivative is a difference of two smoothed
+values one reading apart, so it's both late and jumpy; this uses every
+reading in the window, and noise mostly cancels out.
+
+With the readings x[0] (oldest) to x[N-1], the slope per reading is
+------
+  sum of (k - N/2) * x[k]  /  sum of (k - N/2)^2
+------
+The weights are whole numbers, so the sum is kept as an integer, and
+sliding the window along by one reading only needs the plain sum of the
+window and the reading that falls off the end, not the whole window again:
+------
+  weighted += (N/2 + 1) * oldest + N/2 * newest - sum
+  sum += newest - oldest
+------
+It's exact, so it never drifts.  The fit assumes evenly spaced readings,
+which the sensing task nearly gives us; the slope is divided by the
+average time step over the window.
+
+A stray reading at the newest end would swing the slope hard, so readings
+go through a median of five first.  Three isn't enough: two spikes a
+reading apart get through a median of three, and that's a false grab.
+*/
+private:
+  int32_t _weighted_sum; // sum of (k - N/2) * reading, over the window
+  int32_t _sum; // sum of the readings in the window
+  uint32_t _window_us; // sum of the time steps in the window
+  uint16_t _readings[VELOCITY_WINDOW];
+  uint16_t _steps_us[VELOCITY_WINDOW]; // time step before each reading
+  uint16_t _history[4]; // last four raw readings, for the median
+  uint8_t _oldest; // where the oldest reading is in the ring
+
+public:
+  SlidingVelocity();
+  void init(uint16_t first_reading);
+  void add(uint16_t reading, uint32_t time_since_last_read_us);
+  float value() const; // per millisecond
+};
+
+// Rest readings per noise estimate, about a second of the dial sitting still
+const uint16_t NOISE_BLOCK_READINGS = 1024;
+// The noise the fixed settings were tuned for, counts per reading
+const float NOISE_NOMINAL_SIGMA = 3.0f;
+
+class NoiseFloor {
+/*
+How noisy this dial's readings are, measured while it sits still, so the
+smoothing can suit the power supply it's on instead of the one it was
+tuned on.
+
+The noise is taken from the differences between one reading and the next.
+The dial's own position cancels out of those, and so does a slow drift
+(that's just the mean of the differences), which leaves twice the
+variance of the noise.  The variance comes from Welford's running method,
+a count, a mean and a sum of squares, so it's three numbers no matter how
+many readings go in, and doesn't lose precision the way summing squares
+does.  Readings only count while SlidingVelocity says the dial is still,
+and a difference more than 8 sigmas out is a spike, not noise, and is
+left out, so a turn or a spike doesn't look like a noisy supply.
+
+Every NOISE_BLOCK_READINGS rest readings the block's sigma is blended into
+the estimate (a quarter of the way), and the count starts over, so the
+estimate follows a supply that gets noisier or quieter over time.  scale()
+is the estimate over the noise the settings were tuned for, kept between
+0.5 and 3, and stretches the smoothing, the spike sigma and the deadband
+alike.  Until the first block is in, it's 1 and nothing changes.
+*/
+private:
+  float _mean; // Welford, over this block
+  float _m2;
+  float _sigma; // the estimate, counts per reading, 0 until the first block
+  uint16_t _count; // rest readings in this block
+  uint16_t _last_read;
+
+public:
+  NoiseFloor();
+  void init(uint16_t first_reading);
+  // Returns true when a block finished and the estimate changed
+  bool add(uint16_t reading, float speed_per_ms);
+  inline float sigma() const {
+    return _sigma;
+  };
+  float scale() const;
+};
+
+template <class Filter>
+class BasicSmoothAnalogInput {
+/*
+We have found that the ADC inputs are not nearly as smooth as they
+should be.  Probably noise from the power supply.  The voltage from
+the potentiometers shouldn't have abrupt spikes.  Here we have a class
+to dramatically smooth out the abrupt spikes while still being highly
+responsive.
+
+We take a reading whenever the loop comes around, but no more often than
+every half millisecond.  Every reading carries its real time step,
+measured in microseconds, and goes through the filter.  So the behavior
+doesn't depend on the program loop rate or how evenly it runs, and a fast
+loop just gets less lag.  The filter itself is the template parameter,
+see above; SmoothAnalogInput is the usual one.
+
+Most of the day nobody touches the dials, so there's no point reading them
+a thousand times a second.  Once a dial has been still for two seconds
+(every reading close to the smoothed value, and the fitted speed low) it
+goes idle and is only read every 25 ms.  The first reading that isn't
+close wakes it straight back up to full rate.  While idle, a reading out of
+line is checked with a second burst at once, so one spike that got past
+the burst median doesn't wake it for nothing.  "Close" is a dozen counts,
+or six noise sigmas on a noisy dial (see NoiseFloor).
+
+A steady reading every 25 ms is no problem for the filters, they decay by
+the real time step anyway.  Waking up is: the first reading after the gap
+is a big jump, which the filters would take for a spike and mostly ignore,
+and the velocity window would be 17 readings 25 ms apart with the turn
+averaged in.  So on waking, the gap is filled in with the readings full
+rate would have had, a straight line from the last still reading, fed
+through the filter and the velocity a millisecond apart.  The light then
+follows from there as if the dial had been read at full rate all along,
+and the turn is noticed at most one idle interval late.
+tools/sampling_replay.py replays a day and checks the added latency
+against a target.
 */
 private:
 // underscores start the private variable names
-  uint8_t _pin;  // GPIO pin number
-  double _base_long_ema_factor; // Exponential moving average factor before adjustment
-  double _long_ema; // Long-term exponential moving average
-  double _long_ema_derivative; // Derivative of the long-term EMA
-  double _short_ema_factor; // Spike reduction moving average factor
-  double _short_ema; // Short-term exponential moving average
+// Kept in size order so nothing gets padded, there's one per dial
+  Filter _filter;
+  SlidingVelocity _velocity;
+  NoiseFloor _noise;
+  float _derivative; // Derivative of the smoothed value, per millisecond
+  uint32_t _last_read_time_us; // clock_us32() at the last reading
+  uint32_t _still_us; // How long it's been still, up to SMOOTH_IDLE_AFTER_US
   uint16_t _last_read; // Last reading from the ADC
-  unsigned long _last_read_time;
-  uint8_t _adc_resolution; // Resolution of the ADC, 12-bit for ESP32
-  double _ordinary_change_wide_sigma; // Expect ordinary change per ms within this
-  uint16_t _deadband_zero; // Anything below this is zero
+  uint16_t _deadband_zero; // Anything below this is zero, grows with the noise
   uint16_t _max_brightness; // Maximum brightness value
+  uint8_t _pin;  // GPIO pin number
+  uint8_t _adc_resolution; // Resolution of the ADC, 12-bit for ESP32
+  bool _idle; // Read every SMOOTH_IDLE_INTERVAL_US instead of at full rate
+
+  // Is this reading close enough to the smoothed value to count as still?
+  bool is_steady(uint16_t reading) const;
 
 public:
   /**
    * Constructor for smoothed analog input
-   * 
+   *
    * @param pin The GPIO pin number to use for input
-   * @param long_half_life_ms The half-life of the long-term average in milliseconds
-   * @param short_half_life_ms The half-life of the short-term average in milliseconds
+   * @param long_half_life_ms The half-life of the long-term average in milliseconds (default the filter's own)
+   * @param short_half_life_ms The half-life of the short-term average in milliseconds (default the filter's own)
    * @param inputMode INPUT or INPUT_PULLUP (default INPUT)
    * @param adc_resolution The resolution of the ADC (default 12)
-   * 
+   *
    * This is the constructor, it also initializes the pin
    * We.... could be using the internal pullup resistor but I can't imagine
    * why we would, the potentiometers should never be floating.
   */
-  SmoothAnalogInput(
-    uint8_t pin, 
-    uint16_t long_half_life_ms = 50, 
-    uint16_t short_half_life_ms = 5,
+  BasicSmoothAnalogInput(
+    uint8_t pin,
+    uint16_t long_half_life_ms = Filter::DEFAULT_LONG_HALF_LIFE_MS,
+    uint16_t short_half_life_ms = Filter::DEFAULT_SHORT_HALF_LIFE_MS,
     uint8_t inputMode = INPUT,
     uint8_t adc_resolution = 12);
-  
+
   // Empty default constructor
-  SmoothAnalogInput();
+  BasicSmoothAnalogInput();
 
   /**
    * Take a reading and update the smoothed state, if needed
    * Should be called in each loop iteration
-   * 
+   *
    * @return true if reading was necessary
    */
   bool update();
 
+  /**
+   * Run one reading through the filter, without touching the ADC
+   * update() calls this; it's public so benchmarks can feed in patterns
+   *
+   * @param reading The ADC reading
+   * @param time_since_last_read_us Microseconds since the previous reading
+   */
+  void add_reading(uint16_t reading, uint32_t time_since_last_read_us);
+
+  /**
+   * Change the filter half-lives while running, for tuning
+   *
+   * @param long_half_life_ms The half-life of the long-term average in milliseconds
+   * @param short_half_life_ms The half-life of the short-term average in milliseconds
+   */
+  void set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms);
+
   /**
    * Get the current smoothed state
-   * 
+   *
    * @return The smoothed value of the analog input
    */
   uint16_t get_smoothed_value() const;
 
+  /**
+   * Get the current smoothed state with extra resolution
+   *
+   * The averaging gives us more precision than the 12-bit ADC, which is
+   * handy for dim lights.  Same deadband and maximum as get_smoothed_value().
+   *
+   * @return The smoothed value scaled to 16 bits
+   */
+  uint16_t get_smoothed_fine() const;
+
   /**
    * Get the current raw state
-   * 
+   *
    * @return The raw value of the analog input
    */
   uint16_t get_raw_value() const;
 
   /**
    * Update and get the smoothed value in one step
-   * 
+   *
    * @return The smoothed value of the analog input
    */
   inline uint16_t update_and_get_smoothed() {
@@ -110,7 +403,7 @@ public:
 
   /**
    * Update and get the raw value in one step
-   * 
+   *
    * @return The raw value of the analog input
    */
   inline uint16_t update_and_get_raw() {
@@ -119,14 +412,60 @@ public:
   };
 
   /**
-   * Get the current derivative of the long-term EMA
-   * 
-   * @return The derivative of the long-term EMA
+   * Get the current derivative of the smoothed value
+   *
+   * @return How fast the smoothed value is changing, per millisecond
    */
-  inline double get_smooth_deriv() const {
-    return _long_ema_derivative;
+  inline float get_smooth_deriv() const {
+    return _derivative;
+  };
+
+  /**
+   * Get how fast the dial is being turned, from a line fitted through the
+   * recent readings (see SlidingVelocity)
+   * Sooner and steadier than get_smooth_deriv() for catching a turn
+   *
+   * @return How fast the reading is changing, per millisecond
+   */
+  inline float get_velocity() const {
+    return _velocity.value();
+  };
+
+  /**
+   * Get how noisy the readings are while the dial is still (see NoiseFloor)
+   *
+   * @return Counts per reading, 0 until there's been a second or so of rest
+   */
+  inline float get_noise_sigma() const {
+    return _noise.sigma();
+  };
+
+  /**
+   * Get how much the smoothing, spike sigma and deadband are stretched for the noise
+   *
+   * @return 1 at the noise the settings were tuned for
+   */
+  inline float get_noise_scale() const {
+    return _noise.scale();
+  };
+
+  inline uint16_t get_deadband() const {
+    return _deadband_zero;
+  };
+
+  /**
+   * Is the dial idle, only being read every SMOOTH_IDLE_INTERVAL_US?
+   */
+  inline bool is_idle() const {
+    return _idle;
   };
 
 };
 
-#endif
\ No newline at end of file
+// The filters that get built (see the bottom of SmoothAnalogInput.cpp)
+typedef BasicSmoothAnalogInput<DualEmaFilter> SmoothAnalogInput;
+typedef BasicSmoothAnalogInput<OneEuroFilter> OneEuroAnalogInput;
+typedef BasicSmoothAnalogInput<Median3Filter<DualEmaFilter> > MedianSmoothAnalogInput;
+typedef BasicSmoothAnalogInput<Median3Filter<OneEuroFilter> > MedianOneEuroAnalogInput;
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef STATUS_LED_H
+#define STATUS_LED_H
+
+#include <Arduino.h>
+
+/*
+The little RGB LED on the board, for telling us what the box is up to.
+
+Several things want it: the jingle when the mode changes, the heartbeat in
+debug mode, error codes, and a warning that the lights are about to go off.
+Each gets a layer, and the LED shows the highest one that's on:
+------
+  JINGLE     the mode change jingle, three colors in turn
+  DOZE       slow yellow blink while dozing (SLEEP_PREP), the lights go off soon
+  ERROR      red blinks, as many as the error's number, then a pause
+  HEARTBEAT  dim white, a second on and a second off (DEBUG_MODE)
+------
+Before, the jingle wrote all three pins every pass of the loop, and the
+heartbeat worked out its blink every pass too.  Now each layer's pattern
+knows when it next changes, so update() is just a time comparison until
+then, and a pin is only written when its brightness actually changes.
+
+The LED is on LEDC channels 4 to 6, so it can be dimmed.  The lights use
+channels 0 to 2, and LEDC channels share a timer in pairs, so these can't
+be 3 (it would change the blue light's frequency).  The LED's pins are
+active low, so the duties are upside down.
+*/
+
+// These are a binary mask for RGB
+enum class JingleColors : uint8_t {
+  OFF,
+  RED,
+  GREEN,
+  YELLOW,
+  BLUE,
+  MAGENTA,
+  CYAN,
+  WHITE
+};
+
+// Lowest priority first
+enum class StatusLayer : uint8_t {
+  HEARTBEAT,
+  ERROR,
+  DOZE,
+  JINGLE,
+  COUNT
+};
+
+// The number is how many times it blinks, the lowest one set is shown
+enum class StatusError : uint8_t {
+  NONE,
+  LOOP_OVERRUN,         // loop() went over its budget in the last few seconds
+  SENSING_SINGLE_CORE,  // the sensing task didn't start, loop() reads the inputs
+  NO_MICROPHONE,        // the audio analysis didn't start
+  COUNT
+};
+
+const uint8_t STATUS_LAYER_COUNT = static_cast<uint8_t>(StatusLayer::COUNT);
+
+class StatusLed {
+private:
+  uint8_t _pins[3];
+  uint8_t _first_channel;
+  uint8_t _brightness;
+  bool _started;
+  uint8_t _layers;  // bit per StatusLayer that's on
+  uint8_t _errors;  // bit per StatusError that's set
+  JingleColors _jingle_colors[3];
+  uint16_t _jingle_ms;
+  uint64_t _layer_start_ms[STATUS_LAYER_COUNT];  // clock_ms()
+  uint64_t _next_update_ms;  // nothing changes before this
+  uint8_t _written[3];  // last duty sent to each channel
+
+  // What the top layer shows now, and until when
+  JingleColors pattern(uint8_t &level, uint64_t now_ms, uint64_t &until_ms);
+  void write(JingleColors color, uint8_t level);
+
+public:
+  /**
+   * Constructor for the status LED
+   *
+   * @param red_pin, green_pin, blue_pin The LED's pins, active low
+   * @param first_channel The first of three LEDC channels to use
+   * @param brightness 0-255, how bright full on is
+   */
+  StatusLed(uint8_t red_pin = LED_RED, uint8_t green_pin = LED_GREEN, uint8_t blue_pin = LED_BLUE,
+            uint8_t first_channel = 4, uint8_t brightness = 96);
+
+  /**
+   * Put the pins on the LEDC channels, with the LED off
+   * Call this once from setup(), nothing shows before
+   */
+  void begin();
+
+  /**
+   * Turn a layer on or off, the jingle has its own call
+   * Cheap to call every pass, only a change does anything
+   */
+  void show(StatusLayer layer, bool on);
+
+  /**
+   * Play the jingle, over whatever else is showing
+   *
+   * @param color1, color2, color3 The colors, a third of the time each
+   * @param duration_ms How long the whole jingle takes
+   */
+  void jingle(JingleColors color1, JingleColors color2, JingleColors color3, uint16_t duration_ms);
+
+  /**
+   * Set or clear an error
+   * Cheap to call every pass, only a change does anything
+   */
+  void set_error(StatusError error, bool set);
+
+  void set_brightness(uint8_t brightness);
+
+  /**
+   * Bring the LED up to date, call every pass of the loop
+   */
+  void update();
+};
+
+#endif
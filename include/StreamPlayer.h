@@ -0,0 +1,95 @@
+#ifndef STREAM_PLAYER_H
+#define STREAM_PLAYER_H
+
+#include <Arduino.h>
+
+/*
+Plays out light frames streamed from a computer (music visualizers,
+synchronized scenes, that sort of thing).
+
+Frames arrive over USB serial with the computer's timestamp on them, and
+USB doesn't deliver them evenly.  So we keep them in a small jitter buffer
+and play them a fixed delay after they were stamped, on our own clock.
+Between frames we blend linearly, so 100 frames per second still looks
+smooth.  If the frames stop coming, we hold the last color for a bit and
+then fade out, rather than freezing on whatever was showing.
+
+The computer's clock and ours won't run at exactly the same rate, so the
+offset between them is nudged a tiny bit with every frame to keep the
+buffer from slowly filling up or draining over a long session.
+*/
+
+struct StreamFrame {
+  uint32_t timestamp_us; // on the computer's clock
+  uint16_t red;          // 10-bit PWM duties
+  uint16_t green;
+  uint16_t blue;
+};
+
+const uint8_t STREAM_BUFFER_FRAMES = 64;
+
+class StreamPlayer {
+private:
+  StreamFrame _frames[STREAM_BUFFER_FRAMES];
+  uint8_t _head;  // oldest frame
+  uint8_t _count;
+  bool _synced;  // whether _clock_offset_us means anything yet
+  bool _starved; // out of frames, holding or fading
+  uint32_t _clock_offset_us;  // our time = computer time + offset
+  uint32_t _playout_delay_us;
+  uint32_t _hold_us;
+  uint32_t _fade_us;
+  uint32_t _starved_since_us;
+  StreamFrame _last_output;
+
+  inline StreamFrame& frame_at(uint8_t index) {
+    return _frames[(_head + index) % STREAM_BUFFER_FRAMES];
+  }
+  void drop_oldest();
+
+public:
+  /**
+   * Constructor for the stream player
+   *
+   * @param playout_delay_ms How long after its timestamp a frame is shown
+   * @param hold_ms How long to hold the last color when frames stop
+   * @param fade_ms How long to fade to black after the hold
+   */
+  StreamPlayer(uint16_t playout_delay_ms = 20,
+               uint16_t hold_ms = 250,
+               uint16_t fade_ms = 1000);
+
+  unsigned long frames_received;
+  unsigned long late_frames;     // arrived after they should have played
+  unsigned long dropped_frames;  // buffer was full, or out of order
+  unsigned long underruns;       // times we ran out of frames to play
+
+  /**
+   * Add a frame from the computer
+   *
+   * @param frame The frame, with the computer's timestamp
+   * @param now_us Our current time in microseconds
+   * @return true if the frame was kept
+   */
+  bool push(const StreamFrame &frame, uint32_t now_us);
+
+  /**
+   * Work out the colors to show right now
+   *
+   * @param now_us Our current time in microseconds
+   * @param red, green, blue Set to the 10-bit PWM duties to show
+   */
+  void render(uint32_t now_us, uint16_t &red, uint16_t &green, uint16_t &blue);
+
+  /**
+   * Forget all frames and the clock sync, for when a new stream starts
+   */
+  void reset();
+
+  // How many frames are waiting in the buffer
+  inline uint8_t buffered() const {
+    return _count;
+  };
+};
+
+#endif
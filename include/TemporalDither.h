@@ -0,0 +1,115 @@
+#ifndef TEMPORAL_DITHER_H
+#define TEMPORAL_DITHER_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+/*
+Squeezes more brightness levels out of the 10-bit PWM.
+
+At 10 bits, the bottom of the range is coarse: going from a duty of 3 to 4 is
+a 33% jump in brightness, so dim colors step visibly and slow fades stutter.
+The trick here is temporal dithering (a first-order sigma-delta, if you want
+to look it up).  If we want a duty of 3.25, we show 3 three times and 4 once,
+over and over, fast enough that the eye only sees the average.
+
+Each channel keeps an accumulator of the fractional part that hasn't been
+shown yet.  Every tick the fraction is added in, and whenever it overflows
+we show one step brighter for that tick.  The error never builds up, so the
+long-run average is exactly the requested level.
+
+Ticks come from a hardware timer rather than the loop(), so the dithering
+doesn't wobble when the loop is slow.  We keep 4 bits of fraction on top of
+the 10 PWM bits, 14 bits in all, at 5 kHz.  The slowest pattern (a fraction
+of 1/16) then repeats at about 300 Hz, well out of sight.  More fraction bits
+would make the slowest patterns slow enough to see as flicker.
+*/
+
+const uint8_t DITHER_CHANNELS = 3;
+const uint8_t DITHER_FRACTION_BITS = 4;
+const uint32_t DITHER_TICK_US = 200;  // 5 kHz
+
+class TemporalDither {
+private:
+  uint8_t _pwm_channels[DITHER_CHANNELS];
+  volatile uint16_t _targets[DITHER_CHANNELS];  // 16-bit levels from the loop
+  uint8_t _accumulators[DITHER_CHANNELS];
+  uint16_t _written[DITHER_CHANNELS];  // last duty sent to the PWM
+  esp_timer_handle_t _timer;
+#ifdef LIGHT_BENCHMARK
+  // For timing a change all the way to the PWM, see mark()
+  volatile bool _mark_armed;
+  volatile bool _mark_pending;
+  volatile uint32_t _marks_written;
+  volatile uint32_t _mark_written_us;
+#endif
+
+  static void timer_callback(void* dither);
+
+public:
+  /**
+   * Constructor for the dithering engine
+   *
+   * @param red_channel, green_channel, blue_channel The PWM channels to drive
+   */
+  TemporalDither(uint8_t red_channel = 0, uint8_t green_channel = 1, uint8_t blue_channel = 2);
+
+  /**
+   * Start the dithering timer
+   * Call this once from setup()
+   */
+  void begin();
+
+  /**
+   * Set the levels to show
+   *
+   * @param red, green, blue 16-bit levels, 65535 is (nearly) full on
+   */
+  inline void set(uint16_t red, uint16_t green, uint16_t blue) {
+#ifdef LIGHT_BENCHMARK
+    if (_mark_armed && (red != _targets[0] || green != _targets[1] || blue != _targets[2])) {
+      _mark_armed = false;
+      _mark_pending = true;
+    }
+#endif
+    _targets[0] = red;
+    _targets[1] = green;
+    _targets[2] = blue;
+  };
+
+  /**
+   * Advance the dithering one step, writing any PWM duties that change
+   * Called from the timer, but public so it can be driven by hand
+   */
+  void tick();
+
+  /**
+   * The duty last written to one channel, for checking the output
+   *
+   * @param channel 0, 1 or 2 for red, green or blue
+   */
+  inline uint16_t written(uint8_t channel) const {
+    return _written[channel];
+  };
+
+#ifdef LIGHT_BENCHMARK
+  /**
+   * Time the next change in the levels to the PWM, benchmark firmware only
+   * The first PWM write after the next set() that changes anything counts
+   * one more marks_written(), and notes the time in mark_written_us().
+   */
+  inline void mark() {
+    _mark_pending = false;
+    _mark_armed = true;
+  };
+  inline uint32_t marks_written() const {
+    return _marks_written;
+  };
+  // clock_us32() of the write
+  inline uint32_t mark_written_us() const {
+    return _mark_written_us;
+  };
+#endif
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+Just enough of the Arduino-ESP32 core for the firmware's classes to build
+and run on a computer, for the tests in test/native and the tools that
+drive the real classes (see tools/light_host.py).  Only the native build
+uses it (library.json), the real board gets the real core.
+
+Nothing here talks to hardware.  The clock is made up and only moves when
+it's told to (HostArduino.h), the pins and the ADC read whatever the test
+set them to, and the PWM and Serial writes are kept for the test to look
+at.  The host has the one core, so no task ever starts, and everything
+that has a single-core fallback (SensingTask) uses it.
+
+The pin numbers are the Arduino Nano ESP32's GPIOs, so the analog pins map
+onto the ADC channels the same way they do on the board.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "esp_err.h"
+
+using std::min;
+using std::max;
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+#define OUTPUT_OPEN_DRAIN 0x12
+#define HIGH 1
+#define LOW 0
+#define DEC 10
+#define HEX 16
+
+#define D0 44
+#define D1 43
+#define D2 5
+#define D3 6
+#define D4 7
+#define D5 8
+#define D6 9
+#define D7 10
+#define D8 17
+#define D9 18
+#define D10 21
+#define D11 38
+#define D12 47
+#define D13 48
+#define A0 1
+#define A1 2
+#define A2 3
+#define A3 4
+#define A4 11
+#define A5 12
+#define A6 13
+#define A7 14
+#define LED_RED 46
+#define LED_GREEN 0
+#define LED_BLUE 45
+#define LED_BUILTIN 48
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define PROGMEM
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// The sketch's, src/main.cpp
+void setup();
+void loop();
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+uint32_t analogReadMilliVolts(uint8_t pin);
+void analogReadResolution(uint8_t bits);
+int8_t digitalPinToAnalogChannel(uint8_t pin);
+
+double ledcSetup(uint8_t channel, double frequency, uint8_t resolution_bits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcWrite(uint8_t channel, uint32_t duty);
+
+// The USB serial port.  What's written is kept (host_serial_take_output()), and
+// what's read comes from host_serial_feed(), or a pseudo-terminal if one
+// was opened (host_serial_open_pty()).
+class HostSerial {
+private:
+  size_t print_unsigned(unsigned long long value, int base);
+  size_t print_signed(long long value, int base);
+
+public:
+  void begin(unsigned long baud);
+  int available();
+  int read();
+  size_t read(uint8_t* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length);
+  int availableForWrite();
+  void flush();
+  void setRxBufferSize(size_t size);
+  void setTxTimeoutMs(uint32_t timeout_ms);
+  size_t write(uint8_t value);
+  size_t write(const uint8_t* buffer, size_t length);
+
+  size_t print(const char* text);
+  size_t print(char value);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(long long value, int base = DEC);
+  size_t print(unsigned long long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+  size_t println();
+  template <class T>
+  size_t println(T value) {
+    return print(value) + println();
+  }
+  template <class T>
+  size_t println(T value, int format) {
+    return print(value, format) + println();
+  }
+
+  // Always connected
+  inline operator bool() const {
+    return true;
+  };
+};
+
+extern HostSerial Serial;
+
+class EspClass {
+public:
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz();
+  uint32_t getFreeHeap();
+};
+
+extern EspClass ESP;
+
+// FreeRTOS, single core.  Critical sections have nothing to keep out.
+typedef void* TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef struct {
+  uint32_t owner;
+  uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define pdFAIL 0
+#define pdPASS 1
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (ms)
+
+// Never starts anything, so returns pdFAIL
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack_bytes,
+                                   void* argument, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t* last_wake, TickType_t period);
+TickType_t xTaskGetTickCount();
+BaseType_t xPortGetCoreID();
+void taskYIELD();
+
+#endif
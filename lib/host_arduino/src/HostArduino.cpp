@@ -0,0 +1,810 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <driver/adc.h>
+#include <driver/ledc.h>
+#include <esp_adc_cal.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <soc/ledc_struct.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <thread>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "HostArduino.h"
+
+/*
+The made-up board, see Arduino.h and HostArduino.h.
+*/
+
+const uint8_t HOST_PINS = 49;
+const uint8_t HOST_LEDC_CHANNELS = 8;
+const uint8_t HOST_TIMERS = 8;
+const uint32_t HOST_CPU_MHZ = 240;
+// Roughly what reading a peripheral register takes
+const uint64_t HOST_REGISTER_READ_NS = 50;
+// Kept output past this is dropped from the front, for long soaks
+const size_t HOST_SERIAL_KEEP_BYTES = 1 << 20;
+
+struct host_timer {
+  esp_timer_cb_t callback;
+  void* arg;
+  bool active;
+  uint64_t period_ns;  // 0 for a one-shot
+  uint64_t due_ns;
+};
+
+struct HostLedcChannel {
+  uint8_t setups;
+  uint8_t pin_plus_one;  // 0 until attached
+  uint32_t duty;
+  uint32_t hpoint;
+};
+
+static uint64_t host_ns = 0;
+static double real_time_speed = 0;
+static std::chrono::steady_clock::time_point real_time_start;
+static uint64_t real_time_start_ns = 0;
+
+static host_timer host_timers[HOST_TIMERS];
+static bool running_timers = false;
+
+static uint8_t pin_modes[HOST_PINS];
+// Zero is how everything starts, so it's all right before the constructors run
+static uint8_t pin_driven[HOST_PINS];  // 0 when nothing outside drives it, else the level + 1
+static bool pin_written[HOST_PINS];
+static uint16_t analog_values[HOST_PINS];
+static HostAnalogSource analog_source = nullptr;
+static void* analog_context = nullptr;
+static uint32_t analog_reads = 0;
+static esp_adc_cal_value_t adc_calibration = ESP_ADC_CAL_VAL_EFUSE_TP_FIT;
+static esp_reset_reason_t reset_reason = ESP_RST_POWERON;
+static uint32_t random_state = 0x2545F491;
+
+static HostLedcChannel ledc_channels[HOST_LEDC_CHANNELS];
+// Per timer, the Arduino core puts channels on them in pairs
+static uint32_t ledc_frequency[LEDC_TIMER_MAX];
+static uint8_t ledc_bits[LEDC_TIMER_MAX];
+static uint64_t ledc_reset_ns[LEDC_TIMER_MAX];
+
+static int pty_master = -1;
+static int pty_slave = -1;
+// Like the USB port, writes wait this long for the other end to read, then
+// what's left is dropped, so nobody reading can't hold the loop up for good
+static uint32_t serial_tx_timeout_ms = 100;
+
+// Made the first time they're used, which can be from another file's constructors
+static std::deque<uint8_t> &serial_input() {
+  static std::deque<uint8_t> input;
+  return input;
+}
+
+static std::string &serial_output() {
+  static std::string output;
+  return output;
+}
+
+static std::map<std::string, std::string> &preferences_store() {
+  static std::map<std::string, std::string> store;
+  return store;
+}
+
+HostSerial Serial;
+EspClass ESP;
+ledc_dev_t LEDC = {{{{{{{0}}}, {{{1}}}, {{{2}}}, {{{3}}}}}}};
+
+///////////////////////////////////////////////////////////
+// Clock and timers
+///////////////////////////////////////////////////////////
+
+static uint64_t now_ns() {
+  if (real_time_speed > 0) {
+    std::chrono::steady_clock::duration real = std::chrono::steady_clock::now() - real_time_start;
+    uint64_t followed = real_time_start_ns + static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(real).count() * real_time_speed);
+    host_ns = max(host_ns, followed);
+  }
+  return host_ns;
+}
+
+// Move the clock to a time, running the timers that come due before it
+static void run_until(uint64_t target_ns) {
+  if (running_timers) {
+    // A timer callback waiting, nothing else gets to run meanwhile
+    host_ns = max(host_ns, target_ns);
+    return;
+  }
+  running_timers = true;
+  while (true) {
+    host_timer* next = nullptr;
+    for (uint8_t i = 0; i < HOST_TIMERS; i++) {
+      if (host_timers[i].active && host_timers[i].due_ns <= target_ns &&
+          (next == nullptr || host_timers[i].due_ns < next->due_ns)) {
+        next = &host_timers[i];
+      }
+    }
+    if (next == nullptr) {
+      break;
+    }
+    host_ns = max(host_ns, next->due_ns);
+    if (next->period_ns > 0) {
+      next->due_ns += next->period_ns;
+    } else {
+      next->active = false;
+    }
+    next->callback(next->arg);
+  }
+  host_ns = max(host_ns, target_ns);
+  running_timers = false;
+}
+
+uint64_t host_time_us() {
+  return now_ns() / 1000;
+}
+
+void host_advance_us(uint64_t us) {
+  run_until(now_ns() + us * 1000);
+}
+
+void host_jump_us(uint64_t us) {
+  uint64_t target_ns = now_ns() + us * 1000;
+  // Each periodic timer only due once more, at the last time it would have been
+  for (uint8_t i = 0; i < HOST_TIMERS; i++) {
+    host_timer &timer = host_timers[i];
+    if (timer.active && timer.period_ns > 0 && timer.due_ns <= target_ns) {
+      timer.due_ns += (target_ns - timer.due_ns) / timer.period_ns * timer.period_ns;
+    }
+  }
+  run_until(target_ns);
+}
+
+void host_follow_real_time(double speed) {
+  now_ns();
+  real_time_speed = speed;
+  real_time_start = std::chrono::steady_clock::now();
+  real_time_start_ns = host_ns;
+}
+
+int64_t esp_timer_get_time() {
+  return now_ns() / 1000;
+}
+
+unsigned long micros() {
+  return static_cast<unsigned long>(static_cast<uint32_t>(now_ns() / 1000));
+}
+
+unsigned long millis() {
+  return static_cast<unsigned long>(static_cast<uint32_t>(now_ns() / 1000000));
+}
+
+void delay(uint32_t ms) {
+  delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+  if (real_time_speed > 0) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(static_cast<int64_t>(us * 1000 / real_time_speed)));
+    host_poll();
+  } else {
+    host_advance_us(us);
+  }
+}
+
+void yield() {
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+  for (uint8_t i = 0; i < HOST_TIMERS; i++) {
+    if (host_timers[i].callback == nullptr) {
+      host_timers[i].callback = args->callback;
+      host_timers[i].arg = args->arg;
+      host_timers[i].active = false;
+      *handle = &host_timers[i];
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+  timer->period_ns = period_us * 1000;
+  timer->due_ns = now_ns() + timer->period_ns;
+  timer->active = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  timer->period_ns = 0;
+  timer->due_ns = now_ns() + timeout_us * 1000;
+  timer->active = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (!timer->active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->active = false;
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////
+// Pins and the ADC
+///////////////////////////////////////////////////////////
+
+void host_reset() {
+  memset(pin_driven, 0, sizeof(pin_driven));
+  memset(analog_values, 0, sizeof(analog_values));
+  analog_source = nullptr;
+  analog_context = nullptr;
+  analog_reads = 0;
+  adc_calibration = ESP_ADC_CAL_VAL_EFUSE_TP_FIT;
+  reset_reason = ESP_RST_POWERON;
+  serial_input().clear();
+  serial_output().clear();
+}
+
+void host_set_pin(uint8_t pin, bool level) {
+  if (pin < HOST_PINS) {
+    pin_driven[pin] = level ? HIGH + 1 : LOW + 1;
+  }
+}
+
+void host_release_pin(uint8_t pin) {
+  if (pin < HOST_PINS) {
+    pin_driven[pin] = 0;
+  }
+}
+
+bool host_pin_written(uint8_t pin) {
+  return pin < HOST_PINS && pin_written[pin];
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < HOST_PINS) {
+    pin_modes[pin] = mode;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  if (pin >= HOST_PINS) {
+    return LOW;
+  }
+  if (pin_driven[pin] > 0) {
+    return pin_driven[pin] - 1;
+  }
+  if (pin_modes[pin] == OUTPUT) {
+    return pin_written[pin];
+  }
+  return pin_modes[pin] == INPUT_PULLUP ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < HOST_PINS) {
+    pin_written[pin] = value != LOW;
+  }
+}
+
+void host_set_analog(uint8_t pin, uint16_t value) {
+  if (pin < HOST_PINS) {
+    analog_values[pin] = min(value, static_cast<uint16_t>(4095));
+  }
+}
+
+void host_set_analog_source(HostAnalogSource source, void* context) {
+  analog_source = source;
+  analog_context = context;
+}
+
+uint32_t host_analog_reads() {
+  return analog_reads;
+}
+
+static uint16_t read_analog(uint8_t pin) {
+  analog_reads++;
+  if (analog_source != nullptr) {
+    return min(analog_source(pin, host_time_us(), analog_context), static_cast<uint16_t>(4095));
+  }
+  return pin < HOST_PINS ? analog_values[pin] : 0;
+}
+
+int analogRead(uint8_t pin) {
+  return read_analog(pin);
+}
+
+uint32_t analogReadMilliVolts(uint8_t pin) {
+  return read_analog(pin) * 3300 / 4095;
+}
+
+void analogReadResolution(uint8_t bits) {
+}
+
+// GPIO 1-10 are ADC1, 11-20 ADC2, numbered after them like the Arduino core does
+int8_t digitalPinToAnalogChannel(uint8_t pin) {
+  if (pin >= 1 && pin <= 20) {
+    return pin - 1;
+  }
+  return -1;
+}
+
+esp_err_t adc1_config_width(adc_bits_width_t width) {
+  return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten) {
+  return ESP_OK;
+}
+
+int adc1_get_raw(adc1_channel_t channel) {
+  return read_analog(channel + 1);
+}
+
+esp_err_t adc_digi_initialize(const adc_digi_init_config_t* config) {
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_deinitialize() {
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_controller_configure(const adc_digi_configuration_t* config) {
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_start() {
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_stop() {
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_read_bytes(uint8_t* buffer, uint32_t length, uint32_t* bytes_read, uint32_t timeout_ms) {
+  *bytes_read = 0;
+  return ESP_ERR_TIMEOUT;
+}
+
+void host_set_adc_calibration(esp_adc_cal_value_t source) {
+  adc_calibration = source;
+}
+
+esp_err_t esp_adc_cal_check_efuse(esp_adc_cal_value_t source) {
+  return source == adc_calibration ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t unit, adc_atten_t atten, adc_bits_width_t width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t* characteristics) {
+  memset(characteristics, 0, sizeof(*characteristics));
+  characteristics->adc_num = unit;
+  characteristics->atten = atten;
+  characteristics->bit_width = width;
+  characteristics->vref = default_vref;
+  return adc_calibration == ESP_ADC_CAL_VAL_NOT_SUPPORTED ? ESP_ADC_CAL_VAL_DEFAULT_VREF : adc_calibration;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t raw, const esp_adc_cal_characteristics_t* characteristics) {
+  return raw * 3300 / 4095;
+}
+
+///////////////////////////////////////////////////////////
+// PWM
+///////////////////////////////////////////////////////////
+
+double ledcSetup(uint8_t channel, double frequency, uint8_t resolution_bits) {
+  if (channel >= HOST_LEDC_CHANNELS) {
+    return 0;
+  }
+  ledc_channels[channel].setups++;
+  uint8_t timer = (channel / 2) % LEDC_TIMER_MAX;
+  ledc_frequency[timer] = static_cast<uint32_t>(frequency);
+  ledc_bits[timer] = resolution_bits;
+  return frequency;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel) {
+  if (channel < HOST_LEDC_CHANNELS) {
+    ledc_channels[channel].pin_plus_one = pin + 1;
+  }
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty) {
+  if (channel < HOST_LEDC_CHANNELS) {
+    ledc_channels[channel].duty = duty;
+    ledc_channels[channel].hpoint = 0;
+  }
+}
+
+esp_err_t ledc_set_duty_with_hpoint(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty, uint32_t hpoint) {
+  uint8_t i = mode * 8 + channel;
+  if (i >= HOST_LEDC_CHANNELS) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  ledc_channels[i].duty = duty;
+  ledc_channels[i].hpoint = hpoint;
+  return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel) {
+  return ESP_OK;
+}
+
+esp_err_t ledc_timer_pause(ledc_mode_t mode, ledc_timer_t timer) {
+  return ESP_OK;
+}
+
+esp_err_t ledc_timer_resume(ledc_mode_t mode, ledc_timer_t timer) {
+  return ESP_OK;
+}
+
+esp_err_t ledc_timer_rst(ledc_mode_t mode, ledc_timer_t timer) {
+  ledc_reset_ns[timer] = now_ns();
+  return ESP_OK;
+}
+
+host_ledc_count_t::operator uint32_t() const volatile {
+  host_ns += HOST_REGISTER_READ_NS;
+  uint64_t elapsed_ns = now_ns() - ledc_reset_ns[timer];
+  uint32_t frequency = ledc_frequency[timer] > 0 ? ledc_frequency[timer] : 20000;
+  uint8_t bits = ledc_bits[timer] > 0 ? ledc_bits[timer] : 10;
+  uint64_t counts = elapsed_ns * frequency / 1000 * (1 << bits) / 1000000;
+  return static_cast<uint32_t>(counts & ((1 << bits) - 1));
+}
+
+uint32_t host_ledc_duty(uint8_t channel) {
+  return channel < HOST_LEDC_CHANNELS ? ledc_channels[channel].duty : 0;
+}
+
+uint32_t host_ledc_hpoint(uint8_t channel) {
+  return channel < HOST_LEDC_CHANNELS ? ledc_channels[channel].hpoint : 0;
+}
+
+uint8_t host_ledc_setups(uint8_t channel) {
+  return channel < HOST_LEDC_CHANNELS ? ledc_channels[channel].setups : 0;
+}
+
+uint8_t host_ledc_pin(uint8_t channel) {
+  return channel < HOST_LEDC_CHANNELS ? ledc_channels[channel].pin_plus_one - 1 : 0xFF;
+}
+
+///////////////////////////////////////////////////////////
+// Serial
+///////////////////////////////////////////////////////////
+
+void host_serial_feed(const uint8_t* data, size_t length) {
+  serial_input().insert(serial_input().end(), data, data + length);
+}
+
+std::string host_serial_take_output() {
+  std::string taken;
+  taken.swap(serial_output());
+  return taken;
+}
+
+const char* host_serial_open_pty() {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    return nullptr;
+  }
+  const char* name = ptsname(master);
+  // Hold the other end open too, so the port doesn't hang up between
+  // the tool closing and opening it, and make it raw bytes
+  int slave = open(name, O_RDWR | O_NOCTTY);
+  if (slave < 0) {
+    close(master);
+    return nullptr;
+  }
+  struct termios settings;
+  tcgetattr(slave, &settings);
+  cfmakeraw(&settings);
+  tcsetattr(slave, TCSANOW, &settings);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+  pty_master = master;
+  pty_slave = slave;
+  return name;
+}
+
+static void read_pty() {
+  if (pty_master < 0) {
+    return;
+  }
+  uint8_t buffer[256];
+  ssize_t count;
+  while ((count = ::read(pty_master, buffer, sizeof(buffer))) > 0) {
+    host_serial_feed(buffer, count);
+  }
+}
+
+void host_poll() {
+  run_until(now_ns());
+  read_pty();
+}
+
+void HostSerial::begin(unsigned long baud) {
+}
+
+int HostSerial::available() {
+  read_pty();
+  return serial_input().size();
+}
+
+int HostSerial::read() {
+  if (available() == 0) {
+    return -1;
+  }
+  uint8_t value = serial_input().front();
+  serial_input().pop_front();
+  return value;
+}
+
+size_t HostSerial::read(uint8_t* buffer, size_t length) {
+  return readBytes(buffer, length);
+}
+
+size_t HostSerial::readBytes(uint8_t* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length && available() > 0) {
+    buffer[count++] = read();
+  }
+  return count;
+}
+
+int HostSerial::availableForWrite() {
+  return 256;
+}
+
+void HostSerial::flush() {
+}
+
+void HostSerial::setRxBufferSize(size_t size) {
+}
+
+void HostSerial::setTxTimeoutMs(uint32_t timeout_ms) {
+  serial_tx_timeout_ms = timeout_ms;
+}
+
+size_t HostSerial::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t HostSerial::write(const uint8_t* buffer, size_t length) {
+  std::string &output = serial_output();
+  if (output.size() + length > HOST_SERIAL_KEEP_BYTES) {
+    output.erase(0, output.size() / 2);
+  }
+  output.append(reinterpret_cast<const char*>(buffer), length);
+  if (pty_master >= 0) {
+    size_t written = 0;
+    std::chrono::steady_clock::time_point give_up =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(serial_tx_timeout_ms);
+    while (written < length) {
+      ssize_t count = ::write(pty_master, buffer + written, length - written);
+      if (count > 0) {
+        written += count;
+      } else if (std::chrono::steady_clock::now() < give_up) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      } else {
+        break;
+      }
+    }
+  }
+  return length;
+}
+
+size_t HostSerial::print(const char* text) {
+  return write(reinterpret_cast<const uint8_t*>(text), strlen(text));
+}
+
+size_t HostSerial::print(char value) {
+  return write(static_cast<uint8_t>(value));
+}
+
+size_t HostSerial::print_unsigned(unsigned long long value, int base) {
+  char digits[65];
+  char* at = digits + sizeof(digits) - 1;
+  *at = '\0';
+  do {
+    uint8_t digit = value % base;
+    *--at = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value > 0);
+  return print(at);
+}
+
+size_t HostSerial::print_signed(long long value, int base) {
+  if (value < 0 && base == DEC) {
+    return print('-') + print_unsigned(-static_cast<unsigned long long>(value), base);
+  }
+  return print_unsigned(static_cast<unsigned long long>(value), base);
+}
+
+size_t HostSerial::print(int value, int base) {
+  return print_signed(value, base);
+}
+
+size_t HostSerial::print(unsigned int value, int base) {
+  return print_unsigned(value, base);
+}
+
+size_t HostSerial::print(long value, int base) {
+  return print_signed(value, base);
+}
+
+size_t HostSerial::print(unsigned long value, int base) {
+  return print_unsigned(value, base);
+}
+
+size_t HostSerial::print(long long value, int base) {
+  return print_signed(value, base);
+}
+
+size_t HostSerial::print(unsigned long long value, int base) {
+  return print_unsigned(value, base);
+}
+
+size_t HostSerial::print(double value, int digits) {
+  char text[64];
+  snprintf(text, sizeof(text), "%.*f", digits, value);
+  return print(text);
+}
+
+size_t HostSerial::println() {
+  return print("\r\n");
+}
+
+///////////////////////////////////////////////////////////
+// The rest of the chip
+///////////////////////////////////////////////////////////
+
+uint32_t EspClass::getCycleCount() {
+  return static_cast<uint32_t>(now_ns() * HOST_CPU_MHZ / 1000);
+}
+
+uint32_t EspClass::getCpuFreqMHz() {
+  return HOST_CPU_MHZ;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return 256 * 1024;
+}
+
+void host_set_reset_reason(esp_reset_reason_t reason) {
+  reset_reason = reason;
+}
+
+esp_reset_reason_t esp_reset_reason() {
+  return reset_reason;
+}
+
+// xorshift32
+uint32_t esp_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buffer, uint32_t length) {
+  crc = ~crc;
+  for (uint32_t i = 0; i < length; i++) {
+    crc ^= buffer[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+esp_err_t esp_task_wdt_init(uint32_t timeout_s, bool panic) {
+  return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_add(TaskHandle_t task) {
+  return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_delete(TaskHandle_t task) {
+  return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_reset() {
+  return ESP_OK;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+  return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* buffer, size_t length) {
+  return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t length,
+                             spi_flash_mmap_memory_t memory, const void** mapped,
+                             spi_flash_mmap_handle_t* handle) {
+  return ESP_ERR_NOT_FOUND;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack_bytes,
+                                   void* argument, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t core) {
+  return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+  delay(ticks * portTICK_PERIOD_MS);
+}
+
+void vTaskDelayUntil(TickType_t* last_wake, TickType_t period) {
+  *last_wake += period;
+  TickType_t now = xTaskGetTickCount();
+  if (static_cast<int32_t>(*last_wake - now) > 0) {
+    vTaskDelay(*last_wake - now);
+  }
+}
+
+TickType_t xTaskGetTickCount() {
+  return millis() / portTICK_PERIOD_MS;
+}
+
+BaseType_t xPortGetCoreID() {
+  return 1;
+}
+
+void taskYIELD() {
+}
+
+///////////////////////////////////////////////////////////
+// Preferences
+///////////////////////////////////////////////////////////
+
+Preferences::Preferences()
+  : _name(nullptr) {
+}
+
+bool Preferences::begin(const char* name, bool read_only, const char* partition) {
+  _name = name;
+  return true;
+}
+
+void Preferences::end() {
+  _name = nullptr;
+}
+
+static std::string preferences_key(const char* name, const char* key) {
+  return std::string(name != nullptr ? name : "") + "/" + key;
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  std::map<std::string, std::string>::iterator found = preferences_store().find(preferences_key(_name, key));
+  return found == preferences_store().end() ? 0 : found->second.size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buffer, size_t length) {
+  std::map<std::string, std::string>::iterator found = preferences_store().find(preferences_key(_name, key));
+  if (found == preferences_store().end() || found->second.size() > length) {
+    return 0;
+  }
+  memcpy(buffer, found->second.data(), found->second.size());
+  return found->second.size();
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t length) {
+  preferences_store()[preferences_key(_name, key)] = std::string(static_cast<const char*>(value), length);
+  return length;
+}
+
+bool Preferences::remove(const char* key) {
+  return preferences_store().erase(preferences_key(_name, key)) > 0;
+}
@@ -0,0 +1,134 @@
+#ifndef HOST_ARDUINO_CONTROL_H
+#define HOST_ARDUINO_CONTROL_H
+
+#include <Arduino.h>
+#include <string>
+#include "esp_adc_cal.h"
+#include "esp_system.h"
+
+/*
+What a test can do to the made-up board, see Arduino.h.
+
+The clock starts at zero and only moves when told to, by host_advance_us()
+or a delay().  Moving it runs any esp_timer callbacks that come due on the
+way, in order, each at its own time, so the dithering timer ticks just as
+often as it would on the board.  The tools that talk to a made-up board
+over a pseudo-terminal let it follow the computer's clock instead
+(host_follow_real_time()), and call host_poll() once a loop() pass to run
+the timers and pick up what was sent.
+
+Everything starts out like a board with nothing plugged in: the pins read
+what their pull-ups or pull-downs make them, the dials read 0, and nothing
+has been sent.  host_reset() puts the outside world back like that, between
+tests.  What the firmware set up (pin modes, timers, PWM) stays, and so does
+the clock, which never goes backwards.
+*/
+
+/**
+ * Let go of the pins, put the dials back to 0, and forget what was sent and written
+ */
+void host_reset();
+
+/**
+ * The made-up time, in microseconds since the start
+ */
+uint64_t host_time_us();
+
+/**
+ * Move the clock on, running any timers that come due on the way
+ */
+void host_advance_us(uint64_t us);
+
+/**
+ * Move the clock on in one go, as if everything stood still meanwhile:
+ * each periodic timer that came due runs once, late, instead of every time
+ * it would have (what esp_timer does when it falls behind and skips).  For
+ * tests that get through months, see test/native/test_soak.
+ */
+void host_jump_us(uint64_t us);
+
+/**
+ * Follow the computer's clock from now on, or stop following it
+ *
+ * @param speed How many made-up seconds go by each real one, 0 to stop
+ */
+void host_follow_real_time(double speed);
+
+/**
+ * Bring the clock up to date, run the timers, and take in anything sent
+ * over the pseudo-terminal.  Only needed while following the real time.
+ */
+void host_poll();
+
+/**
+ * Drive a pin from outside, like a button or a motion sensor would
+ */
+void host_set_pin(uint8_t pin, bool level);
+
+/**
+ * Stop driving it, so it reads what its pull-up or pull-down makes it
+ */
+void host_release_pin(uint8_t pin);
+
+/**
+ * The level last written to an output pin
+ */
+bool host_pin_written(uint8_t pin);
+
+/**
+ * Set what an analog pin reads, 0-4095
+ */
+void host_set_analog(uint8_t pin, uint16_t value);
+
+/**
+ * Work out every analog reading from a function instead, nullptr to go
+ * back to host_set_analog()'s values.  It's called once per ADC reading,
+ * with the time the reading is taken.
+ */
+typedef uint16_t (*HostAnalogSource)(uint8_t pin, uint64_t time_us, void* context);
+void host_set_analog_source(HostAnalogSource source, void* context);
+
+/**
+ * How many ADC readings were taken since the last reset
+ */
+uint32_t host_analog_reads();
+
+/**
+ * Which calibration esp_adc_cal finds on the chip, EFUSE_TP_FIT to begin with
+ */
+void host_set_adc_calibration(esp_adc_cal_value_t source);
+
+/**
+ * Why the chip last reset, for esp_reset_reason()
+ */
+void host_set_reset_reason(esp_reset_reason_t reason);
+
+/**
+ * What a PWM channel was set up and last set to
+ * From either ledcWrite() or ledc_set_duty_with_hpoint()
+ */
+uint32_t host_ledc_duty(uint8_t channel);
+uint32_t host_ledc_hpoint(uint8_t channel);
+// How many times ledcSetup() was called on it
+uint8_t host_ledc_setups(uint8_t channel);
+// The pin ledcAttachPin() put it on, or 0xFF
+uint8_t host_ledc_pin(uint8_t channel);
+
+/**
+ * Hand bytes to Serial, as if a computer had sent them
+ */
+void host_serial_feed(const uint8_t* data, size_t length);
+
+/**
+ * Everything written to Serial since the last time, which is then cleared
+ */
+std::string host_serial_take_output();
+
+/**
+ * Connect Serial to a new pseudo-terminal, for a tool to open like a real port
+ *
+ * @return The terminal's path, or nullptr if it couldn't be made
+ */
+const char* host_serial_open_pty();
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include <Arduino.h>
+
+// Kept in memory, so it lasts as long as the test does
+
+class Preferences {
+private:
+  const char* _name;
+
+public:
+  Preferences();
+  bool begin(const char* name, bool read_only = false, const char* partition = nullptr);
+  void end();
+  size_t getBytesLength(const char* key);
+  size_t getBytes(const char* key, void* buffer, size_t length);
+  size_t putBytes(const char* key, const void* value, size_t length);
+  bool remove(const char* key);
+};
+
+#endif
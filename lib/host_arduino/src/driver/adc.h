@@ -0,0 +1,104 @@
+#ifndef HOST_DRIVER_ADC_H
+#define HOST_DRIVER_ADC_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// The ADC reads whatever the test set the pin to, see host_set_analog().
+// The DMA side never has any samples, the microphone's task can't start
+// on the host anyway.
+
+#define BIT(n) (1UL << (n))
+#define SOC_ADC_MAX_CHANNEL_NUM 10
+#define SOC_ADC_DIGI_MAX_BITWIDTH 12
+#define SOC_ADC_DIGI_RESULT_BYTES 4
+#define ADC_MAX_DELAY UINT32_MAX
+
+typedef enum {
+  ADC_UNIT_1 = 1,
+  ADC_UNIT_2 = 2
+} adc_unit_t;
+
+typedef enum {
+  ADC_ATTEN_DB_0,
+  ADC_ATTEN_DB_2_5,
+  ADC_ATTEN_DB_6,
+  ADC_ATTEN_DB_11
+} adc_atten_t;
+
+typedef enum {
+  ADC_WIDTH_BIT_12 = 3
+} adc_bits_width_t;
+
+typedef enum {
+  ADC1_CHANNEL_0 = 0,
+  ADC1_CHANNEL_1,
+  ADC1_CHANNEL_2,
+  ADC1_CHANNEL_3,
+  ADC1_CHANNEL_4,
+  ADC1_CHANNEL_5,
+  ADC1_CHANNEL_6,
+  ADC1_CHANNEL_7,
+  ADC1_CHANNEL_8,
+  ADC1_CHANNEL_9,
+  ADC1_CHANNEL_MAX
+} adc1_channel_t;
+
+esp_err_t adc1_config_width(adc_bits_width_t width);
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten);
+int adc1_get_raw(adc1_channel_t channel);
+
+typedef enum {
+  ADC_CONV_SINGLE_UNIT_1 = 1,
+  ADC_CONV_SINGLE_UNIT_2 = 2
+} adc_digi_convert_mode_t;
+
+typedef enum {
+  ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+  ADC_DIGI_OUTPUT_FORMAT_TYPE2
+} adc_digi_output_format_t;
+
+typedef struct {
+  uint32_t max_store_buf_size;
+  uint32_t conv_num_each_intr;
+  uint32_t adc1_chan_mask;
+  uint32_t adc2_chan_mask;
+} adc_digi_init_config_t;
+
+typedef struct {
+  uint8_t atten;
+  uint8_t channel;
+  uint8_t unit;
+  uint8_t bit_width;
+} adc_digi_pattern_config_t;
+
+typedef struct {
+  bool conv_limit_en;
+  uint32_t conv_limit_num;
+  uint32_t pattern_num;
+  adc_digi_pattern_config_t* adc_pattern;
+  uint32_t sample_freq_hz;
+  adc_digi_convert_mode_t conv_mode;
+  adc_digi_output_format_t format;
+} adc_digi_configuration_t;
+
+typedef struct {
+  union {
+    struct {
+      uint32_t data : 13;
+      uint32_t channel : 4;
+      uint32_t unit : 1;
+      uint32_t reserved : 14;
+    } type2;
+    uint32_t val;
+  };
+} adc_digi_output_data_t;
+
+esp_err_t adc_digi_initialize(const adc_digi_init_config_t* config);
+esp_err_t adc_digi_deinitialize();
+esp_err_t adc_digi_controller_configure(const adc_digi_configuration_t* config);
+esp_err_t adc_digi_start();
+esp_err_t adc_digi_stop();
+esp_err_t adc_digi_read_bytes(uint8_t* buffer, uint32_t length, uint32_t* bytes_read, uint32_t timeout_ms);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef HOST_DRIVER_LEDC_H
+#define HOST_DRIVER_LEDC_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// The duties are kept for the test to look at, see host_ledc_duty()
+
+typedef enum {
+  LEDC_LOW_SPEED_MODE,
+  LEDC_SPEED_MODE_MAX
+} ledc_mode_t;
+
+typedef enum {
+  LEDC_CHANNEL_0,
+  LEDC_CHANNEL_1,
+  LEDC_CHANNEL_2,
+  LEDC_CHANNEL_3,
+  LEDC_CHANNEL_4,
+  LEDC_CHANNEL_5,
+  LEDC_CHANNEL_6,
+  LEDC_CHANNEL_7,
+  LEDC_CHANNEL_MAX
+} ledc_channel_t;
+
+typedef enum {
+  LEDC_TIMER_0,
+  LEDC_TIMER_1,
+  LEDC_TIMER_2,
+  LEDC_TIMER_3,
+  LEDC_TIMER_MAX
+} ledc_timer_t;
+
+esp_err_t ledc_set_duty_with_hpoint(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty, uint32_t hpoint);
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel);
+esp_err_t ledc_timer_pause(ledc_mode_t mode, ledc_timer_t timer);
+esp_err_t ledc_timer_resume(ledc_mode_t mode, ledc_timer_t timer);
+esp_err_t ledc_timer_rst(ledc_mode_t mode, ledc_timer_t timer);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef HOST_ESP_ADC_CAL_H
+#define HOST_ESP_ADC_CAL_H
+
+#include <stdint.h>
+#include "driver/adc.h"
+
+// A straight line from 0 to 3300 mV, so a corrected reading comes out the
+// same as the raw one.  Which calibration the chip "has" is up to the test,
+// see host_set_adc_calibration().
+
+typedef enum {
+  ESP_ADC_CAL_VAL_EFUSE_VREF = 0,
+  ESP_ADC_CAL_VAL_EFUSE_TP = 1,
+  ESP_ADC_CAL_VAL_DEFAULT_VREF = 2,
+  ESP_ADC_CAL_VAL_EFUSE_TP_FIT = 3,
+  ESP_ADC_CAL_VAL_MAX,
+  ESP_ADC_CAL_VAL_NOT_SUPPORTED = ESP_ADC_CAL_VAL_MAX
+} esp_adc_cal_value_t;
+
+typedef struct {
+  adc_unit_t adc_num;
+  adc_atten_t atten;
+  adc_bits_width_t bit_width;
+  uint32_t coeff_a;
+  uint32_t coeff_b;
+  uint32_t vref;
+  const uint32_t* low_curve;
+  const uint32_t* high_curve;
+  uint8_t version;
+} esp_adc_cal_characteristics_t;
+
+esp_err_t esp_adc_cal_check_efuse(esp_adc_cal_value_t source);
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t unit, adc_atten_t atten, adc_bits_width_t width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t* characteristics);
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t raw, const esp_adc_cal_characteristics_t* characteristics);
+
+#endif
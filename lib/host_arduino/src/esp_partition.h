@@ -0,0 +1,44 @@
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// There's no flash on the host, so no partitions are ever found
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xFF
+} esp_partition_subtype_t;
+
+typedef struct {
+  void* flash_chip;
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+  bool encrypted;
+} esp_partition_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+typedef enum {
+  SPI_FLASH_MMAP_DATA,
+  SPI_FLASH_MMAP_INST
+} spi_flash_mmap_memory_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* buffer, size_t length);
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t length,
+                             spi_flash_mmap_memory_t memory, const void** mapped,
+                             spi_flash_mmap_handle_t* handle);
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_ESP_TASK_WDT_H
+#define HOST_ESP_TASK_WDT_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Nothing ever gets stuck long enough on the host to need this
+
+typedef void* TaskHandle_t;
+
+esp_err_t esp_task_wdt_init(uint32_t timeout_s, bool panic);
+esp_err_t esp_task_wdt_add(TaskHandle_t task);
+esp_err_t esp_task_wdt_delete(TaskHandle_t task);
+esp_err_t esp_task_wdt_reset();
+
+#endif
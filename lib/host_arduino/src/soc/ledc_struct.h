@@ -0,0 +1,27 @@
+#ifndef HOST_SOC_LEDC_STRUCT_H
+#define HOST_SOC_LEDC_STRUCT_H
+
+#include <stdint.h>
+
+// Only the timer counts, worked out from the made-up clock when they're
+// read.  Each read takes a little time, like a register read does, so a
+// loop that waits for the count to move gets there.
+
+struct host_ledc_count_t {
+  uint8_t timer;
+  operator uint32_t() const volatile;
+};
+
+typedef volatile struct ledc_dev_s {
+  struct {
+    struct {
+      struct {
+        host_ledc_count_t timer_cnt;
+      } value;
+    } timer[4];
+  } timer_group[1];
+} ledc_dev_t;
+
+extern ledc_dev_t LEDC;
+
+#endif
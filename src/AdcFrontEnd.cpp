@@ -0,0 +1,97 @@
+#include <Arduino.h>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+#include "AdcFrontEnd.h"
+#include "PwmPhase.h"
+
+/*
+Oversampling and calibration for the dial readings, see AdcFrontEnd.h.
+*/
+
+// The correction table has an entry every 16 raw counts, blended in between.
+// The curve is gentle, so that's as good as a full 4096-entry table at a
+// sixteenth of the size.
+const uint8_t ADC_TABLE_SHIFT = 4;
+const uint16_t ADC_TABLE_STEPS = 4096 >> ADC_TABLE_SHIFT;
+const uint16_t ADC_MAX_READING = 4095;
+
+static uint16_t adc_table[ADC_TABLE_STEPS + 1];
+static bool adc_ready = false;
+static uint16_t adc_configured_channels = 0;  // bit per ADC1 channel
+
+AdcCalibration adc_front_end_begin() {
+  esp_adc_cal_characteristics_t characteristics;
+  adc1_config_width(ADC_WIDTH_BIT_12);
+  esp_adc_cal_value_t source = esp_adc_cal_characterize(
+    ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &characteristics);
+
+  // Scale the millivolts so a full-scale reading still comes out as 4095.
+  // The ADC tops out a little under the 3.3V the dials go up to, and we
+  // want to straighten the curve, not change the dial range.
+  uint32_t full_scale_mv = esp_adc_cal_raw_to_voltage(ADC_MAX_READING, &characteristics);
+  if (full_scale_mv == 0) {
+    return AdcCalibration::NO_TABLE;
+  }
+  for (uint16_t i = 0; i <= ADC_TABLE_STEPS; i++) {
+    uint16_t raw = min(static_cast<uint16_t>(i << ADC_TABLE_SHIFT), ADC_MAX_READING);
+    uint32_t mv = esp_adc_cal_raw_to_voltage(raw, &characteristics);
+    adc_table[i] = min(mv * ADC_MAX_READING / full_scale_mv, static_cast<uint32_t>(ADC_MAX_READING));
+  }
+  adc_ready = true;
+  if (source == ESP_ADC_CAL_VAL_EFUSE_TP_FIT || source == ESP_ADC_CAL_VAL_EFUSE_TP ||
+      source == ESP_ADC_CAL_VAL_EFUSE_VREF) {
+    return AdcCalibration::FACTORY;
+  }
+  return AdcCalibration::DEFAULT_CURVE;
+}
+
+static uint16_t linearize(uint16_t raw) {
+  uint16_t index = raw >> ADC_TABLE_SHIFT;
+  int32_t fraction = raw & ((1 << ADC_TABLE_SHIFT) - 1);
+  return adc_table[index] + (((static_cast<int32_t>(adc_table[index + 1]) - adc_table[index]) *
+                             fraction) >> ADC_TABLE_SHIFT);
+}
+
+// The pin's ADC1 channel, set up for the full range, or -1 if it isn't one
+static int8_t adc1_channel_for(uint8_t pin) {
+  int8_t channel = digitalPinToAnalogChannel(pin);
+  if (!adc_ready || channel < 0 || channel >= ADC1_CHANNEL_MAX) {
+    return -1;
+  }
+  if (!(adc_configured_channels & (1 << channel))) {
+    adc1_config_channel_atten(static_cast<adc1_channel_t>(channel), ADC_ATTEN_DB_11);  // full 0-3.3V range
+    adc_configured_channels |= 1 << channel;
+  }
+  return channel;
+}
+
+uint16_t adc_front_end_read(uint8_t pin) {
+  int8_t channel = adc1_channel_for(pin);
+  if (channel < 0) {
+    return analogRead(pin);
+  }
+  adc1_channel_t adc_channel = static_cast<adc1_channel_t>(channel);
+
+  // Take the burst, sorting as we go, each reading clear of the PWM edges
+  uint16_t samples[ADC_OVERSAMPLE];
+  for (uint8_t i = 0; i < ADC_OVERSAMPLE; i++) {
+    pwm_phase_wait_quiet();
+    uint16_t sample = adc1_get_raw(adc_channel);
+    uint8_t j = i;
+    while (j > 0 && samples[j - 1] > sample) {
+      samples[j] = samples[j - 1];
+      j--;
+    }
+    samples[j] = sample;
+  }
+  return linearize(samples[ADC_OVERSAMPLE / 2]);
+}
+
+uint16_t adc_front_end_read_raw(uint8_t pin) {
+  int8_t channel = adc1_channel_for(pin);
+  if (channel < 0) {
+    return analogRead(pin);
+  }
+  pwm_phase_wait_quiet();
+  return adc1_get_raw(static_cast<adc1_channel_t>(channel));
+}
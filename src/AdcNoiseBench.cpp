@@ -0,0 +1,132 @@
+#ifdef LIGHT_BENCHMARK
+
+#include <Arduino.h>
+#include <algorithm>
+#include <math.h>
+#include <esp_system.h>
+#include "AdcFrontEnd.h"
+#include "AdcNoiseBench.h"
+#include "PwmPhase.h"
+
+/*
+Raw ADC noise against the PWM phase, see AdcNoiseBench.h.
+*/
+
+const uint16_t NOISE_SAMPLES = 2000;
+const uint8_t NOISE_LEVELS_PCT[] = {0, 10, 25, 50, 75, 100};
+const uint16_t NOISE_SPIKE_COUNTS = 50;
+const uint32_t NOISE_SETTLE_MS = 5;
+const uint8_t NOISE_PIN = A0;
+// The lead sweep, synced, at levels where the edges are spread through the cycle
+const uint8_t NOISE_LEADS_US[] = {0, 1, 2, 3, 4, 5, 6, 8};
+const uint8_t NOISE_LEAD_LEVELS_PCT[] = {25, 50, 75};
+
+struct NoiseWay {
+  const char* name;
+  bool stagger;
+  bool sync;
+};
+
+const NoiseWay NOISE_WAYS[] = {
+  {"aligned", false, false},
+  {"staggered", true, false},
+  {"synced", true, true},
+};
+
+static uint16_t noise_samples[NOISE_SAMPLES];
+
+static void set_lights(uint8_t percent) {
+  uint16_t duty = static_cast<uint32_t>(percent) * (LIGHT_PWM_PERIOD - 1) / 100;
+  for (uint8_t i = 0; i < LIGHT_PWM_CHANNELS; i++) {
+    pwm_phase_write(i, i, duty);
+  }
+  delay(NOISE_SETTLE_MS);
+}
+
+static void print_metric(const char* pattern, const char* metric, float value) {
+  Serial.print("QUALITY,");
+  Serial.print(pattern);
+  Serial.print(",");
+  Serial.print(metric);
+  Serial.print(",");
+  Serial.println(value, 4);
+}
+
+// Takes the readings, prints them under pattern, returns the standard deviation
+static float measure(const char* pattern) {
+  for (uint16_t i = 0; i < NOISE_SAMPLES; i++) {
+    // Somewhere random in the 50 us cycle, so reading in step with it
+    // can't make the unsynced ones look better than they are
+    delayMicroseconds(esp_random() % 50);
+    noise_samples[i] = adc_front_end_read_raw(NOISE_PIN);
+  }
+
+  float sum = 0;
+  for (uint16_t i = 0; i < NOISE_SAMPLES; i++) {
+    sum += noise_samples[i];
+  }
+  float mean = sum / NOISE_SAMPLES;
+  float squares = 0;
+  for (uint16_t i = 0; i < NOISE_SAMPLES; i++) {
+    squares += (noise_samples[i] - mean) * (noise_samples[i] - mean);
+  }
+  std::sort(noise_samples, noise_samples + NOISE_SAMPLES);
+  uint16_t median = noise_samples[NOISE_SAMPLES / 2];
+  uint16_t spikes = 0;
+  for (uint16_t i = 0; i < NOISE_SAMPLES; i++) {
+    if (abs(static_cast<int32_t>(noise_samples[i]) - median) > NOISE_SPIKE_COUNTS) {
+      spikes++;
+    }
+  }
+
+  float sd = sqrtf(squares / NOISE_SAMPLES);
+  print_metric(pattern, "sd", sd);
+  print_metric(pattern, "p2p", noise_samples[NOISE_SAMPLES - 1] - noise_samples[0]);
+  print_metric(pattern, "spike_pct", 100.0f * spikes / NOISE_SAMPLES);
+  return sd;
+}
+
+// How far ahead of the sampling the quiet check should look.  The built-in
+// lead is a guess at how long adc1_get_raw() takes to sample, this is the
+// board's answer: whichever lead comes out quietest over the levels.
+static void sweep_leads() {
+  pwm_phase_configure(true, true);
+  float quietest_sd = 0;
+  uint8_t quietest_us = 0;
+  for (uint8_t lead_us : NOISE_LEADS_US) {
+    pwm_phase_set_adc_lead_us(lead_us);
+    float sd = 0;
+    for (uint8_t percent : NOISE_LEAD_LEVELS_PCT) {
+      set_lights(percent);
+      char pattern[32];
+      snprintf(pattern, sizeof(pattern), "adc_noise_lead%uus_%u", lead_us, percent);
+      sd += measure(pattern);
+    }
+    if (lead_us == NOISE_LEADS_US[0] || sd < quietest_sd) {
+      quietest_sd = sd;
+      quietest_us = lead_us;
+    }
+  }
+  pwm_phase_reset_adc_lead();
+  print_metric("adc_noise_lead", "quietest_us", quietest_us);
+}
+
+///////////////////////////////////////////////////////////
+
+void run_adc_noise_benchmarks() {
+  pwm_phase_begin();
+  for (const NoiseWay &way : NOISE_WAYS) {
+    pwm_phase_configure(way.stagger, way.sync);
+    for (uint8_t percent : NOISE_LEVELS_PCT) {
+      // The staggering goes in with the write
+      set_lights(percent);
+      char pattern[32];
+      snprintf(pattern, sizeof(pattern), "adc_noise_%s_%u", way.name, percent);
+      measure(pattern);
+    }
+  }
+  sweep_leads();
+  set_lights(0);
+}
+
+#endif
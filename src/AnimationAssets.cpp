@@ -0,0 +1,177 @@
+#include <Arduino.h>
+#include <esp_rom_crc.h>
+#include "AnimationAssets.h"
+
+/*
+Reading animations straight out of mapped flash, see AnimationAssets.h.
+*/
+
+static_assert(sizeof(AssetHeader) == 16, "AssetHeader has to match tools/pack_assets.py");
+static_assert(sizeof(AssetEntry) == 32, "AssetEntry has to match tools/pack_assets.py");
+static_assert(sizeof(AssetFrame) == 6, "AssetFrame has to match tools/pack_assets.py");
+static_assert(sizeof(AssetKeyframe) == 12, "AssetKeyframe has to match tools/pack_assets.py");
+
+// a + (b - a) * fraction, for one channel, with the fraction in Q16
+static inline uint16_t blend(uint16_t a, uint16_t b, uint32_t fraction) {
+  return a + ((static_cast<int64_t>(b - a) * fraction) >> 16);
+}
+
+static inline void blend_color(uint16_t red_a, uint16_t green_a, uint16_t blue_a,
+                               uint16_t red_b, uint16_t green_b, uint16_t blue_b,
+                               uint32_t part, uint32_t whole, RgbColor &color) {
+  // One divide for all three, 64-bit since keyframes can be many minutes apart
+  uint32_t fraction = (static_cast<uint64_t>(part) << 16) / whole;
+  color.red = blend(red_a, red_b, fraction);
+  color.green = blend(green_a, green_b, fraction);
+  color.blue = blend(blue_a, blue_b, fraction);
+}
+
+AnimationAssets::AnimationAssets()
+  : _image(nullptr), _entries(nullptr), _count(0), _mmap_handle(0) {
+}
+
+bool AnimationAssets::begin() {
+  const esp_partition_t* partition = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(ASSET_PARTITION_SUBTYPE), "assets");
+  if (partition == nullptr) {
+    Serial.println("No assets partition, no animations");
+    return false;
+  }
+
+  // Just the header first, to see how much to map
+  AssetHeader header;
+  if (esp_partition_read(partition, 0, &header, sizeof(header)) != ESP_OK ||
+      header.magic != ASSET_MAGIC || header.size < sizeof(header) || header.size > partition->size) {
+    Serial.println("Assets partition is empty, no animations");
+    return false;
+  }
+  const void* mapped = nullptr;
+  if (esp_partition_mmap(partition, 0, header.size, SPI_FLASH_MMAP_DATA, &mapped, &_mmap_handle) != ESP_OK) {
+    Serial.println("Couldn't map the assets partition");
+    return false;
+  }
+  if (!open(static_cast<const uint8_t*>(mapped), header.size)) {
+    Serial.println("Assets image doesn't check out, rebuild it with tools/pack_assets.py");
+    spi_flash_munmap(_mmap_handle);
+    return false;
+  }
+  Serial.print("Animations: ");
+  Serial.println(_count);
+  return true;
+}
+
+bool AnimationAssets::open(const uint8_t* image, uint32_t size) {
+  _image = nullptr;
+  _entries = nullptr;
+  _count = 0;
+
+  const AssetHeader* header = reinterpret_cast<const AssetHeader*>(image);
+  if (size < sizeof(AssetHeader) || header->magic != ASSET_MAGIC ||
+      header->version != ASSET_VERSION || header->size != size) {
+    return false;
+  }
+  if (sizeof(AssetHeader) + header->count * sizeof(AssetEntry) > size) {
+    return false;
+  }
+  if (esp_rom_crc32_le(0, image + sizeof(AssetHeader), size - sizeof(AssetHeader)) != header->crc) {
+    return false;
+  }
+
+  // Check every entry once here, so sample() doesn't have to
+  const AssetEntry* entries = reinterpret_cast<const AssetEntry*>(image + sizeof(AssetHeader));
+  for (uint16_t i = 0; i < header->count; i++) {
+    const AssetEntry &entry = entries[i];
+    uint32_t item_size = 0;
+    if (entry.kind == static_cast<uint8_t>(AssetKind::FRAMES) && entry.frame_ms > 0) {
+      item_size = sizeof(AssetFrame);
+    } else if (entry.kind == static_cast<uint8_t>(AssetKind::KEYFRAMES)) {
+      item_size = sizeof(AssetKeyframe);
+    }
+    if (item_size == 0 || entry.count == 0 || entry.duration_ms == 0 || (entry.offset & 3) != 0 ||
+        entry.offset > size || entry.count > (size - entry.offset) / item_size) {
+      return false;
+    }
+    if (entry.kind == static_cast<uint8_t>(AssetKind::KEYFRAMES)) {
+      const AssetKeyframe* keyframes = reinterpret_cast<const AssetKeyframe*>(image + entry.offset);
+      for (uint32_t k = 0; k < entry.count; k++) {
+        if (keyframes[k].time_ms > entry.duration_ms ||
+            (k > 0 && keyframes[k].time_ms < keyframes[k - 1].time_ms)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  _image = image;
+  _entries = entries;
+  _count = header->count;
+  return true;
+}
+
+int16_t AnimationAssets::find(const char* name) const {
+  for (uint16_t i = 0; i < _count; i++) {
+    if (strncmp(_entries[i].name, name, ASSET_NAME_LENGTH) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void AnimationAssets::sample(uint16_t index, uint32_t time_ms, RgbColor &color) const {
+  const AssetEntry &entry = _entries[index];
+  bool loop = entry.flags & ASSET_FLAG_LOOP;
+  uint32_t t = loop ? time_ms % entry.duration_ms : min(time_ms, entry.duration_ms);
+
+  if (entry.kind == static_cast<uint8_t>(AssetKind::FRAMES)) {
+    // Blend from this frame into the next, like the stream player does
+    const AssetFrame* frames = reinterpret_cast<const AssetFrame*>(_image + entry.offset);
+    uint32_t frame = t / entry.frame_ms;
+    if (frame >= entry.count) {
+      frame = entry.count - 1;
+      t = frame * entry.frame_ms;
+    }
+    uint32_t next = frame + 1 < entry.count ? frame + 1 : (loop ? 0 : frame);
+    const AssetFrame &a = frames[frame];
+    const AssetFrame &b = frames[next];
+    blend_color(a.red, a.green, a.blue, b.red, b.green, b.blue,
+                t - frame * entry.frame_ms, entry.frame_ms, color);
+    return;
+  }
+
+  // Keyframes: find the last one at or before t, by halves
+  const AssetKeyframe* keyframes = reinterpret_cast<const AssetKeyframe*>(_image + entry.offset);
+  if (t < keyframes[0].time_ms) {
+    color.red = keyframes[0].red;
+    color.green = keyframes[0].green;
+    color.blue = keyframes[0].blue;
+    return;
+  }
+  uint32_t low = 0;
+  uint32_t high = entry.count;
+  while (high - low > 1) {
+    uint32_t middle = (low + high) / 2;
+    if (keyframes[middle].time_ms <= t) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  const AssetKeyframe &a = keyframes[low];
+  if (low + 1 < entry.count) {
+    const AssetKeyframe &b = keyframes[low + 1];
+    uint32_t span = b.time_ms - a.time_ms;
+    if (span > 0) {
+      blend_color(a.red, a.green, a.blue, b.red, b.green, b.blue, t - a.time_ms, span, color);
+      return;
+    }
+  } else if (loop && entry.duration_ms > a.time_ms) {
+    // Fade from the last keyframe back into the first over what's left
+    const AssetKeyframe &b = keyframes[0];
+    blend_color(a.red, a.green, a.blue, b.red, b.green, b.blue,
+                t - a.time_ms, entry.duration_ms - a.time_ms, color);
+    return;
+  }
+  color.red = a.red;
+  color.green = a.green;
+  color.blue = a.blue;
+}
@@ -0,0 +1,270 @@
+#include <Arduino.h>
+#include <driver/adc.h>
+#include "AudioAnalyzer.h"
+
+/*
+Audio band analysis, see AudioAnalyzer.h for the big picture.
+
+Band levels come out on a log scale with an automatic gain: each band
+remembers the loudest it has been recently (slowly forgetting), and the
+light level is how close the current block is to that peak.  That way it
+works for quiet background music and for a dance party without anyone
+having to turn a knob.
+
+Each band turning itself up on its own would also turn up whatever leaks
+in from a loud neighbour, so two things keep the bands apart.  The blocks
+are windowed (Hann) before the filters, which cuts a filter's hearing of
+faraway frequencies from a little to practically nothing.  And a band is
+never brighter than it is loud next to the loudest band, on the same scale
+as the gain, so a band well below the loudest one stays dark.
+*/
+
+// The frequencies we listen for in each band.  Each Goertzel filter only
+// hears about 30 Hz around its frequency, so we spread a few across a band.
+static const uint16_t band_frequencies_hz[AUDIO_BAND_COUNT][AUDIO_FILTERS_PER_BAND] = {
+  {50, 80, 125, 200},       // bass -> red
+  {400, 700, 1000, 1500},   // mid -> green
+  {2000, 2500, 3000, 3500}  // treble -> blue
+};
+
+// Log-scale settings, all in Q8 log2 of the Goertzel power
+const int32_t AUDIO_LEVEL_RANGE = 12 * 256;  // about 36 dB from dark to full
+const int32_t AUDIO_MIN_PEAK = 24 * 256;     // don't turn up the gain on silence (windowed)
+const int32_t AUDIO_PEAK_DECAY = 8;          // per block, roughly 3 dB per second
+const uint16_t AUDIO_LEVEL_RELEASE = 64;     // per block, dims over about half a second
+
+// DMA buffer for one read, 4 bytes per sample on the ESP32-S3
+const uint16_t AUDIO_READ_BYTES = 256;
+
+// How long begin() waits for the first samples
+const uint32_t AUDIO_FIRST_READ_MS = 100;
+
+static portMUX_TYPE audio_levels_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Hann window over a block, Q14, filled in by the first analyzer made
+static int16_t hann_window[AUDIO_BLOCK_SAMPLES];
+
+// log2 in Q8, good enough for turning power into a brightness
+static int32_t log2_q8(uint64_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  int32_t exponent = 63 - __builtin_clzll(value);
+  // The 8 bits after the leading one make a decent linear approximation
+  uint32_t fraction = static_cast<uint32_t>((value << (63 - exponent)) >> 55) & 0xFF;
+  return exponent * 256 + fraction;
+}
+
+///////////////////////////////////////////////////////////
+// Goertzel filter
+///////////////////////////////////////////////////////////
+
+GoertzelFilter::GoertzelFilter()
+  : _coeff(0),
+    _s1(0),
+    _s2(0) {
+}
+
+void GoertzelFilter::set_frequency(uint16_t frequency_hz, uint32_t sample_rate_hz) {
+  // Only done once at startup, so floating point is fine here
+  _coeff = static_cast<int32_t>(2.0 * cos(2.0 * M_PI * frequency_hz / sample_rate_hz) * (1 << 14));
+}
+
+uint64_t GoertzelFilter::finish_block() {
+  // power = s1^2 + s2^2 - coeff*s1*s2
+  int64_t s1 = _s1;
+  int64_t s2 = _s2;
+  int64_t power = s1 * s1 + s2 * s2 - ((((_coeff * s1) >> 14)) * s2);
+  _s1 = 0;
+  _s2 = 0;
+  return power > 0 ? static_cast<uint64_t>(power) : 0;
+}
+
+///////////////////////////////////////////////////////////
+// Analyzer
+///////////////////////////////////////////////////////////
+
+AudioAnalyzer::AudioAnalyzer(uint8_t pin, uint32_t sample_rate_hz)
+  : _pin(pin),
+    _sample_rate_hz(sample_rate_hz),
+    _running(false),
+    _dc_level(2048 << 8),
+    _samples_in_block(0),
+    _blocks_analyzed(0) {
+  for (uint8_t band = 0; band < AUDIO_BAND_COUNT; band++) {
+    for (uint8_t i = 0; i < AUDIO_FILTERS_PER_BAND; i++) {
+      _filters[band][i].set_frequency(band_frequencies_hz[band][i], _sample_rate_hz);
+    }
+    _peak_log[band] = AUDIO_MIN_PEAK;
+    _levels[band] = 0;
+  }
+  // Only done once at startup, so floating point is fine here too
+  if (hann_window[AUDIO_BLOCK_SAMPLES / 2] == 0) {
+    for (uint16_t i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+      hann_window[i] = static_cast<int16_t>((0.5 - 0.5 * cos(2.0 * M_PI * i / AUDIO_BLOCK_SAMPLES)) * (1 << 14));
+    }
+  }
+}
+
+bool AudioAnalyzer::begin() {
+  if (_running) {
+    return true;
+  }
+  // Arduino numbers the ADC2 channels after the ADC1 ones
+  int8_t analog_channel = digitalPinToAnalogChannel(_pin);
+  if (analog_channel < 0) {
+    Serial.println("Audio pin is not an analog pin!");
+    return false;
+  }
+  bool second_unit = analog_channel >= SOC_ADC_MAX_CHANNEL_NUM;
+  uint8_t channel = analog_channel % SOC_ADC_MAX_CHANNEL_NUM;
+
+  adc_digi_init_config_t init_config = {};
+  init_config.max_store_buf_size = 4 * AUDIO_READ_BYTES;
+  init_config.conv_num_each_intr = AUDIO_READ_BYTES;
+  init_config.adc1_chan_mask = second_unit ? 0 : BIT(channel);
+  init_config.adc2_chan_mask = second_unit ? BIT(channel) : 0;
+  if (adc_digi_initialize(&init_config) != ESP_OK) {
+    Serial.println("Audio ADC DMA init failed");
+    return false;
+  }
+
+  adc_digi_pattern_config_t pattern = {};
+  pattern.atten = ADC_ATTEN_DB_11;  // full 0-3.3V range
+  pattern.channel = channel;
+  pattern.unit = second_unit ? 1 : 0;
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+  adc_digi_configuration_t config = {};
+  config.conv_limit_en = false;
+  config.conv_limit_num = 250;
+  config.pattern_num = 1;
+  config.adc_pattern = &pattern;
+  config.sample_freq_hz = _sample_rate_hz;
+  config.conv_mode = second_unit ? ADC_CONV_SINGLE_UNIT_2 : ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+  if (adc_digi_controller_configure(&config) != ESP_OK || adc_digi_start() != ESP_OK) {
+    Serial.println("Audio ADC DMA start failed");
+    adc_digi_deinitialize();
+    return false;
+  }
+
+  // The second unit in continuous mode isn't supported on the S3 (see
+  // AudioAnalyzer.h), so check the first samples at least come from our pin
+  uint8_t buffer[AUDIO_READ_BYTES];
+  uint32_t bytes_read = 0;
+  esp_err_t result = adc_digi_read_bytes(buffer, sizeof(buffer), &bytes_read, AUDIO_FIRST_READ_MS);
+  bool samples_ok = (result == ESP_OK || result == ESP_ERR_INVALID_STATE) && bytes_read >= SOC_ADC_DIGI_RESULT_BYTES;
+  for (uint32_t i = 0; samples_ok && i + SOC_ADC_DIGI_RESULT_BYTES <= bytes_read; i += SOC_ADC_DIGI_RESULT_BYTES) {
+    adc_digi_output_data_t* sample = reinterpret_cast<adc_digi_output_data_t*>(buffer + i);
+    samples_ok = sample->type2.unit == pattern.unit && sample->type2.channel == channel;
+  }
+  if (!samples_ok) {
+    Serial.println("Audio ADC DMA gave no usable samples");
+    adc_digi_stop();
+    adc_digi_deinitialize();
+    return false;
+  }
+
+  // Core 0, leaving core 1 to the Arduino loop()
+  _running = xTaskCreatePinnedToCore(task_entry, "audio", 4096, this, 2, nullptr, 0) == pdPASS;
+  return _running;
+}
+
+void AudioAnalyzer::task_entry(void* analyzer) {
+  static_cast<AudioAnalyzer*>(analyzer)->run();
+}
+
+void AudioAnalyzer::run() {
+  uint8_t buffer[AUDIO_READ_BYTES];
+  while (true) {
+    uint32_t bytes_read = 0;
+    // Blocks until the DMA has a buffer for us
+    esp_err_t result = adc_digi_read_bytes(buffer, sizeof(buffer), &bytes_read, ADC_MAX_DELAY);
+    if (result != ESP_OK && result != ESP_ERR_INVALID_STATE) {
+      // ESP_ERR_INVALID_STATE just means we fell behind and lost some
+      // samples, which only costs us a slightly short block
+      continue;
+    }
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= bytes_read; i += SOC_ADC_DIGI_RESULT_BYTES) {
+      adc_digi_output_data_t* sample = reinterpret_cast<adc_digi_output_data_t*>(buffer + i);
+      add_sample(sample->type2.data);
+    }
+  }
+}
+
+void AudioAnalyzer::add_sample(int32_t sample) {
+  // Take out the microphone's DC bias with a slow running average
+  _dc_level += ((sample << 8) - _dc_level) >> 10;
+  int32_t centered = sample - (_dc_level >> 8);
+  int32_t windowed = (centered * hann_window[_samples_in_block]) >> 14;
+
+  for (uint8_t band = 0; band < AUDIO_BAND_COUNT; band++) {
+    for (uint8_t i = 0; i < AUDIO_FILTERS_PER_BAND; i++) {
+      _filters[band][i].add_sample(windowed);
+    }
+  }
+  if (++_samples_in_block == AUDIO_BLOCK_SAMPLES) {
+    finish_block();
+    _samples_in_block = 0;
+  }
+}
+
+void AudioAnalyzer::finish_block() {
+  int32_t loudness_of[AUDIO_BAND_COUNT];
+  int32_t loudest = 0;
+  for (uint8_t band = 0; band < AUDIO_BAND_COUNT; band++) {
+    uint64_t power = 0;
+    for (uint8_t i = 0; i < AUDIO_FILTERS_PER_BAND; i++) {
+      power += _filters[band][i].finish_block();
+    }
+    loudness_of[band] = log2_q8(power);
+    loudest = max(loudest, loudness_of[band]);
+  }
+
+  uint16_t new_levels[AUDIO_BAND_COUNT];
+  for (uint8_t band = 0; band < AUDIO_BAND_COUNT; band++) {
+    int32_t loudness = loudness_of[band];
+
+    // Automatic gain: jump up to new peaks, slowly forget old ones
+    if (loudness > _peak_log[band]) {
+      _peak_log[band] = loudness;
+    } else {
+      _peak_log[band] = max(_peak_log[band] - AUDIO_PEAK_DECAY, AUDIO_MIN_PEAK);
+    }
+
+    int32_t level = (loudness - (_peak_log[band] - AUDIO_LEVEL_RANGE)) * 1023 / AUDIO_LEVEL_RANGE;
+    // And no brighter than it is loud next to the loudest band
+    int32_t gate = (loudness - (loudest - AUDIO_LEVEL_RANGE)) * 1023 / AUDIO_LEVEL_RANGE;
+    level = constrain(min(level, gate), 0, 1023);
+    // Light up instantly, dim gently, otherwise it looks like a strobe
+    if (level < _levels[band] - AUDIO_LEVEL_RELEASE) {
+      level = _levels[band] - AUDIO_LEVEL_RELEASE;
+    }
+    new_levels[band] = level;
+  }
+
+  portENTER_CRITICAL(&audio_levels_mux);
+  for (uint8_t band = 0; band < AUDIO_BAND_COUNT; band++) {
+    _levels[band] = new_levels[band];
+  }
+  _blocks_analyzed++;
+  portEXIT_CRITICAL(&audio_levels_mux);
+}
+
+void AudioAnalyzer::get_levels(uint16_t &bass, uint16_t &mid, uint16_t &treble) {
+  portENTER_CRITICAL(&audio_levels_mux);
+  bass = _levels[static_cast<uint8_t>(AudioBand::BASS)];
+  mid = _levels[static_cast<uint8_t>(AudioBand::MID)];
+  treble = _levels[static_cast<uint8_t>(AudioBand::TREBLE)];
+  portEXIT_CRITICAL(&audio_levels_mux);
+}
+
+unsigned long AudioAnalyzer::blocks_analyzed() const {
+  // Only 32 bits, but the analysis task bumps it under the lock along
+  // with the levels, so read it the same way
+  portENTER_CRITICAL(&audio_levels_mux);
+  unsigned long blocks = _blocks_analyzed;
+  portEXIT_CRITICAL(&audio_levels_mux);
+  return blocks;
+}
@@ -0,0 +1,420 @@
+#ifdef LIGHT_BENCHMARK
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include "Benchmark.h"
+#include "AdcNoiseBench.h"
+#include "AnimationAssets.h"
+#include "Clock.h"
+#include "ColorMath.h"
+#include "DebounceInput.h"
+#include "FlightRecorder.h"
+#include "LightVM.h"
+#include "OutputController.h"
+#include "QualityBench.h"
+#include "SeqLock.h"
+
+/*
+On-device microbenchmarks, see Benchmark.h.
+*/
+
+const uint8_t BENCH_SAMPLES = 101;  // odd, so there's a middle one
+const uint16_t BENCH_WARMUP_CALLS = 50;  // fill the caches and settle the filters
+const uint32_t BENCH_SEQLOCK_READS = 200000;  // a few hundred milliseconds
+
+typedef void (*BenchCall)(uint16_t i);
+
+// The things being timed.  Globals so the calls themselves stay tiny.
+static SmoothAnalogInput* bench_pot;
+static OneEuroAnalogInput* bench_one_euro_pot;
+static MedianSmoothAnalogInput* bench_median_pot;
+static DebounceInput* bench_button;
+static ProgramState* bench_state;
+static OutputController* bench_output;
+static HueBrightness* bench_hue_brightness;
+static SeqLock<InputSnapshot>* bench_seqlock;
+static LightVM* bench_vm;
+static AnimationAssets* bench_assets;
+static int16_t bench_frames_index;
+static int16_t bench_keyframes_index;
+static const esp_partition_t* bench_assets_partition;
+static InputSnapshot bench_inputs;
+static volatile bool bench_writer_done;
+static volatile uint32_t bench_sink;  // keeps results from being optimized out
+
+// Time one call with the cycle counter
+static uint32_t time_call(BenchCall call, uint16_t i) {
+  uint32_t start = ESP.getCycleCount();
+  call(i);
+  return ESP.getCycleCount() - start;
+}
+
+static void sort_samples(uint32_t* samples, uint8_t count) {
+  // Insertion sort, it's only a hundred numbers
+  for (uint8_t i = 1; i < count; i++) {
+    uint32_t value = samples[i];
+    uint8_t j = i;
+    while (j > 0 && samples[j - 1] > value) {
+      samples[j] = samples[j - 1];
+      j--;
+    }
+    samples[j] = value;
+  }
+}
+
+// Time a call over and over, and print the results less the timing overhead
+// Returns the median
+static uint32_t run_one(const char* name, BenchCall call, uint32_t overhead, bool wait_for_tick = false) {
+  uint32_t samples[BENCH_SAMPLES];
+  for (uint16_t i = 0; i < BENCH_WARMUP_CALLS; i++) {
+    call(i);
+  }
+  for (uint8_t i = 0; i < BENCH_SAMPLES; i++) {
+    if (wait_for_tick) {
+      // So the dial is due for a real reading every time
+      unsigned long now = millis();
+      while (millis() == now) {
+      }
+    }
+    uint32_t cycles = time_call(call, BENCH_WARMUP_CALLS + i);
+    samples[i] = cycles > overhead ? cycles - overhead : 0;
+  }
+  sort_samples(samples, BENCH_SAMPLES);
+
+  Serial.print("BENCH,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.print(BENCH_SAMPLES);
+  Serial.print(",");
+  Serial.print(samples[0]);
+  Serial.print(",");
+  Serial.println(samples[BENCH_SAMPLES / 2]);
+  return samples[BENCH_SAMPLES / 2];
+}
+
+///////////////////////////////////////////////////////////
+// The calls being timed
+///////////////////////////////////////////////////////////
+
+static void call_nothing(uint16_t i) {
+  bench_sink = i;
+}
+
+// A dial sitting still, with a count or so of ADC noise
+static void call_pot_steady(uint16_t i) {
+  bench_pot->add_reading(2000 + (i & 1), 1000);
+}
+
+// A dial being turned at a steady pace
+static void call_pot_ramp(uint16_t i) {
+  bench_pot->add_reading((i * 2) & 0xFFF, 1000);
+}
+
+// A noisy dial, with a big spike every so often
+static void call_pot_spikes(uint16_t i) {
+  bench_pot->add_reading(i % 10 == 0 ? 2800 : 2000 + (i & 3), 1000);
+}
+
+// The other filters, same patterns
+static void call_one_euro_ramp(uint16_t i) {
+  bench_one_euro_pot->add_reading((i * 2) & 0xFFF, 1000);
+}
+
+static void call_median_spikes(uint16_t i) {
+  bench_median_pot->add_reading(i % 10 == 0 ? 2800 : 2000 + (i & 3), 1000);
+}
+
+// The whole update, ADC read and all
+static void call_pot_update(uint16_t i) {
+  bench_sink = bench_pot->update();
+}
+
+static void call_debounce_update(uint16_t i) {
+  bench_sink = bench_button->update();
+}
+
+static void call_handle_sleep(uint16_t i) {
+  bench_sink = bench_state->handle_sleep(false);
+}
+
+static void call_set_rainbow(uint16_t i) {
+  bench_output->set_rainbow(static_cast<unsigned long>(i) * 7);
+}
+
+static void call_hsv_to_rgb(uint16_t i) {
+  HsvColor hsv = {static_cast<uint16_t>((i * 37) % HUE_STEPS), 200, 40000};
+  bench_sink = hsv_to_rgb(hsv).green;
+}
+
+static void call_hue_brightness(uint16_t i) {
+  HsvColor hsv = {static_cast<uint16_t>((i * 37) % HUE_STEPS), 200, 40000};
+  bench_sink = bench_hue_brightness->to_rgb(hsv).green;
+}
+
+// Has to stay under a microsecond, it's on every mode change and button
+static void call_flight_record(uint16_t i) {
+  flight_record(FlightEventType::BUTTON, i & 7, i & 1);
+}
+
+// A short program, the red dial straight to the red light
+static const uint8_t BENCH_VM_DIAL_PROGRAM[] = {
+  static_cast<uint8_t>(Op::DIAL), 0,
+  static_cast<uint8_t>(Op::PUSH8), 4,
+  static_cast<uint8_t>(Op::DIV),
+  static_cast<uint8_t>(Op::PUSH8), 0,
+  static_cast<uint8_t>(Op::PUSH8), 0,
+  static_cast<uint8_t>(Op::RGB),
+  static_cast<uint8_t>(Op::END)
+};
+
+// Counts up forever, so every pass runs the whole budget
+static const uint8_t BENCH_VM_SPIN_PROGRAM[] = {
+  static_cast<uint8_t>(Op::LOAD), 0,
+  static_cast<uint8_t>(Op::PUSH8), 1,
+  static_cast<uint8_t>(Op::ADD),
+  static_cast<uint8_t>(Op::STORE), 0,
+  static_cast<uint8_t>(Op::JMP), 0, 0
+};
+
+static void call_vm_dial(uint16_t i) {
+  bench_inputs.dial_value[0] = i & 0xFFF;
+  bench_sink = bench_vm->run(0, bench_inputs, i);
+}
+
+static void call_vm_spin(uint16_t i) {
+  bench_sink = bench_vm->run(1, bench_inputs, i);
+}
+
+// Animation frames in order, as they're played
+static void call_asset_frame_in_order(uint16_t i) {
+  RgbColor color;
+  const AssetEntry &entry = bench_assets->entry(bench_frames_index);
+  bench_assets->sample(bench_frames_index, static_cast<uint32_t>(i) * entry.frame_ms, color);
+  bench_sink = color.red;
+}
+
+// Jumping all over, so most reads miss the flash cache
+static void call_asset_frame_scattered(uint16_t i) {
+  RgbColor color;
+  const AssetEntry &entry = bench_assets->entry(bench_frames_index);
+  uint32_t frame = (static_cast<uint32_t>(i) * 2654435761u) % entry.count;
+  bench_assets->sample(bench_frames_index, frame * entry.frame_ms, color);
+  bench_sink = color.red;
+}
+
+// The same frame, copied out with a flash read instead of mapped
+static void call_asset_frame_copied(uint16_t i) {
+  const AssetEntry &entry = bench_assets->entry(bench_frames_index);
+  uint32_t frame = (static_cast<uint32_t>(i) * 2654435761u) % entry.count;
+  AssetFrame copy;
+  esp_partition_read(bench_assets_partition, entry.offset + frame * sizeof(AssetFrame), &copy, sizeof(copy));
+  bench_sink = copy.red;
+}
+
+static void call_asset_keyframe(uint16_t i) {
+  RgbColor color;
+  const AssetEntry &entry = bench_assets->entry(bench_keyframes_index);
+  bench_assets->sample(bench_keyframes_index, (static_cast<uint32_t>(i) * 7919) % entry.duration_ms, color);
+  bench_sink = color.red;
+}
+
+static void call_seqlock_read(uint16_t i) {
+  InputSnapshot snapshot;
+  bench_sink = bench_seqlock->read(snapshot);
+}
+
+///////////////////////////////////////////////////////////
+// Torn read check for the snapshot hand-off between the cores
+///////////////////////////////////////////////////////////
+
+// Every field comes from the same counter, so a snapshot that's half
+// one write and half another is easy to spot
+static void fill_check_snapshot(InputSnapshot &snapshot, uint32_t count) {
+  snapshot.pass = count;
+  snapshot.taken_us = ~count;
+  for (uint8_t i = 0; i < DIAL_COUNT; i++) {
+    snapshot.dial_speed[i] = static_cast<float>(count & 0xFFFF);
+    snapshot.dial_velocity[i] = static_cast<float>(count >> 16);
+    snapshot.dial_value[i] = count;
+    snapshot.dial_fine[i] = count >> 1;
+  }
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    snapshot.presses[i] = count;
+    snapshot.releases[i] = count >> 8;
+  }
+  snapshot.buttons_down = count;
+  snapshot.motion_sensors = count >> 3;
+  snapshot.occupied = count & 1;
+}
+
+static bool check_snapshot_whole(const InputSnapshot &snapshot) {
+  InputSnapshot expected;
+  memset(&expected, 0, sizeof(expected));
+  fill_check_snapshot(expected, snapshot.pass);
+  return memcmp(&expected, &snapshot, sizeof(snapshot)) == 0;
+}
+
+// Writes as fast as it can on core 0 until the reader is done
+static void seqlock_writer(void* unused) {
+  InputSnapshot snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  uint32_t count = 0;
+  while (!bench_writer_done) {
+    fill_check_snapshot(snapshot, ++count);
+    bench_seqlock->write(snapshot);
+    if ((count & 0x3FF) == 0) {
+      taskYIELD();
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+// Read from this core while the other one writes, and count bad copies
+// Returns how many checks failed
+static uint32_t check_seqlock() {
+  // Start from a whole one, the empty lock isn't a counter snapshot
+  InputSnapshot snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  fill_check_snapshot(snapshot, 0);
+  bench_seqlock->write(snapshot);
+
+  bench_writer_done = false;
+  if (xTaskCreatePinnedToCore(seqlock_writer, "bench_writer", 2048, nullptr, 1, nullptr, 0) != pdPASS) {
+    Serial.println("BENCH_CHECK,seqlock_torn_reads,0,1");
+    return 1;
+  }
+  uint32_t torn = 0;
+  uint32_t retries = 0;
+  for (uint32_t i = 0; i < BENCH_SEQLOCK_READS; i++) {
+    retries += bench_seqlock->read(snapshot);
+    if (!check_snapshot_whole(snapshot)) {
+      torn++;
+    }
+  }
+  bench_writer_done = true;
+  delay(10);  // let the writer finish up
+
+  Serial.print("BENCH_CHECK,seqlock_torn_reads,");
+  Serial.print(BENCH_SEQLOCK_READS);
+  Serial.print(",");
+  Serial.println(torn);
+  Serial.print("BENCH_INFO,seqlock_retries,");
+  Serial.println(retries);
+  return torn > 0 ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////
+
+uint32_t run_benchmarks(const ProgramState &state, OutputController &output) {
+  // Give the computer a moment to open the port, so nothing is missed
+  while (!Serial && millis() < 5000) {
+    delay(10);
+  }
+  Serial.println("BENCH_START");
+
+  // Our own copy, so the real program state isn't touched.  The output
+  // controller is the only one (a second would set up the same PWM
+  // channels again), and it never starts its dithering timer, only the
+  // quality checks tick it by hand (and light up the lights for a few seconds).
+  static ProgramState local_state;
+  local_state = state;
+  static HueBrightness local_hue_brightness;
+  static SmoothAnalogInput local_pot(A0);
+  static OneEuroAnalogInput local_one_euro_pot(A0);
+  static MedianSmoothAnalogInput local_median_pot(A0);
+  static DebounceInput local_button(D12, "bench");
+  static SeqLock<InputSnapshot> local_seqlock;
+  static LightVM local_vm;
+  static AnimationAssets local_assets;
+  bench_state = &local_state;
+  bench_output = &output;
+  bench_hue_brightness = &local_hue_brightness;
+  bench_pot = &local_pot;
+  bench_one_euro_pot = &local_one_euro_pot;
+  bench_median_pot = &local_median_pot;
+  bench_button = &local_button;
+  bench_seqlock = &local_seqlock;
+  bench_vm = &local_vm;
+  bench_assets = &local_assets;
+  memset(&bench_inputs, 0, sizeof(bench_inputs));
+
+  // How long an empty call takes to time, taken off everything else
+  uint32_t samples[BENCH_SAMPLES];
+  for (uint8_t i = 0; i < BENCH_SAMPLES; i++) {
+    samples[i] = time_call(call_nothing, i);
+  }
+  sort_samples(samples, BENCH_SAMPLES);
+  uint32_t overhead = samples[0];
+
+  run_one("smooth_filter_steady", call_pot_steady, overhead);
+  run_one("smooth_filter_ramp", call_pot_ramp, overhead);
+  run_one("smooth_filter_spikes", call_pot_spikes, overhead);
+  run_one("one_euro_filter_ramp", call_one_euro_ramp, overhead);
+  run_one("median_filter_spikes", call_median_spikes, overhead);
+  run_one("smooth_update_read", call_pot_update, overhead, true);
+  run_one("smooth_update_skip", call_pot_update, overhead);
+  run_one("debounce_update", call_debounce_update, overhead);
+
+  // Awake with recent motion, then asleep
+  local_state.update_mode(Mode::RGB);
+  local_state.last_motion_detected = clock_ms();
+  run_one("handle_sleep_awake", call_handle_sleep, overhead);
+  local_state.update_mode(Mode::OFF);
+  run_one("handle_sleep_off", call_handle_sleep, overhead);
+
+  run_one("set_rainbow", call_set_rainbow, overhead);
+  run_one("hsv_to_rgb", call_hsv_to_rgb, overhead);
+  run_one("hue_brightness_to_rgb", call_hue_brightness, overhead);
+  run_one("seqlock_read", call_seqlock_read, overhead);
+  run_one("flight_record", call_flight_record, overhead);
+
+  // Light programs: a typical short one, and one that uses its whole budget
+  uint16_t position = 0;
+  local_vm.load(0, BENCH_VM_DIAL_PROGRAM, sizeof(BENCH_VM_DIAL_PROGRAM), position);
+  local_vm.load(1, BENCH_VM_SPIN_PROGRAM, sizeof(BENCH_VM_SPIN_PROGRAM), position);
+  run_one("vm_dial_pass", call_vm_dial, overhead);
+  uint32_t spin_cycles = run_one("vm_budget_pass", call_vm_spin, overhead);
+  Serial.print("BENCH_INFO,vm_cycles_per_instruction,");
+  Serial.println(static_cast<float>(spin_cycles) / VM_TICK_BUDGET, 2);
+
+  // Animation playback straight from the mapped flash, if an image has been
+  // written (tools/pack_assets.py, with --bench for a big one to miss the cache on)
+  bench_assets_partition = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(ASSET_PARTITION_SUBTYPE), "assets");
+  bench_frames_index = -1;
+  bench_keyframes_index = -1;
+  if (local_assets.begin()) {
+    bench_frames_index = local_assets.find("bench");
+    for (uint16_t i = 0; i < local_assets.count(); i++) {
+      AssetKind kind = static_cast<AssetKind>(local_assets.entry(i).kind);
+      if (kind == AssetKind::FRAMES && bench_frames_index < 0) {
+        bench_frames_index = i;
+      } else if (kind == AssetKind::KEYFRAMES && bench_keyframes_index < 0) {
+        bench_keyframes_index = i;
+      }
+    }
+  }
+  if (bench_frames_index >= 0) {
+    Serial.print("BENCH_INFO,asset_bench_frames,");
+    Serial.println(local_assets.entry(bench_frames_index).count);
+    run_one("asset_frame_in_order", call_asset_frame_in_order, overhead);
+    run_one("asset_frame_scattered", call_asset_frame_scattered, overhead);
+    run_one("asset_frame_copied", call_asset_frame_copied, overhead);
+  }
+  if (bench_keyframes_index >= 0) {
+    run_one("asset_keyframe_sample", call_asset_keyframe, overhead);
+  }
+  if (bench_frames_index < 0 && bench_keyframes_index < 0) {
+    Serial.println("BENCH_INFO,asset_bench_frames,0");
+  }
+
+  uint32_t failed_checks = check_seqlock();
+  run_quality_benchmarks(local_state, output);
+  run_adc_noise_benchmarks();
+
+  Serial.print("BENCH_DONE,");
+  Serial.println(ESP.getCpuFreqMHz());
+  return failed_checks;
+}
+
+#endif
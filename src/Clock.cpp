@@ -0,0 +1,11 @@
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "Clock.h"
+
+/*
+The 64-bit clock, see Clock.h.
+*/
+
+uint64_t clock_us() {
+  return esp_timer_get_time();
+}
@@ -0,0 +1,114 @@
+#include <Arduino.h>
+#include "ColorMath.h"
+
+/*
+Fixed-point color conversions, see ColorMath.h.
+*/
+
+void hsv_to_rgb_batch(const HsvColor* hsv, RgbColor* rgb, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    rgb[i] = hsv_to_rgb(hsv[i]);
+  }
+}
+
+// Work out numerator / denominator without a divide instruction.
+// We normalize the denominator into [0.5, 1), take the usual straight-line
+// first guess at its reciprocal, and polish it with two Newton steps
+// (x = x * (2 - d * x)), which gets us to about 16 bits.  All Q30.
+static uint32_t divide(uint32_t numerator, uint16_t denominator) {
+  if (denominator == 0) {
+    return 0;
+  }
+  uint8_t shift = __builtin_clz(static_cast<uint32_t>(denominator)) - 16;
+  uint64_t d = static_cast<uint64_t>(denominator << shift) << 14;  // Q30, 0.5-1
+  const uint64_t one = 1ULL << 30;
+  // 48/17 - 32/17 * d
+  uint64_t x = 3031741620ULL - ((2021161080ULL * d) >> 30);
+  x = (x * (2 * one - ((d * x) >> 30))) >> 30;
+  x = (x * (2 * one - ((d * x) >> 30))) >> 30;
+  // numerator / denominator = numerator * 2^shift / (d * 2^16)
+  // The +1 nudges exact quotients that land just under a whole number
+  return static_cast<uint32_t>((static_cast<uint64_t>(numerator) * (x + 1)) >> (46 - shift));
+}
+
+HsvColor rgb_to_hsv(const RgbColor &rgb) {
+  uint16_t high = max(rgb.red, max(rgb.green, rgb.blue));
+  uint16_t low = min(rgb.red, min(rgb.green, rgb.blue));
+  uint16_t delta = high - low;
+
+  HsvColor hsv;
+  hsv.val = high;
+  if (delta == 0) {
+    // Some shade of gray, hue doesn't matter
+    hsv.hue = 0;
+    hsv.sat = 0;
+    return hsv;
+  }
+  hsv.sat = min(divide(static_cast<uint32_t>(delta) * 255, high), 255u);
+
+  // Which sector pair we're in depends on which channel is highest, and
+  // the position comes from the other two
+  int32_t hue;
+  if (high == rgb.red) {
+    hue = (rgb.green >= rgb.blue) ?
+      static_cast<int32_t>(divide(static_cast<uint32_t>(rgb.green - rgb.blue) << 8, delta)) :
+      HUE_STEPS - static_cast<int32_t>(divide(static_cast<uint32_t>(rgb.blue - rgb.green) << 8, delta));
+  } else if (high == rgb.green) {
+    hue = 2 * HUE_SECTOR_STEPS + ((rgb.blue >= rgb.red) ?
+      static_cast<int32_t>(divide(static_cast<uint32_t>(rgb.blue - rgb.red) << 8, delta)) :
+      -static_cast<int32_t>(divide(static_cast<uint32_t>(rgb.red - rgb.blue) << 8, delta)));
+  } else {
+    hue = 4 * HUE_SECTOR_STEPS + ((rgb.red >= rgb.green) ?
+      static_cast<int32_t>(divide(static_cast<uint32_t>(rgb.red - rgb.green) << 8, delta)) :
+      -static_cast<int32_t>(divide(static_cast<uint32_t>(rgb.green - rgb.red) << 8, delta)));
+  }
+  hsv.hue = hue >= HUE_STEPS ? hue - HUE_STEPS : hue;
+  return hsv;
+}
+
+///////////////////////////////////////////////////////////
+// Constant brightness around the color wheel
+///////////////////////////////////////////////////////////
+
+HueBrightness::HueBrightness(float red_weight, float green_weight, float blue_weight) {
+  // How bright each hue looks at full saturation and value
+  float brightness[TABLE_STEPS + 1];
+  float dimmest = 1e9;
+  for (uint8_t i = 0; i <= TABLE_STEPS; i++) {
+    HsvColor hsv = {static_cast<uint16_t>((i << TABLE_SHIFT) % HUE_STEPS), 255, 65535};
+    RgbColor rgb = hsv_to_rgb(hsv);
+    brightness[i] = (red_weight * rgb.red + green_weight * rgb.green + blue_weight * rgb.blue) / 65535.0;
+    dimmest = min(dimmest, brightness[i]);
+  }
+  // Scale everything down to the dimmest hue
+  for (uint8_t i = 0; i <= TABLE_STEPS; i++) {
+    _gains[i] = static_cast<uint16_t>(32768.0 * dimmest / brightness[i]);
+  }
+}
+
+RgbColor HueBrightness::to_rgb(const HsvColor &hsv) const {
+  RgbColor rgb = hsv_to_rgb(hsv);
+
+  // Look up the gain, blending between table entries
+  uint16_t hue = hsv.hue < HUE_STEPS ? hsv.hue : hsv.hue % HUE_STEPS;
+  uint8_t index = hue >> TABLE_SHIFT;
+  int32_t fraction = hue & ((1 << TABLE_SHIFT) - 1);
+  int32_t gain = _gains[index] + (((static_cast<int32_t>(_gains[index + 1]) - _gains[index]) *
+                 fraction) >> TABLE_SHIFT);
+
+  // Grays don't need any help, so ease off the correction as the
+  // saturation drops
+  uint32_t sat = hsv.sat + (hsv.sat >> 7);
+  gain = 32768 - (((32768 - gain) * static_cast<int32_t>(sat)) >> 8);
+
+  rgb.red = (static_cast<uint32_t>(rgb.red) * gain) >> 15;
+  rgb.green = (static_cast<uint32_t>(rgb.green) * gain) >> 15;
+  rgb.blue = (static_cast<uint32_t>(rgb.blue) * gain) >> 15;
+  return rgb;
+}
+
+void HueBrightness::to_rgb_batch(const HsvColor* hsv, RgbColor* rgb, size_t count) const {
+  for (size_t i = 0; i < count; i++) {
+    rgb[i] = to_rgb(hsv[i]);
+  }
+}
@@ -1,18 +1,21 @@
+#include "Clock.h"
 #include "DebounceInput.h"
 
+// Size budget, one per button and motion sensor: the name pointer plus 8 bytes
+static_assert(sizeof(DebounceInput) <= sizeof(const char*) + 8, "DebounceInput is over its size budget");
+
 DebounceInput::DebounceInput(uint8_t pin, const char* buttonName, 
   uint16_t debounceDelay, uint8_t inputMode, bool activeLow) 
-  : _pin(pin), 
+  : _buttonName(buttonName),
     _debounceDelay(debounceDelay),
+    _lastDebounceTime(0),
+    _pin(pin), 
     _lastStableState(false),
     _currentState(false),
-    _lastDebounceTime(0),
-    _mode(inputMode),
-    _activeLow(activeLow),
-    _buttonName(buttonName){
+    _activeLow(activeLow){
 
   // initialization
-  pinMode(_pin, _mode); // INPUT_PULLUP is default, keep that in mind!
+  pinMode(_pin, inputMode); // INPUT_PULLUP is default, keep that in mind!
   _lastStableState = digitalRead(_pin);
   if (_activeLow) {
     _lastStableState = !_lastStableState;
@@ -37,13 +40,13 @@ bool DebounceInput::update() {
   if (reading != _currentState) {
     // Reset the debouncing timer
     // We will not consider the change stable until enough time has passed
-    _lastDebounceTime = millis();
+    _lastDebounceTime = clock_ms();
   }
   
   bool stateChanged = false;
   
   // If enough time has passed, consider the change stable
-  if ((millis() - _lastDebounceTime) > _debounceDelay) {
+  if (static_cast<uint16_t>(clock_ms() - _lastDebounceTime) > _debounceDelay) {
     // If the reading has changed since the last stable state
     if (reading != _lastStableState) {
       _lastStableState = reading;
@@ -57,4 +60,16 @@ bool DebounceInput::update() {
 
 bool DebounceInput::isActive() const {
   return _lastStableState;
+}
+
+bool DebounceInput::isSettled() const {
+  return _currentState == _lastStableState;
+}
+
+const char* DebounceInput::getButtonName() const {
+  return _buttonName;
+}
+
+uint8_t DebounceInput::getPin() const {
+  return _pin;
 }
\ No newline at end of file
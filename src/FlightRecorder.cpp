@@ -0,0 +1,63 @@
+#include <Arduino.h>
+#include <esp_system.h>
+#include "Clock.h"
+#include "FlightRecorder.h"
+
+/*
+The event ring buffer, see FlightRecorder.h.
+*/
+
+const uint32_t FLIGHT_LOG_MAGIC = 0x464C4F47;  // "FLOG"
+const uint16_t FLIGHT_LOG_MASK = FLIGHT_LOG_EVENTS - 1;
+
+static_assert((FLIGHT_LOG_EVENTS & FLIGHT_LOG_MASK) == 0, "FLIGHT_LOG_EVENTS must be a power of two");
+static_assert(sizeof(FlightEvent) == 8, "FlightEvent has to match tools/flight_log.py");
+
+struct FlightLog {
+  uint32_t magic;
+  uint32_t written;  // events ever written, the next goes at written % size
+  uint16_t boots;
+  FlightEvent events[FLIGHT_LOG_EVENTS];
+};
+
+// Not cleared at startup, so it survives everything but a power-on
+RTC_NOINIT_ATTR static FlightLog flight_log;
+
+uint32_t flight_recorder_begin() {
+  esp_reset_reason_t reason = esp_reset_reason();
+
+  // After a power-on, RTC memory holds garbage, same as LoopMonitor
+  uint32_t kept = 0;
+  if (flight_log.magic == FLIGHT_LOG_MAGIC && reason != ESP_RST_POWERON) {
+    kept = min(flight_log.written, static_cast<uint32_t>(FLIGHT_LOG_EVENTS));
+  } else {
+    flight_log.magic = FLIGHT_LOG_MAGIC;
+    flight_log.written = 0;
+    flight_log.boots = 0;
+  }
+  flight_log.boots++;
+  flight_record(FlightEventType::BOOT, static_cast<uint8_t>(reason), flight_log.boots);
+  return kept;
+}
+
+void flight_record(FlightEventType type, uint8_t a, uint16_t b) {
+  FlightEvent &event = flight_log.events[flight_log.written & FLIGHT_LOG_MASK];
+  event.time_ms = clock_ms32();
+  event.type = static_cast<uint8_t>(type);
+  event.a = a;
+  event.b = b;
+  flight_log.written++;
+}
+
+uint16_t flight_recorder_count() {
+  return min(flight_log.written, static_cast<uint32_t>(FLIGHT_LOG_EVENTS));
+}
+
+bool flight_recorder_get(uint16_t index, FlightEvent &event) {
+  uint16_t count = flight_recorder_count();
+  if (index >= count) {
+    return false;
+  }
+  event = flight_log.events[(flight_log.written - count + index) & FLIGHT_LOG_MASK];
+  return true;
+}
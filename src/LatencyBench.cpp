@@ -0,0 +1,228 @@
+#ifdef LIGHT_BENCHMARK
+
+#include <Arduino.h>
+#include <algorithm>
+#include <esp_system.h>
+#include "Clock.h"
+#include "LatencyBench.h"
+
+/*
+Press-to-light latency, see LatencyBench.h.
+*/
+
+// Keep these the same as in tools/latency_report.py
+const Mode LATENCY_BUTTON_MODES[] = {
+  Mode::OFF, Mode::RGB, Mode::WHITE, Mode::CUSTOM_1, Mode::CUSTOM_3, Mode::CUSTOM_6, Mode::HSV
+};
+const Mode LATENCY_WAKE_MODES[] = {Mode::RGB, Mode::WHITE, Mode::CUSTOM_1, Mode::HSV};
+const uint8_t LATENCY_PRESSES = 20;  // per starting mode
+const uint8_t LATENCY_WAKES = 8;     // fewer, each waits out the cooldown
+const uint32_t LATENCY_SETTLE_MS = 150;
+const uint32_t LATENCY_TIMEOUT_MS = 500;
+const uint32_t LATENCY_RELEASE_MS = 150;
+const uint32_t LATENCY_COOLDOWN_MS = 4500;  // past MotionSensorState's 4 s
+const uint32_t LATENCY_STACK_BYTES = 3072;
+
+// Which input the spare pin is looped back to
+static const char* latency_input_name = nullptr;
+static int8_t latency_button = -1;  // or a motion sensor, if -1
+static OutputController* latency_output = nullptr;
+
+// A starting mode for loop() to go to, and the mode to have come from
+static volatile bool latency_requested = false;
+static volatile Mode latency_requested_mode = Mode::OFF;
+static volatile Mode latency_requested_last_mode = Mode::OFF;
+static volatile Mode latency_current_mode = Mode::OFF;
+
+static uint32_t latency_samples[LATENCY_PRESSES];
+
+// Does the input follow the spare pin?
+static bool follows(uint8_t pin) {
+  digitalWrite(LATENCY_INJECT_PIN, LOW);
+  delayMicroseconds(50);
+  bool low = digitalRead(pin);
+  digitalWrite(LATENCY_INJECT_PIN, HIGH);
+  delayMicroseconds(50);
+  bool high = digitalRead(pin);
+  return !low && high;
+}
+
+// The mode a button press goes to, from this one, see loop() in main.cpp
+static Mode pressed_mode(Button button, Mode from) {
+  switch (button) {
+    case Button::CYCLE:
+      return Mode::INVALID;  // always somewhere else
+    case Button::OFF:
+      return Mode::OFF;
+    case Button::WHITE:
+      return Mode::WHITE;
+    case Button::RGB:
+      return from == Mode::RGB ? Mode::HSV : Mode::RGB;
+    default:
+      return static_cast<Mode>(static_cast<int>(Mode::CUSTOM_1) +
+                               static_cast<int>(button) - static_cast<int>(Button::S1));
+  }
+}
+
+static void request_mode(Mode mode, Mode last_mode) {
+  latency_requested_last_mode = last_mode;
+  latency_requested_mode = mode;
+  latency_requested = true;
+  while (latency_requested) {
+    vTaskDelay(1);
+  }
+  vTaskDelay(pdMS_TO_TICKS(LATENCY_SETTLE_MS));
+}
+
+// Press (or wave at) the input once, return the latency in microseconds,
+// 0 if the lights didn't change, or UINT32_MAX if something else changed
+// the mode first
+static uint32_t inject_once(Mode start) {
+  if (latency_current_mode != start) {
+    return UINT32_MAX;
+  }
+  TemporalDither &dither = latency_output->dither();
+  uint32_t marks = dither.marks_written();
+  // Somewhere random in the sensing period
+  delayMicroseconds(esp_random() % 1000);
+  uint32_t pressed_us = clock_us32();
+  digitalWrite(LATENCY_INJECT_PIN, latency_button >= 0 ? LOW : HIGH);
+
+  uint32_t latency_us = 0;
+  uint32_t waited_ms = 0;
+  while (waited_ms < LATENCY_TIMEOUT_MS) {
+    if (dither.marks_written() != marks) {
+      latency_us = dither.mark_written_us() - pressed_us;
+      break;
+    }
+    vTaskDelay(1);
+    waited_ms += portTICK_PERIOD_MS;
+  }
+  digitalWrite(LATENCY_INJECT_PIN, latency_button >= 0 ? HIGH : LOW);
+  vTaskDelay(pdMS_TO_TICKS(latency_button >= 0 ? LATENCY_RELEASE_MS : LATENCY_COOLDOWN_MS));
+  return latency_us;
+}
+
+static void report(Mode mode, uint8_t count, uint8_t unchanged) {
+  Serial.print("LATENCY,");
+  Serial.print(latency_input_name);
+  Serial.print(",");
+  Serial.print(static_cast<int>(mode));
+  Serial.print(",");
+  Serial.print(count);
+  Serial.print(",");
+  Serial.print(unchanged);
+  std::sort(latency_samples, latency_samples + count);
+  uint32_t low = count > 0 ? latency_samples[0] : 0;
+  uint32_t median = count > 0 ? latency_samples[count / 2] : 0;
+  // Nearest rank, ceil(0.9 * count) - 1
+  uint32_t p90 = count > 0 ? latency_samples[(count * 9 + 9) / 10 - 1] : 0;
+  uint32_t high = count > 0 ? latency_samples[count - 1] : 0;
+  Serial.print(",");
+  Serial.print(low);
+  Serial.print(",");
+  Serial.print(median);
+  Serial.print(",");
+  Serial.print(p90);
+  Serial.print(",");
+  Serial.println(high);
+}
+
+static void run_scenario(Mode start, Mode came_from, uint8_t presses) {
+  uint8_t count = 0;
+  uint8_t unchanged = 0;
+  for (uint8_t i = 0; i < presses; i++) {
+    request_mode(start, came_from);
+    uint32_t latency_us = inject_once(start);
+    if (latency_us == 0) {
+      unchanged++;
+    } else if (latency_us != UINT32_MAX) {
+      latency_samples[count++] = latency_us;
+    }
+  }
+  // Dozing is always where motion starts, so say what it woke back up to
+  report(start == Mode::SLEEP_PREP ? came_from : start, count, unchanged);
+}
+
+static void latency_task(void*) {
+  if (latency_button >= 0) {
+    Button button = static_cast<Button>(latency_button);
+    for (Mode start : LATENCY_BUTTON_MODES) {
+      if (pressed_mode(button, start) != start) {
+        run_scenario(start, Mode::OFF, LATENCY_PRESSES);
+      }
+    }
+  } else {
+    for (Mode lit : LATENCY_WAKE_MODES) {
+      run_scenario(Mode::SLEEP_PREP, lit, LATENCY_WAKES);
+    }
+  }
+  // Back to off, and leave the pin as found
+  request_mode(Mode::OFF, Mode::OFF);
+  pinMode(LATENCY_INJECT_PIN, INPUT);
+  Serial.println("LATENCY_DONE");
+  vTaskDelete(nullptr);
+}
+
+///////////////////////////////////////////////////////////
+
+void latency_bench_begin(ProgramState &state, DebounceInput* buttons, OutputController &output) {
+  latency_output = &output;
+  latency_current_mode = state.curr_mode;
+
+  // Wiggle the spare pin (quicker than either debouncing notices) and see
+  // what follows it
+  pinMode(LATENCY_INJECT_PIN, OUTPUT);
+  for (uint8_t i = 0; i < BUTTON_COUNT && latency_input_name == nullptr; i++) {
+    if (follows(buttons[i].getPin())) {
+      latency_button = i;
+      latency_input_name = buttons[i].getButtonName();
+    }
+  }
+  const MotionSensorState* sensors[] = {
+    &state.motion_detector_a, &state.motion_detector_b, &state.motion_detector_c
+  };
+  for (const MotionSensorState* sensor : sensors) {
+    if (latency_input_name == nullptr && sensor->enabled() && follows(sensor->pin())) {
+      latency_input_name = "motion";
+    }
+  }
+
+  if (latency_input_name == nullptr) {
+    pinMode(LATENCY_INJECT_PIN, INPUT);
+    Serial.println("Nothing looped back to D1, no latency measurement");
+    Serial.println("LATENCY_DONE");
+    return;
+  }
+  if (latency_button >= 0) {
+    // Open drain, so pressing the real button at the same time is harmless
+    pinMode(LATENCY_INJECT_PIN, OUTPUT_OPEN_DRAIN);
+    digitalWrite(LATENCY_INJECT_PIN, HIGH);
+  } else {
+    digitalWrite(LATENCY_INJECT_PIN, LOW);
+  }
+  Serial.print("Measuring press-to-light latency on ");
+  Serial.println(latency_input_name);
+  // Core 0 with the sensing task, below it, it only ever waits
+  if (xTaskCreatePinnedToCore(latency_task, "latency", LATENCY_STACK_BYTES, nullptr, 1,
+                              nullptr, 0) != pdPASS) {
+    Serial.println("LATENCY_DONE");
+  }
+}
+
+bool latency_bench_poll(ProgramState &state) {
+  latency_current_mode = state.curr_mode;
+  if (!latency_requested) {
+    return false;
+  }
+  // Dozing wakes back up to the mode before it, so go through that first
+  state.update_mode(latency_requested_last_mode);
+  state.update_mode(latency_requested_mode);
+  // And don't doze off partway through
+  state.manual_motion_update();
+  latency_current_mode = state.curr_mode;
+  latency_requested = false;
+  return true;
+}
+
+#endif
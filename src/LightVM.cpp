@@ -0,0 +1,387 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <math.h>
+#include "LightVM.h"
+
+/*
+The bytecode checker and interpreter, see LightVM.h.
+*/
+
+const char* VM_PREFERENCES_NAMESPACE = "programs";
+
+// What each instruction takes off the stack, puts back, and how many operand
+// bytes follow it.  In the same order as Op.
+struct OpInfo {
+  uint8_t pops;
+  uint8_t pushes;
+  uint8_t operand_bytes;
+};
+
+static const OpInfo OP_INFO[VM_OP_COUNT] = {
+  {0, 0, 0},  // END
+  {0, 1, 1},  // PUSH8
+  {0, 1, 2},  // PUSH16
+  {1, 2, 0},  // DUP
+  {1, 0, 0},  // DROP
+  {2, 2, 0},  // SWAP
+  {2, 3, 0},  // OVER
+  {2, 1, 0},  // ADD
+  {2, 1, 0},  // SUB
+  {2, 1, 0},  // MUL
+  {2, 1, 0},  // DIV
+  {2, 1, 0},  // MOD
+  {2, 1, 0},  // MIN
+  {2, 1, 0},  // MAX
+  {2, 1, 0},  // AND
+  {2, 1, 0},  // OR
+  {2, 1, 0},  // XOR
+  {2, 1, 0},  // SHL
+  {2, 1, 0},  // SHR
+  {2, 1, 0},  // LT
+  {2, 1, 0},  // GT
+  {2, 1, 0},  // EQ
+  {1, 1, 0},  // NOT
+  {1, 1, 0},  // NEG
+  {1, 1, 0},  // SIN
+  {1, 1, 0},  // RANDOM
+  {0, 1, 1},  // LOAD
+  {1, 0, 1},  // STORE
+  {0, 0, 2},  // JMP
+  {1, 0, 2},  // JZ
+  {0, 1, 1},  // DIAL
+  {0, 1, 1},  // BUTTON
+  {0, 1, 0},  // TIME
+  {3, 0, 0},  // RGB
+  {3, 0, 0},  // HSV
+};
+
+static inline uint16_t read_u16(const uint8_t* data) {
+  return data[0] | (data[1] << 8);
+}
+
+static inline int32_t clamp(int32_t value, int32_t low, int32_t high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+// Put together a preferences key for a slot, "slot0" to "slot7"
+static void slot_key(uint8_t slot, char* key) {
+  memcpy(key, "slot", 4);
+  key[4] = '0' + slot;
+  key[5] = '\0';
+}
+
+LightVM::LightVM() {
+  memset(_programs, 0, sizeof(_programs));
+  memset(_lengths, 0, sizeof(_lengths));
+  memset(_stats, 0, sizeof(_stats));
+  memset(_staging, 0, sizeof(_staging));
+  _random_state = 0x12345678;
+  restart();
+}
+
+void LightVM::begin() {
+  Preferences preferences;
+  if (!preferences.begin(VM_PREFERENCES_NAMESPACE, true)) {
+    // Nothing was ever saved
+    return;
+  }
+  char key[6];
+  uint8_t code[VM_PROGRAM_SIZE];
+  for (uint8_t slot = 0; slot < VM_SLOTS; slot++) {
+    slot_key(slot, key);
+    size_t length = preferences.getBytesLength(key);
+    if (length == 0 || length > VM_PROGRAM_SIZE) {
+      continue;
+    }
+    preferences.getBytes(key, code, length);
+    // Checked again, in case the instruction set changed since it was saved
+    uint16_t position = 0;
+    if (load(slot, code, length, position) != VmCheck::OK) {
+      Serial.print("Saved program doesn't check out, slot ");
+      Serial.println(slot);
+    }
+  }
+  preferences.end();
+}
+
+VmCheck LightVM::check(const uint8_t* code, uint16_t length, uint16_t &position) {
+  position = 0;
+  if (length == 0 || length > VM_PROGRAM_SIZE) {
+    return VmCheck::TOO_BIG;
+  }
+
+  // First pass: every instruction and operand, and where instructions start
+  bool starts[VM_PROGRAM_SIZE] = {};
+  for (uint16_t pc = 0; pc < length; ) {
+    position = pc;
+    uint8_t op = code[pc];
+    if (op >= VM_OP_COUNT) {
+      return VmCheck::BAD_OPCODE;
+    }
+    if (pc + 1 + OP_INFO[op].operand_bytes > length) {
+      return VmCheck::TRUNCATED;
+    }
+    uint8_t operand = OP_INFO[op].operand_bytes > 0 ? code[pc + 1] : 0;
+    switch (static_cast<Op>(op)) {
+      case Op::LOAD:
+      case Op::STORE:
+        if (operand >= VM_VARIABLES) return VmCheck::BAD_OPERAND;
+        break;
+      case Op::DIAL:
+        if (operand >= DIAL_COUNT) return VmCheck::BAD_OPERAND;
+        break;
+      case Op::BUTTON:
+        if (operand >= BUTTON_COUNT) return VmCheck::BAD_OPERAND;
+        break;
+      default:
+        break;
+    }
+    starts[pc] = true;
+    pc += 1 + OP_INFO[op].operand_bytes;
+  }
+
+  // Second pass: follow every path from the top, working out the stack
+  // depth at each instruction.  Every way into an instruction has to agree.
+  int8_t depths[VM_PROGRAM_SIZE];
+  memset(depths, -1, sizeof(depths));
+  uint16_t pending[VM_PROGRAM_SIZE];
+  uint16_t pending_count = 0;
+  depths[0] = 0;
+  pending[pending_count++] = 0;
+
+  while (pending_count > 0) {
+    uint16_t pc = pending[--pending_count];
+    position = pc;
+    Op op = static_cast<Op>(code[pc]);
+    const OpInfo &info = OP_INFO[code[pc]];
+    int8_t depth = depths[pc];
+    if (depth < info.pops) {
+      return VmCheck::STACK_UNDERFLOW;
+    }
+    depth = depth - info.pops + info.pushes;
+    if (depth > VM_STACK_SIZE) {
+      return VmCheck::STACK_OVERFLOW;
+    }
+
+    // Where it can go next: the following instruction, the jump target, or both
+    uint16_t next[2];
+    uint8_t next_count = 0;
+    if (op == Op::JMP || op == Op::JZ) {
+      uint16_t target = read_u16(code + pc + 1);
+      if (target >= length || !starts[target]) {
+        return VmCheck::BAD_JUMP;
+      }
+      next[next_count++] = target;
+    }
+    if (op != Op::END && op != Op::JMP) {
+      uint16_t following = pc + 1 + info.operand_bytes;
+      if (following >= length) {
+        return VmCheck::FALLS_OFF_END;
+      }
+      next[next_count++] = following;
+    }
+
+    for (uint8_t i = 0; i < next_count; i++) {
+      if (depths[next[i]] < 0) {
+        depths[next[i]] = depth;
+        pending[pending_count++] = next[i];
+      } else if (depths[next[i]] != depth) {
+        position = next[i];
+        return VmCheck::STACK_MISMATCH;
+      }
+    }
+  }
+  position = 0;
+  return VmCheck::OK;
+}
+
+VmCheck LightVM::load(uint8_t slot, const uint8_t* code, uint16_t length, uint16_t &position) {
+  if (slot >= VM_SLOTS) {
+    return VmCheck::BAD_OPERAND;
+  }
+  VmCheck result = check(code, length, position);
+  if (result != VmCheck::OK) {
+    return result;
+  }
+  memcpy(_programs[slot], code, length);
+  _lengths[slot] = length;
+  memset(&_stats[slot], 0, sizeof(_stats[slot]));
+  return VmCheck::OK;
+}
+
+bool LightVM::stage(uint16_t offset, const uint8_t* data, uint8_t length) {
+  if (offset + length > VM_PROGRAM_SIZE) {
+    return false;
+  }
+  memcpy(_staging + offset, data, length);
+  return true;
+}
+
+VmCheck LightVM::commit(uint8_t slot, uint16_t length, uint16_t &position) {
+  position = 0;
+  if (slot >= VM_SLOTS) {
+    return VmCheck::BAD_OPERAND;
+  }
+  if (length > 0) {
+    VmCheck result = load(slot, _staging, length, position);
+    if (result != VmCheck::OK) {
+      return result;
+    }
+  } else {
+    _lengths[slot] = 0;
+  }
+
+  Preferences preferences;
+  if (preferences.begin(VM_PREFERENCES_NAMESPACE, false)) {
+    char key[6];
+    slot_key(slot, key);
+    if (length > 0) {
+      preferences.putBytes(key, _programs[slot], length);
+    } else {
+      preferences.remove(key);
+    }
+    preferences.end();
+  }
+  return VmCheck::OK;
+}
+
+void LightVM::restart() {
+  memset(_variables, 0, sizeof(_variables));
+  _color.red = 0;
+  _color.green = 0;
+  _color.blue = 0;
+}
+
+bool LightVM::run(uint8_t slot, const InputSnapshot &inputs, uint32_t time_ms) {
+  // In the same order as Op
+  static const void* const dispatch[] = {
+    &&op_end, &&op_push8, &&op_push16, &&op_dup, &&op_drop, &&op_swap, &&op_over,
+    &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_min, &&op_max,
+    &&op_and, &&op_or, &&op_xor, &&op_shl, &&op_shr, &&op_lt, &&op_gt, &&op_eq,
+    &&op_not, &&op_neg, &&op_sin, &&op_random, &&op_load, &&op_store,
+    &&op_jmp, &&op_jz, &&op_dial, &&op_button, &&op_time, &&op_rgb, &&op_hsv
+  };
+  static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == VM_OP_COUNT, "dispatch table must match Op");
+
+  // The program was checked when loaded, so no bounds checks in here
+  const uint8_t* code = _programs[slot];
+  const uint8_t* pc = code;
+  int32_t stack[VM_STACK_SIZE];
+  int32_t* sp = stack;  // one past the top
+  uint32_t budget = VM_TICK_BUDGET + 1;  // the first NEXT() takes one off
+  bool finished = true;
+  int32_t a;
+  int32_t b;
+
+#define NEXT() do { if (--budget == 0) goto out_of_budget; goto *dispatch[*pc++]; } while (0)
+#define BINARY(result) do { b = *--sp; a = sp[-1]; sp[-1] = (result); NEXT(); } while (0)
+// Wrap around rather than overflow, like the hardware does
+#define WRAP(result) static_cast<int32_t>(static_cast<uint32_t>(result))
+
+  NEXT();
+
+op_push8:
+  *sp++ = static_cast<int8_t>(*pc++);
+  NEXT();
+op_push16:
+  *sp++ = static_cast<int16_t>(read_u16(pc));
+  pc += 2;
+  NEXT();
+op_dup:
+  *sp = sp[-1];
+  sp++;
+  NEXT();
+op_drop:
+  sp--;
+  NEXT();
+op_swap:
+  a = sp[-1];
+  sp[-1] = sp[-2];
+  sp[-2] = a;
+  NEXT();
+op_over:
+  *sp = sp[-2];
+  sp++;
+  NEXT();
+op_add: BINARY(WRAP(static_cast<uint32_t>(a) + static_cast<uint32_t>(b)));
+op_sub: BINARY(WRAP(static_cast<uint32_t>(a) - static_cast<uint32_t>(b)));
+op_mul: BINARY(WRAP(static_cast<uint32_t>(a) * static_cast<uint32_t>(b)));
+op_div: BINARY(b == 0 ? 0 : (b == -1 ? WRAP(0u - static_cast<uint32_t>(a)) : a / b));
+op_mod: BINARY(b == 0 || b == -1 ? 0 : a % b);
+op_min: BINARY(a < b ? a : b);
+op_max: BINARY(a > b ? a : b);
+op_and: BINARY(a & b);
+op_or: BINARY(a | b);
+op_xor: BINARY(a ^ b);
+op_shl: BINARY(WRAP(static_cast<uint32_t>(a) << (b & 31)));
+op_shr: BINARY(a >> (b & 31));
+op_lt: BINARY(a < b ? 1 : 0);
+op_gt: BINARY(a > b ? 1 : 0);
+op_eq: BINARY(a == b ? 1 : 0);
+op_not:
+  sp[-1] = sp[-1] == 0 ? 1 : 0;
+  NEXT();
+op_neg:
+  sp[-1] = WRAP(0u - static_cast<uint32_t>(sp[-1]));
+  NEXT();
+op_sin:
+  sp[-1] = static_cast<int32_t>(lroundf(1023.0f * sinf((sp[-1] & 1023) * (2.0f * M_PI / 1024.0f))));
+  NEXT();
+op_random:
+  // xorshift32, plenty for candle flicker
+  _random_state ^= _random_state << 13;
+  _random_state ^= _random_state >> 17;
+  _random_state ^= _random_state << 5;
+  sp[-1] = sp[-1] > 0 ? static_cast<int32_t>(_random_state % static_cast<uint32_t>(sp[-1])) : 0;
+  NEXT();
+op_load:
+  *sp++ = _variables[*pc++];
+  NEXT();
+op_store:
+  _variables[*pc++] = *--sp;
+  NEXT();
+op_jmp:
+  pc = code + read_u16(pc);
+  NEXT();
+op_jz:
+  pc = *--sp == 0 ? code + read_u16(pc) : pc + 2;
+  NEXT();
+op_dial:
+  *sp++ = inputs.dial_value[*pc++];
+  NEXT();
+op_button:
+  *sp++ = (inputs.buttons_down >> *pc++) & 1;
+  NEXT();
+op_time:
+  *sp++ = static_cast<int32_t>(time_ms);
+  NEXT();
+op_rgb:
+  sp -= 3;
+  _color.red = clamp(sp[0], 0, 1023) << 6;
+  _color.green = clamp(sp[1], 0, 1023) << 6;
+  _color.blue = clamp(sp[2], 0, 1023) << 6;
+  NEXT();
+op_hsv: {
+  sp -= 3;
+  HsvColor hsv;
+  int32_t hue = sp[0] % HUE_STEPS;
+  hsv.hue = hue < 0 ? hue + HUE_STEPS : hue;
+  hsv.sat = clamp(sp[1], 0, 255);
+  hsv.val = clamp(sp[2], 0, 1023) << 6;
+  _color = hsv_to_rgb(hsv);
+  NEXT();
+}
+
+out_of_budget:
+  // The instruction that found the budget empty didn't run
+  budget = 1;
+  finished = false;
+  _stats[slot].overruns++;
+op_end:
+#undef NEXT
+#undef BINARY
+#undef WRAP
+  _stats[slot].passes++;
+  _stats[slot].instructions += VM_TICK_BUDGET + 1 - budget;
+  return finished;
+}
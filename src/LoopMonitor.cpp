@@ -0,0 +1,128 @@
+#include <Arduino.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include "Clock.h"
+#include "LoopMonitor.h"
+
+/*
+Loop timing and the task watchdog, see LoopMonitor.h.
+*/
+
+const uint32_t LOOP_RECORD_MAGIC = 0x4C4F4F50;  // "LOOP"
+const uint8_t LOOP_STAGE_COUNT = static_cast<uint8_t>(LoopStage::STAGE_COUNT);
+
+// Not cleared at startup, so it survives a watchdog reset.  There is only
+// one loop(), so only one of these.
+RTC_NOINIT_ATTR static LoopOverrunRecord loop_record;
+
+LoopMonitor::LoopMonitor(uint32_t budget_us, uint8_t watchdog_timeout_s)
+  : _budget_us(budget_us),
+    _watchdog_timeout_s(watchdog_timeout_s),
+    _watchdog_running(false),
+    _started(false),
+    _iteration_start_us(0),
+    _stage_start_us(0),
+    _have_previous(false) {
+  for (uint8_t i = 0; i < LOOP_STAGE_COUNT; i++) {
+    _stage_us[i] = 0;
+  }
+  memset(&_previous, 0, sizeof(_previous));
+}
+
+bool LoopMonitor::begin() {
+  esp_reset_reason_t reason = esp_reset_reason();
+
+  // After a power-on, RTC memory holds garbage, so only trust the magic
+  // number together with a reset that keeps RTC memory
+  uint32_t boot_count = 0;
+  if (loop_record.magic == LOOP_RECORD_MAGIC && reason != ESP_RST_POWERON) {
+    _previous = loop_record;
+    _have_previous = true;
+    boot_count = loop_record.boot_count;
+  }
+  memset(&loop_record, 0, sizeof(loop_record));
+  // Any passes before this don't count as the first one
+  _started = false;
+  loop_record.magic = LOOP_RECORD_MAGIC;
+  loop_record.boot_count = boot_count + 1;
+  loop_record.reset_reason = static_cast<uint8_t>(reason);
+
+  if (_watchdog_timeout_s > 0) {
+    // The Arduino core may have started the watchdog already, which is fine,
+    // we just add ourselves to it
+    esp_err_t err = esp_task_wdt_init(_watchdog_timeout_s, true);
+    if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) {
+      _watchdog_running = esp_task_wdt_add(NULL) == ESP_OK;
+    }
+  }
+
+  return _have_previous && reason == ESP_RST_TASK_WDT;
+}
+
+void LoopMonitor::close_stage(uint32_t now_us) {
+  _stage_us[loop_record.current_stage] += now_us - _stage_start_us;
+  _stage_start_us = now_us;
+}
+
+void LoopMonitor::start_iteration() {
+  uint32_t now_us = clock_us32();
+
+  // Wrap up the iteration that just finished (none on the first call)
+  if (_started) {
+    close_stage(now_us);
+    uint32_t elapsed_us = now_us - _iteration_start_us;
+
+    // Blame whichever stage took the most time
+    uint8_t slowest = 0;
+    for (uint8_t i = 1; i < LOOP_STAGE_COUNT; i++) {
+      if (_stage_us[i] > _stage_us[slowest]) {
+        slowest = i;
+      }
+    }
+    if (elapsed_us > loop_record.worst_us) {
+      loop_record.worst_us = elapsed_us;
+      loop_record.worst_stage = slowest;
+    }
+    if (elapsed_us > _budget_us) {
+      loop_record.overruns++;
+      loop_record.last_overrun_ms = clock_ms32();
+      loop_record.last_overrun_us = elapsed_us;
+      loop_record.last_overrun_stage = slowest;
+    }
+    loop_record.iterations++;
+  }
+
+  for (uint8_t i = 0; i < LOOP_STAGE_COUNT; i++) {
+    _stage_us[i] = 0;
+  }
+  _started = true;
+  _iteration_start_us = now_us;
+  _stage_start_us = now_us;
+  loop_record.current_stage = static_cast<uint8_t>(LoopStage::IDLE);
+
+  if (_watchdog_running) {
+    esp_task_wdt_reset();
+  }
+}
+
+void LoopMonitor::stage(LoopStage stage) {
+  close_stage(clock_us32());
+  loop_record.current_stage = static_cast<uint8_t>(stage);
+}
+
+const LoopOverrunRecord& LoopMonitor::get_record() const {
+  return loop_record;
+}
+
+const char* loop_stage_name(uint8_t stage) {
+  switch (static_cast<LoopStage>(stage)) {
+    case LoopStage::IDLE: return "idle";
+    case LoopStage::BUTTONS: return "buttons";
+    case LoopStage::ANALOG: return "analog";
+    case LoopStage::SLEEP: return "sleep";
+    case LoopStage::SERIAL_IO: return "serial";
+    case LoopStage::LIGHTS: return "lights";
+    case LoopStage::DEBUG_PRINT: return "debug print";
+    default: return "unknown";
+  }
+}
@@ -1,13 +1,17 @@
 #include <Arduino.h>
+#include "Clock.h"
 #include "MotionSensorState.h"
 
 /*
 Motion Sensor state and functions
 */
 
+// Size budget, there are three of these.  The 64-bit motion time has to
+// sit on an 8-byte boundary, so it's 32 with the input and the padding.
+static_assert(sizeof(MotionSensorState) <= 32, "MotionSensorState is over its size budget");
+
 // Normal constructor for enabled motion sensor
 MotionSensorState::MotionSensorState(unsigned int motion_pin, bool enabled) {
-  _motion_pin = motion_pin;
   _last_motion_detected = 0;
   _cooldown_time = 4000;
   // intialize the pin
@@ -17,7 +21,6 @@ MotionSensorState::MotionSensorState(unsigned int motion_pin, bool enabled) {
 
 // Default constructor for a disabled motion sensor
 MotionSensorState::MotionSensorState() {
-  _motion_pin = 0;
   _last_motion_detected = 0;
   _cooldown_time = 4000;
   _enabled = false;
@@ -32,7 +35,7 @@ bool MotionSensorState::update() {
     return false;
   }
   if (_motion_input.update()) {
-    _last_motion_detected = millis();
+    _last_motion_detected = clock_ms();
     return true;
   }
   return false;
@@ -49,8 +52,16 @@ bool MotionSensorState::occupied() {
   if (update()) {
     return true;
   }
-  if (millis() - _last_motion_detected < _cooldown_time) {
+  if (clock_ms() - _last_motion_detected < _cooldown_time) {
     return true;
   }
   return false;
+}
+
+uint8_t MotionSensorState::pin() const {
+  return _motion_input.getPin();
+}
+
+bool MotionSensorState::enabled() const {
+  return _enabled;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <Arduino.h>
+#include "Clock.h"
 #include "OutputController.h"
+#include "PwmPhase.h"
 
 /*
 Control the lights and the program logic!
@@ -8,26 +10,25 @@ Control the lights and the program logic!
 OutputController::OutputController(unsigned int red_output_pwm_pin, 
                                    unsigned int green_output_pwm_pin, 
                                    unsigned int blue_output_pwm_pin,
-                                   unsigned long rainbow_duration) {
+                                   unsigned long rainbow_duration,
+                                   uint32_t power_budget_mw)
+  : _power(power_budget_mw) {
   _red_output_pwm_pin = red_output_pwm_pin;
   _green_output_pwm_pin = green_output_pwm_pin;
   _blue_output_pwm_pin = blue_output_pwm_pin;
   _rainbow_duration = rainbow_duration;
-  _last_jingle_time = 0;
-  _jingle_duration = 0;
-  _jingle_color_1 = JingleColors::OFF;
-  _jingle_color_2 = JingleColors::OFF;
-  _jingle_color_3 = JingleColors::OFF;
   _rainbow_start_time = 0;
+  _animation = -1;
+  // Hue steps per millisecond, Q16
+  _rainbow_hue_per_ms = (static_cast<uint32_t>(HUE_STEPS) << 16) / _rainbow_duration;
 
   // initialize PWM pins and parameters
   // Set the PWM frequency above human hearing range
   // Note that the PWM frequency * resolution must be under 40 MHz, the clock
   // frequency used by the PWM generator on the ESP32.
   // See: https://lastminuteengineers.com/esp32-pwm-tutorial/
-  const int pwm_freq = 20000;
-  const int pwm_resolution = 10;
-  const int max_pwm = (1 << pwm_resolution) - 1; // Clever way to get 2^PWM_RESOLUTION - 1
+  const int pwm_freq = LIGHT_PWM_FREQ;
+  const int pwm_resolution = LIGHT_PWM_BITS;
 
   _red_pwm_channel = 0;
   _green_pwm_channel = 1;
@@ -42,6 +43,38 @@ OutputController::OutputController(unsigned int red_output_pwm_pin,
   ledcAttachPin(_blue_output_pwm_pin, _blue_pwm_channel);
 }
 
+// Which program slot a mode runs, or -1 if it isn't a CUSTOM mode
+static int8_t program_slot(Mode mode) {
+  if (mode < Mode::CUSTOM_1 || mode > Mode::CUSTOM_8) {
+    return -1;
+  }
+  return static_cast<int8_t>(mode) - static_cast<int8_t>(Mode::CUSTOM_1);
+}
+
+void OutputController::begin() {
+  // The dithering runs on a timer, so it has to wait until the system
+  // is all the way up before starting.  Line up the PWM timers first, so
+  // the lights switch at their own places in the cycle (see PwmPhase.h).
+  pwm_phase_begin();
+  _dither.begin();
+  _vm.begin();
+  _assets.begin();
+  _status.begin();
+}
+
+void OutputController::write_color(unsigned int red, unsigned int green, unsigned int blue) {
+  // 10-bit PWM duties -> 16-bit levels for the dithering
+  write_color_fine(min(red, 1023u) << 6, min(green, 1023u) << 6, min(blue, 1023u) << 6);
+}
+
+void OutputController::write_color_fine(uint16_t red, uint16_t green, uint16_t blue) {
+  // Everything going to the lights comes through here.  Keep it within
+  // the power budget, then the dithering timer picks it up and does the
+  // actual PWM writes.
+  _power.limit(red, green, blue);
+  _dither.set(red, green, blue);
+}
+
 void OutputController::run_color_jingle(JingleColors color1, JingleColors color2, 
                                          JingleColors color3, int duration_ms) {
   /*
@@ -49,19 +82,11 @@ void OutputController::run_color_jingle(JingleColors color1, JingleColors color2
   This is a simple function to run a jingle of colors.
   */
 
-  // Set the colors
-  _jingle_color_1 = color1;
-  _jingle_color_2 = color2;
-  _jingle_color_3 = color3;
-
-  // Set the duration
-  _jingle_duration = duration_ms;
-
-  // Set the last jingle time
-  _last_jingle_time = millis();
+  // The status LED plays it, over whatever else it's showing
+  _status.jingle(color1, color2, color3, duration_ms);
 
   Serial.print("Jingle stop time: ");
-  Serial.println(_last_jingle_time + _jingle_duration);
+  Serial.println(clock_ms() + duration_ms);
 }
 
 void OutputController::enter_mode(ProgramState &state) {
@@ -71,19 +96,44 @@ void OutputController::enter_mode(ProgramState &state) {
   */
 
   // Reset the mode start time
-  state.last_mode_start = millis();
+  state.last_mode_start = clock_ms();
+
+#ifdef LIGHT_BENCHMARK
+  // Time this mode's first change to the lights, see LatencyBench.h
+  _dither.mark();
+#endif
   
-  unsigned int red_out = 0;
-  unsigned int green_out = 0;
-  unsigned int blue_out = 0;
-  unsigned int white_out = 0;
+  uint16_t white_fine = 0;
+
+  // A program loaded for this CUSTOM mode takes over from the built-in color
+  _animation = -1;
+  int8_t slot = program_slot(state.curr_mode);
+  if (slot >= 0 && _vm.loaded(slot)) {
+    Serial.print("Running program ");
+    Serial.println(slot + 1);
+    _vm.restart();
+    write_color(0, 0, 0);
+    run_color_jingle(JingleColors::WHITE, JingleColors::CYAN, JingleColors::WHITE);
+    return;
+  }
+
+  // Otherwise an animation named after the mode ("custom1"...) does
+  if (slot >= 0) {
+    char name[] = "custom0";
+    name[6] = '1' + slot;
+    _animation = _assets.find(name);
+    if (_animation >= 0) {
+      Serial.print("Playing animation ");
+      Serial.println(name);
+      run_color_jingle(JingleColors::WHITE, JingleColors::MAGENTA, JingleColors::WHITE);
+      return;
+    }
+  }
 
   switch(state.curr_mode) {
     case Mode::OFF:
       // Turn off all the lights
-      ledcWrite(_red_pwm_channel, 0);
-      ledcWrite(_green_pwm_channel, 0);
-      ledcWrite(_blue_pwm_channel, 0);
+      write_color(0, 0, 0);
       if (state.last_mode != Mode::OFF) {
         // Only run the jingle if we're not already off
         run_color_jingle(JingleColors::WHITE, JingleColors::WHITE, JingleColors::OFF);
@@ -91,21 +141,14 @@ void OutputController::enter_mode(ProgramState &state) {
       break;
     case Mode::SLEEP_PREP:
       // Turn off all the lights
-      ledcWrite(_red_pwm_channel, 0);
-      ledcWrite(_green_pwm_channel, 0);
-      ledcWrite(_blue_pwm_channel, 0);
+      write_color(0, 0, 0);
       run_color_jingle(JingleColors::WHITE, JingleColors::OFF, JingleColors::OFF);
       break;
     case Mode::RGB:
       // Set the lights to the RGB values
-      // Convert 12-bit to 10-bit
-      red_out = state.red_pot_val >> 2;
-      green_out = state.green_pot_val >> 2;
-      blue_out = state.blue_pot_val >> 2;
-      // Set the lights to the RGB values
-      ledcWrite(_red_pwm_channel, red_out);
-      ledcWrite(_green_pwm_channel, green_out);
-      ledcWrite(_blue_pwm_channel, blue_out);
+      write_color_fine(state.inputs.fine(Dial::RED),
+                       state.inputs.fine(Dial::GREEN),
+                       state.inputs.fine(Dial::BLUE));
       run_color_jingle(JingleColors::RED, JingleColors::GREEN, JingleColors::BLUE);
       Serial.print("Setting RGB maybe TO ");
       Serial.print(state.red_pot_val);
@@ -122,15 +165,16 @@ void OutputController::enter_mode(ProgramState &state) {
       break;
     case Mode::WHITE:
       // Set the lights to white
-      // Convert 12-bit to 10-bit
-      white_out = state.white_pot_val >> 2;
-      // Set the lights to white
-      ledcWrite(_red_pwm_channel, white_out);
-      ledcWrite(_green_pwm_channel, white_out);
-      ledcWrite(_blue_pwm_channel, white_out);
+      white_fine = state.inputs.fine(Dial::WHITE);
+      write_color_fine(white_fine, white_fine, white_fine);
 
       run_color_jingle(JingleColors::WHITE, JingleColors::OFF, JingleColors::WHITE);
       break;
+    case Mode::HSV:
+      // The dials are now hue, saturation and brightness
+      write_color_from_dials_hsv(state);
+      run_color_jingle(JingleColors::RED, JingleColors::YELLOW, JingleColors::GREEN);
+      break;
     case Mode::CUSTOM_1:
       // Set the lights to custom 1
       Serial.println("Setting custom 1");
@@ -138,61 +182,47 @@ void OutputController::enter_mode(ProgramState &state) {
       Serial.println(_red_pwm_channel);
       Serial.println(_green_pwm_channel);
       Serial.println(_blue_pwm_channel);
-      ledcWrite(_red_pwm_channel, 250);
-      ledcWrite(_green_pwm_channel, 0);
-      ledcWrite(_blue_pwm_channel, 0);
+      write_color(250, 0, 0);
       run_color_jingle(JingleColors::RED, JingleColors::OFF, JingleColors::RED);
       break;
     case Mode::CUSTOM_2:
       // Set the lights to custom 2
       Serial.println("Setting custom 2");
-      ledcWrite(_red_pwm_channel, 0);
-      ledcWrite(_green_pwm_channel, 250);
-      ledcWrite(_blue_pwm_channel, 0);
+      write_color(0, 250, 0);
       run_color_jingle(JingleColors::GREEN, JingleColors::OFF, JingleColors::GREEN);
       break;
     case Mode::CUSTOM_3:
       // Set the lights to custom 3
       Serial.println("Setting custom 3");
-      ledcWrite(_red_pwm_channel, 0);
-      ledcWrite(_green_pwm_channel, 0);
-      ledcWrite(_blue_pwm_channel, 250);
+      write_color(0, 0, 250);
       run_color_jingle(JingleColors::BLUE, JingleColors::OFF, JingleColors::BLUE);
       break;
     case Mode::CUSTOM_4:
       // Set the lights to custom 4
       Serial.println("Setting custom 4");
-      ledcWrite(_red_pwm_channel, 250);
-      ledcWrite(_green_pwm_channel, 250);
-      ledcWrite(_blue_pwm_channel, 0);
+      write_color(250, 250, 0);
       run_color_jingle(JingleColors::YELLOW, JingleColors::OFF, JingleColors::YELLOW);
       break;
     case Mode::CUSTOM_5:
       // Set the lights to custom 5
       Serial.println("Setting custom 5");
-      ledcWrite(_red_pwm_channel, 0);
-      ledcWrite(_green_pwm_channel, 250);
-      ledcWrite(_blue_pwm_channel, 250);
+      write_color(0, 250, 250);
       run_color_jingle(JingleColors::CYAN, JingleColors::OFF, JingleColors::CYAN);
       break;
     case Mode::CUSTOM_6:
       // Set the lights to custom 6
       Serial.println("Setting custom 6");
-      ledcWrite(_red_pwm_channel, 250);
-      ledcWrite(_green_pwm_channel, 0);
-      ledcWrite(_blue_pwm_channel, 250);
+      write_color(250, 0, 250);
       run_color_jingle(JingleColors::MAGENTA, JingleColors::OFF, JingleColors::MAGENTA);
       break;
     case Mode::CUSTOM_7:
       // Set the lights to custom 7
       // BEGIN THE SECRET RAINBOW!!!
       Serial.println("Setting custom 7");
-      ledcWrite(_red_pwm_channel, 800);
-      ledcWrite(_green_pwm_channel, 0);
-      ledcWrite(_blue_pwm_channel, 0);
+      write_color(800, 0, 0);
       // don't reset the rainbow if we just briefly started to doze
       if (state.last_mode != Mode::SLEEP_PREP) {
-        _rainbow_start_time = millis();
+        _rainbow_start_time = clock_ms();
       }
 
       run_color_jingle(JingleColors::MAGENTA, JingleColors::CYAN, JingleColors::YELLOW);
@@ -200,9 +230,25 @@ void OutputController::enter_mode(ProgramState &state) {
     case Mode::CUSTOM_8:
       // Set the lights to custom 8
       Serial.println("Setting custom 8");
-      ledcWrite(_red_pwm_channel, 0);
-      ledcWrite(_green_pwm_channel, 100);
-      ledcWrite(_blue_pwm_channel, 100);
+      write_color(0, 100, 100);
+      break;
+    case Mode::REMOTE:
+      // Colors come from the computer, see SerialProtocol
+      write_color(state.remote_red_val, state.remote_green_val, state.remote_blue_val);
+      run_color_jingle(JingleColors::CYAN, JingleColors::BLUE, JingleColors::CYAN);
+      break;
+    case Mode::STREAM:
+      // A new stream is starting, so don't play out leftovers from an old one
+      // (unless we just briefly started to doze)
+      if (state.last_mode != Mode::SLEEP_PREP) {
+        state.stream_player.reset();
+      }
+      run_color_jingle(JingleColors::BLUE, JingleColors::CYAN, JingleColors::BLUE);
+      break;
+    case Mode::AUDIO:
+      // Lights follow the music from here on, see process_mode
+      Serial.println("Setting audio mode");
+      run_color_jingle(JingleColors::RED, JingleColors::GREEN, JingleColors::RED);
       break;
     case Mode::INVALID:
       // Set the lights to invalid
@@ -216,38 +262,29 @@ void OutputController::process_mode(ProgramState &state) {
   This should be called in the main loop.
   */
 
-  // Regardless of mode, check if we're in the jingle!
-  // Also, check if we're just after it, to turn it off
-  unsigned long curr_time = millis();
-  unsigned int white_out = 0;
-  unsigned int red_out = 0;
-  unsigned int green_out = 0;
-  unsigned int blue_out = 0;
-  if (curr_time - _last_jingle_time < _jingle_duration + 100) {
-    // We're in the jingle, set the lights to the jingle colors
-    JingleColors curr_color = JingleColors::OFF;
-    if (curr_time - _last_jingle_time < _jingle_duration / 3) {
-      curr_color = _jingle_color_1;
-    } else if (curr_time - _last_jingle_time < 2 * _jingle_duration / 3) {
-      curr_color = _jingle_color_2;
-    } else if (curr_time - _last_jingle_time < _jingle_duration) {
-      curr_color = _jingle_color_3;
-    }
-    if (static_cast<unsigned int>(curr_color) & static_cast<unsigned int>(JingleColors::RED)) {
-      digitalWrite(LED_RED, LOW);
-    } else {
-      digitalWrite(LED_RED, HIGH);
-    }
-    if (static_cast<unsigned int>(curr_color) & static_cast<unsigned int>(JingleColors::GREEN)) {
-      digitalWrite(LED_GREEN, LOW);
-    } else {
-      digitalWrite(LED_GREEN, HIGH);
-    }
-    if (static_cast<unsigned int>(curr_color) & static_cast<unsigned int>(JingleColors::BLUE)) {
-      digitalWrite(LED_BLUE, LOW);
-    } else {
-      digitalWrite(LED_BLUE, HIGH);
-    }
+  uint64_t curr_time = clock_ms();
+  uint16_t white_fine = 0;
+
+  // Count up the energy used since last time
+  _power.account(state.curr_mode, clock_us32());
+
+  // The status LED warns that the lights are dozing off, and plays any
+  // jingle.  It only touches the pins when something changes.
+  _status.show(StatusLayer::DOZE, state.curr_mode == Mode::SLEEP_PREP);
+  _status.update();
+
+  int8_t slot = program_slot(state.curr_mode);
+  if (slot >= 0 && _vm.loaded(slot)) {
+    // One pass of the program, cut short if it runs too long
+    _vm.run(slot, state.inputs, static_cast<uint32_t>(curr_time - state.last_mode_start));
+    write_color_fine(_vm.color().red, _vm.color().green, _vm.color().blue);
+    return;
+  }
+  if (slot >= 0 && _animation >= 0) {
+    RgbColor color;
+    _assets.sample(_animation, static_cast<uint32_t>(curr_time - state.last_mode_start), color);
+    write_color_fine(color.red, color.green, color.blue);
+    return;
   }
 
   switch(state.curr_mode) {
@@ -259,23 +296,20 @@ void OutputController::process_mode(ProgramState &state) {
       break;
     case Mode::RGB:
       // Set the lights to the RGB values
-      // Convert 12-bit to 10-bit
-      red_out = state.red_pot_val >> 2;
-      green_out = state.green_pot_val >> 2;
-      blue_out = state.blue_pot_val >> 2;
-      // Set the lights to the RGB values
-      ledcWrite(_red_pwm_channel, red_out);
-      ledcWrite(_green_pwm_channel, green_out);
-      ledcWrite(_blue_pwm_channel, blue_out);
+      // The smoothing gives us more than 12 bits, and the dithering
+      // can show more than 10, so use the fine values all the way
+      write_color_fine(state.inputs.fine(Dial::RED),
+                       state.inputs.fine(Dial::GREEN),
+                       state.inputs.fine(Dial::BLUE));
       break;
     case Mode::WHITE:
       // Set the lights to white
-      // Convert 12-bit to 10-bit
-      white_out = state.white_pot_val >> 2;
-      // Set the lights to white
-      ledcWrite(_red_pwm_channel, white_out);
-      ledcWrite(_green_pwm_channel, white_out);
-      ledcWrite(_blue_pwm_channel, white_out);
+      white_fine = state.inputs.fine(Dial::WHITE);
+      write_color_fine(white_fine, white_fine, white_fine);
+      break;
+    case Mode::HSV:
+      // Red dial is hue, green is saturation, blue is brightness
+      write_color_from_dials_hsv(state);
       break;
     case Mode::CUSTOM_1:
       // Set the lights to custom 1
@@ -303,47 +337,58 @@ void OutputController::process_mode(ProgramState &state) {
     case Mode::CUSTOM_8:
       // Set the lights to custom 8
       break;
+    case Mode::REMOTE:
+      // The computer may have sent new colors since last time
+      write_color(state.remote_red_val, state.remote_green_val, state.remote_blue_val);
+      break;
+    case Mode::STREAM: {
+      // Frames from the computer, played out on our clock
+      uint16_t stream_red = 0;
+      uint16_t stream_green = 0;
+      uint16_t stream_blue = 0;
+      state.stream_player.render(clock_us32(), stream_red, stream_green, stream_blue);
+      write_color(stream_red, stream_green, stream_blue);
+      break;
+    }
+    case Mode::AUDIO:
+      // Bass is red, middle is green, treble is blue
+      // The white dial sets the overall brightness
+      white_fine = state.inputs.fine(Dial::WHITE);
+      write_color_fine((static_cast<uint32_t>(state.audio_bass_val) * white_fine) >> 10,
+                       (static_cast<uint32_t>(state.audio_mid_val) * white_fine) >> 10,
+                       (static_cast<uint32_t>(state.audio_treble_val) * white_fine) >> 10);
+      break;
     case Mode::INVALID:
       // Set the lights to invalid
       break;
   }
 }
 
-void OutputController::set_rainbow(unsigned long time_diff, uint16_t max_brightness) {
+void OutputController::write_color_from_dials_hsv(ProgramState &state) {
+  HsvColor hsv;
+  // 16-bit dial values -> 0-1535 hue and 0-255 saturation
+  hsv.hue = (static_cast<uint32_t>(state.inputs.fine(Dial::RED)) * HUE_STEPS) >> 16;
+  hsv.sat = state.inputs.fine(Dial::GREEN) >> 8;
+  hsv.val = state.inputs.fine(Dial::BLUE);
+  // Turning the hue dial shouldn't make the lights brighter or dimmer
+  RgbColor rgb = _hue_brightness.to_rgb(hsv);
+  write_color_fine(rgb.red, rgb.green, rgb.blue);
+}
+
+void OutputController::set_rainbow(uint64_t time_diff, uint16_t max_brightness) {
   /*
   Set the lights to a rainbow pattern.
-  This is a simple function to set the lights to a rainbow pattern.
+  We go once around the color wheel per rainbow duration, keeping every
+  color about equally bright so it doesn't pulse as it goes.
   */
-  time_diff = time_diff % _rainbow_duration;
-  // Set the colors
-  int red = 0;
-  int green = 0;
-  int blue = 0;
-  // Start at full red, moving towards green
-  if (time_diff < _rainbow_duration/3){
-    // Set the colors
-    red = max_brightness - (max_brightness * time_diff / (_rainbow_duration/3));
-    green = max_brightness * time_diff / (_rainbow_duration/3);
-    blue = 0;
-    }
-  // Then move towards blue
-  else if (time_diff < 2 * _rainbow_duration/3){
-    // Set the colors
-    red = 0;
-    green = max_brightness - (max_brightness * (time_diff - _rainbow_duration/3) / (_rainbow_duration/3));
-    blue = max_brightness * (time_diff - _rainbow_duration/3) / (_rainbow_duration/3);
-  }
-  // Finally move back to red
-  else {
-    // Set the colors
-    red = max_brightness * (time_diff - 2 * _rainbow_duration/3) / (_rainbow_duration/3);
-    green = 0;
-    blue = max_brightness - (max_brightness * (time_diff - 2 * _rainbow_duration/3) / (_rainbow_duration/3));
-  }
-
+  // Hue step per millisecond was worked out in the constructor, so this
+  // is a multiply and a shift rather than a pile of divisions
+  HsvColor hsv;
+  hsv.hue = ((time_diff * _rainbow_hue_per_ms) >> 16) % HUE_STEPS;
+  hsv.sat = 255;
+  hsv.val = min(max_brightness, static_cast<uint16_t>(1023)) << 6;
+  RgbColor rgb = _hue_brightness.to_rgb(hsv);
 
   // Set the colors
-  ledcWrite(_red_pwm_channel, red);
-  ledcWrite(_green_pwm_channel, green);
-  ledcWrite(_blue_pwm_channel, blue);
+  write_color_fine(rgb.red, rgb.green, rgb.blue);
 }
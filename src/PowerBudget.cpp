@@ -0,0 +1,75 @@
+#include <Arduino.h>
+#include "PowerBudget.h"
+
+/*
+Power model, limiter and energy count for the light strip, see PowerBudget.h.
+*/
+
+// mW * us -> mWh
+const uint64_t NJ_PER_MWH = 3600000000ULL;
+
+PowerBudget::PowerBudget(uint32_t budget_mw,
+                         uint16_t red_full_mw,
+                         uint16_t green_full_mw,
+                         uint16_t blue_full_mw)
+  : _budget_mw(budget_mw),
+    _draw_mw(0),
+    _limiting(false),
+    _limit_events(0),
+    _last_account_us(0),
+    _energy_nj(0) {
+  _full_duty_mw[0] = red_full_mw;
+  _full_duty_mw[1] = green_full_mw;
+  _full_duty_mw[2] = blue_full_mw;
+  for (uint8_t i = 0; i < MODE_COUNT; i++) {
+    _mode_energy_nj[i] = 0;
+  }
+}
+
+bool PowerBudget::limit(uint16_t &red, uint16_t &green, uint16_t &blue) {
+  // Level (as 12 bits, plenty here) times milliwatts at full duty, so
+  // >> 12 gives milliwatts.  Stays inside 32 bits for any coefficients.
+  uint32_t draw_mw = ((red >> 4) * static_cast<uint32_t>(_full_duty_mw[0]) +
+                      (green >> 4) * static_cast<uint32_t>(_full_duty_mw[1]) +
+                      (blue >> 4) * static_cast<uint32_t>(_full_duty_mw[2])) >> 12;
+
+  bool over_budget = _budget_mw != 0 && draw_mw > _budget_mw;
+  if (over_budget) {
+    // Scale everything by budget / draw.  This is the only division, and
+    // it only happens while we're actually limiting.
+    uint32_t scale = (static_cast<uint64_t>(_budget_mw) << 16) / draw_mw;
+    red = (static_cast<uint32_t>(red) * scale) >> 16;
+    green = (static_cast<uint32_t>(green) * scale) >> 16;
+    blue = (static_cast<uint32_t>(blue) * scale) >> 16;
+    draw_mw = _budget_mw;
+    if (!_limiting) {
+      _limit_events++;
+    }
+  }
+  _limiting = over_budget;
+  _draw_mw = draw_mw;
+  return over_budget;
+}
+
+void PowerBudget::account(Mode mode, uint32_t now_us) {
+  // Whatever we were drawing has been on since the last call
+  uint64_t energy_nj = static_cast<uint64_t>(_draw_mw) * (now_us - _last_account_us);
+  _last_account_us = now_us;
+  _energy_nj += energy_nj;
+  uint8_t mode_index = static_cast<uint8_t>(mode);
+  if (mode_index < MODE_COUNT) {
+    _mode_energy_nj[mode_index] += energy_nj;
+  }
+}
+
+uint32_t PowerBudget::get_energy_mwh() const {
+  return _energy_nj / NJ_PER_MWH;
+}
+
+uint32_t PowerBudget::get_mode_energy_mwh(Mode mode) const {
+  uint8_t mode_index = static_cast<uint8_t>(mode);
+  if (mode_index >= MODE_COUNT) {
+    return 0;
+  }
+  return _mode_energy_nj[mode_index] / NJ_PER_MWH;
+}
@@ -1,10 +1,16 @@
 #include <Arduino.h>
+#include "Clock.h"
+#include "FlightRecorder.h"
 #include "ProgramState.h"
 
 /*
 Program State class and functions!
 */
 
+// Size budget, this holds all the dials (with their velocity windows and
+// noise estimates), sensors, the stream buffer and the latest input snapshot
+static_assert(sizeof(ProgramState) <= 1776, "ProgramState is over its size budget");
+
 ProgramState::ProgramState(unsigned int red_pot_pin, 
                            unsigned int green_pot_pin, 
                            unsigned int blue_pot_pin, 
@@ -12,9 +18,8 @@ ProgramState::ProgramState(unsigned int red_pot_pin,
                            Mode max_usable_mode,
                            unsigned int wake_to_doze_time,
                            unsigned int doze_to_sleep_time) {
-  last_cycle_start = millis();
-  last_motion_detected = millis();
-  last_mode_start = millis();
+  last_motion_detected = clock_ms();
+  last_mode_start = clock_ms();
   _red_pot_pin = red_pot_pin;
   _green_pot_pin = green_pot_pin;
   _blue_pot_pin = blue_pot_pin;
@@ -23,10 +28,10 @@ ProgramState::ProgramState(unsigned int red_pot_pin,
 
 
   // initialize pins
-  red_pot = SmoothAnalogInput(_red_pot_pin);
-  green_pot = SmoothAnalogInput(_green_pot_pin);
-  blue_pot = SmoothAnalogInput(_blue_pot_pin);
-  white_pot = SmoothAnalogInput(_white_pot_pin);
+  red_pot = RedPotInput(_red_pot_pin);
+  green_pot = GreenPotInput(_green_pot_pin);
+  blue_pot = BluePotInput(_blue_pot_pin);
+  white_pot = WhitePotInput(_white_pot_pin);
 
   // sleep things
   _wake_to_doze_time = wake_to_doze_time; // 10 seconds
@@ -35,6 +40,14 @@ ProgramState::ProgramState(unsigned int red_pot_pin,
   // initialize logic mode
   curr_mode = Mode::OFF;
   last_mode = Mode::OFF;
+  mode_change_count = 0;
+  remote_red_val = 0;
+  remote_green_val = 0;
+  remote_blue_val = 0;
+  audio_bass_val = 0;
+  audio_mid_val = 0;
+  audio_treble_val = 0;
+  memset(&inputs, 0, sizeof(inputs));
 
   // initialize motion sensors
   motion_detector_a = MotionSensorState(A5);
@@ -43,12 +56,12 @@ ProgramState::ProgramState(unsigned int red_pot_pin,
 
 }
 
-bool ProgramState::read_pot_values() {
-  red_pot_val = red_pot.update_and_get_smoothed();
-  green_pot_val = green_pot.update_and_get_smoothed();
-  blue_pot_val = blue_pot.update_and_get_smoothed();
-  white_pot_val = white_pot.update_and_get_smoothed();
-  return true;
+void ProgramState::take_inputs(const InputSnapshot &snapshot) {
+  inputs = snapshot;
+  red_pot_val = inputs.value(Dial::RED);
+  green_pot_val = inputs.value(Dial::GREEN);
+  blue_pot_val = inputs.value(Dial::BLUE);
+  white_pot_val = inputs.value(Dial::WHITE);
 }
 
 bool ProgramState::update_motion_sensors() {
@@ -59,9 +72,12 @@ bool ProgramState::update_motion_sensors() {
 }
 
 Mode ProgramState::update_mode(Mode new_mode) {
+  flight_record(FlightEventType::MODE_CHANGE, static_cast<uint8_t>(new_mode),
+                static_cast<uint8_t>(curr_mode));
   last_mode = curr_mode;
   curr_mode = new_mode;
-  last_mode_start = millis();
+  last_mode_start = clock_ms();
+  mode_change_count++;
   return curr_mode;
 }
 
@@ -92,20 +108,19 @@ void ProgramState::manual_motion_update() {
   // for confirming occupancy.  When a button is triggered,
   // we'll reset the last motion detected time.
   // Note: we won't do this for the off button
-  last_motion_detected = millis();
+  last_motion_detected = clock_ms();
 }
 
-bool ProgramState::handle_sleep() {
-  unsigned long curr_time = millis();
+bool ProgramState::handle_sleep(bool occupied) {
+  uint64_t curr_time = clock_ms();
   // If we haven't seen motion in a while, prepare for sleep
-  bool in_motion_a = motion_detector_a.occupied();
-  bool in_motion_b = motion_detector_b.occupied();
-  bool in_motion_c = motion_detector_c.occupied();
-  if (in_motion_a || in_motion_b || in_motion_c) {
+  if (occupied) {
     last_motion_detected = curr_time;
   }
   if (curr_mode != Mode::SLEEP_PREP && curr_mode != Mode::OFF) {
     if (curr_time - last_motion_detected > _wake_to_doze_time) {
+      flight_record(FlightEventType::SLEEP, static_cast<uint8_t>(FlightSleepStep::DOZE),
+                    static_cast<uint8_t>(curr_mode));
       update_mode(Mode::SLEEP_PREP);
       Serial.println("Going to sleep prep mode");
       return true;
@@ -115,15 +130,50 @@ bool ProgramState::handle_sleep() {
   if (curr_mode == Mode::SLEEP_PREP) {
     if (curr_time - last_motion_detected > _doze_to_sleep_time + _wake_to_doze_time) {
       // Go to sleep for good now!
+      flight_record(FlightEventType::SLEEP, static_cast<uint8_t>(FlightSleepStep::SLEEP),
+                    static_cast<uint8_t>(curr_mode));
       update_mode(Mode::OFF);
       Serial.println("Going to sleep mode from sleep prep");
       return true;
     }
-    if (in_motion_a || in_motion_b || in_motion_c) {
+    if (occupied) {
       // Go back to the last mode
+      flight_record(FlightEventType::SLEEP, static_cast<uint8_t>(FlightSleepStep::WAKE),
+                    static_cast<uint8_t>(curr_mode));
       update_mode(last_mode);
       return true;
     }
   }
   return false;
-}
\ No newline at end of file
+}
+
+bool ProgramState::check_dials(float wake_speed, float grab_speed) {
+  // If dial speed is above threshold, either way, prevent sleep
+  if (fabsf(inputs.speed(Dial::RED)) > wake_speed ||
+      fabsf(inputs.speed(Dial::GREEN)) > wake_speed ||
+      fabsf(inputs.speed(Dial::BLUE)) > wake_speed ||
+      fabsf(inputs.speed(Dial::WHITE)) > wake_speed) {
+    manual_motion_update();
+  }
+
+  // Check for mode grab, on the fitted speed, which catches a turn sooner
+  // and isn't fooled by a couple of spikes (tools/velocity_compare.py)
+  if (curr_mode == Mode::OFF) {
+    return false;
+  }
+  // HSV mode uses the same dials, so don't grab it away from itself
+  if (curr_mode != Mode::RGB && curr_mode != Mode::HSV) {
+    if (fabsf(inputs.velocity(Dial::RED)) > grab_speed ||
+        fabsf(inputs.velocity(Dial::GREEN)) > grab_speed ||
+        fabsf(inputs.velocity(Dial::BLUE)) > grab_speed) {
+      update_mode(Mode::RGB);
+      return true;
+    }
+  } else if (curr_mode != Mode::WHITE) {
+    if (fabsf(inputs.velocity(Dial::WHITE)) > grab_speed) {
+      update_mode(Mode::WHITE);
+      return true;
+    }
+  }
+  return false;
+}
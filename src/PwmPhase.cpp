@@ -0,0 +1,113 @@
+#include <Arduino.h>
+#include <driver/ledc.h>
+#include <soc/ledc_struct.h>
+#include "PwmPhase.h"
+
+/*
+Staggered light PWM and quiet-phase ADC reading, see PwmPhase.h.
+*/
+
+const uint16_t LIGHT_PWM_MASK = LIGHT_PWM_PERIOD - 1;
+
+static constexpr uint16_t us_to_counts(uint16_t us) {
+  return static_cast<uint32_t>(us) * LIGHT_PWM_PERIOD * LIGHT_PWM_FREQ / 1000000;
+}
+
+// How close to an edge a reading can't be.  The ringing after an edge lasts
+// a microsecond or two, and the sampling itself takes about one.
+const uint16_t PWM_QUIET_BEFORE_COUNTS = us_to_counts(1);
+const uint16_t PWM_QUIET_AFTER_COUNTS = us_to_counts(2);
+// Roughly how long adc1_get_raw() takes to get to the sampling.  Only a
+// guess so far: the benchmark firmware sweeps it (adc_noise_lead_* in
+// AdcNoiseBench.h), and the quietest lead from a board belongs here.
+const uint16_t PWM_ADC_LEAD_COUNTS = us_to_counts(3);
+
+static bool pwm_ready = false;
+static bool pwm_stagger = true;
+static bool pwm_sync = true;
+static uint16_t pwm_adc_lead = PWM_ADC_LEAD_COUNTS;
+// What each light's channel was last given, the edges are worked out from these
+static volatile uint16_t pwm_duties[LIGHT_PWM_CHANNELS] = {0, 0, 0};
+static volatile uint16_t pwm_hpoints[LIGHT_PWM_CHANNELS] = {0, 0, 0};
+
+// The Arduino core puts channels on timers in pairs
+static ledc_timer_t timer_of(uint8_t channel) {
+  return static_cast<ledc_timer_t>((channel / 2) % LEDC_TIMER_MAX);
+}
+
+// Where red's timer is in the cycle, they all count in step after begin
+static inline uint16_t pwm_count() {
+  return LEDC.timer_group[0].timer[timer_of(0)].value.timer_cnt & LIGHT_PWM_MASK;
+}
+
+static bool near_edge(uint16_t at) {
+  for (uint8_t i = 0; i < LIGHT_PWM_CHANNELS; i++) {
+    uint16_t duty = pwm_duties[i];
+    if (duty == 0 || duty >= LIGHT_PWM_PERIOD) {
+      continue;  // off or full on, never switches
+    }
+    uint16_t edges[2] = {pwm_hpoints[i], static_cast<uint16_t>((pwm_hpoints[i] + duty) & LIGHT_PWM_MASK)};
+    for (uint16_t edge : edges) {
+      uint16_t since = (at - edge) & LIGHT_PWM_MASK;
+      if (since < PWM_QUIET_AFTER_COUNTS || since > LIGHT_PWM_PERIOD - PWM_QUIET_BEFORE_COUNTS) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void pwm_phase_begin() {
+  // Stop the timers, zero them, and start them again back to back, which
+  // puts them within a count of each other
+  for (uint8_t channel = 0; channel < LIGHT_PWM_CHANNELS; channel++) {
+    ledc_timer_pause(LEDC_LOW_SPEED_MODE, timer_of(channel));
+  }
+  for (uint8_t channel = 0; channel < LIGHT_PWM_CHANNELS; channel++) {
+    ledc_timer_rst(LEDC_LOW_SPEED_MODE, timer_of(channel));
+  }
+  for (uint8_t channel = 0; channel < LIGHT_PWM_CHANNELS; channel++) {
+    ledc_timer_resume(LEDC_LOW_SPEED_MODE, timer_of(channel));
+  }
+  pwm_ready = true;
+}
+
+void pwm_phase_write(uint8_t light, uint8_t channel, uint16_t duty) {
+  // Full on is one past the top, the same as ledcWrite() does it
+  uint16_t hardware_duty = duty >= LIGHT_PWM_MASK ? LIGHT_PWM_PERIOD : duty;
+  uint16_t hpoint = pwm_stagger ? light * LIGHT_PWM_PERIOD / LIGHT_PWM_CHANNELS : 0;
+  ledc_mode_t mode = static_cast<ledc_mode_t>(channel / 8);
+  ledc_channel_t ledc_channel = static_cast<ledc_channel_t>(channel % 8);
+  ledc_set_duty_with_hpoint(mode, ledc_channel, hardware_duty, hpoint);
+  ledc_update_duty(mode, ledc_channel);
+  pwm_duties[light] = hardware_duty;
+  pwm_hpoints[light] = hpoint;
+}
+
+void pwm_phase_wait_quiet() {
+  if (!pwm_ready || !pwm_sync) {
+    return;
+  }
+  // Six edges and their margins never cover the whole period, but count
+  // how far the timer has gone anyway, so this can't hang
+  uint16_t last = pwm_count();
+  uint16_t waited = 0;
+  while (near_edge((last + pwm_adc_lead) & LIGHT_PWM_MASK) && waited < LIGHT_PWM_PERIOD) {
+    uint16_t now = pwm_count();
+    waited += (now - last) & LIGHT_PWM_MASK;
+    last = now;
+  }
+}
+
+void pwm_phase_configure(bool stagger, bool sync) {
+  pwm_stagger = stagger;
+  pwm_sync = sync;
+}
+
+void pwm_phase_set_adc_lead_us(uint8_t us) {
+  pwm_adc_lead = us_to_counts(us);
+}
+
+void pwm_phase_reset_adc_lead() {
+  pwm_adc_lead = PWM_ADC_LEAD_COUNTS;
+}
@@ -0,0 +1,212 @@
+#ifdef LIGHT_BENCHMARK
+
+#include <Arduino.h>
+#include <math.h>
+#include "QualityBench.h"
+
+/*
+Flicker and response checks for the dial-to-light chain, see QualityBench.h.
+*/
+
+const uint16_t QUALITY_WARMUP_MS = 1000;  // settle at the starting level, not logged
+const uint16_t QUALITY_MAX_MS = 2000;
+const uint8_t QUALITY_TICKS_PER_MS = 1000 / DITHER_TICK_US;
+const uint16_t QUALITY_LOG_TICKS = QUALITY_MAX_MS * QUALITY_TICKS_PER_MS;
+const uint8_t QUALITY_CYCLE_TICKS = 1 << DITHER_FRACTION_BITS;  // one whole dither pattern
+const float QUALITY_DUTY_PER_COUNT = 1024.0f / 4096.0f;  // 12-bit dial to 10-bit duty
+
+// Every duty the dithering wrote, one per tick.  20 KB, benchmark firmware only.
+static uint16_t quality_log[QUALITY_LOG_TICKS];
+static uint32_t quality_noise_state;
+
+typedef float (*QualityPattern)(uint16_t ms);
+
+// Roughly Gaussian, from four uniform numbers, with a fixed seed
+static float noise(float sigma) {
+  float sum = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    // xorshift32
+    quality_noise_state ^= quality_noise_state << 13;
+    quality_noise_state ^= quality_noise_state >> 17;
+    quality_noise_state ^= quality_noise_state << 5;
+    sum += static_cast<float>(quality_noise_state) / 2147483648.0f - 1.0f;
+  }
+  // Four uniforms from -1 to 1 add up to a variance of 4/3
+  return sum * sigma * 0.866f;
+}
+
+///////////////////////////////////////////////////////////
+// The dial patterns, in ADC counts
+///////////////////////////////////////////////////////////
+
+static float pattern_step(uint16_t ms) {
+  return (ms < 500 ? 1000.0f : 3000.0f) + noise(2);
+}
+
+static float pattern_ramp(uint16_t ms) {
+  float level = 1000.0f;
+  if (ms >= 1500) {
+    level = 3000.0f;
+  } else if (ms >= 500) {
+    level = 1000.0f + 2.0f * (ms - 500);
+  }
+  return level + noise(2);
+}
+
+// 50 ms of heavy noise every 400 ms
+static float pattern_noise_burst(uint16_t ms) {
+  return 2000.0f + noise(ms % 400 < 50 ? 24 : 2);
+}
+
+static float pattern_spikes(uint16_t ms) {
+  return 1500.0f + (ms % 97 == 50 ? 800.0f : 0.0f) + noise(2);
+}
+
+// Rectified mains ripple, and a short dip every 250 ms as something else draws power
+static float pattern_noisy_supply(uint16_t ms) {
+  float ripple = 6.0f * sinf(2.0f * M_PI * 100.0f * ms / 1000.0f);
+  float dip = ms % 250 < 3 ? -150.0f : 0.0f;
+  return 2000.0f + ripple + dip + noise(3);
+}
+
+///////////////////////////////////////////////////////////
+// Running the chain
+///////////////////////////////////////////////////////////
+
+// One millisecond: a dial reading, a pass of process_mode(), and the dither ticks in between
+static void step_chain(ProgramState &state, OutputController &output, float reading, uint16_t* log) {
+  float clamped = constrain(reading, 0.0f, 4095.0f);
+  state.white_pot.add_reading(static_cast<uint16_t>(clamped + 0.5f), 1000);
+  state.inputs.dial_fine[static_cast<uint8_t>(Dial::WHITE)] = state.white_pot.get_smoothed_fine();
+  output.process_mode(state);
+  for (uint8_t i = 0; i < QUALITY_TICKS_PER_MS; i++) {
+    output.dither().tick();
+    if (log != nullptr) {
+      log[i] = output.dither().written(0);
+    }
+  }
+}
+
+static void run_pattern(ProgramState &state, OutputController &output, QualityPattern pattern, uint16_t length_ms) {
+  quality_noise_state = 2463534242u;
+  for (uint16_t ms = 0; ms < QUALITY_WARMUP_MS; ms++) {
+    step_chain(state, output, pattern(0), nullptr);
+  }
+  for (uint16_t ms = 0; ms < length_ms; ms++) {
+    step_chain(state, output, pattern(ms), &quality_log[ms * QUALITY_TICKS_PER_MS]);
+  }
+}
+
+///////////////////////////////////////////////////////////
+// Measuring the log
+///////////////////////////////////////////////////////////
+
+// Average duty over one dither pattern centered on this tick, what the eye sees
+static float cycle_mean(uint16_t tick, uint16_t length_ms) {
+  int32_t start = static_cast<int32_t>(tick) - QUALITY_CYCLE_TICKS / 2;
+  int32_t last_start = length_ms * QUALITY_TICKS_PER_MS - QUALITY_CYCLE_TICKS;
+  start = constrain(start, 0, last_start);
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < QUALITY_CYCLE_TICKS; i++) {
+    sum += quality_log[start + i];
+  }
+  return static_cast<float>(sum) / QUALITY_CYCLE_TICKS;
+}
+
+static float window_mean(uint16_t from_ms, uint16_t to_ms) {
+  uint32_t sum = 0;
+  for (uint32_t i = from_ms * QUALITY_TICKS_PER_MS; i < to_ms * QUALITY_TICKS_PER_MS; i++) {
+    sum += quality_log[i];
+  }
+  return static_cast<float>(sum) / ((to_ms - from_ms) * QUALITY_TICKS_PER_MS);
+}
+
+// First tick from here on where the light reaches this level, going up
+static uint16_t first_reaching(float level, uint16_t from_ms, uint16_t length_ms) {
+  uint16_t end = length_ms * QUALITY_TICKS_PER_MS;
+  for (uint16_t tick = from_ms * QUALITY_TICKS_PER_MS; tick < end; tick++) {
+    if (cycle_mean(tick, length_ms) >= level) {
+      return tick;
+    }
+  }
+  return end;
+}
+
+static void print_metric(const char* pattern, const char* metric, float value) {
+  Serial.print("QUALITY,");
+  Serial.print(pattern);
+  Serial.print(",");
+  Serial.print(metric);
+  Serial.print(",");
+  Serial.println(value, 4);
+}
+
+// Flicker index and percent modulation over a still stretch, one value per dither pattern
+static void print_flicker(const char* pattern, uint16_t from_ms, uint16_t to_ms) {
+  float mean = window_mean(from_ms, to_ms);
+  float above = 0;
+  float total = 0;
+  float low = 1e9f;
+  float high = 0;
+  for (uint32_t tick = from_ms * QUALITY_TICKS_PER_MS; tick + QUALITY_CYCLE_TICKS <= to_ms * QUALITY_TICKS_PER_MS;
+       tick += QUALITY_CYCLE_TICKS) {
+    float level = cycle_mean(tick + QUALITY_CYCLE_TICKS / 2, to_ms);
+    above += max(level - mean, 0.0f);
+    total += level;
+    low = min(low, level);
+    high = max(high, level);
+  }
+  print_metric(pattern, "flicker_index", total > 0 ? above / total : 0);
+  print_metric(pattern, "modulation_pct", high + low > 0 ? 100.0f * (high - low) / (high + low) : 0);
+}
+
+///////////////////////////////////////////////////////////
+
+void run_quality_benchmarks(ProgramState &state, OutputController &output) {
+  state.update_mode(Mode::WHITE);
+
+  // Step at 500 ms
+  run_pattern(state, output, pattern_step, 1500);
+  float before = window_mean(300, 500);
+  float after = window_mean(1200, 1500);
+  float size = after - before;
+  uint16_t tick_10 = first_reaching(before + 0.1f * size, 500, 1500);
+  uint16_t tick_90 = first_reaching(before + 0.9f * size, 500, 1500);
+  float peak = 0;
+  for (uint16_t tick = 500 * QUALITY_TICKS_PER_MS; tick < 1500 * QUALITY_TICKS_PER_MS; tick++) {
+    peak = max(peak, cycle_mean(tick, 1500));
+  }
+  print_metric("step", "rise_ms", static_cast<float>(tick_90 - tick_10) / QUALITY_TICKS_PER_MS);
+  print_metric("step", "overshoot_pct", size > 0 ? max(100.0f * (peak - after) / size, 0.0f) : 0);
+  print_flicker("step", 1200, 1500);
+
+  // Ramp from 500 to 1500 ms, halfway up at 1000 ms
+  run_pattern(state, output, pattern_ramp, 2000);
+  float halfway = (window_mean(300, 500) + window_mean(1800, 2000)) / 2;
+  uint16_t tick_half = first_reaching(halfway, 500, 2000);
+  print_metric("ramp", "lag_ms", static_cast<float>(tick_half) / QUALITY_TICKS_PER_MS - 1000.0f);
+
+  run_pattern(state, output, pattern_noise_burst, 2000);
+  print_flicker("noise_burst", 0, 2000);
+
+  // A spike at 50 ms, 147 ms and so on
+  run_pattern(state, output, pattern_spikes, 1000);
+  float level = window_mean(0, 1000);
+  float worst = 0;
+  for (uint16_t tick = 50 * QUALITY_TICKS_PER_MS; tick < 1000 * QUALITY_TICKS_PER_MS; tick++) {
+    worst = max(worst, fabsf(cycle_mean(tick, 1000) - level));
+  }
+  print_metric("spikes", "spike_leak_pct", 100.0f * worst / (800.0f * QUALITY_DUTY_PER_COUNT));
+  print_flicker("spikes", 0, 1000);
+
+  run_pattern(state, output, pattern_noisy_supply, 2000);
+  print_flicker("noisy_supply", 0, 2000);
+
+  // Leave the lights dark again, the real dithering only writes what changes
+  state.inputs.dial_fine[static_cast<uint8_t>(Dial::WHITE)] = 0;
+  output.process_mode(state);
+  output.dither().tick();
+  state.update_mode(Mode::OFF);
+}
+
+#endif
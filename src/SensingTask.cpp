@@ -0,0 +1,244 @@
+#include <Arduino.h>
+#include <esp_task_wdt.h>
+#include "Clock.h"
+#include "SensingTask.h"
+
+/*
+The input side of the two-core pipeline, see SensingTask.h.
+*/
+
+const uint32_t SENSING_STACK_BYTES = 4096;
+const UBaseType_t SENSING_PRIORITY = 3;  // above the audio analysis
+const uint8_t BUTTONS_IDLE_BIT = 1 << DIAL_COUNT;
+
+SensingTask::SensingTask(ProgramState &state, DebounceInput* buttons, uint8_t period_ms)
+  : _state(state),
+    _buttons(buttons),
+    _period_ms(period_ms),
+    _running(false),
+    _worst_pass_us(0),
+    _dial_reads(0),
+    _button_polls(0),
+    _buttons_busy_ms(0),
+    _last_button_poll_ms(0),
+    _idle_inputs(0),
+    _filter_requests_seen(0),
+    _reads(0),
+    _read_retries(0),
+    _last_latency_pass(0),
+    _last_latency_us(0),
+    _worst_latency_us(0),
+    _latency_count(0),
+    _latency_total_us(0) {
+  memset(&_working, 0, sizeof(_working));
+  memset(&_filter_applied, 0, sizeof(_filter_applied));
+  memset(&_filter_wanted, 0, sizeof(_filter_wanted));
+}
+
+bool SensingTask::begin() {
+  if (_running) {
+    return true;
+  }
+  // Count from here, none of what was read before it started in the stats
+  _reads = 0;
+  _read_retries = 0;
+  _worst_latency_us = 0;
+  _latency_count = 0;
+  _latency_total_us = 0;
+  _dial_reads = 0;
+  _button_polls = 0;
+  // Start with the buttons as they are, so nothing held down at power-up
+  // counts as a press
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    if (_buttons[i].isActive()) {
+      _working.buttons_down |= 1 << i;
+    }
+  }
+  // Have a real snapshot ready before loop() first asks
+  sense();
+
+  // Core 0, leaving core 1 to the Arduino loop()
+  _running = xTaskCreatePinnedToCore(task_entry, "sensing", SENSING_STACK_BYTES, this,
+                                     SENSING_PRIORITY, nullptr, 0) == pdPASS;
+  return _running;
+}
+
+void SensingTask::task_entry(void* sensing) {
+  static_cast<SensingTask*>(sensing)->run();
+}
+
+void SensingTask::run() {
+  // A stuck sensing task would freeze the dials without anyone noticing,
+  // so it gets the same watchdog as loop() (if LoopMonitor started it)
+  bool watched = esp_task_wdt_add(NULL) == ESP_OK;
+  TickType_t last_wake = xTaskGetTickCount();
+  TickType_t period = pdMS_TO_TICKS(_period_ms);
+  if (period == 0) {
+    period = 1;
+  }
+  while (true) {
+    sense();
+    if (watched) {
+      esp_task_wdt_reset();
+    }
+    vTaskDelayUntil(&last_wake, period);
+  }
+}
+
+// The dials can each have a different filter type, so no common pointer
+template <class Pot>
+static bool read_dial(Pot &pot, InputSnapshot &snapshot, Dial dial) {
+  uint8_t i = static_cast<uint8_t>(dial);
+  if (!pot.update()) {
+    return false;  // nothing new, and the snapshot still has the last one
+  }
+  snapshot.dial_value[i] = pot.get_smoothed_value();
+  snapshot.dial_fine[i] = pot.get_smoothed_fine();
+  snapshot.dial_speed[i] = pot.get_smooth_deriv();
+  snapshot.dial_velocity[i] = pot.get_velocity();
+  snapshot.dial_noise_sigma[i] = pot.get_noise_sigma();
+  snapshot.dial_noise_scale[i] = pot.get_noise_scale();
+  return true;
+}
+
+// Put in a dial's requested half-lives, if they're new
+template <class Pot>
+static void apply_filter(Pot &pot, const FilterRequest &request, FilterRequest &applied, Dial dial) {
+  uint8_t i = static_cast<uint8_t>(dial);
+  uint16_t long_ms = request.long_half_life_ms[i];
+  uint16_t short_ms = request.short_half_life_ms[i];
+  if (long_ms == 0 || (long_ms == applied.long_half_life_ms[i] &&
+                       short_ms == applied.short_half_life_ms[i])) {
+    return;
+  }
+  pot.set_half_lives(long_ms, short_ms);
+  applied.long_half_life_ms[i] = long_ms;
+  applied.short_half_life_ms[i] = short_ms;
+}
+
+// Bit per idle dial, for the stats
+template <class Pot>
+static uint8_t idle_bit(const Pot &pot, Dial dial) {
+  return pot.is_idle() ? 1 << static_cast<uint8_t>(dial) : 0;
+}
+
+bool SensingTask::buttons_due(uint64_t now_ms, uint64_t busy_ms, uint64_t last_poll_ms, bool &idle) {
+  idle = now_ms - busy_ms >= BUTTON_IDLE_AFTER_MS;
+  return !idle || now_ms - last_poll_ms >= BUTTON_IDLE_PERIOD_MS;
+}
+
+void SensingTask::sense() {
+  uint32_t start_us = clock_us32();
+  uint64_t now_ms = clock_ms();
+
+  if (_filter_requested.writes() != _filter_requests_seen) {
+    apply_filter_request();
+  }
+
+  bool buttons_idle;
+  if (buttons_due(now_ms, _buttons_busy_ms, _last_button_poll_ms, buttons_idle)) {
+    _last_button_poll_ms = now_ms;
+    _button_polls++;
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      if (_buttons[i].update()) {
+        if (_buttons[i].isActive()) {
+          _working.presses[i]++;
+          _working.buttons_down |= 1 << i;
+        } else {
+          _working.releases[i]++;
+          _working.buttons_down &= ~(1 << i);
+        }
+      }
+      if (!_buttons[i].isSettled()) {
+        _buttons_busy_ms = now_ms;
+      }
+    }
+  }
+
+  // Each dial decides for itself whether it's time for a reading
+  _dial_reads += read_dial(_state.red_pot, _working, Dial::RED);
+  _dial_reads += read_dial(_state.green_pot, _working, Dial::GREEN);
+  _dial_reads += read_dial(_state.blue_pot, _working, Dial::BLUE);
+  _dial_reads += read_dial(_state.white_pot, _working, Dial::WHITE);
+  _idle_inputs = idle_bit(_state.red_pot, Dial::RED) | idle_bit(_state.green_pot, Dial::GREEN) |
+                 idle_bit(_state.blue_pot, Dial::BLUE) | idle_bit(_state.white_pot, Dial::WHITE) |
+                 (buttons_idle ? BUTTONS_IDLE_BIT : 0);
+
+  // Check every sensor, occupied() is also what keeps each one updated
+  bool occupied_a = _state.motion_detector_a.occupied();
+  bool occupied_b = _state.motion_detector_b.occupied();
+  bool occupied_c = _state.motion_detector_c.occupied();
+  _working.motion_sensors = (occupied_a ? 1 : 0) | (occupied_b ? 2 : 0) | (occupied_c ? 4 : 0);
+  _working.occupied = _working.motion_sensors != 0;
+
+  _working.pass++;
+  _working.taken_us = clock_us32();
+  _published.write(_working);
+
+  uint32_t elapsed_us = _working.taken_us - start_us;
+  if (elapsed_us > _worst_pass_us) {
+    _worst_pass_us = elapsed_us;
+  }
+}
+
+void SensingTask::apply_filter_request() {
+  // Noted before the read, so a request that lands in between is put in
+  // now and again next pass, never missed
+  _filter_requests_seen = _filter_requested.writes();
+  FilterRequest request;
+  _filter_requested.read(request);
+  apply_filter(_state.red_pot, request, _filter_applied, Dial::RED);
+  apply_filter(_state.green_pot, request, _filter_applied, Dial::GREEN);
+  apply_filter(_state.blue_pot, request, _filter_applied, Dial::BLUE);
+  apply_filter(_state.white_pot, request, _filter_applied, Dial::WHITE);
+}
+
+void SensingTask::latest(InputSnapshot &snapshot) {
+  if (!_running) {
+    sense();
+  }
+  _read_retries += _published.read(snapshot);
+  _reads++;
+}
+
+void SensingTask::request_filter(uint8_t dials, uint16_t long_half_life_ms,
+                                 uint16_t short_half_life_ms) {
+  // All of them go across each time, so two requests between sensing
+  // passes don't lose the first
+  for (uint8_t i = 0; i < DIAL_COUNT; i++) {
+    if (dials & (1 << i)) {
+      _filter_wanted.long_half_life_ms[i] = long_half_life_ms;
+      _filter_wanted.short_half_life_ms[i] = short_half_life_ms;
+    }
+  }
+  _filter_requested.write(_filter_wanted);
+}
+
+void SensingTask::lights_updated(const InputSnapshot &snapshot) {
+  // loop() usually goes around several times per snapshot, only the
+  // first time the lights are written from it counts
+  if (snapshot.pass == _last_latency_pass) {
+    return;
+  }
+  _last_latency_pass = snapshot.pass;
+  _last_latency_us = clock_us32() - snapshot.taken_us;
+  if (_last_latency_us > _worst_latency_us) {
+    _worst_latency_us = _last_latency_us;
+  }
+  _latency_total_us += _last_latency_us;
+  _latency_count++;
+}
+
+void SensingTask::get_stats(SensingStats &stats) const {
+  stats.passes = _published.writes();
+  stats.worst_pass_us = _worst_pass_us;
+  stats.reads = _reads;
+  stats.read_retries = _read_retries;
+  stats.last_latency_us = _last_latency_us;
+  stats.average_latency_us = _latency_count > 0 ? _latency_total_us / _latency_count : 0;
+  stats.worst_latency_us = _worst_latency_us;
+  stats.running = _running;
+  stats.dial_reads = _dial_reads;
+  stats.button_polls = _button_polls;
+  stats.idle_inputs = _idle_inputs;
+}
@@ -0,0 +1,501 @@
+#include <Arduino.h>
+#include "SerialProtocol.h"
+#include "Clock.h"
+#include "FlightRecorder.h"
+
+/*
+Framed binary control protocol, see SerialProtocol.h for the frame layout.
+*/
+
+uint16_t crc16_update(uint16_t crc, uint8_t data) {
+  // Nibble-at-a-time table, small enough to not care about and still
+  // quite a bit faster than going bit by bit
+  static const uint16_t crc_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+  };
+  crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (data >> 4)];
+  crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (data & 0x0F)];
+  return crc;
+}
+
+// Little-endian helpers for the payloads
+static uint16_t read_u16(const uint8_t* p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void write_u16(uint8_t* p, uint16_t value) {
+  p[0] = value & 0xFF;
+  p[1] = value >> 8;
+}
+
+static void write_u32(uint8_t* p, uint32_t value) {
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+  p[2] = (value >> 16) & 0xFF;
+  p[3] = value >> 24;
+}
+
+// A dial speed in hundredths of a unit per millisecond, pinned to what
+// fits in the reply (a hard flick can go past it, and converting a float
+// that doesn't fit is undefined)
+static int16_t speed_hundredths(float speed) {
+  float hundredths = speed * 100;
+  if (hundredths >= INT16_MAX) {
+    return INT16_MAX;
+  }
+  if (hundredths <= INT16_MIN) {
+    return INT16_MIN;
+  }
+  return static_cast<int16_t>(hundredths);
+}
+
+///////////////////////////////////////////////////////////
+// Frame parser
+///////////////////////////////////////////////////////////
+
+FrameParser::FrameParser()
+  : _scan(0),
+    _end(0),
+    _frame_start(0),
+    _state(ParseState::WAIT_SYNC),
+    _length(0),
+    _command(0),
+    _payload_seen(0),
+    _crc(0xFFFF),
+    _received_crc(0),
+    frames_ok(0),
+    crc_errors(0),
+    length_errors(0) {
+}
+
+void FrameParser::compact() {
+  // Everything before a frame in progress (or everything scanned, if we're
+  // waiting for a sync byte) is finished with.  Slide the rest down.
+  uint16_t keep_from = (_state == ParseState::WAIT_SYNC) ? _scan : _frame_start;
+  if (keep_from == 0) {
+    return;
+  }
+  memmove(_buffer, _buffer + keep_from, _end - keep_from);
+  _end -= keep_from;
+  _scan -= keep_from;
+  _frame_start = (_state == ParseState::WAIT_SYNC) ? 0 : _frame_start - keep_from;
+}
+
+uint8_t* FrameParser::write_space(size_t &space) {
+  compact();
+  space = sizeof(_buffer) - _end;
+  return _buffer + _end;
+}
+
+void FrameParser::commit(size_t count) {
+  _end += count;
+}
+
+bool FrameParser::next_frame(Frame &frame) {
+  while (_scan < _end) {
+    uint8_t data = _buffer[_scan++];
+    switch (_state) {
+      case ParseState::WAIT_SYNC:
+        if (data == PROTOCOL_SYNC_BYTE) {
+          _frame_start = _scan - 1;
+          _crc = 0xFFFF;
+          _state = ParseState::LENGTH;
+        }
+        break;
+      case ParseState::LENGTH:
+        if (data > PROTOCOL_MAX_PAYLOAD) {
+          // Can't be a real frame, look for the next sync byte
+          length_errors++;
+          _scan = _frame_start + 1;
+          _state = ParseState::WAIT_SYNC;
+          break;
+        }
+        _length = data;
+        _crc = crc16_update(_crc, data);
+        _state = ParseState::COMMAND;
+        break;
+      case ParseState::COMMAND:
+        _command = data;
+        _crc = crc16_update(_crc, data);
+        _payload_seen = 0;
+        _state = (_length > 0) ? ParseState::PAYLOAD : ParseState::CRC_LOW;
+        break;
+      case ParseState::PAYLOAD:
+        _crc = crc16_update(_crc, data);
+        if (++_payload_seen == _length) {
+          _state = ParseState::CRC_LOW;
+        }
+        break;
+      case ParseState::CRC_LOW:
+        _received_crc = data;
+        _state = ParseState::CRC_HIGH;
+        break;
+      case ParseState::CRC_HIGH:
+        _received_crc |= static_cast<uint16_t>(data) << 8;
+        _state = ParseState::WAIT_SYNC;
+        if (_received_crc != _crc) {
+          // Probably a debug print that contained the sync byte, or line
+          // noise.  Start looking again just after the false sync.
+          crc_errors++;
+          _scan = _frame_start + 1;
+          break;
+        }
+        frames_ok++;
+        frame.command = _command;
+        frame.length = _length;
+        frame.payload = _buffer + _frame_start + 3;
+        return true;
+    }
+  }
+  return false;
+}
+
+///////////////////////////////////////////////////////////
+// Command handling
+///////////////////////////////////////////////////////////
+
+SerialProtocol::SerialProtocol()
+  : _unknown_commands(0) {
+}
+
+bool SerialProtocol::poll(ProgramState &state, OutputController &output, const LoopMonitor &monitor,
+                          SensingTask &sensing) {
+  bool mode_updated = false;
+  int available = Serial.available();
+  while (available > 0) {
+    // Read straight into the parser's buffer, no copies on the way in
+    size_t space = 0;
+    uint8_t* destination = _parser.write_space(space);
+    size_t count = Serial.read(destination, min(space, static_cast<size_t>(available)));
+    if (count == 0) {
+      break;
+    }
+    _parser.commit(count);
+    available -= count;
+
+    Frame frame;
+    while (_parser.next_frame(frame)) {
+      mode_updated = handle_frame(frame, state, output, monitor, sensing) || mode_updated;
+    }
+  }
+  return mode_updated;
+}
+
+bool SerialProtocol::handle_frame(const Frame &frame, ProgramState &state, OutputController &output,
+                                  const LoopMonitor &monitor, SensingTask &sensing) {
+  uint8_t reply[PROTOCOL_MAX_PAYLOAD];
+  bool mode_updated = false;
+
+  switch (static_cast<Command>(frame.command)) {
+    case Command::PING:
+      // Echo back whatever was sent
+      send_reply(frame.command, frame.payload, frame.length);
+      break;
+
+    case Command::GET_STATE: {
+      reply[0] = static_cast<uint8_t>(state.curr_mode);
+      reply[1] = static_cast<uint8_t>(state.last_mode);
+      write_u16(reply + 2, state.red_pot_val);
+      write_u16(reply + 4, state.green_pot_val);
+      write_u16(reply + 6, state.blue_pot_val);
+      write_u16(reply + 8, state.white_pot_val);
+      // Dial speeds in hundredths of a unit per millisecond
+      write_u16(reply + 10, speed_hundredths(state.inputs.speed(Dial::RED)));
+      write_u16(reply + 12, speed_hundredths(state.inputs.speed(Dial::GREEN)));
+      write_u16(reply + 14, speed_hundredths(state.inputs.speed(Dial::BLUE)));
+      write_u16(reply + 16, speed_hundredths(state.inputs.speed(Dial::WHITE)));
+      write_u32(reply + 18, min(clock_ms() - state.last_motion_detected, static_cast<uint64_t>(UINT32_MAX)));
+      send_reply(frame.command, reply, 22);
+      break;
+    }
+
+    case Command::SET_MODE: {
+      if (frame.length != 1) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      // Dozing only comes from nobody moving, see handle_sleep()
+      if (frame.payload[0] >= static_cast<uint8_t>(Mode::INVALID) ||
+          frame.payload[0] == static_cast<uint8_t>(Mode::SLEEP_PREP)) {
+        send_nack(frame.command, ProtocolError::BAD_VALUE);
+        break;
+      }
+      state.manual_motion_update();
+      state.update_mode(static_cast<Mode>(frame.payload[0]));
+      mode_updated = true;
+      send_reply(frame.command, frame.payload, 1);
+      break;
+    }
+
+    case Command::SET_RGB:
+    case Command::SET_WHITE: {
+      bool is_white = static_cast<Command>(frame.command) == Command::SET_WHITE;
+      if (frame.length != (is_white ? 2 : 6)) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      // Values are straight 10-bit PWM duties
+      state.remote_red_val = min(read_u16(frame.payload), static_cast<uint16_t>(1023));
+      if (is_white) {
+        state.remote_green_val = state.remote_red_val;
+        state.remote_blue_val = state.remote_red_val;
+      } else {
+        state.remote_green_val = min(read_u16(frame.payload + 2), static_cast<uint16_t>(1023));
+        state.remote_blue_val = min(read_u16(frame.payload + 4), static_cast<uint16_t>(1023));
+      }
+      state.manual_motion_update();
+      if (state.curr_mode != Mode::REMOTE) {
+        state.update_mode(Mode::REMOTE);
+        mode_updated = true;
+      }
+      send_reply(frame.command, nullptr, 0);
+      break;
+    }
+
+    case Command::GET_COUNTERS:
+      write_u32(reply, _parser.frames_ok);
+      write_u32(reply + 4, _parser.crc_errors);
+      write_u32(reply + 8, _parser.length_errors);
+      write_u32(reply + 12, _unknown_commands);
+      write_u32(reply + 16, state.mode_change_count);
+      write_u32(reply + 20, clock_ms32());
+      send_reply(frame.command, reply, 24);
+      break;
+
+    case Command::SET_FILTER: {
+      // pot index (0-3 for red, green, blue, white, 0xFF for all),
+      // then long and short half-lives in milliseconds
+      if (frame.length != 5) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      uint8_t index = frame.payload[0];
+      uint16_t long_half_life_ms = read_u16(frame.payload + 1);
+      uint16_t short_half_life_ms = read_u16(frame.payload + 3);
+      if (long_half_life_ms == 0 || short_half_life_ms == 0 ||
+          (index > 3 && index != 0xFF)) {
+        send_nack(frame.command, ProtocolError::BAD_VALUE);
+        break;
+      }
+      // The sensing task is filtering these on the other core, so it puts
+      // them in itself on its next pass, see SensingTask.h
+      uint8_t dials = index == 0xFF ? (1 << DIAL_COUNT) - 1 : 1 << index;
+      sensing.request_filter(dials, long_half_life_ms, short_half_life_ms);
+      send_reply(frame.command, frame.payload, frame.length);
+      break;
+    }
+
+    case Command::STREAM_FRAMES: {
+      // One or more frames of: timestamp (us), red, green, blue (10-bit)
+      // No reply, at hundreds of frames per second the replies would
+      // just get in the way.  Use GET_STREAM_STATS to see how it's going.
+      const uint8_t frame_size = 10;
+      if (frame.length == 0 || frame.length % frame_size != 0) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      uint32_t now_us = clock_us32();
+      for (uint8_t offset = 0; offset < frame.length; offset += frame_size) {
+        StreamFrame stream_frame;
+        stream_frame.timestamp_us = read_u32(frame.payload + offset);
+        stream_frame.red = min(read_u16(frame.payload + offset + 4), static_cast<uint16_t>(1023));
+        stream_frame.green = min(read_u16(frame.payload + offset + 6), static_cast<uint16_t>(1023));
+        stream_frame.blue = min(read_u16(frame.payload + offset + 8), static_cast<uint16_t>(1023));
+        state.stream_player.push(stream_frame, now_us);
+      }
+      // Every frame counts as someone being there, like a button press,
+      // or a stream longer than the sleep timeout would doze off partway
+      state.manual_motion_update();
+      if (state.curr_mode != Mode::STREAM) {
+        state.update_mode(Mode::STREAM);
+        mode_updated = true;
+      }
+      break;
+    }
+
+    case Command::GET_STREAM_STATS:
+      write_u32(reply, state.stream_player.frames_received);
+      write_u32(reply + 4, state.stream_player.late_frames);
+      write_u32(reply + 8, state.stream_player.dropped_frames);
+      write_u32(reply + 12, state.stream_player.underruns);
+      reply[16] = state.stream_player.buffered();
+      send_reply(frame.command, reply, 17);
+      break;
+
+    case Command::GET_POWER:
+      write_u32(reply, output.power().get_draw_mw());
+      write_u32(reply + 4, output.power().get_budget_mw());
+      write_u32(reply + 8, output.power().get_energy_mwh());
+      write_u32(reply + 12, output.power().get_limit_events());
+      send_reply(frame.command, reply, 16);
+      break;
+
+    case Command::SET_POWER_BUDGET:
+      // Milliwatts, 0 for no limit.  Takes effect on the next color change.
+      if (frame.length != 4) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      output.power().set_budget_mw(read_u32(frame.payload));
+      send_reply(frame.command, frame.payload, 4);
+      break;
+
+    case Command::GET_MODE_ENERGY:
+      // Milliwatt-hours used in each mode since boot, in mode order
+      static_assert(4 * MODE_COUNT <= PROTOCOL_MAX_PAYLOAD,
+                    "Too many modes for one GET_MODE_ENERGY reply, it needs paging like GET_FLIGHT_LOG");
+      for (uint8_t i = 0; i < MODE_COUNT; i++) {
+        write_u32(reply + 4 * i, output.power().get_mode_energy_mwh(static_cast<Mode>(i)));
+      }
+      send_reply(frame.command, reply, 4 * MODE_COUNT);
+      break;
+
+    case Command::GET_LOOP_STATS: {
+      // This boot's overrun record, then the one from before the last reset
+      const LoopOverrunRecord &record = monitor.get_record();
+      LoopOverrunRecord previous;
+      bool have_previous = monitor.get_previous(previous);
+      write_u32(reply, monitor.get_budget_us());
+      write_u32(reply + 4, record.iterations);
+      write_u32(reply + 8, record.overruns);
+      write_u32(reply + 12, record.last_overrun_ms);
+      write_u32(reply + 16, record.last_overrun_us);
+      write_u32(reply + 20, record.worst_us);
+      reply[24] = record.last_overrun_stage;
+      reply[25] = record.worst_stage;
+      reply[26] = record.reset_reason;
+      write_u32(reply + 27, record.boot_count);
+      reply[31] = have_previous ? 1 : 0;
+      reply[32] = previous.current_stage;
+      write_u32(reply + 33, previous.overruns);
+      write_u32(reply + 37, previous.worst_us);
+      reply[41] = previous.worst_stage;
+      send_reply(frame.command, reply, 42);
+      break;
+    }
+
+    case Command::GET_SENSING_STATS: {
+      SensingStats stats;
+      sensing.get_stats(stats);
+      write_u32(reply, stats.passes);
+      write_u32(reply + 4, stats.worst_pass_us);
+      write_u32(reply + 8, stats.reads);
+      write_u32(reply + 12, stats.read_retries);
+      write_u32(reply + 16, stats.last_latency_us);
+      write_u32(reply + 20, stats.average_latency_us);
+      write_u32(reply + 24, stats.worst_latency_us);
+      reply[28] = stats.running ? 1 : 0;
+      write_u32(reply + 29, stats.dial_reads);
+      write_u32(reply + 33, stats.button_polls);
+      reply[37] = stats.idle_inputs;
+      send_reply(frame.command, reply, 38);
+      break;
+    }
+
+    case Command::GET_FLIGHT_LOG: {
+      // Payload is the index to start from (0 is the oldest event).
+      // Reply is the event count, that index, then as many events as fit.
+      if (frame.length != 2) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      uint16_t start = read_u16(frame.payload);
+      uint16_t count = flight_recorder_count();
+      write_u16(reply, count);
+      write_u16(reply + 2, start);
+      uint8_t length = 4;
+      FlightEvent event;
+      for (uint16_t i = start; length + sizeof(event) <= PROTOCOL_MAX_PAYLOAD &&
+                               flight_recorder_get(i, event); i++) {
+        write_u32(reply + length, event.time_ms);
+        reply[length + 4] = event.type;
+        reply[length + 5] = event.a;
+        write_u16(reply + length + 6, event.b);
+        length += sizeof(event);
+      }
+      send_reply(frame.command, reply, length);
+      break;
+    }
+
+    case Command::WRITE_PROGRAM:
+      // A piece of a program on its way in: u16 offset, then the bytes.
+      // Nothing runs until it's committed.
+      if (frame.length < 2) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      if (!output.vm().stage(read_u16(frame.payload), frame.payload + 2, frame.length - 2)) {
+        send_nack(frame.command, ProtocolError::BAD_VALUE);
+        break;
+      }
+      send_reply(frame.command, frame.payload, 2);
+      break;
+
+    case Command::COMMIT_PROGRAM: {
+      // u8 slot (0 is CUSTOM_1), u16 length (0 to clear the slot).
+      // Reply is the VmCheck result and where in the program it went wrong.
+      if (frame.length != 3) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      uint16_t position = 0;
+      VmCheck result = output.vm().commit(frame.payload[0], read_u16(frame.payload + 1), position);
+      reply[0] = static_cast<uint8_t>(result);
+      write_u16(reply + 1, position);
+      send_reply(frame.command, reply, 3);
+      break;
+    }
+
+    case Command::GET_PROGRAM_STATS: {
+      if (frame.length != 1) {
+        send_nack(frame.command, ProtocolError::BAD_LENGTH);
+        break;
+      }
+      uint8_t slot = frame.payload[0];
+      if (slot >= VM_SLOTS) {
+        send_nack(frame.command, ProtocolError::BAD_VALUE);
+        break;
+      }
+      const VmStats &stats = output.vm().stats(slot);
+      write_u16(reply, output.vm().length(slot));
+      write_u32(reply + 2, stats.passes);
+      write_u32(reply + 6, stats.overruns);
+      write_u32(reply + 10, stats.instructions);
+      send_reply(frame.command, reply, 14);
+      break;
+    }
+
+    default:
+      _unknown_commands++;
+      send_nack(frame.command, ProtocolError::UNKNOWN_COMMAND);
+      break;
+  }
+  return mode_updated;
+}
+
+void SerialProtocol::send_reply(uint8_t command, const uint8_t* payload, uint8_t length) {
+  // Build the whole frame first so it goes out in one write
+  _tx_buffer[0] = PROTOCOL_SYNC_BYTE;
+  _tx_buffer[1] = length;
+  _tx_buffer[2] = command | PROTOCOL_REPLY_FLAG;
+  uint16_t crc = 0xFFFF;
+  crc = crc16_update(crc, _tx_buffer[1]);
+  crc = crc16_update(crc, _tx_buffer[2]);
+  for (uint8_t i = 0; i < length; i++) {
+    _tx_buffer[3 + i] = payload[i];
+    crc = crc16_update(crc, payload[i]);
+  }
+  write_u16(_tx_buffer + 3 + length, crc);
+  Serial.write(_tx_buffer, length + 5);
+}
+
+void SerialProtocol::send_nack(uint8_t command, ProtocolError error) {
+  uint8_t payload[2] = {command, static_cast<uint8_t>(error)};
+  send_reply(static_cast<uint8_t>(Command::NACK), payload, 2);
+}
@@ -1,101 +1,461 @@
 #include "SmoothAnalogInput.h"
+#include "AdcFrontEnd.h"
+#include "Clock.h"
 
-SmoothAnalogInput::SmoothAnalogInput(uint8_t pin, 
-  uint16_t long_half_life_ms, 
-  uint16_t short_half_life_ms, 
-  uint8_t inputMode,
-  uint8_t adc_resolution) 
-  : _pin(pin), 
-    _base_long_ema_factor(1 - exp(-1.0 * M_LN2 / long_half_life_ms)), // HL->tau
+// Floats rather than doubles throughout: the ESP32-S3 has hardware for
+// single precision, but doubles are done in software, and the dials don't
+// need anywhere near that precision anyway.
+
+// 2^(-i/64), one step of the table is 1/64 of a half-life
+static const uint8_t EXP2_TABLE_STEPS = 64;
+static const float EXP2_NEG_TABLE[EXP2_TABLE_STEPS + 1] = {
+  1.0000000f, 0.9892280f, 0.9785721f, 0.9680309f, 0.9576033f,
+  0.9472880f, 0.9370838f, 0.9269896f, 0.9170040f, 0.9071261f,
+  0.8973545f, 0.8876882f, 0.8781261f, 0.8686669f, 0.8593096f,
+  0.8500532f, 0.8408964f, 0.8318383f, 0.8228777f, 0.8140137f,
+  0.8052452f, 0.7965711f, 0.7879904f, 0.7795022f, 0.7711054f,
+  0.7627991f, 0.7545822f, 0.7464539f, 0.7384131f, 0.7304589f,
+  0.7225904f, 0.7148067f, 0.7071068f, 0.6994898f, 0.6919549f,
+  0.6845012f, 0.6771278f, 0.6698338f, 0.6626183f, 0.6554806f,
+  0.6484198f, 0.6414350f, 0.6345255f, 0.6276904f, 0.6209289f,
+  0.6142403f, 0.6076237f, 0.6010784f, 0.5946036f, 0.5881985f,
+  0.5818624f, 0.5755946f, 0.5693943f, 0.5632608f, 0.5571934f,
+  0.5511913f, 0.5452539f, 0.5393804f, 0.5335702f, 0.5278226f,
+  0.5221369f, 0.5165124f, 0.5109486f, 0.5054446f, 0.5000000f,
+};
+
+// 2^(-x) for x >= 0.  The whole half-lives are a shift of the exponent,
+// the fraction comes from the table, blended between entries, which is good
+// to about 1 part in 60000.
+static float exp2_neg(float x) {
+  if (x >= 24) {
+    return 0;  // gone as far as a float can tell
+  }
+  float steps = x * EXP2_TABLE_STEPS;
+  uint32_t whole_steps = static_cast<uint32_t>(steps);
+  float fraction = steps - whole_steps;
+  uint8_t index = whole_steps % EXP2_TABLE_STEPS;
+  float value = EXP2_NEG_TABLE[index] + (EXP2_NEG_TABLE[index + 1] - EXP2_NEG_TABLE[index]) * fraction;
+  return ldexpf(value, -static_cast<int>(whole_steps / EXP2_TABLE_STEPS));
+}
+
+// Half-lives per microsecond
+static float half_life_to_rate(uint16_t half_life_ms) {
+  return 1.0f / (half_life_ms * 1000.0f);
+}
+
+// Size budgets, there's one of these for each dial
+static_assert(sizeof(DualEmaFilter) <= 28, "DualEmaFilter is over its size budget");
+static_assert(sizeof(OneEuroFilter) <= 24, "OneEuroFilter is over its size budget");
+static_assert(sizeof(SlidingVelocity) <= 92, "SlidingVelocity is over its size budget");
+static_assert(sizeof(NoiseFloor) <= 16, "NoiseFloor is over its size budget");
+static_assert(sizeof(Median3Filter<DualEmaFilter>) <= 32, "Median3Filter is over its size budget");
+static_assert(sizeof(Median3Filter<OneEuroFilter>) <= 28, "Median3Filter is over its size budget");
+
+///////////////////////////////////////////////////////////
+// The original dual EMA
+///////////////////////////////////////////////////////////
+
+DualEmaFilter::DualEmaFilter(uint16_t long_half_life_ms, uint16_t short_half_life_ms)
+  : _long_rate(half_life_to_rate(long_half_life_ms)),
     _long_ema(0),
-    _long_ema_derivative(0),
-    _short_ema_factor(1 - exp(-1.0 * M_LN2 / short_half_life_ms)), // HL->tau
+    _short_rate(half_life_to_rate(short_half_life_ms)),
     _short_ema(0),
-    _last_read(0),
-    _last_read_time(0),
-    _adc_resolution(adc_resolution),
     _ordinary_change_wide_sigma(1),
-    _deadband_zero(30),
-    _max_brightness(4000){
+    _noise_scale(1),
+    _last_read(0) {
+}
 
+void DualEmaFilter::init(uint16_t first_reading, uint8_t adc_resolution) {
   // Get the ordinary change wide sigma properly calculated
   // Expect no faster than full-scale per second, so 1/1000 per ms
-  _ordinary_change_wide_sigma = (1 << _adc_resolution)/1000.0;
-
-  // Calculate max brightness to 90% of full scale
-  _max_brightness = static_cast<uint16_t>((1 << _adc_resolution) * 0.9);
-
-  // initialization
-  pinMode(_pin, inputMode); // INPUT is default, the pullup is silly here
-  _last_read = analogRead(_pin);
-  _long_ema = _last_read;
-  _short_ema = _last_read;
+  _ordinary_change_wide_sigma = (1 << adc_resolution)/1000.0f * _noise_scale;
+  _last_read = first_reading;
+  _long_ema = first_reading;
+  _short_ema = first_reading;
 }
 
-SmoothAnalogInput::SmoothAnalogInput() {
-  // Empty constructor
+void DualEmaFilter::set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms) {
+  _long_rate = half_life_to_rate(long_half_life_ms) / _noise_scale;
+  _short_rate = half_life_to_rate(short_half_life_ms);
 }
 
-bool SmoothAnalogInput::update() {
-  // Read the current physical state of the pin if needed
-  unsigned long curr_time = millis();
-  if (curr_time - _last_read_time < 1) {
-    _last_read_time = curr_time;
-    return false;
-  }
-
-  unsigned long time_since_last_read = curr_time - _last_read_time;
-
-  uint16_t reading = analogRead(_pin);
-  _last_read_time = curr_time;
+void DualEmaFilter::set_noise_scale(float scale) {
+  // A noisier dial gets longer smoothing, and its ordinary changes are
+  // bigger, so it takes a bigger jump to count as a spike
+  _long_rate *= _noise_scale / scale;
+  _ordinary_change_wide_sigma *= scale / _noise_scale;
+  _noise_scale = scale;
+}
 
+float DualEmaFilter::add(uint16_t reading, uint32_t time_since_last_read_us) {
   // Get correction factor for long-term EMA based on how far
   // we are from the recent readings.
   // We worry more about smoothing when the light is dim, while we want
   // faster responsiveness when the light is bright.
-  double reading_diff = static_cast<double>(abs((int)reading - (int)_last_read));
-  double spike_factor = reading_diff / _ordinary_change_wide_sigma;
-  double brightness_relaxing = 1.0;
+  float reading_diff = static_cast<float>(abs((int)reading - (int)_last_read));
+  float spike_factor = reading_diff / _ordinary_change_wide_sigma;
+  float brightness_relaxing = 1.0f;
   if (reading > 50 * _ordinary_change_wide_sigma) {
-    brightness_relaxing = 1 + 0.5 * sqrt(reading - 50 * _ordinary_change_wide_sigma)/_ordinary_change_wide_sigma;
+    brightness_relaxing = 1 + 0.5f * sqrtf(reading - 50 * _ordinary_change_wide_sigma)/_ordinary_change_wide_sigma;
   }
   spike_factor = spike_factor / brightness_relaxing;
-  
-  double long_ema_factor = _base_long_ema_factor * exp(-spike_factor);
 
-  // if we're having problems with not making it every millisecond, we can increase the
-  // influence of this reading so we can try to keep the 50ms half-life
-  if (time_since_last_read > 1) {
-    long_ema_factor *= constrain(0.95 * time_since_last_read, 1, 10);
-  }
-
-  double last_long_ema = _long_ema;
+  // How much of the old average is left after this time step, for a
+  // steady reading.  Then a spike gets less say, by e^-spike_factor.
+  float long_ema_factor = (1 - exp2_neg(time_since_last_read_us * _long_rate)) *
+                          exp2_neg(spike_factor * static_cast<float>(M_LOG2E));
 
   // Update the long-term EMA
   _long_ema = long_ema_factor * reading + (1 - long_ema_factor) * _long_ema;
 
-  // Get the derivative of the long-term EMA
-  _long_ema_derivative = (_long_ema - last_long_ema) / time_since_last_read;
-
   // Update the short-term EMA
-  _short_ema = _short_ema_factor * reading + (1 - _short_ema_factor) * _short_ema;
+  float short_ema_factor = 1 - exp2_neg(time_since_last_read_us * _short_rate);
+  _short_ema = short_ema_factor * reading + (1 - short_ema_factor) * _short_ema;
 
   _last_read = reading;
-  _last_read_time = curr_time;
+  return _long_ema;
+}
+
+///////////////////////////////////////////////////////////
+// One Euro
+///////////////////////////////////////////////////////////
+
+// A cutoff of f hertz is an EMA with a time constant of 1/(2 pi f), so
+// this many half-lives per microsecond for each hertz
+const float HERTZ_TO_RATE = 2 * M_PI / M_LN2 * 1e-6f;
+
+OneEuroFilter::OneEuroFilter(uint16_t long_half_life_ms, uint16_t short_half_life_ms, float beta)
+  : _value(0),
+    _speed(0),
+    _min_cutoff_rate(half_life_to_rate(long_half_life_ms)),
+    _speed_cutoff_rate(half_life_to_rate(short_half_life_ms)),
+    _beta(beta),
+    _noise_scale(1) {
+}
+
+void OneEuroFilter::init(uint16_t first_reading, uint8_t adc_resolution) {
+  _value = first_reading;
+  _speed = 0;
+}
+
+void OneEuroFilter::set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms) {
+  _min_cutoff_rate = half_life_to_rate(long_half_life_ms) / _noise_scale;
+  _speed_cutoff_rate = half_life_to_rate(short_half_life_ms);
+}
+
+void OneEuroFilter::set_noise_scale(float scale) {
+  // Only at rest, turning the dial still opens it right up
+  _min_cutoff_rate *= _noise_scale / scale;
+  _noise_scale = scale;
+}
+
+float OneEuroFilter::add(uint16_t reading, uint32_t time_since_last_read_us) {
+  // Smooth the speed first, at its own fixed cutoff
+  float raw_speed = (reading - _value) * 1000.0f / time_since_last_read_us;
+  float speed_factor = 1 - exp2_neg(time_since_last_read_us * _speed_cutoff_rate);
+  _speed = speed_factor * raw_speed + (1 - speed_factor) * _speed;
+
+  // Then the faster the dial is moving, the higher the cutoff
+  float rate = _min_cutoff_rate + _beta * fabsf(_speed) * HERTZ_TO_RATE;
+  float factor = 1 - exp2_neg(time_since_last_read_us * rate);
+  _value = factor * reading + (1 - factor) * _value;
+  return _value;
+}
+
+///////////////////////////////////////////////////////////
+// Least-squares velocity
+///////////////////////////////////////////////////////////
+
+static const int32_t VELOCITY_HALF = VELOCITY_WINDOW / 2;
+// The sum of (k - N/2)^2 over the window, N(N^2 - 1)/12
+static const int32_t VELOCITY_WEIGHTS_SQUARED =
+  static_cast<int32_t>(VELOCITY_WINDOW) * (VELOCITY_WINDOW * VELOCITY_WINDOW - 1) / 12;
+// Longer gaps than this are counted as this, the window's stale by then anyway
+static const uint32_t VELOCITY_MAX_STEP_US = 65535;
+
+// The middle of five, in six comparisons: drop the smallest of four twice
+static inline uint16_t median5(uint16_t a, uint16_t b, uint16_t c, uint16_t d, uint16_t e) {
+  if (a > b) std::swap(a, b);
+  if (c > d) std::swap(c, d);
+  if (a > c) {
+    std::swap(a, c);
+    std::swap(b, d);
+  }
+  a = e;
+  if (a > b) std::swap(a, b);
+  if (a > c) {
+    std::swap(a, c);
+    std::swap(b, d);
+  }
+  return min(b, c);
+}
+
+SlidingVelocity::SlidingVelocity() {
+  init(0);
+}
+
+void SlidingVelocity::init(uint16_t first_reading) {
+  // As if the dial had been sitting there, read every millisecond
+  for (uint8_t i = 0; i < VELOCITY_WINDOW; i++) {
+    _readings[i] = first_reading;
+    _steps_us[i] = 1000;
+  }
+  for (uint8_t i = 0; i < 4; i++) {
+    _history[i] = first_reading;
+  }
+  _weighted_sum = 0;
+  _sum = static_cast<int32_t>(first_reading) * VELOCITY_WINDOW;
+  _window_us = 1000 * VELOCITY_WINDOW;
+  _oldest = 0;
+}
+
+void SlidingVelocity::add(uint16_t reading, uint32_t time_since_last_read_us) {
+  int32_t newest = median5(_history[0], _history[1], _history[2], _history[3], reading);
+  _history[0] = _history[1];
+  _history[1] = _history[2];
+  _history[2] = _history[3];
+  _history[3] = reading;
+
+  // Slide the window along, see above
+  int32_t oldest = _readings[_oldest];
+  _weighted_sum += (VELOCITY_HALF + 1) * oldest + VELOCITY_HALF * newest - _sum;
+  _sum += newest - oldest;
+  _readings[_oldest] = newest;
+
+  uint16_t step_us = min(time_since_last_read_us, VELOCITY_MAX_STEP_US);
+  _window_us += step_us - _steps_us[_oldest];
+  _steps_us[_oldest] = step_us;
+
+  _oldest = _oldest + 1 < VELOCITY_WINDOW ? _oldest + 1 : 0;
+}
+
+float SlidingVelocity::value() const {
+  // Slope per reading, over the average milliseconds per reading
+  return static_cast<float>(_weighted_sum) * (1000.0f * VELOCITY_WINDOW) /
+         (static_cast<float>(VELOCITY_WEIGHTS_SQUARED) * _window_us);
+}
+
+///////////////////////////////////////////////////////////
+// Noise floor
+///////////////////////////////////////////////////////////
+
+// Slower than this (counts per millisecond) is sitting still
+static const float NOISE_REST_SPEED = 2.0f;
+static const float NOISE_OUTLIER_SIGMAS = 8.0f;
+static const float NOISE_BLEND = 0.25f;
+static const float NOISE_MIN_SCALE = 0.5f;
+static const float NOISE_MAX_SCALE = 3.0f;
+
+NoiseFloor::NoiseFloor() {
+  init(0);
+}
+
+void NoiseFloor::init(uint16_t first_reading) {
+  _mean = 0;
+  _m2 = 0;
+  _sigma = 0;
+  _count = 0;
+  _last_read = first_reading;
+}
+
+bool NoiseFloor::add(uint16_t reading, float speed_per_ms) {
+  float difference = static_cast<float>(reading) - _last_read;
+  _last_read = reading;
+  if (fabsf(speed_per_ms) > NOISE_REST_SPEED) {
+    return false;
+  }
+  // The differences have sqrt(2) sigmas of noise in them.  Before there's
+  // an estimate, go by the noisiest we'd adjust for, or the first block's
+  // spikes would make it look far noisier than it is.
+  float sigma = _sigma > 0 ? _sigma : NOISE_NOMINAL_SIGMA * NOISE_MAX_SCALE;
+  if (fabsf(difference) > NOISE_OUTLIER_SIGMAS * static_cast<float>(M_SQRT2) * sigma) {
+    return false;
+  }
+
+  // Welford
+  _count++;
+  float delta = difference - _mean;
+  _mean += delta / _count;
+  _m2 += delta * (difference - _mean);
+  if (_count < NOISE_BLOCK_READINGS) {
+    return false;
+  }
+
+  float block_sigma = sqrtf(_m2 / (2 * (_count - 1)));
+  _sigma = _sigma > 0 ? _sigma + NOISE_BLEND * (block_sigma - _sigma) : block_sigma;
+  _mean = 0;
+  _m2 = 0;
+  _count = 0;
+  return true;
+}
+
+float NoiseFloor::scale() const {
+  if (_sigma <= 0) {
+    return 1;
+  }
+  return constrain(_sigma / NOISE_NOMINAL_SIGMA, NOISE_MIN_SCALE, NOISE_MAX_SCALE);
+}
+
+///////////////////////////////////////////////////////////
+// The dial itself
+///////////////////////////////////////////////////////////
+
+// The deadband at the nominal noise, it's stretched like the smoothing
+static const uint16_t SMOOTH_DEADBAND_ZERO = 30;
+// Going idle and waking back up, see SmoothAnalogInput.h
+static const float SMOOTH_STEADY_COUNTS = 12.0f;
+static const float SMOOTH_STEADY_SIGMAS = 6.0f;
+static const float SMOOTH_IDLE_SPEED = 1.0f;  // counts per millisecond, under the grab speed
+static const uint32_t SMOOTH_FULL_RATE_STEP_US = 1000;  // the sensing period
+
+template <class Filter>
+BasicSmoothAnalogInput<Filter>::BasicSmoothAnalogInput(uint8_t pin,
+  uint16_t long_half_life_ms,
+  uint16_t short_half_life_ms,
+  uint8_t inputMode,
+  uint8_t adc_resolution)
+  : _filter(long_half_life_ms, short_half_life_ms),
+    _derivative(0),
+    _last_read_time_us(0),
+    _still_us(0),
+    _last_read(0),
+    _deadband_zero(SMOOTH_DEADBAND_ZERO),
+    _max_brightness(4000),
+    _pin(pin),
+    _adc_resolution(adc_resolution),
+    _idle(false) {
+  // Calculate max brightness to 90% of full scale
+  _max_brightness = static_cast<uint16_t>((1 << _adc_resolution) * 0.9f);
+
+  // initialization
+  pinMode(_pin, inputMode); // INPUT is default, the pullup is silly here
+  _last_read = adc_front_end_read(_pin);
+  _last_read_time_us = clock_us32();
+  _filter.init(_last_read, _adc_resolution);
+  _velocity.init(_last_read);
+  _noise.init(_last_read);
+}
+
+template <class Filter>
+BasicSmoothAnalogInput<Filter>::BasicSmoothAnalogInput() {
+  // Empty constructor
+}
+
+template <class Filter>
+bool BasicSmoothAnalogInput<Filter>::update() {
+  // Read the current physical state of the pin if it's been long enough
+  uint32_t curr_time_us = clock_us32();
+  uint32_t time_since_last_read_us = curr_time_us - _last_read_time_us;
+  if (time_since_last_read_us < (_idle ? SMOOTH_IDLE_INTERVAL_US : SMOOTH_MIN_INTERVAL_US)) {
+    return false;
+  }
+
+  uint16_t reading = adc_front_end_read(_pin);
+  if (_idle && !is_steady(reading)) {
+    // Make sure before waking up, a lone spike will be gone by now
+    reading = adc_front_end_read(_pin);
+  }
+  _last_read_time_us = curr_time_us;
+  add_reading(reading, time_since_last_read_us);
   return true;
 }
 
-uint16_t SmoothAnalogInput::get_smoothed_value() const {
+template <class Filter>
+void BasicSmoothAnalogInput<Filter>::add_reading(uint16_t reading, uint32_t time_since_last_read_us) {
+  float last_value = _filter.value();
+  bool steady = is_steady(reading);
+  // One reading off on its own is a spike, which happens every second or so
+  bool moved = !steady && !is_steady(_last_read);
+  uint32_t step_us = time_since_last_read_us;
+  if (_idle && !steady) {
+    // Back to full rate, filling in the gap a millisecond at a time
+    _idle = false;
+    _still_us = 0;
+    uint32_t steps = time_since_last_read_us / SMOOTH_FULL_RATE_STEP_US;
+    int32_t change = static_cast<int32_t>(reading) - _last_read;
+    for (uint32_t i = 1; i < steps; i++) {
+      uint16_t filled = _last_read + change * static_cast<int32_t>(i) / static_cast<int32_t>(steps);
+      _filter.add(filled, SMOOTH_FULL_RATE_STEP_US);
+      _velocity.add(filled, SMOOTH_FULL_RATE_STEP_US);
+    }
+    if (steps > 1) {
+      step_us -= (steps - 1) * SMOOTH_FULL_RATE_STEP_US;
+    }
+  }
+
+  float value = _filter.add(reading, step_us);
+  _velocity.add(reading, step_us);
+  if (_noise.add(reading, _velocity.value())) {
+    float scale = _noise.scale();
+    _filter.set_noise_scale(scale);
+    _deadband_zero = static_cast<uint16_t>(SMOOTH_DEADBAND_ZERO * scale + 0.5f);
+  }
+
+  // Get the derivative of the smoothed value, per millisecond as always
+  _derivative = (value - last_value) * 1000.0f / time_since_last_read_us;
+  _last_read = reading;
+
+  // Still for long enough, drop to the idle rate
+  if (moved || fabsf(_velocity.value()) > SMOOTH_IDLE_SPEED) {
+    _still_us = 0;
+  } else if (!_idle) {
+    _still_us += min(time_since_last_read_us, SMOOTH_IDLE_AFTER_US);
+    _idle = _still_us >= SMOOTH_IDLE_AFTER_US;
+  }
+}
+
+template <class Filter>
+bool BasicSmoothAnalogInput<Filter>::is_steady(uint16_t reading) const {
+  float band = max(SMOOTH_STEADY_COUNTS, SMOOTH_STEADY_SIGMAS * _noise.sigma());
+  return fabsf(reading - _filter.value()) <= band;
+}
+
+template <class Filter>
+void BasicSmoothAnalogInput<Filter>::set_half_lives(uint16_t long_half_life_ms, uint16_t short_half_life_ms) {
+  _filter.set_half_lives(long_half_life_ms, short_half_life_ms);
+}
+
+template <class Filter>
+uint16_t BasicSmoothAnalogInput<Filter>::get_smoothed_value() const {
   // Give deadband at bottom, max brightness at top
-  if (_long_ema < _deadband_zero) {
+  float value = _filter.value();
+  if (value < _deadband_zero) {
     return static_cast<uint16_t>(0);
   }
-  if (_long_ema > _max_brightness) {
+  if (value > _max_brightness) {
     return _max_brightness;
   }
-  return static_cast<uint16_t>(_long_ema);
+  return static_cast<uint16_t>(value);
 }
 
-uint16_t SmoothAnalogInput::get_raw_value() const {
+template <class Filter>
+uint16_t BasicSmoothAnalogInput<Filter>::get_smoothed_fine() const {
+  float value = _filter.value();
+  if (value < _deadband_zero) {
+    return static_cast<uint16_t>(0);
+  }
+  if (value > _max_brightness) {
+    return _max_brightness << (16 - _adc_resolution);
+  }
+  return static_cast<uint16_t>(value * (1 << (16 - _adc_resolution)));
+}
+
+template <class Filter>
+uint16_t BasicSmoothAnalogInput<Filter>::get_raw_value() const {
   return _last_read;
-}
\ No newline at end of file
+}
+
+// Build the versions the dials can pick from in ProgramState.h.  Add a
+// line here to use a new combination.
+template class BasicSmoothAnalogInput<DualEmaFilter>;
+template class BasicSmoothAnalogInput<OneEuroFilter>;
+template class BasicSmoothAnalogInput<Median3Filter<DualEmaFilter> >;
+template class BasicSmoothAnalogInput<Median3Filter<OneEuroFilter> >;
+
+// And their size budgets.  Each is its own number of bytes, so a member that
+// grows has to raise its own budget and the dial's, on purpose.
+static_assert(sizeof(SmoothAnalogInput) <= 160, "SmoothAnalogInput is over its size budget");
+static_assert(sizeof(OneEuroAnalogInput) <= 156, "OneEuroAnalogInput is over its size budget");
+static_assert(sizeof(MedianSmoothAnalogInput) <= 164, "MedianSmoothAnalogInput is over its size budget");
+static_assert(sizeof(MedianOneEuroAnalogInput) <= 160, "MedianOneEuroAnalogInput is over its size budget");
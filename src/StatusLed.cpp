@@ -0,0 +1,183 @@
+#include <Arduino.h>
+#include "Clock.h"
+#include "StatusLed.h"
+
+/*
+The onboard status LED, see StatusLed.h.
+*/
+
+const uint32_t STATUS_PWM_FREQ = 5000;
+const uint8_t STATUS_PWM_RESOLUTION = 8;
+const uint8_t STATUS_OFF_DUTY = 255;  // active low
+
+// How bright each layer is, before the overall brightness
+const uint8_t STATUS_HEARTBEAT_LEVEL = 48;
+const uint8_t STATUS_DOZE_LEVEL = 160;
+
+// The patterns, in milliseconds
+const uint16_t STATUS_HEARTBEAT_HALF_MS = 1000;
+const uint16_t STATUS_DOZE_HALF_MS = 500;
+const uint16_t STATUS_BLINK_ON_MS = 150;
+const uint16_t STATUS_BLINK_MS = 400;
+const uint16_t STATUS_BLINK_PAUSE_MS = 1500;
+
+StatusLed::StatusLed(uint8_t red_pin, uint8_t green_pin, uint8_t blue_pin,
+                     uint8_t first_channel, uint8_t brightness)
+  : _first_channel(first_channel),
+    _brightness(brightness),
+    _started(false),
+    _layers(0),
+    _errors(0),
+    _jingle_ms(0),
+    _next_update_ms(0) {
+  _pins[0] = red_pin;
+  _pins[1] = green_pin;
+  _pins[2] = blue_pin;
+  for (uint8_t i = 0; i < 3; i++) {
+    _jingle_colors[i] = JingleColors::OFF;
+    _written[i] = STATUS_OFF_DUTY;
+  }
+  for (uint8_t i = 0; i < STATUS_LAYER_COUNT; i++) {
+    _layer_start_ms[i] = 0;
+  }
+}
+
+void StatusLed::begin() {
+  if (_started) {
+    return;
+  }
+  for (uint8_t i = 0; i < 3; i++) {
+    // Off before the pin is handed over, or it lights up for a moment
+    ledcSetup(_first_channel + i, STATUS_PWM_FREQ, STATUS_PWM_RESOLUTION);
+    ledcWrite(_first_channel + i, STATUS_OFF_DUTY);
+    ledcAttachPin(_pins[i], _first_channel + i);
+    _written[i] = STATUS_OFF_DUTY;
+  }
+  _started = true;
+  _next_update_ms = 0;
+}
+
+void StatusLed::show(StatusLayer layer, bool on) {
+  uint8_t bit = 1 << static_cast<uint8_t>(layer);
+  if (((_layers & bit) != 0) == on) {
+    return;
+  }
+  _layers ^= bit;
+  _layer_start_ms[static_cast<uint8_t>(layer)] = clock_ms();
+  _next_update_ms = 0;
+}
+
+void StatusLed::jingle(JingleColors color1, JingleColors color2, JingleColors color3,
+                       uint16_t duration_ms) {
+  _jingle_colors[0] = color1;
+  _jingle_colors[1] = color2;
+  _jingle_colors[2] = color3;
+  _jingle_ms = max(duration_ms, static_cast<uint16_t>(3));
+  // Start over, even if one was already playing
+  _layers |= 1 << static_cast<uint8_t>(StatusLayer::JINGLE);
+  _layer_start_ms[static_cast<uint8_t>(StatusLayer::JINGLE)] = clock_ms();
+  _next_update_ms = 0;
+}
+
+void StatusLed::set_error(StatusError error, bool set) {
+  uint8_t bit = 1 << static_cast<uint8_t>(error);
+  if (((_errors & bit) != 0) == set) {
+    return;
+  }
+  uint8_t shown = _errors & -_errors;  // the lowest one
+  _errors ^= bit;
+  show(StatusLayer::ERROR, _errors != 0);
+  // Start the blinks over if it's a different number now
+  if ((_errors & -_errors) != shown) {
+    _layer_start_ms[static_cast<uint8_t>(StatusLayer::ERROR)] = clock_ms();
+    _next_update_ms = 0;
+  }
+}
+
+void StatusLed::set_brightness(uint8_t brightness) {
+  _brightness = brightness;
+  _next_update_ms = 0;
+}
+
+void StatusLed::update() {
+  if (!_started) {
+    return;
+  }
+  uint64_t now_ms = clock_ms();
+  if (now_ms < _next_update_ms) {
+    return;
+  }
+  uint8_t level = 0;
+  JingleColors color = pattern(level, now_ms, _next_update_ms);
+  write(color, level);
+}
+
+JingleColors StatusLed::pattern(uint8_t &level, uint64_t now_ms, uint64_t &until_ms) {
+  // A finished jingle uncovers whatever is underneath
+  uint8_t jingle_bit = 1 << static_cast<uint8_t>(StatusLayer::JINGLE);
+  uint64_t jingle_elapsed = now_ms - _layer_start_ms[static_cast<uint8_t>(StatusLayer::JINGLE)];
+  if ((_layers & jingle_bit) && jingle_elapsed >= _jingle_ms) {
+    _layers &= ~jingle_bit;
+  }
+
+  level = 255;
+  if (_layers & jingle_bit) {
+    uint16_t third = _jingle_ms / 3;
+    uint8_t step = min(jingle_elapsed / third, static_cast<uint64_t>(2));
+    until_ms = _layer_start_ms[static_cast<uint8_t>(StatusLayer::JINGLE)] +
+               (step == 2 ? _jingle_ms : (step + 1) * third);
+    return _jingle_colors[step];
+  }
+
+  if (_layers & (1 << static_cast<uint8_t>(StatusLayer::DOZE))) {
+    uint64_t elapsed = now_ms - _layer_start_ms[static_cast<uint8_t>(StatusLayer::DOZE)];
+    level = STATUS_DOZE_LEVEL;
+    until_ms = now_ms + STATUS_DOZE_HALF_MS - elapsed % STATUS_DOZE_HALF_MS;
+    return (elapsed / STATUS_DOZE_HALF_MS) % 2 == 0 ? JingleColors::YELLOW : JingleColors::OFF;
+  }
+
+  if (_layers & (1 << static_cast<uint8_t>(StatusLayer::ERROR))) {
+    // Blink the lowest error's number, then pause
+    uint8_t code = 0;
+    while (!(_errors & (1 << code))) {
+      code++;
+    }
+    uint32_t blinks_ms = code * STATUS_BLINK_MS;
+    uint32_t phase = (now_ms - _layer_start_ms[static_cast<uint8_t>(StatusLayer::ERROR)]) %
+                     (blinks_ms + STATUS_BLINK_PAUSE_MS);
+    if (phase >= blinks_ms) {
+      until_ms = now_ms + blinks_ms + STATUS_BLINK_PAUSE_MS - phase;
+      return JingleColors::OFF;
+    }
+    uint32_t in_blink = phase % STATUS_BLINK_MS;
+    if (in_blink < STATUS_BLINK_ON_MS) {
+      until_ms = now_ms + STATUS_BLINK_ON_MS - in_blink;
+      return JingleColors::RED;
+    }
+    until_ms = now_ms + STATUS_BLINK_MS - in_blink;
+    return JingleColors::OFF;
+  }
+
+  if (_layers & (1 << static_cast<uint8_t>(StatusLayer::HEARTBEAT))) {
+    uint64_t elapsed = now_ms - _layer_start_ms[static_cast<uint8_t>(StatusLayer::HEARTBEAT)];
+    level = STATUS_HEARTBEAT_LEVEL;
+    until_ms = now_ms + STATUS_HEARTBEAT_HALF_MS - elapsed % STATUS_HEARTBEAT_HALF_MS;
+    return (elapsed / STATUS_HEARTBEAT_HALF_MS) % 2 == 0 ? JingleColors::WHITE : JingleColors::OFF;
+  }
+
+  // Nothing on, nothing to do until something changes
+  until_ms = UINT64_MAX;
+  return JingleColors::OFF;
+}
+
+void StatusLed::write(JingleColors color, uint8_t level) {
+  uint8_t on_duty = STATUS_OFF_DUTY - (static_cast<uint16_t>(level) * _brightness) / 255;
+  for (uint8_t i = 0; i < 3; i++) {
+    // JingleColors is red, green, blue from the lowest bit up
+    uint8_t duty = (static_cast<uint8_t>(color) & (1 << i)) ? on_duty : STATUS_OFF_DUTY;
+    if (duty != _written[i]) {
+      ledcWrite(_first_channel + i, duty);
+      _written[i] = duty;
+    }
+  }
+}
@@ -0,0 +1,143 @@
+#include <Arduino.h>
+#include "StreamPlayer.h"
+
+/*
+Jitter buffer and playout for streamed frames, see StreamPlayer.h.
+
+All the time comparisons are done as signed differences of unsigned
+microsecond counters, so they keep working when clock_us32() (or the
+computer's counter) wraps around every 71 minutes or so.
+*/
+
+// If a frame is this far off from where we expect it, the computer
+// probably restarted its stream, so start over rather than slewing
+const int32_t STREAM_RESYNC_US = 1000000;
+
+StreamPlayer::StreamPlayer(uint16_t playout_delay_ms, uint16_t hold_ms, uint16_t fade_ms)
+  : _head(0),
+    _count(0),
+    _synced(false),
+    _starved(false),
+    _clock_offset_us(0),
+    _playout_delay_us(playout_delay_ms * 1000UL),
+    _hold_us(hold_ms * 1000UL),
+    _fade_us(fade_ms * 1000UL),
+    _starved_since_us(0),
+    frames_received(0),
+    late_frames(0),
+    dropped_frames(0),
+    underruns(0) {
+  _last_output = {0, 0, 0, 0};
+}
+
+void StreamPlayer::reset() {
+  _head = 0;
+  _count = 0;
+  _synced = false;
+  _starved = false;
+}
+
+void StreamPlayer::drop_oldest() {
+  _head = (_head + 1) % STREAM_BUFFER_FRAMES;
+  _count--;
+}
+
+bool StreamPlayer::push(const StreamFrame &frame, uint32_t now_us) {
+  frames_received++;
+
+  if (_synced && _count > 0) {
+    int32_t since_newest = static_cast<int32_t>(frame.timestamp_us - frame_at(_count - 1).timestamp_us);
+    if (since_newest < -STREAM_RESYNC_US) {
+      // Timestamps jumped way back, must be a new stream
+      reset();
+    } else if (since_newest <= 0) {
+      // Out of order or repeated, we've already moved past it
+      dropped_frames++;
+      return false;
+    }
+  }
+
+  if (!_synced) {
+    // Show the first frame one playout delay from now
+    _clock_offset_us = now_us + _playout_delay_us - frame.timestamp_us;
+    _synced = true;
+  }
+
+  // How early did this frame get here, compared to when it will play?
+  int32_t slack = static_cast<int32_t>(frame.timestamp_us + _clock_offset_us - now_us);
+  int32_t error = slack - static_cast<int32_t>(_playout_delay_us);
+  if (error > STREAM_RESYNC_US || error < -STREAM_RESYNC_US) {
+    // Way off, the stream paused and restarted with a new timebase
+    reset();
+    _clock_offset_us = now_us + _playout_delay_us - frame.timestamp_us;
+    _synced = true;
+    error = 0;
+  }
+  if (slack < 0) {
+    // Still worth keeping, it's newer than anything we have
+    late_frames++;
+  }
+  // Slowly pull the clock offset so frames arrive one playout delay early
+  // on average.  The big divisor keeps USB jitter from moving it much.
+  _clock_offset_us -= error / 256;
+
+  if (_count == STREAM_BUFFER_FRAMES) {
+    drop_oldest();
+    dropped_frames++;
+  }
+  frame_at(_count) = frame;
+  _count++;
+  return true;
+}
+
+void StreamPlayer::render(uint32_t now_us, uint16_t &red, uint16_t &green, uint16_t &blue) {
+  if (_synced && _count > 0) {
+    uint32_t stream_now = now_us - _clock_offset_us;
+
+    // Throw away frames we've fully played past
+    while (_count >= 2 && static_cast<int32_t>(frame_at(1).timestamp_us - stream_now) <= 0) {
+      drop_oldest();
+    }
+
+    StreamFrame &from = frame_at(0);
+    if (static_cast<int32_t>(from.timestamp_us - stream_now) > 0) {
+      // Nothing due yet (just started), keep showing what we were
+    } else if (_count >= 2) {
+      if (_starved) {
+        // Frames are back.  Blend from whatever we faded down to, rather
+        // than jumping back up to the old frame.
+        from.timestamp_us = stream_now;
+        from.red = _last_output.red;
+        from.green = _last_output.green;
+        from.blue = _last_output.blue;
+        _starved = false;
+      }
+      StreamFrame &to = frame_at(1);
+      uint32_t span = to.timestamp_us - from.timestamp_us;
+      uint32_t fraction = (static_cast<uint64_t>(stream_now - from.timestamp_us) << 8) / span;
+      _last_output.red = from.red + (((static_cast<int32_t>(to.red) - from.red) * static_cast<int32_t>(fraction)) >> 8);
+      _last_output.green = from.green + (((static_cast<int32_t>(to.green) - from.green) * static_cast<int32_t>(fraction)) >> 8);
+      _last_output.blue = from.blue + (((static_cast<int32_t>(to.blue) - from.blue) * static_cast<int32_t>(fraction)) >> 8);
+    } else {
+      // Played the last frame we have and the next one isn't here
+      if (!_starved) {
+        _starved = true;
+        _starved_since_us = now_us;
+        underruns++;
+      }
+      uint32_t starved_for = now_us - _starved_since_us;
+      uint32_t scale = 256;
+      if (starved_for >= _hold_us + _fade_us) {
+        scale = 0;
+      } else if (starved_for > _hold_us) {
+        scale = 256 - (static_cast<uint64_t>(starved_for - _hold_us) << 8) / _fade_us;
+      }
+      _last_output.red = (from.red * scale) >> 8;
+      _last_output.green = (from.green * scale) >> 8;
+      _last_output.blue = (from.blue * scale) >> 8;
+    }
+  }
+  red = _last_output.red;
+  green = _last_output.green;
+  blue = _last_output.blue;
+}
@@ -0,0 +1,77 @@
+#include <Arduino.h>
+#include "Clock.h"
+#include "PwmPhase.h"
+#include "TemporalDither.h"
+
+/*
+Temporal dithering for the LED PWM outputs, see TemporalDither.h.
+*/
+
+// 16-bit level -> 10 PWM bits plus DITHER_FRACTION_BITS of fraction
+const uint8_t DITHER_DROPPED_BITS = 16 - 10 - DITHER_FRACTION_BITS;
+const uint8_t DITHER_FRACTION_MASK = (1 << DITHER_FRACTION_BITS) - 1;
+
+TemporalDither::TemporalDither(uint8_t red_channel, uint8_t green_channel, uint8_t blue_channel)
+  : _timer(nullptr) {
+#ifdef LIGHT_BENCHMARK
+  _mark_armed = false;
+  _mark_pending = false;
+  _marks_written = 0;
+  _mark_written_us = 0;
+#endif
+  _pwm_channels[0] = red_channel;
+  _pwm_channels[1] = green_channel;
+  _pwm_channels[2] = blue_channel;
+  for (uint8_t i = 0; i < DITHER_CHANNELS; i++) {
+    _targets[i] = 0;
+    _accumulators[i] = 0;
+    _written[i] = 0;
+  }
+}
+
+void TemporalDither::begin() {
+  if (_timer != nullptr) {
+    return;
+  }
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = timer_callback;
+  timer_args.arg = this;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "dither";
+  // If we ever fall behind, just carry on rather than catching up in a burst
+  timer_args.skip_unhandled_events = true;
+  esp_timer_create(&timer_args, &_timer);
+  esp_timer_start_periodic(_timer, DITHER_TICK_US);
+}
+
+void TemporalDither::timer_callback(void* dither) {
+  static_cast<TemporalDither*>(dither)->tick();
+}
+
+void TemporalDither::tick() {
+  for (uint8_t i = 0; i < DITHER_CHANNELS; i++) {
+    uint16_t target = _targets[i] >> DITHER_DROPPED_BITS;
+    uint16_t duty = target >> DITHER_FRACTION_BITS;
+
+    // Add in the fraction, and show one step brighter when it overflows
+    _accumulators[i] += target & DITHER_FRACTION_MASK;
+    if (_accumulators[i] > DITHER_FRACTION_MASK) {
+      _accumulators[i] -= DITHER_FRACTION_MASK + 1;
+      duty++;
+    }
+
+    // Only touch the hardware when something changes.  Each light goes in
+    // at its own place in the PWM cycle, see PwmPhase.h.
+    if (duty != _written[i]) {
+      pwm_phase_write(i, _pwm_channels[i], duty);
+      _written[i] = duty;
+#ifdef LIGHT_BENCHMARK
+      if (_mark_pending) {
+        _mark_pending = false;
+        _mark_written_us = clock_us32();
+        _marks_written++;
+      }
+#endif
+    }
+  }
+}
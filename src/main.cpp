@@ -2,6 +2,16 @@
 #include "DebounceInput.h"
 #include "ProgramState.h"
 #include "OutputController.h"
+#include "SerialProtocol.h"
+#include "AudioAnalyzer.h"
+#include "LoopMonitor.h"
+#include "AdcFrontEnd.h"
+#include "Clock.h"
+#include "SensingTask.h"
+#include "FlightRecorder.h"
+#ifdef LIGHT_BENCHMARK
+#include "LatencyBench.h"
+#endif
 
 ///////////////////////////////////////////////////////////
 // Set some global parameters for how this should all work!
@@ -10,7 +20,11 @@ const bool DEBUG_MODE = false; // Set to false when ready
 const unsigned long WAKE_TO_DOZE_TIME = 30000; // 30 seconds
 const unsigned long DOZE_TO_SLEEP_TIME = 5000; // 5 seconds past doze
 const double wake_dial_deriv_threshold = 1.2; // dial speed to keep from sleep
-const double mode_grab_dial_deriv_threshold = 1.85; // dial speed to grab mode
+const double mode_grab_dial_deriv_threshold = 1.85; // fitted dial speed to grab mode
+const bool AUDIO_ENABLED = true; // Set to false if no microphone on A4
+const uint32_t POWER_BUDGET_MW = 0; // Most the strip may draw, 0 for no limit
+const uint32_t LOOP_BUDGET_US = 2000; // Longest a loop() should take, see LoopMonitor
+const uint8_t LOOP_WATCHDOG_S = 5; // Reset if loop() is stuck this long
 
 ///////////////////////////////////////////////////////////
 
@@ -24,28 +38,55 @@ const int MAX_PWM = (1 << PWM_RESOLUTION) - 1; // Clever way to get 2^PWM_RESOLU
 ProgramState program_state;
 
 // set up the output controller in global scope
-OutputController output_controller;
-
-// Declare a function to set the LED
-void led_debug_heartbeat(ProgramState &state);
-
-// set up digital input pins
-DebounceInput button_rgb(D12, "rgb");
-DebounceInput button_white(D11, "white");
-DebounceInput button_cycle(D9, "cycle");
-DebounceInput button_off(D10, "off");
-DebounceInput button_s1(D8, "s1");
-DebounceInput button_s2(D7, "s2");
-DebounceInput button_s3(D5, "s3");
-DebounceInput button_s4(D6, "s4");
-
-// For debugging inputs
-long int last_report_millis = 0;
-long int last_analog_read_millis = 0;
+OutputController output_controller(D3, D2, D4, 20000, POWER_BUDGET_MW);
+
+// set up the serial control protocol in global scope
+SerialProtocol serial_protocol;
+
+// set up the microphone analysis, it runs on the other core
+AudioAnalyzer audio_analyzer(A4);
+
+// set up the loop timing checks and watchdog
+LoopMonitor loop_monitor(LOOP_BUDGET_US, LOOP_WATCHDOG_S);
+
+// set up digital input pins, in the same order as the Button enum
+DebounceInput buttons[BUTTON_COUNT] = {
+  DebounceInput(D12, "rgb"),
+  DebounceInput(D11, "white"),
+  DebounceInput(D9, "cycle"),
+  DebounceInput(D10, "off"),
+  DebounceInput(D8, "s1"),
+  DebounceInput(D7, "s2"),
+  DebounceInput(D5, "s3"),
+  DebounceInput(D6, "s4")
+};
+
+// set up the input reading, it runs on the other core
+SensingTask sensing_task(program_state, buttons);
+
+// What happened to a button since the last time we looked
+enum class ButtonEdge : uint8_t {
+  NONE,
+  PRESSED,
+  RELEASED
+};
+uint8_t seen_presses[BUTTON_COUNT];
+uint8_t seen_releases[BUTTON_COUNT];
+uint8_t seen_motion_sensors = 0;
+ButtonEdge button_edge(const InputSnapshot &inputs, Button button);
+
+// When these last ran, clock_ms()
+uint64_t last_report_ms = 0;
+uint64_t last_sleep_check_ms = 0;
+
+// Loop overruns, shown on the status LED for a while after each one
+const uint32_t OVERRUN_SHOW_MS = 10000;
+uint32_t seen_overruns = 0;
+uint64_t show_overrun_until_ms = 0;
 
 // cycle_counter for testing purposes
 int cycle_counter = 0;
-int last_changed_milli = 0;
+uint64_t last_changed_ms = 0;
 int press_counter = 0;
 
 // Setup function called once after power up or reset
@@ -59,9 +100,28 @@ void setup() {
   pinMode(LED_BLUE, OUTPUT);
   pinMode(LED_BUILTIN, OUTPUT);
 
+  // Keep the events from before a reset, and mark this boot
+  uint32_t kept_events = flight_recorder_begin();
+  if (kept_events > 0) {
+    Serial.print("Flight recorder has events from before the reset: ");
+    Serial.println(kept_events);
+  }
+
   Serial.print("Using PWM resolution of: ");
   Serial.println(PWM_RESOLUTION);
 
+  // Get the dial readings cleaned up before the dials are set up
+  switch (adc_front_end_begin()) {
+    case AdcCalibration::NO_TABLE:
+      Serial.println("Couldn't build the ADC correction, using the readings as they come");
+      break;
+    case AdcCalibration::DEFAULT_CURVE:
+      Serial.println("No ADC calibration on this chip, using the default curve");
+      break;
+    case AdcCalibration::FACTORY:
+      break;
+  }
+
   // Get the program state set up
   program_state = ProgramState(
     A0, // Red pot pin
@@ -80,10 +140,44 @@ void setup() {
   digitalWrite(LED_BLUE, HIGH);
   digitalWrite(LED_BUILTIN, LOW);
 
+  // Start the light output timing, and the status LED
+  output_controller.begin();
+  output_controller.status().show(StatusLayer::HEARTBEAT, DEBUG_MODE);
+
+  // Start watching the loop, and say so if it was stuck before the reset
+  if (loop_monitor.begin()) {
+    LoopOverrunRecord previous;
+    loop_monitor.get_previous(previous);
+    Serial.print("Reset by the watchdog! Loop was stuck in: ");
+    Serial.println(loop_stage_name(previous.current_stage));
+  }
+
+  // Start reading the inputs on the other core
+  if (sensing_task.begin()) {
+    Serial.println("Reading the inputs on core 0");
+  } else {
+    output_controller.status().set_error(StatusError::SENSING_SINGLE_CORE, true);
+  }
+
+  if (AUDIO_ENABLED) {
+    if (audio_analyzer.begin()) {
+      Serial.println("Listening for music on A4");
+    } else {
+      output_controller.status().set_error(StatusError::NO_MICROPHONE, true);
+    }
+  }
+
+#ifdef LIGHT_BENCHMARK
+  // With everything running, time presses to the lights, if there's a
+  // jumper for it, see LatencyBench.h
+  latency_bench_begin(program_state, buttons, output_controller);
+#endif
+
 }
 
 void loop() {
   // put your main code here, to run repeatedly:
+  loop_monitor.start_iteration();
   cycle_counter++;
   // Update the input states
 
@@ -95,12 +189,25 @@ void loop() {
   // to special mode with rainbows...
   bool mode_updated = false;
   bool special_button_pressed = false;
+  ButtonEdge edge;
+
+  // Everything below works from this one snapshot of the inputs
+  loop_monitor.stage(LoopStage::ANALOG);
+  InputSnapshot inputs;
+  sensing_task.latest(inputs);
+  program_state.take_inputs(inputs);
+  if (inputs.motion_sensors != seen_motion_sensors) {
+    flight_record(FlightEventType::MOTION, inputs.motion_sensors, seen_motion_sensors);
+    seen_motion_sensors = inputs.motion_sensors;
+  }
+  loop_monitor.stage(LoopStage::BUTTONS);
 
   // CYCLE BUTTON
-  if (button_cycle.update()) {
+  edge = button_edge(inputs, Button::CYCLE);
+  if (edge != ButtonEdge::NONE) {
     program_state.manual_motion_update();
     // If the state changed, print it
-    if (button_cycle.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("Cycle button pressed!");
       press_counter++;
       program_state.cycle_mode();
@@ -112,19 +219,21 @@ void loop() {
     Serial.print("Cycle count, millis: ");
     Serial.print(cycle_counter);
     Serial.print(", ");
-    Serial.println((millis() - last_changed_milli));
+    uint64_t elapsed_ms = clock_ms() - last_changed_ms;
+    Serial.println(elapsed_ms);
     Serial.print("Rate:");
-    Serial.println(cycle_counter / (millis() - last_changed_milli));
+    Serial.println(cycle_counter / max(elapsed_ms, static_cast<uint64_t>(1)));
     Serial.print("Presses:" );
     Serial.println(press_counter);
-    last_changed_milli = millis();
+    last_changed_ms = clock_ms();
     cycle_counter = 0;
   }
 
   // OFF BUTTON
-  if (button_off.update()) {
+  edge = button_edge(inputs, Button::OFF);
+  if (edge != ButtonEdge::NONE) {
     // If the state changed, print it
-    if (button_off.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("Off button pressed!");
       program_state.update_mode(Mode::OFF);
       mode_updated = true;
@@ -134,10 +243,11 @@ void loop() {
   }
 
   // WHITE BUTTON
-  if (button_white.update()) {
+  edge = button_edge(inputs, Button::WHITE);
+  if (edge != ButtonEdge::NONE) {
     program_state.manual_motion_update();
     // If the state changed, print it
-    if (button_white.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("White button pressed!");
       program_state.update_mode(Mode::WHITE);
       mode_updated = true;
@@ -147,12 +257,18 @@ void loop() {
   }
 
   // RGB BUTTON
-  if (button_rgb.update()) {
+  edge = button_edge(inputs, Button::RGB);
+  if (edge != ButtonEdge::NONE) {
     program_state.manual_motion_update();
     // If the state changed, print it
-    if (button_rgb.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("RGB button pressed!");
-      program_state.update_mode(Mode::RGB);
+      // Pressing it again switches the dials to hue, saturation, brightness
+      if (program_state.curr_mode == Mode::RGB) {
+        program_state.update_mode(Mode::HSV);
+      } else {
+        program_state.update_mode(Mode::RGB);
+      }
       mode_updated = true;
     } else {
       Serial.println("RGB button released!");
@@ -160,10 +276,11 @@ void loop() {
   }
 
   // S1 BUTTON
-  if (button_s1.update()) {
+  edge = button_edge(inputs, Button::S1);
+  if (edge != ButtonEdge::NONE) {
     program_state.manual_motion_update();
     // If the state changed, print it
-    if (button_s1.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("S1 button pressed!");
       special_button_pressed = true;
       program_state.update_mode(Mode::CUSTOM_1);
@@ -174,10 +291,11 @@ void loop() {
   }
 
   // S2 BUTTON
-  if (button_s2.update()) {
+  edge = button_edge(inputs, Button::S2);
+  if (edge != ButtonEdge::NONE) {
     program_state.manual_motion_update();
     // If the state changed, print it
-    if (button_s2.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("S2 button pressed!");
       special_button_pressed = true;
       program_state.update_mode(Mode::CUSTOM_2);
@@ -188,11 +306,11 @@ void loop() {
   }
 
   // S3 BUTTON
-
-  if (button_s3.update()) {
+  edge = button_edge(inputs, Button::S3);
+  if (edge != ButtonEdge::NONE) {
     program_state.manual_motion_update();
     // If the state changed, print it
-    if (button_s3.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("S3 button pressed!");
       special_button_pressed = true;
       program_state.update_mode(Mode::CUSTOM_3);
@@ -203,10 +321,11 @@ void loop() {
   }
 
   // S4 BUTTON
-  if (button_s4.update()) {
+  edge = button_edge(inputs, Button::S4);
+  if (edge != ButtonEdge::NONE) {
     program_state.manual_motion_update();
     // If the state changed, print it
-    if (button_s4.isActive()) {
+    if (edge == ButtonEdge::PRESSED) {
       Serial.println("S4 button pressed!");
       special_button_pressed = true;
       program_state.update_mode(Mode::CUSTOM_4);
@@ -222,135 +341,149 @@ void loop() {
   if (special_button_pressed) {
     // count how many special buttons are active
     int special_button_count = 0;
-    if (button_s1.isActive()) special_button_count++;
-    if (button_s2.isActive()) special_button_count++;
-    if (button_s3.isActive()) special_button_count++;
-    if (button_s4.isActive()) special_button_count++;
-
-    // If we have more than one special button pressed, go to special mode
-    if (special_button_count > 1) {
+    if (inputs.down(Button::S1)) special_button_count++;
+    if (inputs.down(Button::S2)) special_button_count++;
+    if (inputs.down(Button::S3)) special_button_count++;
+    if (inputs.down(Button::S4)) special_button_count++;
+
+    // Three or more, and we dance to the music
+    // Two (or more, without a microphone that started), and we go to special mode
+    if (special_button_count > 2 && AUDIO_ENABLED && audio_analyzer.running()) {
+      Serial.println("Going to audio mode!");
+      program_state.update_mode(Mode::AUDIO);
+      mode_updated = true;
+    } else if (special_button_count > 1) {
       Serial.println("Going to special mode!");
       program_state.update_mode(Mode::CUSTOM_7);
       mode_updated = true;
     }
   }
 
-  // Read the analog inputs
-  program_state.read_pot_values();
-
-  // Check analog inputs for sleep and mode grab
-  // If dial speed is above threshold, prevent sleep
-  if (program_state.red_pot.get_smooth_deriv() > wake_dial_deriv_threshold ||
-      program_state.green_pot.get_smooth_deriv() > wake_dial_deriv_threshold ||
-      program_state.blue_pot.get_smooth_deriv() > wake_dial_deriv_threshold ||
-      program_state.white_pot.get_smooth_deriv() > wake_dial_deriv_threshold) {
-    program_state.manual_motion_update();
+  // Read the music
+  loop_monitor.stage(LoopStage::ANALOG);
+  if (program_state.curr_mode == Mode::AUDIO) {
+    audio_analyzer.get_levels(program_state.audio_bass_val,
+                              program_state.audio_mid_val,
+                              program_state.audio_treble_val);
   }
 
-  // Check for mode grab
-  if (program_state.curr_mode != Mode::OFF) {
-    if (program_state.curr_mode != Mode::RGB) {
-      if (abs(program_state.red_pot.get_smooth_deriv()) > mode_grab_dial_deriv_threshold ||
-          abs(program_state.green_pot.get_smooth_deriv()) > mode_grab_dial_deriv_threshold ||
-          abs(program_state.blue_pot.get_smooth_deriv()) > mode_grab_dial_deriv_threshold) {
-        program_state.update_mode(Mode::RGB);
-        mode_updated = true;
-      }
-    } else if (program_state.curr_mode != Mode::WHITE) {
-      if (abs(program_state.white_pot.get_smooth_deriv()) > mode_grab_dial_deriv_threshold) {
-        program_state.update_mode(Mode::WHITE);
-        mode_updated = true;
-      }
-    }
-  }
-
-  // Do the background task
-  if (DEBUG_MODE) {
-    led_debug_heartbeat(program_state);
-  }
+  // Check analog inputs for sleep and mode grab
+  mode_updated = program_state.check_dials(wake_dial_deriv_threshold,
+                                           mode_grab_dial_deriv_threshold) || mode_updated;
 
   // Read motion sensors, handle sleep decision
-  // Only run this once per ten milliseconds
-  long int curr_time = millis();
-  if (curr_time % 10 == 0) {
-    if (curr_time - last_analog_read_millis > 1) {
-      last_analog_read_millis = curr_time;  
-      // Check for sleep stuff, this also updates the motion sensors
-      mode_updated = program_state.handle_sleep() || mode_updated;
-    }
+  // Only run this once per ten milliseconds.  Counted from the last time,
+  // rather than on the tens, so a slow pass can't make it skip one.
+  loop_monitor.stage(LoopStage::SLEEP);
+  uint64_t curr_time = clock_ms();
+  if (curr_time - last_sleep_check_ms >= 10) {
+    last_sleep_check_ms = curr_time;
+    // Check for sleep stuff, the sensing task keeps the motion sensors updated
+    mode_updated = program_state.handle_sleep(inputs.occupied) || mode_updated;
   }
 
-
+  // Check for commands from a computer
+  loop_monitor.stage(LoopStage::SERIAL_IO);
+  mode_updated = serial_protocol.poll(program_state, output_controller, loop_monitor,
+                                      sensing_task) || mode_updated;
+#ifdef LIGHT_BENCHMARK
+  mode_updated = latency_bench_poll(program_state) || mode_updated;
+#endif
 
   // Handle the logic
+  loop_monitor.stage(LoopStage::LIGHTS);
+  if (loop_monitor.get_record().overruns != seen_overruns) {
+    seen_overruns = loop_monitor.get_record().overruns;
+    show_overrun_until_ms = curr_time + OVERRUN_SHOW_MS;
+  }
+  output_controller.status().set_error(StatusError::LOOP_OVERRUN, curr_time < show_overrun_until_ms);
   if (mode_updated) {
     output_controller.enter_mode(program_state);
   }
   output_controller.process_mode(program_state);
+  sensing_task.lights_updated(inputs);
 
 
   // Write the analog inputs and some output data once per second
   // This is for debugging
   if (DEBUG_MODE) {
-
-    if (curr_time % 1000 == 0) {
-      if (curr_time - last_report_millis > 1) {
-        last_report_millis = curr_time;
-        Serial.print(curr_time);
-        Serial.print(" Red: ");
-        Serial.print(program_state.red_pot_val);
-        Serial.print(", Green: ");
-        Serial.print(program_state.green_pot_val);
-        Serial.print(", Blue: ");
-        Serial.print(program_state.blue_pot_val);
-        Serial.print(", White: ");
-        Serial.print(program_state.white_pot_val);
-        Serial.print(", Motion A: ");
-        Serial.print(program_state.motion_detector_a.update());
-        Serial.print(": ");
-        Serial.print(program_state.motion_detector_a.occupied());
-        Serial.print(", Motion B: ");
-        Serial.print(program_state.motion_detector_b.update());
-        Serial.print(": ");
-        Serial.println(program_state.motion_detector_b.occupied());
-        Serial.print("Current, last mode: ");
-        Serial.print(static_cast<int>(program_state.curr_mode));
-        Serial.print(", ");
-        Serial.println(static_cast<int>(program_state.last_mode));
-        Serial.print("Dial speeds: ");
-        Serial.print(program_state.red_pot.get_smooth_deriv());
-        Serial.print(", ");
-        Serial.print(program_state.green_pot.get_smooth_deriv());
-        Serial.print(", ");
-        Serial.print(program_state.blue_pot.get_smooth_deriv());
-        Serial.print(", ");
-        Serial.println(program_state.white_pot.get_smooth_deriv());
-      }
+    loop_monitor.stage(LoopStage::DEBUG_PRINT);
+
+    if (curr_time - last_report_ms >= 1000) {
+      last_report_ms = curr_time;
+      Serial.print(curr_time);
+      Serial.print(" Red: ");
+      Serial.print(program_state.red_pot_val);
+      Serial.print(", Green: ");
+      Serial.print(program_state.green_pot_val);
+      Serial.print(", Blue: ");
+      Serial.print(program_state.blue_pot_val);
+      Serial.print(", White: ");
+      Serial.print(program_state.white_pot_val);
+      Serial.print(", Occupied: ");
+      Serial.println(inputs.occupied);
+      Serial.print("Current, last mode: ");
+      Serial.print(static_cast<int>(program_state.curr_mode));
+      Serial.print(", ");
+      Serial.println(static_cast<int>(program_state.last_mode));
+      Serial.print("Dial speeds: ");
+      Serial.print(inputs.speed(Dial::RED));
+      Serial.print(", ");
+      Serial.print(inputs.speed(Dial::GREEN));
+      Serial.print(", ");
+      Serial.print(inputs.speed(Dial::BLUE));
+      Serial.print(", ");
+      Serial.println(inputs.speed(Dial::WHITE));
+      Serial.print("Dial noise at rest, counts: ");
+      Serial.print(inputs.noise_sigma(Dial::RED));
+      Serial.print(", ");
+      Serial.print(inputs.noise_sigma(Dial::GREEN));
+      Serial.print(", ");
+      Serial.print(inputs.noise_sigma(Dial::BLUE));
+      Serial.print(", ");
+      Serial.println(inputs.noise_sigma(Dial::WHITE));
+      Serial.print("Dial smoothing scale for the noise: ");
+      Serial.print(inputs.noise_scale(Dial::RED));
+      Serial.print(", ");
+      Serial.print(inputs.noise_scale(Dial::GREEN));
+      Serial.print(", ");
+      Serial.print(inputs.noise_scale(Dial::BLUE));
+      Serial.print(", ");
+      Serial.println(inputs.noise_scale(Dial::WHITE));
+      Serial.print("Loop overruns, worst us: ");
+      Serial.print(loop_monitor.get_record().overruns);
+      Serial.print(", ");
+      Serial.println(loop_monitor.get_record().worst_us);
+      SensingStats sensing_stats;
+      sensing_task.get_stats(sensing_stats);
+      Serial.print("Input to lights us, average, worst: ");
+      Serial.print(sensing_stats.average_latency_us);
+      Serial.print(", ");
+      Serial.println(sensing_stats.worst_latency_us);
     }
   }
 
 }
 
-// A function to blink the built-in LED for testing to confirm it is on
-void led_debug_heartbeat(ProgramState &state) {
-  if (millis() - state.last_cycle_start < 0) {
-    // This might happen in the case of rollover,
-    // reset the last_cycle_start to zero, then
-    state.last_cycle_start = 0;
-  }
-  if (millis() - state.last_cycle_start < 1000) {
-    digitalWrite(LED_BUILTIN, HIGH);
+// Compare the button counts with the ones we saw last time
+ButtonEdge button_edge(const InputSnapshot &inputs, Button button) {
+  uint8_t i = static_cast<uint8_t>(button);
+  bool pressed = inputs.presses[i] != seen_presses[i];
+  bool released = inputs.releases[i] != seen_releases[i];
+  seen_presses[i] = inputs.presses[i];
+  seen_releases[i] = inputs.releases[i];
+  if (pressed) {
+    flight_record(FlightEventType::BUTTON, i, 1);
   }
-  else if (millis() - state.last_cycle_start < 2000) {
-    digitalWrite(LED_BUILTIN, LOW);
+  if (released) {
+    flight_record(FlightEventType::BUTTON, i, 0);
   }
-  else if (millis() - state.last_cycle_start < 3000) {
-    digitalWrite(LED_BUILTIN, HIGH);
+  // A tap that came and went between two looks still counts as a press
+  if (pressed) {
+    return ButtonEdge::PRESSED;
   }
-  else if (millis() - state.last_cycle_start < 4000) {
-    digitalWrite(LED_BUILTIN, LOW);
+  if (released) {
+    return ButtonEdge::RELEASED;
   }
-  else {
-    state.last_cycle_start = millis();
-  }
-}
\ No newline at end of file
+  return ButtonEdge::NONE;
+}
@@ -0,0 +1,47 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "AdcFrontEnd.h"
+#include "Benchmark.h"
+#include "OutputController.h"
+#include "ProgramState.h"
+
+/*
+The on-device microbenchmarks and checks, see Benchmark.h.  Flash and run
+with pio test -e embedded -v, which keeps what the board printed, then
+compare the timings with the baseline:
+
+    pio test -e embedded -v > bench.txt
+    python tools/check_benchmarks.py --log bench.txt
+
+The test itself only fails on the correctness checks, the timings are for
+tools/check_benchmarks.py to judge.  It all runs again on every reset, so
+python tools/check_benchmarks.py /dev/ttyACM0 works too once it's flashed.
+*/
+
+// The only output controller, so the PWM channels are only set up once
+static OutputController output;
+static ProgramState state;
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_benchmarks() {
+  TEST_ASSERT_EQUAL_UINT32(0, run_benchmarks(state, output));
+}
+
+void setup() {
+  // Time for the computer to open the port after the reset
+  delay(2000);
+  adc_front_end_begin();
+  state = ProgramState();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmarks);
+  UNITY_END();
+}
+
+void loop() {
+}
@@ -0,0 +1,53 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include "AdcFrontEnd.h"
+
+/*
+The ADC front end: what it says it built the correction from, and that the
+corrected readings keep the raw readings' 0-4095 range and order.
+*/
+
+void setUp() {
+  host_reset();
+}
+
+void tearDown() {
+}
+
+static void test_factory_calibration_is_reported() {
+  host_set_adc_calibration(ESP_ADC_CAL_VAL_EFUSE_TP_FIT);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(AdcCalibration::FACTORY), static_cast<int>(adc_front_end_begin()));
+  host_set_adc_calibration(ESP_ADC_CAL_VAL_EFUSE_VREF);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(AdcCalibration::FACTORY), static_cast<int>(adc_front_end_begin()));
+}
+
+static void test_default_curve_is_not_reported_as_missing() {
+  host_set_adc_calibration(ESP_ADC_CAL_VAL_DEFAULT_VREF);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(AdcCalibration::DEFAULT_CURVE), static_cast<int>(adc_front_end_begin()));
+}
+
+static void test_corrected_readings_keep_their_range_and_order() {
+  adc_front_end_begin();
+  uint16_t last = 0;
+  for (uint16_t raw = 0; raw <= 4095; raw += 5) {
+    host_set_analog(A0, raw);
+    uint16_t corrected = adc_front_end_read(A0);
+    TEST_ASSERT_GREATER_OR_EQUAL(last, corrected);
+    last = corrected;
+  }
+  host_set_analog(A0, 0);
+  TEST_ASSERT_EQUAL_UINT16(0, adc_front_end_read(A0));
+  // The table's last step ends on 4095 rather than 4096, so the very top
+  // comes out a count or two short
+  host_set_analog(A0, 4095);
+  TEST_ASSERT_UINT_WITHIN(2, 4095, adc_front_end_read(A0));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_factory_calibration_is_reported);
+  RUN_TEST(test_default_curve_is_not_reported_as_missing);
+  RUN_TEST(test_corrected_readings_keep_their_range_and_order);
+  return UNITY_END();
+}
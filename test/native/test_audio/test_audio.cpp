@@ -0,0 +1,118 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include "AudioAnalyzer.h"
+
+/*
+The audio analysis on made-up microphone signals: tones in each band,
+white noise, and silence, fed in at 8 kHz the way the task would.  Prints
+the band levels for each, and how long a sample takes on this computer, to
+compare a change to the filters or the gain before trying it on the board.
+*/
+
+const uint32_t SAMPLE_RATE_HZ = 8000;
+// About two seconds, long enough for the automatic gain to settle
+const uint32_t SETTLE_SAMPLES = 2 * SAMPLE_RATE_HZ;
+
+struct Levels {
+  uint16_t bass;
+  uint16_t mid;
+  uint16_t treble;
+};
+
+static uint32_t noise_state = 0x2545F491;
+
+static int32_t noise(int32_t amplitude) {
+  noise_state ^= noise_state << 13;
+  noise_state ^= noise_state >> 17;
+  noise_state ^= noise_state << 5;
+  return static_cast<int32_t>(noise_state % (2 * amplitude + 1)) - amplitude;
+}
+
+// Around the middle of the range, like the microphone module's bias
+static Levels listen(uint16_t frequency_hz, int32_t tone_amplitude, int32_t noise_amplitude) {
+  AudioAnalyzer analyzer(A4, SAMPLE_RATE_HZ);
+  for (uint32_t i = 0; i < SETTLE_SAMPLES; i++) {
+    double tone = tone_amplitude * sin(2 * M_PI * frequency_hz * i / SAMPLE_RATE_HZ);
+    int32_t sample = 2048 + static_cast<int32_t>(tone) + (noise_amplitude ? noise(noise_amplitude) : 0);
+    analyzer.add_sample(constrain(sample, 0, 4095));
+  }
+  Levels levels;
+  analyzer.get_levels(levels.bass, levels.mid, levels.treble);
+  char message[96];
+  snprintf(message, sizeof(message), "%5u Hz tone %4d, noise %4d: bass %4u mid %4u treble %4u",
+           frequency_hz, static_cast<int>(tone_amplitude), static_cast<int>(noise_amplitude),
+           levels.bass, levels.mid, levels.treble);
+  TEST_MESSAGE(message);
+  return levels;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// A tone in one band can't light up the others past a quarter
+const uint16_t OFF_BAND_MAX = 256;
+
+static void test_bass_tone_lights_bass() {
+  Levels levels = listen(80, 800, 0);
+  TEST_ASSERT_GREATER_THAN(900, levels.bass);
+  TEST_ASSERT_LESS_THAN(OFF_BAND_MAX, levels.mid);
+  TEST_ASSERT_LESS_THAN(OFF_BAND_MAX, levels.treble);
+}
+
+static void test_mid_tone_lights_mid() {
+  Levels levels = listen(1000, 800, 0);
+  TEST_ASSERT_GREATER_THAN(900, levels.mid);
+  TEST_ASSERT_LESS_THAN(OFF_BAND_MAX, levels.bass);
+  TEST_ASSERT_LESS_THAN(OFF_BAND_MAX, levels.treble);
+}
+
+static void test_treble_tone_lights_treble() {
+  Levels levels = listen(3000, 800, 0);
+  TEST_ASSERT_GREATER_THAN(900, levels.treble);
+  TEST_ASSERT_LESS_THAN(OFF_BAND_MAX, levels.bass);
+  TEST_ASSERT_LESS_THAN(OFF_BAND_MAX, levels.mid);
+}
+
+static void test_noise_lights_every_band() {
+  Levels levels = listen(0, 0, 600);
+  TEST_ASSERT_GREATER_THAN(300, levels.bass);
+  TEST_ASSERT_GREATER_THAN(300, levels.mid);
+  TEST_ASSERT_GREATER_THAN(300, levels.treble);
+}
+
+static void test_silence_stays_dark() {
+  // Only the ADC's own noise, a count or two
+  Levels levels = listen(0, 0, 2);
+  TEST_ASSERT_EQUAL_UINT16(0, levels.bass);
+  TEST_ASSERT_EQUAL_UINT16(0, levels.mid);
+  TEST_ASSERT_EQUAL_UINT16(0, levels.treble);
+}
+
+static void test_time_per_sample() {
+  AudioAnalyzer analyzer(A4, SAMPLE_RATE_HZ);
+  const uint32_t samples = 20 * SAMPLE_RATE_HZ;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < samples; i++) {
+    analyzer.add_sample(2048 + noise(600));
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  char message[64];
+  snprintf(message, sizeof(message), "%.1f ns per sample on this computer", ns / samples);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(samples / AUDIO_BLOCK_SAMPLES, analyzer.blocks_analyzed());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_bass_tone_lights_bass);
+  RUN_TEST(test_mid_tone_lights_mid);
+  RUN_TEST(test_treble_tone_lights_treble);
+  RUN_TEST(test_noise_lights_every_band);
+  RUN_TEST(test_silence_stays_dark);
+  RUN_TEST(test_time_per_sample);
+  return UNITY_END();
+}
@@ -0,0 +1,175 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include "ColorMath.h"
+
+/*
+The fixed-point color math against the textbook HSV conversion in doubles,
+over every hue, and how long each conversion takes on this computer.
+*/
+
+const uint8_t SATURATIONS[] = {0, 1, 64, 128, 192, 254, 255};
+const uint16_t VALUES[] = {0, 1, 255, 1000, 32768, 65535};
+
+static void reference_hsv_to_rgb(const HsvColor &hsv, double rgb[3]) {
+  double h = hsv.hue / static_cast<double>(HUE_SECTOR_STEPS);
+  double s = hsv.sat / 255.0;
+  double v = hsv.val;
+  int sector = static_cast<int>(h);
+  double f = h - sector;
+  double p = v * (1 - s);
+  double q = v * (1 - s * f);
+  double t = v * (1 - s * (1 - f));
+  switch (sector) {
+    case 0: rgb[0] = v; rgb[1] = t; rgb[2] = p; break;
+    case 1: rgb[0] = q; rgb[1] = v; rgb[2] = p; break;
+    case 2: rgb[0] = p; rgb[1] = v; rgb[2] = t; break;
+    case 3: rgb[0] = p; rgb[1] = q; rgb[2] = v; break;
+    case 4: rgb[0] = t; rgb[1] = p; rgb[2] = v; break;
+    default: rgb[0] = v; rgb[1] = p; rgb[2] = q; break;
+  }
+}
+
+// Hue difference the short way around the wheel
+static int hue_distance(uint16_t a, uint16_t b) {
+  int difference = abs(static_cast<int>(a) - static_cast<int>(b));
+  return min(difference, static_cast<int>(HUE_STEPS) - difference);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_hsv_to_rgb_matches_doubles() {
+  double worst = 0;
+  for (uint16_t hue = 0; hue < HUE_STEPS; hue++) {
+    for (uint8_t s = 0; s < sizeof(SATURATIONS); s++) {
+      for (uint8_t v = 0; v < sizeof(VALUES) / sizeof(VALUES[0]); v++) {
+        HsvColor hsv = {hue, SATURATIONS[s], VALUES[v]};
+        RgbColor rgb = hsv_to_rgb(hsv);
+        double expected[3];
+        reference_hsv_to_rgb(hsv, expected);
+        const uint16_t got[3] = {rgb.red, rgb.green, rgb.blue};
+        for (uint8_t i = 0; i < 3; i++) {
+          // As a fraction of the brightness, so dim colors count as much,
+          // less the one count that rounding down can always lose
+          double error = max(fabs(got[i] - expected[i]) - 1, 0.0) / max(static_cast<double>(hsv.val), 1.0);
+          worst = max(worst, error);
+        }
+      }
+    }
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "worst error %.3f%% of the value", 100 * worst);
+  TEST_MESSAGE(message);
+  // The levels are worked out in 1/256ths
+  TEST_ASSERT_LESS_OR_EQUAL(2.0 / 256, worst);
+}
+
+static void test_full_saturation_turns_channels_off() {
+  for (uint16_t hue = 0; hue < HUE_STEPS; hue += HUE_SECTOR_STEPS) {
+    HsvColor hsv = {static_cast<uint16_t>(hue + HUE_SECTOR_STEPS / 2), 255, 65535};
+    RgbColor rgb = hsv_to_rgb(hsv);
+    TEST_ASSERT_EQUAL_UINT16(0, min(rgb.red, min(rgb.green, rgb.blue)));
+    TEST_ASSERT_EQUAL_UINT16(65535, max(rgb.red, max(rgb.green, rgb.blue)));
+  }
+}
+
+static void test_rgb_to_hsv_round_trips() {
+  int worst_hue = 0;
+  int worst_sat = 0;
+  for (uint16_t hue = 0; hue < HUE_STEPS; hue++) {
+    for (uint8_t s = 2; s < sizeof(SATURATIONS); s++) {
+      HsvColor hsv = {hue, SATURATIONS[s], 50000};
+      HsvColor back = rgb_to_hsv(hsv_to_rgb(hsv));
+      worst_hue = max(worst_hue, hue_distance(hsv.hue, back.hue));
+      worst_sat = max(worst_sat, abs(static_cast<int>(hsv.sat) - static_cast<int>(back.sat)));
+      TEST_ASSERT_EQUAL_UINT16(hsv.val, back.val);
+    }
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "worst hue %d steps, saturation %d", worst_hue, worst_sat);
+  TEST_MESSAGE(message);
+  // About a step, plus what the low saturations lose going to RGB
+  TEST_ASSERT_LESS_OR_EQUAL(4, worst_hue);
+  TEST_ASSERT_LESS_OR_EQUAL(2, worst_sat);
+}
+
+static void test_hue_brightness_evens_out_the_wheel() {
+  HueBrightness balance;
+  const double weights[3] = {0.33, 0.47, 0.20};
+  double dimmest = 1e9;
+  double brightest = 0;
+  for (uint16_t hue = 0; hue < HUE_STEPS; hue++) {
+    HsvColor hsv = {hue, 255, 65535};
+    RgbColor rgb = balance.to_rgb(hsv);
+    double looks = weights[0] * rgb.red + weights[1] * rgb.green + weights[2] * rgb.blue;
+    dimmest = min(dimmest, looks);
+    brightest = max(brightest, looks);
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "brightest hue %.2f%% over the dimmest",
+           100 * (brightest / dimmest - 1));
+  TEST_MESSAGE(message);
+  // The gain table is 32 hues apart, in between it's interpolated
+  TEST_ASSERT_LESS_THAN(1.05, brightest / dimmest);
+}
+
+// Time a conversion over the whole wheel, in nanoseconds per color
+template <class Convert>
+static double time_per_color(Convert convert) {
+  const uint16_t rounds = 200;
+  volatile uint32_t sink = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint16_t round = 0; round < rounds; round++) {
+    for (uint16_t hue = 0; hue < HUE_STEPS; hue++) {
+      sink = sink + convert(hue, round);
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ns / (static_cast<double>(rounds) * HUE_STEPS);
+}
+
+struct ConvertHsv {
+  uint32_t operator()(uint16_t hue, uint16_t round) const {
+    HsvColor hsv = {hue, static_cast<uint8_t>(round), 40000};
+    return hsv_to_rgb(hsv).green;
+  }
+};
+
+struct ConvertRgb {
+  uint32_t operator()(uint16_t hue, uint16_t round) const {
+    RgbColor rgb = {static_cast<uint16_t>(hue * 40), static_cast<uint16_t>(round * 300), 20000};
+    return rgb_to_hsv(rgb).hue;
+  }
+};
+
+struct ConvertBalanced {
+  const HueBrightness* balance;
+  uint32_t operator()(uint16_t hue, uint16_t round) const {
+    HsvColor hsv = {hue, static_cast<uint8_t>(round), 40000};
+    return balance->to_rgb(hsv).green;
+  }
+};
+
+static void test_time_per_conversion() {
+  HueBrightness balance;
+  ConvertBalanced balanced = {&balance};
+  char message[96];
+  snprintf(message, sizeof(message), "ns per color on this computer: hsv_to_rgb %.1f, "
+           "rgb_to_hsv %.1f, HueBrightness %.1f",
+           time_per_color(ConvertHsv()), time_per_color(ConvertRgb()), time_per_color(balanced));
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_hsv_to_rgb_matches_doubles);
+  RUN_TEST(test_full_saturation_turns_channels_off);
+  RUN_TEST(test_rgb_to_hsv_round_trips);
+  RUN_TEST(test_hue_brightness_evens_out_the_wheel);
+  RUN_TEST(test_time_per_conversion);
+  return UNITY_END();
+}
@@ -0,0 +1,81 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include "TemporalDither.h"
+
+/*
+The dithering's promise: over any 16 ticks, the average duty is exactly the
+level asked for, to 4 bits past the PWM's 10, and the slowest pattern still
+repeats every 16 ticks.
+*/
+
+const uint16_t FRACTION_STEPS = 1 << DITHER_FRACTION_BITS;
+
+// What the PWM should average for a 16-bit level, in 1/16ths of a duty step
+static uint32_t expected_sixteenths(uint16_t level) {
+  return level >> (16 - 10 - DITHER_FRACTION_BITS);
+}
+
+void setUp() {
+  host_reset();
+}
+
+void tearDown() {
+}
+
+static void test_average_is_exact_for_every_level() {
+  TemporalDither dither;
+  for (uint32_t level = 0; level <= 0xFFFF; level += 4) {
+    dither.set(level, 0xFFFF - level, level / 2);
+    // Start from wherever the last level left the accumulators, like it would
+    uint32_t sums[DITHER_CHANNELS] = {0, 0, 0};
+    for (uint16_t tick = 0; tick < FRACTION_STEPS; tick++) {
+      dither.tick();
+      for (uint8_t i = 0; i < DITHER_CHANNELS; i++) {
+        sums[i] += dither.written(i);
+      }
+    }
+    TEST_ASSERT_EQUAL_UINT32(expected_sixteenths(level), sums[0]);
+    TEST_ASSERT_EQUAL_UINT32(expected_sixteenths(0xFFFF - level), sums[1]);
+    TEST_ASSERT_EQUAL_UINT32(expected_sixteenths(level / 2), sums[2]);
+  }
+}
+
+static void test_only_neighbouring_duties_are_shown() {
+  TemporalDither dither;
+  // 3.25 steps, 3 three times and 4 once
+  uint16_t level = (3 * FRACTION_STEPS + FRACTION_STEPS / 4) << (16 - 10 - DITHER_FRACTION_BITS);
+  dither.set(level, level, level);
+  uint8_t brighter = 0;
+  for (uint16_t tick = 0; tick < 4 * FRACTION_STEPS; tick++) {
+    dither.tick();
+    uint16_t duty = dither.written(0);
+    TEST_ASSERT_TRUE(duty == 3 || duty == 4);
+    brighter += duty == 4 ? 1 : 0;
+  }
+  TEST_ASSERT_EQUAL_UINT8(4 * 4, brighter);
+}
+
+static void test_timer_drives_the_pwm() {
+  TemporalDither dither;
+  dither.begin();
+  uint16_t level = 0x1234;
+  dither.set(level, level, level);
+  // A tick's worth of time at a time, summing what the PWM was set to
+  host_advance_us(DITHER_TICK_US);
+  uint32_t sum = 0;
+  const uint32_t ticks = 100 * FRACTION_STEPS;
+  for (uint32_t tick = 0; tick < ticks; tick++) {
+    host_advance_us(DITHER_TICK_US);
+    sum += host_ledc_duty(0);
+  }
+  TEST_ASSERT_EQUAL_UINT32(100 * expected_sixteenths(level), sum);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_average_is_exact_for_every_level);
+  RUN_TEST(test_only_neighbouring_duties_are_shown);
+  RUN_TEST(test_timer_drives_the_pwm);
+  return UNITY_END();
+}
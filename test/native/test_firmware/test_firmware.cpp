@@ -0,0 +1,117 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include "Clock.h"
+#include "ProgramState.h"
+
+/*
+The whole firmware on the made-up board (lib/host_arduino): setup() once,
+then loop() a pass a millisecond, pressing buttons and leaving the room the
+way someone would.
+*/
+
+// From src/main.cpp
+extern ProgramState program_state;
+
+const uint8_t WHITE_BUTTON_PIN = D11;
+const uint8_t OFF_BUTTON_PIN = D10;
+const uint8_t SPECIAL_BUTTON_PINS[] = {D8, D7, D5};
+const uint32_t SLEEP_AFTER_MS = 30000 + 5000;
+// The motion sensors count as seeing someone for this long after they last did
+const uint32_t MOTION_COOLDOWN_MS = 4000;
+
+static void run_ms(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    loop();
+    host_advance_us(1000);
+  }
+}
+
+// Held down long enough to get through the debouncing, then let go
+static void press(uint8_t pin) {
+  host_set_pin(pin, LOW);
+  run_ms(100);
+  host_release_pin(pin);
+  run_ms(100);
+}
+
+void setUp() {
+  host_reset();
+}
+
+void tearDown() {
+}
+
+static void test_setup_sets_up_each_light_once() {
+  setup();
+  run_ms(10);
+  const uint8_t pins[] = {D3, D2, D4};
+  for (uint8_t channel = 0; channel < 3; channel++) {
+    TEST_ASSERT_EQUAL_UINT8(1, host_ledc_setups(channel));
+    TEST_ASSERT_EQUAL_UINT8(pins[channel], host_ledc_pin(channel));
+  }
+}
+
+static void test_buttons_change_the_mode() {
+  press(WHITE_BUTTON_PIN);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::WHITE), static_cast<int>(program_state.curr_mode));
+  press(OFF_BUTTON_PIN);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::OFF), static_cast<int>(program_state.curr_mode));
+}
+
+static void test_lights_go_off_when_the_room_is_left() {
+  run_ms(MOTION_COOLDOWN_MS);
+  press(WHITE_BUTTON_PIN);
+  run_ms(SLEEP_AFTER_MS - 1000);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::SLEEP_PREP), static_cast<int>(program_state.curr_mode));
+  run_ms(2000);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::OFF), static_cast<int>(program_state.curr_mode));
+}
+
+static void test_special_buttons_pick_one_mode_by_count() {
+  host_set_pin(SPECIAL_BUTTON_PINS[0], LOW);
+  run_ms(100);
+  host_set_pin(SPECIAL_BUTTON_PINS[1], LOW);
+  run_ms(100);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::CUSTOM_7), static_cast<int>(program_state.curr_mode));
+  // Three would be AUDIO, but the made-up board has no microphone running
+  // (its tasks never start), so they stay on the special mode
+  host_set_pin(SPECIAL_BUTTON_PINS[2], LOW);
+  run_ms(100);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::CUSTOM_7), static_cast<int>(program_state.curr_mode));
+  for (uint8_t i = 0; i < 3; i++) {
+    host_release_pin(SPECIAL_BUTTON_PINS[i]);
+  }
+  run_ms(100);
+}
+
+// A dial turned steadily from one end to the other
+static void turn(uint8_t pin, uint16_t from, uint16_t to, uint32_t ms) {
+  for (uint32_t i = 0; i <= ms; i++) {
+    host_set_analog(pin, from + (static_cast<int32_t>(to) - from) * static_cast<int32_t>(i) / static_cast<int32_t>(ms));
+    run_ms(1);
+  }
+  run_ms(200);
+}
+
+static void test_turning_a_dial_grabs_the_mode() {
+  press(WHITE_BUTTON_PIN);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::WHITE), static_cast<int>(program_state.curr_mode));
+  // Slow enough to just wake it, not to take over
+  turn(A3, 0, 200, 400);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::WHITE), static_cast<int>(program_state.curr_mode));
+  turn(A1, 0, 3000, 500);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::RGB), static_cast<int>(program_state.curr_mode));
+  turn(A3, 200, 3000, 500);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::WHITE), static_cast<int>(program_state.curr_mode));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_setup_sets_up_each_light_once);
+  RUN_TEST(test_buttons_change_the_mode);
+  RUN_TEST(test_lights_go_off_when_the_room_is_left);
+  RUN_TEST(test_special_buttons_pick_one_mode_by_count);
+  RUN_TEST(test_turning_a_dial_grabs_the_mode);
+  return UNITY_END();
+}
@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include "Clock.h"
+#include "OutputController.h"
+#include "ProgramState.h"
+#include "SensingTask.h"
+
+/*
+Press-to-light latency through the whole firmware on the made-up board:
+drive a pin at some point in the millisecond, then run loop() a pass at a
+time until the PWM duty moves.  The board does the same with a jumper in
+the benchmark firmware (include/LatencyBench.h); here it's every build.
+*/
+
+// From src/main.cpp
+extern ProgramState program_state;
+extern OutputController output_controller;
+
+const uint8_t WHITE_BUTTON_PIN = D11;
+const uint8_t MOTION_PIN = A5;
+const uint8_t LIGHT_CHANNELS = 3;
+const uint32_t PASS_US = 250;
+const uint32_t STEP_US = 10;
+const uint32_t TIMEOUT_US = 200000;
+const uint8_t PRESSES = 20;
+// What each input has to get through, see DebounceInput and main.cpp
+const uint32_t BUTTON_DEBOUNCE_US = 50000;
+const uint32_t MOTION_DEBOUNCE_US = 20000;
+const uint32_t SLEEP_CHECK_US = 10000;
+// Idle buttons are only polled this often, see SensingTask.h
+const uint32_t BUTTON_IDLE_PERIOD_US = BUTTON_IDLE_PERIOD_MS * 1000;
+const uint32_t MOTION_COOLDOWN_MS = 4000;
+// Past the debouncing, a loop() pass, the dithering tick and the ms the press landed in
+const uint32_t SLACK_US = 2000;
+
+static void run_ms(uint32_t ms) {
+  uint64_t until_us = clock_us() + static_cast<uint64_t>(ms) * 1000;
+  while (clock_us() < until_us) {
+    loop();
+    host_advance_us(PASS_US);
+  }
+}
+
+static bool lights_are(const uint32_t* duties) {
+  for (uint8_t channel = 0; channel < LIGHT_CHANNELS; channel++) {
+    if (host_ledc_duty(channel) != duties[channel]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Drive the pin, return how long until the lights change, in microseconds
+static uint32_t time_to_lights(uint8_t pin, bool level, uint32_t offset_us) {
+  host_advance_us(offset_us);
+  uint32_t before[LIGHT_CHANNELS];
+  for (uint8_t channel = 0; channel < LIGHT_CHANNELS; channel++) {
+    before[channel] = host_ledc_duty(channel);
+  }
+  uint32_t pressed_us = clock_us32();
+  host_set_pin(pin, level);
+  while (clock_us32() - pressed_us < TIMEOUT_US) {
+    loop();
+    for (uint32_t step = 0; step < PASS_US; step += STEP_US) {
+      host_advance_us(STEP_US);
+      if (!lights_are(before)) {
+        return clock_us32() - pressed_us;
+      }
+    }
+  }
+  return UINT32_MAX;
+}
+
+static void go_to(Mode last_mode, Mode mode) {
+  program_state.update_mode(last_mode);
+  program_state.update_mode(mode);
+  program_state.manual_motion_update();
+  output_controller.enter_mode(program_state);
+  run_ms(150);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_a_press_takes_the_debounce_and_a_little() {
+  host_reset();
+  host_set_analog(A0, 3000);
+  host_set_analog(A1, 2000);
+  host_set_analog(A2, 1000);
+  host_set_analog(A3, 2500);
+  setup();
+  run_ms(100);
+
+  uint32_t worst_us = 0;
+  for (uint8_t i = 0; i < PRESSES; i++) {
+    go_to(Mode::WHITE, Mode::OFF);
+    // Spread over the millisecond, and over the loop() pass
+    uint32_t latency_us = time_to_lights(WHITE_BUTTON_PIN, LOW, i * 53 % 1000);
+    host_release_pin(WHITE_BUTTON_PIN);
+    run_ms(150);
+    TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::WHITE), static_cast<int>(program_state.curr_mode));
+    TEST_ASSERT_TRUE(latency_us >= BUTTON_DEBOUNCE_US);
+    TEST_ASSERT_TRUE(latency_us <= BUTTON_DEBOUNCE_US + SLACK_US);
+    worst_us = max(worst_us, latency_us);
+  }
+  printf("Worst press to light %u us\n", worst_us);
+}
+
+static void test_a_press_after_a_while_waits_for_the_idle_poll() {
+  go_to(Mode::WHITE, Mode::OFF);
+  run_ms(2000);
+  uint32_t latency_us = time_to_lights(WHITE_BUTTON_PIN, LOW, 0);
+  host_release_pin(WHITE_BUTTON_PIN);
+  run_ms(150);
+  TEST_ASSERT_TRUE(latency_us >= BUTTON_DEBOUNCE_US);
+  TEST_ASSERT_TRUE(latency_us <= BUTTON_DEBOUNCE_US + BUTTON_IDLE_PERIOD_US + SLACK_US);
+}
+
+static void test_motion_wakes_the_lights_after_its_debounce_and_the_sleep_check() {
+  for (uint8_t i = 0; i < PRESSES / 4; i++) {
+    go_to(Mode::WHITE, Mode::SLEEP_PREP);
+    uint32_t latency_us = time_to_lights(MOTION_PIN, HIGH, i * 211 % 1000);
+    host_release_pin(MOTION_PIN);
+    run_ms(MOTION_COOLDOWN_MS + 500);
+    TEST_ASSERT_TRUE(latency_us >= MOTION_DEBOUNCE_US);
+    TEST_ASSERT_TRUE(latency_us <= MOTION_DEBOUNCE_US + SLEEP_CHECK_US + SLACK_US);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_a_press_takes_the_debounce_and_a_little);
+  RUN_TEST(test_a_press_after_a_while_waits_for_the_idle_poll);
+  RUN_TEST(test_motion_wakes_the_lights_after_its_debounce_and_the_sleep_check);
+  return UNITY_END();
+}
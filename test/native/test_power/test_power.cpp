@@ -0,0 +1,122 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "PowerBudget.h"
+
+/*
+The power limiter and the energy count: over the budget the three levels
+come down together and land at (not over) the budget, and the energy adds
+up right through the microsecond clock wrapping.
+*/
+
+const uint32_t FULL_WHITE_MW = 3 * 10000;
+
+static uint32_t draw_of(uint16_t red, uint16_t green, uint16_t blue) {
+  // With the default 10 W a channel
+  return (static_cast<uint64_t>(red) + green + blue) * 10000 / 65536;
+}
+
+static uint32_t random_state = 0x2545F491;
+
+static uint16_t random_level() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state & 0xFFFF;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_no_budget_never_limits() {
+  PowerBudget power;
+  uint16_t red = 65535, green = 65535, blue = 65535;
+  TEST_ASSERT_FALSE(power.limit(red, green, blue));
+  TEST_ASSERT_EQUAL_UINT16(65535, red);
+  TEST_ASSERT_EQUAL_UINT16(65535, green);
+  TEST_ASSERT_EQUAL_UINT16(65535, blue);
+  TEST_ASSERT_UINT32_WITHIN(10, FULL_WHITE_MW, power.get_draw_mw());
+}
+
+static void test_under_budget_is_untouched() {
+  PowerBudget power(20000);
+  uint16_t red = 30000, green = 20000, blue = 10000;
+  TEST_ASSERT_FALSE(power.limit(red, green, blue));
+  TEST_ASSERT_EQUAL_UINT16(30000, red);
+  TEST_ASSERT_EQUAL_UINT16(20000, green);
+  TEST_ASSERT_EQUAL_UINT16(10000, blue);
+  TEST_ASSERT_EQUAL_UINT32(0, power.get_limit_events());
+}
+
+static void test_over_budget_keeps_the_color() {
+  for (uint16_t i = 0; i < 10000; i++) {
+    uint32_t budget_mw = 1000 + random_level() % 25000;
+    PowerBudget power(budget_mw);
+    uint16_t asked[3] = {random_level(), random_level(), random_level()};
+    uint16_t red = asked[0], green = asked[1], blue = asked[2];
+    bool limited = power.limit(red, green, blue);
+    if (!limited) {
+      TEST_ASSERT_LESS_OR_EQUAL(budget_mw + 10, draw_of(red, green, blue));
+      continue;
+    }
+    // At the budget.  The limiter works the draw out from 12 bits of each
+    // level, so it can be off by a few milliwatts either way.
+    uint32_t draw_mw = draw_of(red, green, blue);
+    TEST_ASSERT_LESS_OR_EQUAL(budget_mw + 10, draw_mw);
+    TEST_ASSERT_GREATER_OR_EQUAL(budget_mw * 99 / 100, draw_mw);
+    // The same fraction off every channel, to within rounding
+    const uint16_t got[3] = {red, green, blue};
+    uint16_t brightest = 0;
+    for (uint8_t c = 1; c < 3; c++) {
+      if (asked[c] > asked[brightest]) {
+        brightest = c;
+      }
+    }
+    double scale = got[brightest] / static_cast<double>(asked[brightest]);
+    for (uint8_t c = 0; c < 3; c++) {
+      TEST_ASSERT_FLOAT_WITHIN(2.0, asked[c] * scale, got[c]);
+    }
+  }
+}
+
+static void test_limit_events_count_each_time_it_starts() {
+  PowerBudget power(10000);
+  const uint16_t levels[] = {60000, 60000, 10000, 60000, 10000};
+  for (uint8_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+    uint16_t red = levels[i], green = levels[i], blue = levels[i];
+    power.limit(red, green, blue);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2, power.get_limit_events());
+}
+
+static void test_energy_adds_up_through_the_clock_wrapping() {
+  PowerBudget power;
+  // An hour a millisecond at a time, starting just before micros() wraps.
+  // Like the loop, the first call only starts the count, with nothing on yet.
+  uint32_t now_us = UINT32_MAX - 500000;
+  power.account(Mode::RGB, now_us);
+  uint16_t red = 65535, green = 0, blue = 0;
+  power.limit(red, green, blue);
+  uint32_t draw_mw = power.get_draw_mw();
+  for (uint32_t ms = 0; ms < 3600000; ms++) {
+    now_us += 1000;
+    power.account(ms < 1800000 ? Mode::RGB : Mode::HSV, now_us);
+  }
+  TEST_ASSERT_UINT32_WITHIN(1, draw_mw, power.get_energy_mwh());
+  TEST_ASSERT_UINT32_WITHIN(1, draw_mw / 2, power.get_mode_energy_mwh(Mode::RGB));
+  TEST_ASSERT_UINT32_WITHIN(1, draw_mw / 2, power.get_mode_energy_mwh(Mode::HSV));
+  TEST_ASSERT_EQUAL_UINT32(0, power.get_mode_energy_mwh(Mode::WHITE));
+  TEST_ASSERT_EQUAL_UINT32(0, power.get_mode_energy_mwh(Mode::INVALID));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_no_budget_never_limits);
+  RUN_TEST(test_under_budget_is_untouched);
+  RUN_TEST(test_over_budget_keeps_the_color);
+  RUN_TEST(test_limit_events_count_each_time_it_starts);
+  RUN_TEST(test_energy_adds_up_through_the_clock_wrapping);
+  return UNITY_END();
+}
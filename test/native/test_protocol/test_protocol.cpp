@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include <string>
+#include "SerialProtocol.h"
+
+/*
+The serial protocol against the real parser and command handling, with
+frames handed straight to Serial and the replies read back from it.
+*/
+
+// From src/main.cpp
+extern ProgramState program_state;
+extern OutputController output_controller;
+extern SerialProtocol serial_protocol;
+extern LoopMonitor loop_monitor;
+extern SensingTask sensing_task;
+
+static std::string encode_frame(uint8_t command, const std::string &payload) {
+  std::string frame;
+  frame += static_cast<char>(PROTOCOL_SYNC_BYTE);
+  frame += static_cast<char>(payload.size());
+  frame += static_cast<char>(command);
+  frame += payload;
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 1; i < frame.size(); i++) {
+    crc = crc16_update(crc, static_cast<uint8_t>(frame[i]));
+  }
+  frame += static_cast<char>(crc & 0xFF);
+  frame += static_cast<char>(crc >> 8);
+  return frame;
+}
+
+static void send(const std::string &bytes) {
+  host_serial_feed(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+  serial_protocol.poll(program_state, output_controller, loop_monitor, sensing_task);
+}
+
+// The payload of the first reply to a command in what was written, and
+// fails the test if there isn't one
+static std::string reply_to(uint8_t command) {
+  std::string output = host_serial_take_output();
+  std::string start;
+  start += static_cast<char>(PROTOCOL_SYNC_BYTE);
+  size_t position = 0;
+  while ((position = output.find(start, position)) != std::string::npos) {
+    if (position + 3 <= output.size() &&
+        static_cast<uint8_t>(output[position + 2]) == (command | PROTOCOL_REPLY_FLAG)) {
+      uint8_t length = output[position + 1];
+      TEST_ASSERT_TRUE(position + length + 5 <= output.size());
+      return output.substr(position + 3, length);
+    }
+    position++;
+  }
+  TEST_FAIL_MESSAGE("no reply");
+  return std::string();
+}
+
+static int16_t read_i16(const std::string &payload, size_t offset) {
+  return static_cast<int16_t>(static_cast<uint8_t>(payload[offset]) |
+                              (static_cast<uint8_t>(payload[offset + 1]) << 8));
+}
+
+void setUp() {
+  host_reset();
+}
+
+void tearDown() {
+}
+
+static void test_crc_matches_ccitt_false() {
+  // The standard check value, CRC-16/CCITT-FALSE of "123456789"
+  const char* text = "123456789";
+  uint16_t crc = 0xFFFF;
+  for (const char* c = text; *c; c++) {
+    crc = crc16_update(crc, *c);
+  }
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, crc);
+}
+
+static void test_ping_is_echoed_through_debug_text() {
+  send("some debug text\r\n" + encode_frame(0x01, "hello") + "more text");
+  TEST_ASSERT_EQUAL_STRING("hello", reply_to(0x01).c_str());
+}
+
+static void test_bad_crc_is_dropped_and_counted() {
+  std::string frame = encode_frame(0x01, "x");
+  frame[frame.size() - 1] ^= 0xFF;
+  send(frame + encode_frame(0x06, ""));
+  std::string counters = reply_to(0x06);
+  // frames_ok, then crc_errors
+  TEST_ASSERT_EQUAL_UINT8(1, static_cast<uint8_t>(counters[4]));
+}
+
+static void test_fast_dial_speed_is_pinned_to_the_reply() {
+  program_state.inputs.dial_speed[0] = 1000.0f;
+  program_state.inputs.dial_speed[1] = -1000.0f;
+  program_state.inputs.dial_speed[2] = 1.5f;
+  program_state.inputs.dial_speed[3] = 0;
+  send(encode_frame(0x02, ""));
+  std::string state = reply_to(0x02);
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, read_i16(state, 10));
+  TEST_ASSERT_EQUAL_INT16(INT16_MIN, read_i16(state, 12));
+  TEST_ASSERT_EQUAL_INT16(150, read_i16(state, 14));
+  TEST_ASSERT_EQUAL_INT16(0, read_i16(state, 16));
+}
+
+static void test_set_mode_refuses_to_doze() {
+  Mode before = program_state.curr_mode;
+  send(encode_frame(0x03, std::string(1, static_cast<char>(Mode::SLEEP_PREP))));
+  std::string nack = reply_to(0x7F);
+  TEST_ASSERT_EQUAL_UINT8(0x03, static_cast<uint8_t>(nack[0]));
+  TEST_ASSERT_EQUAL_UINT8(static_cast<uint8_t>(ProtocolError::BAD_VALUE), static_cast<uint8_t>(nack[1]));
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(before), static_cast<int>(program_state.curr_mode));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_matches_ccitt_false);
+  RUN_TEST(test_ping_is_echoed_through_debug_text);
+  RUN_TEST(test_bad_crc_is_dropped_and_counted);
+  RUN_TEST(test_fast_dial_speed_is_pinned_to_the_reply);
+  RUN_TEST(test_set_mode_refuses_to_doze);
+  return UNITY_END();
+}
@@ -0,0 +1,202 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include <atomic>
+#include <thread>
+#include "InputSnapshot.h"
+#include "SensingTask.h"
+#include "SeqLock.h"
+
+/*
+The hand-off from the sensing task to loop().  The SeqLock gets a real
+second thread hammering it, the sensing task runs its single-core fallback
+like it does on the host, driven a pass at a time.
+*/
+
+// From src/main.cpp
+extern ProgramState program_state;
+extern SensingTask sensing_task;
+
+const uint8_t WHITE_BUTTON_PIN = D11;
+const uint32_t SEQLOCK_READS = 1000000;
+
+// Every word the same, so a copy that's half old and half new shows.  Big
+// enough that the copy gets interrupted now and then, even on one core.
+struct Stamped {
+  uint32_t words[64];
+};
+
+// Sensing passes a millisecond apart, like the task would do them
+static void sense_ms(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    sensing_task.sense();
+    host_advance_us(1000);
+  }
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_seqlock_reads_are_never_torn() {
+  static SeqLock<Stamped> lock;
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> written(0);
+  // Writes as fast as it can until the reader has had enough
+  std::thread writer([&]() {
+    Stamped value;
+    uint32_t i = 0;
+    while (!done) {
+      i++;
+      for (uint8_t word = 0; word < 64; word++) {
+        value.words[word] = i;
+      }
+      lock.write(value);
+    }
+    written = i;
+  });
+  while (lock.writes() == 0) {
+  }
+
+  uint32_t retries = 0;
+  uint32_t last = 0;
+  uint32_t torn = 0;
+  uint32_t backwards = 0;
+  for (uint32_t read = 0; read < SEQLOCK_READS; read++) {
+    Stamped value;
+    retries += lock.read(value);
+    for (uint8_t word = 1; word < 64; word++) {
+      if (value.words[word] != value.words[0]) {
+        torn++;
+        break;
+      }
+    }
+    if (value.words[0] < last) {
+      backwards++;
+    }
+    last = value.words[0];
+  }
+  done = true;
+  writer.join();
+  printf("%u reads alongside %u writes, %u retries\n", SEQLOCK_READS, written.load(), retries);
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_EQUAL_UINT32(0, backwards);
+  TEST_ASSERT_EQUAL_UINT32(written.load(), lock.writes());
+  Stamped value;
+  TEST_ASSERT_EQUAL_UINT32(0, lock.read(value));
+  TEST_ASSERT_EQUAL_UINT32(written.load(), value.words[63]);
+}
+
+static void test_snapshot_has_the_dials() {
+  host_reset();
+  host_set_analog(A0, 3000);
+  host_set_analog(A3, 500);
+  setup();
+  sense_ms(500);
+  InputSnapshot snapshot;
+  sensing_task.latest(snapshot);
+  TEST_ASSERT_FALSE(sensing_task.running());
+  TEST_ASSERT_UINT16_WITHIN(20, 3000, snapshot.value(Dial::RED));
+  TEST_ASSERT_UINT16_WITHIN(20, 500, snapshot.value(Dial::WHITE));
+  TEST_ASSERT_EQUAL_UINT16(0, snapshot.value(Dial::GREEN));
+}
+
+static void test_quick_tap_between_snapshots_is_counted() {
+  InputSnapshot before;
+  sensing_task.latest(before);
+  // Pressed and let go again between two looks, loop() never sees it down
+  host_set_pin(WHITE_BUTTON_PIN, LOW);
+  sense_ms(100);
+  host_release_pin(WHITE_BUTTON_PIN);
+  sense_ms(100);
+  InputSnapshot after;
+  sensing_task.latest(after);
+  uint8_t white = static_cast<uint8_t>(Button::WHITE);
+  TEST_ASSERT_FALSE(after.down(Button::WHITE));
+  TEST_ASSERT_EQUAL_UINT8(1, static_cast<uint8_t>(after.presses[white] - before.presses[white]));
+  TEST_ASSERT_EQUAL_UINT8(1, static_cast<uint8_t>(after.releases[white] - before.releases[white]));
+  TEST_ASSERT_TRUE(after.pass > before.pass);
+}
+
+static void test_latency_counts_each_snapshot_once() {
+  SensingStats start;
+  sensing_task.get_stats(start);
+  InputSnapshot snapshot;
+  sensing_task.latest(snapshot);
+  host_advance_us(700);
+  sensing_task.lights_updated(snapshot);
+  // loop() going around again on the same snapshot doesn't count
+  host_advance_us(5000);
+  sensing_task.lights_updated(snapshot);
+  SensingStats stats;
+  sensing_task.get_stats(stats);
+  TEST_ASSERT_EQUAL_UINT32(700, stats.last_latency_us);
+  TEST_ASSERT_TRUE(stats.worst_latency_us >= 700);
+  TEST_ASSERT_EQUAL_UINT32(start.reads + 1, stats.reads);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.read_retries);
+}
+
+static void test_idle_buttons_are_polled_less_but_still_seen() {
+  sense_ms(2000);
+  SensingStats before;
+  sensing_task.get_stats(before);
+  TEST_ASSERT_TRUE(before.idle_inputs & (1 << DIAL_COUNT));
+  sense_ms(1000);
+  SensingStats after;
+  sensing_task.get_stats(after);
+  TEST_ASSERT_UINT32_WITHIN(1, 1000 / 20, after.button_polls - before.button_polls);
+
+  InputSnapshot start;
+  sensing_task.latest(start);
+  host_set_pin(WHITE_BUTTON_PIN, LOW);
+  sense_ms(60);
+  InputSnapshot held;
+  sensing_task.latest(held);
+  host_release_pin(WHITE_BUTTON_PIN);
+  sense_ms(100);
+  uint8_t white = static_cast<uint8_t>(Button::WHITE);
+  TEST_ASSERT_TRUE(held.down(Button::WHITE));
+  TEST_ASSERT_EQUAL_UINT8(1, static_cast<uint8_t>(held.presses[white] - start.presses[white]));
+  sensing_task.get_stats(after);
+  TEST_ASSERT_FALSE(after.idle_inputs & (1 << DIAL_COUNT));
+}
+
+static void test_filter_requests_go_in_on_the_next_pass() {
+  sense_ms(3000);
+  // Two before the sensing task gets to either, neither gets lost
+  sensing_task.request_filter(1 << static_cast<uint8_t>(Dial::RED), 2000, 2000);
+  sensing_task.request_filter(1 << static_cast<uint8_t>(Dial::GREEN), 2000, 2000);
+  host_set_analog(A0, 0);
+  host_set_analog(A1, 3000);
+  host_set_analog(A2, 3000);
+  sense_ms(200);
+  InputSnapshot snapshot;
+  sensing_task.latest(snapshot);
+  TEST_ASSERT_TRUE(snapshot.value(Dial::RED) > 2500);
+  TEST_ASSERT_TRUE(snapshot.value(Dial::GREEN) < 500);
+  TEST_ASSERT_TRUE(snapshot.value(Dial::BLUE) > 2500);
+}
+
+static void test_snapshot_has_the_noise_floor() {
+  sense_ms(2000);
+  InputSnapshot snapshot;
+  sensing_task.latest(snapshot);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, program_state.white_pot.get_noise_sigma(), snapshot.noise_sigma(Dial::WHITE));
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, program_state.white_pot.get_noise_scale(), snapshot.noise_scale(Dial::WHITE));
+  TEST_ASSERT_TRUE(snapshot.noise_scale(Dial::WHITE) > 0);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_seqlock_reads_are_never_torn);
+  RUN_TEST(test_snapshot_has_the_dials);
+  RUN_TEST(test_quick_tap_between_snapshots_is_counted);
+  RUN_TEST(test_latency_counts_each_snapshot_once);
+  RUN_TEST(test_idle_buttons_are_polled_less_but_still_seen);
+  RUN_TEST(test_snapshot_has_the_noise_floor);
+  RUN_TEST(test_filter_requests_go_in_on_the_next_pass);
+  return UNITY_END();
+}
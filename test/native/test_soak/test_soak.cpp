@@ -0,0 +1,387 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include "Clock.h"
+#include "DebounceInput.h"
+#include "InputSnapshot.h"
+#include "ProgramState.h"
+
+/*
+A soak test: months of made-up use, run through the real setup() and loop()
+on the made-up board (lib/host_arduino) in seconds, to catch what only
+goes wrong after the box has been on for weeks.
+
+The clock starts two hours short of where a 32-bit millisecond count wraps,
+so every 32-bit wrap (milliseconds once, microseconds every 71 minutes)
+happens along the way.  Between passes it jumps straight to the next thing
+that happens (host_jump_us(), so the dithering timer doesn't have to tick
+through months): a second at a time while the lights are on or someone's
+there, a minute at a time while the room's empty and dark, and every 10 ms
+while a button is down or a dial is turning, and for a moment after.
+
+Someone comes and goes a few times a day, stays anything from ten minutes to
+four hours, sits still long enough for the lights to doze now and then,
+presses buttons and turns dials.  It all goes in through the pins, so the
+debouncing, the sensing task and the motion sensor cooldown are the real
+ones too.  It's all from a fixed seed, so every run is the same.  After every
+pass these are checked:
+------
+  presses      every button press changed the mode the way it should
+  sleep        every time the room was left, the lights went off in time
+  stuck_on     no pass had the lights on past the sleep time with nobody around
+  early_doze   the lights never dozed while someone was still busy
+  clock        the clock never went backwards, and no time was in the future
+------
+*/
+
+// From src/main.cpp
+extern ProgramState program_state;
+extern DebounceInput buttons[BUTTON_COUNT];
+
+const uint8_t DIAL_PINS[DIAL_COUNT] = {A0, A1, A2, A3};
+const uint32_t WAKE_TO_DOZE_MS = 30000;
+const uint32_t DOZE_TO_SLEEP_MS = 5000;
+// The motion sensors count as seeing someone for this long after they last did
+const uint64_t MOTION_COOLDOWN_MS = 4000;
+const uint64_t MOTION_DEBOUNCE_MS = 20;
+
+const uint64_t SECOND_MS = 1000;
+const uint64_t MINUTE_MS = 60 * SECOND_MS;
+const uint64_t HOUR_MS = 60 * MINUTE_MS;
+const uint64_t DAY_MS = 24 * HOUR_MS;
+
+const uint64_t SOAK_DAYS = 92;
+// Two hours short of where a 32-bit millisecond count wraps
+const uint64_t SOAK_START_MS = (1ULL << 32) - 2 * HOUR_MS;
+const uint64_t SOAK_STEP_MS = SECOND_MS;       // someone's there, or the lights are on
+const uint64_t SOAK_IDLE_STEP_MS = MINUTE_MS;  // empty and dark
+const uint64_t SOAK_FINE_STEP_MS = 10;         // while anything's happening
+const uint64_t SOAK_FINE_AFTER_MS = 500;       // and for this long after
+// Someone moving sets the motion sensor off for this long, then it rests as long
+const uint64_t SOAK_MOTION_PULSE_MS = 2 * SECOND_MS;
+const uint64_t SOAK_PRESS_MS = 100;
+// Counts per millisecond, faster than both the wake and the mode grab thresholds
+const uint64_t SOAK_TURN_SPEED = 5;
+// How long a press or a turn takes to get through the debouncing and be seen
+const uint64_t SOAK_NOTICE_MS = 100;
+// How late the lights can fairly go off: the motion sensor's cooldown after
+// the last time it went off, and a pass or so late for each of seeing that,
+// dozing and going off
+const uint64_t SOAK_SLACK_MS = MOTION_COOLDOWN_MS + 3 * SOAK_STEP_MS;
+const uint32_t SOAK_SEED = 0x50414B21;
+
+struct SoakCheck {
+  uint32_t runs;
+  uint32_t failures;
+};
+
+// What the made-up person is up to, all times clock_ms()
+struct SoakPerson {
+  bool present;
+  uint64_t next_change_ms;  // arrives or leaves
+  uint64_t still_from_ms;   // sits still enough for the motion sensors to lose them
+  uint64_t still_until_ms;
+  uint64_t next_press_ms;
+  uint64_t next_turn_ms;
+};
+
+// A press or a turn under way
+struct SoakAction {
+  int8_t button;  // held down until release_ms, or -1
+  uint64_t release_ms;
+  int8_t dial;  // turning from turn_from to turn_to, or -1
+  uint16_t turn_from;
+  uint16_t turn_to;
+  uint64_t turn_start_ms;
+  uint64_t turn_end_ms;
+};
+
+// When they were last up to something, and the time before that
+struct SoakActivity {
+  uint64_t last_ms;
+  uint64_t before_ms;
+};
+
+struct SoakResults {
+  SoakCheck presses;
+  SoakCheck sleeps;
+  SoakCheck stuck_on;
+  SoakCheck early_doze;
+  SoakCheck clock;
+  uint32_t passes;
+  uint32_t ms32_wraps;
+  uint32_t us32_wraps;
+};
+
+static SoakResults results;
+static uint32_t soak_random_state;
+
+// xorshift32, from low to high inclusive
+static uint64_t soak_random(uint64_t low, uint64_t high) {
+  soak_random_state ^= soak_random_state << 13;
+  soak_random_state ^= soak_random_state >> 17;
+  soak_random_state ^= soak_random_state << 5;
+  return low + soak_random_state % (high - low + 1);
+}
+
+static void schedule_still(SoakPerson &person, uint64_t now_ms) {
+  person.still_from_ms = now_ms + soak_random(MINUTE_MS, 30 * MINUTE_MS);
+  person.still_until_ms = person.still_from_ms + soak_random(5 * SECOND_MS, 60 * SECOND_MS);
+}
+
+// What a press should have done to the mode, see loop() in main.cpp.  Only
+// one button is ever pressed at a time, so no secret modes.
+static bool press_worked(Button button, Mode before, Mode after) {
+  switch (button) {
+    case Button::CYCLE:
+      return after != before;
+    case Button::OFF:
+      return after == Mode::OFF;
+    case Button::WHITE:
+      return after == Mode::WHITE;
+    case Button::RGB:
+      return after == (before == Mode::RGB ? Mode::HSV : Mode::RGB);
+    default:
+      return static_cast<int>(after) == static_cast<int>(Mode::CUSTOM_1) +
+             static_cast<int>(button) - static_cast<int>(Button::S1);
+  }
+}
+
+static void note_activity(SoakActivity &activity, uint64_t at_ms) {
+  if (at_ms >= activity.last_ms) {
+    activity.before_ms = activity.last_ms;
+    activity.last_ms = at_ms;
+  } else {
+    activity.before_ms = max(activity.before_ms, at_ms);
+  }
+}
+
+// The last activity loop() could have seen by now
+static uint64_t noticed_activity_ms(const SoakActivity &activity, uint64_t now_ms) {
+  return now_ms - activity.last_ms >= SOAK_NOTICE_MS ? activity.last_ms : activity.before_ms;
+}
+
+static void print_check(const char* name, const SoakCheck &check) {
+  printf("soak %-10s %9u runs, %u failed\n", name, check.runs, check.failures);
+}
+
+static void run_soak() {
+  memset(&results, 0, sizeof(results));
+  soak_random_state = SOAK_SEED;
+  host_reset();
+  for (uint8_t d = 0; d < DIAL_COUNT; d++) {
+    host_set_analog(DIAL_PINS[d], 2048);
+  }
+  host_jump_us(SOAK_START_MS * 1000 - host_time_us());
+  setup();
+  uint8_t motion_pin = program_state.motion_detector_a.pin();
+
+  uint64_t start_ms = clock_ms();
+  uint64_t end_ms = start_ms + SOAK_DAYS * DAY_MS;
+  uint64_t sleep_limit_ms = WAKE_TO_DOZE_MS + DOZE_TO_SLEEP_MS + SOAK_SLACK_MS;
+  uint16_t dial_values[DIAL_COUNT] = {2048, 2048, 2048, 2048};
+
+  SoakPerson person;
+  memset(&person, 0, sizeof(person));
+  person.next_change_ms = start_ms + soak_random(MINUTE_MS, 2 * HOUR_MS);
+  SoakAction action = {-1, 0, -1, 0, 0, 0, 0};
+  // Only presses and turns held up to here are checked, see press_worked()
+  bool button_was_down[BUTTON_COUNT];
+  memset(button_was_down, 0, sizeof(button_was_down));
+  SoakActivity activity = {start_ms, start_ms};
+  uint64_t last_ms = start_ms;
+  uint64_t fine_until_ms = 0;
+  bool idle_too_long = false;
+  uint64_t motion_from_ms = 0;
+
+  while (clock_ms() < end_ms) {
+    uint64_t now_ms = clock_ms();
+
+    // Move the person along
+    if (now_ms >= person.next_change_ms) {
+      person.present = !person.present;
+      if (person.present) {
+        person.next_change_ms = now_ms + soak_random(10 * MINUTE_MS, 4 * HOUR_MS);
+        person.next_press_ms = now_ms + soak_random(5 * SECOND_MS, 20 * MINUTE_MS);
+        person.next_turn_ms = now_ms + soak_random(MINUTE_MS, HOUR_MS);
+        schedule_still(person, now_ms);
+      } else {
+        person.next_change_ms = now_ms + soak_random(30 * MINUTE_MS, 16 * HOUR_MS);
+      }
+      fine_until_ms = now_ms + SOAK_FINE_AFTER_MS;
+    }
+    if (person.present && now_ms >= person.still_until_ms) {
+      schedule_still(person, now_ms);
+    }
+    bool still = now_ms >= person.still_from_ms && now_ms < person.still_until_ms;
+    bool occupied = person.present && !still;
+
+    // The motion sensor goes off and rests in turn while they move about.
+    // Each time counts from when it went off, once it's lasted long enough
+    // to get through the debouncing (sitting still can cut one short).
+    bool motion = occupied && (now_ms / SOAK_MOTION_PULSE_MS) % 2 == 0;
+    if (!motion) {
+      motion_from_ms = 0;
+    } else if (motion_from_ms == 0) {
+      motion_from_ms = now_ms;
+    } else if (now_ms - motion_from_ms > MOTION_DEBOUNCE_MS) {
+      note_activity(activity, motion_from_ms);
+    }
+    host_set_pin(motion_pin, motion);
+
+    // Start a press or a turn, one at a time, or finish one
+    bool busy = action.button >= 0 || action.dial >= 0;
+    if (!busy && person.present && now_ms >= person.next_press_ms) {
+      action.button = soak_random(0, BUTTON_COUNT - 1);
+      action.release_ms = now_ms + SOAK_PRESS_MS;
+      host_set_pin(buttons[action.button].getPin(), LOW);
+      // The OFF button doesn't count as activity, see manual_motion_update()
+      if (action.button != static_cast<int8_t>(Button::OFF)) {
+        note_activity(activity, now_ms);
+      }
+      person.next_press_ms = now_ms + soak_random(5 * SECOND_MS, 40 * MINUTE_MS);
+    } else if (!busy && person.present && now_ms >= person.next_turn_ms) {
+      action.dial = soak_random(0, DIAL_COUNT - 1);
+      action.turn_from = dial_values[action.dial];
+      // At least a quarter of the way round, so it can't be missed
+      action.turn_to = (action.turn_from + soak_random(1024, 3071)) % 4096;
+      action.turn_start_ms = now_ms;
+      action.turn_end_ms = now_ms + abs(static_cast<int32_t>(action.turn_to) - action.turn_from) / SOAK_TURN_SPEED;
+      note_activity(activity, now_ms);
+      person.next_turn_ms = now_ms + soak_random(MINUTE_MS, HOUR_MS);
+    }
+    if (action.button >= 0 && now_ms >= action.release_ms) {
+      host_release_pin(buttons[action.button].getPin());
+      action.button = -1;
+    }
+    if (action.dial >= 0) {
+      uint64_t into_ms = min(now_ms, action.turn_end_ms) - action.turn_start_ms;
+      int32_t span = static_cast<int32_t>(action.turn_to) - action.turn_from;
+      int32_t span_ms = static_cast<int32_t>(action.turn_end_ms - action.turn_start_ms);
+      dial_values[action.dial] = action.turn_from + span * static_cast<int32_t>(into_ms) / span_ms;
+      host_set_analog(DIAL_PINS[action.dial], dial_values[action.dial]);
+      if (now_ms >= action.turn_end_ms) {
+        action.dial = -1;
+      }
+    }
+    if (action.button >= 0 || action.dial >= 0) {
+      fine_until_ms = now_ms + SOAK_FINE_AFTER_MS;
+    }
+
+    Mode before = program_state.curr_mode;
+    loop();
+    results.passes++;
+    Mode after = program_state.curr_mode;
+
+    // Check what loop() made of it
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      bool down = buttons[i].isActive();
+      if (down && !button_was_down[i]) {
+        results.presses.runs++;
+        if (!press_worked(static_cast<Button>(i), before, after)) {
+          results.presses.failures++;
+        }
+      }
+      button_was_down[i] = down;
+    }
+    if (after == Mode::SLEEP_PREP && before != Mode::SLEEP_PREP) {
+      results.early_doze.runs++;
+      if (now_ms - noticed_activity_ms(activity, now_ms) <= WAKE_TO_DOZE_MS) {
+        results.early_doze.failures++;
+      }
+    }
+    bool now_too_long = now_ms - activity.last_ms > sleep_limit_ms;
+    if (now_too_long) {
+      results.stuck_on.runs++;
+      if (after != Mode::OFF) {
+        results.stuck_on.failures++;
+      }
+      // Only the first pass past the limit counts as a time the room was left
+      if (!idle_too_long) {
+        results.sleeps.runs++;
+        if (after != Mode::OFF) {
+          results.sleeps.failures++;
+        }
+      }
+    }
+    idle_too_long = now_too_long;
+    results.clock.runs++;
+    // The made-up board's clock moves a little during a pass, like a real one
+    uint64_t after_ms = clock_ms();
+    if (now_ms < last_ms || program_state.last_mode_start > after_ms ||
+        program_state.last_motion_detected > after_ms) {
+      results.clock.failures++;
+    }
+    last_ms = now_ms;
+
+    // Jump to the next pass, or to whatever happens before it
+    uint64_t step_ms = (person.present || after != Mode::OFF) ? SOAK_STEP_MS : SOAK_IDLE_STEP_MS;
+    if (now_ms < fine_until_ms) {
+      step_ms = SOAK_FINE_STEP_MS;
+    }
+    uint64_t next_ms = min(now_ms + step_ms, person.next_change_ms);
+    if (person.present) {
+      next_ms = min(next_ms, min(person.next_press_ms, person.next_turn_ms));
+      next_ms = min(next_ms, now_ms < person.still_from_ms ? person.still_from_ms : person.still_until_ms);
+      // A pass as the motion sensor changes, so each change is seen twice to get through the debouncing
+      next_ms = min(next_ms, (now_ms / SOAK_MOTION_PULSE_MS + 1) * SOAK_MOTION_PULSE_MS);
+    }
+    // Never closer than loop() checks for sleep, or a pass's motion could go unseen
+    next_ms = max(next_ms, now_ms + SOAK_FINE_STEP_MS);
+    host_jump_us((next_ms - now_ms) * 1000);
+
+    // Nobody's reading what loop() prints
+    if ((results.passes & 0xFFF) == 0) {
+      host_serial_take_output();
+    }
+  }
+
+  uint64_t end_us = clock_us();
+  results.ms32_wraps = static_cast<uint32_t>((end_us / 1000 >> 32) - (start_ms >> 32));
+  results.us32_wraps = static_cast<uint32_t>((end_us >> 32) - (start_ms * 1000 >> 32));
+  printf("soak %u days, %u passes, %u millisecond wraps, %u microsecond wraps\n",
+         static_cast<uint32_t>(SOAK_DAYS), results.passes, results.ms32_wraps, results.us32_wraps);
+  print_check("presses", results.presses);
+  print_check("sleep", results.sleeps);
+  print_check("stuck_on", results.stuck_on);
+  print_check("early_doze", results.early_doze);
+  print_check("clock", results.clock);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_soak_gets_past_the_wraps() {
+  run_soak();
+  TEST_ASSERT_TRUE(results.ms32_wraps >= 1);
+  TEST_ASSERT_TRUE(results.us32_wraps >= (SOAK_DAYS * DAY_MS * 1000) >> 32);
+  TEST_ASSERT_EQUAL_UINT32(0, results.clock.failures);
+}
+
+static void test_soak_presses_always_work() {
+  TEST_ASSERT_TRUE(results.presses.runs > 0);
+  TEST_ASSERT_EQUAL_UINT32(0, results.presses.failures);
+}
+
+static void test_soak_lights_go_off_when_the_room_is_left() {
+  TEST_ASSERT_TRUE(results.sleeps.runs > 0);
+  TEST_ASSERT_EQUAL_UINT32(0, results.sleeps.failures);
+  TEST_ASSERT_EQUAL_UINT32(0, results.stuck_on.failures);
+}
+
+static void test_soak_lights_never_doze_early() {
+  TEST_ASSERT_TRUE(results.early_doze.runs > 0);
+  TEST_ASSERT_EQUAL_UINT32(0, results.early_doze.failures);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_soak_gets_past_the_wraps);
+  RUN_TEST(test_soak_presses_always_work);
+  RUN_TEST(test_soak_lights_go_off_when_the_room_is_left);
+  RUN_TEST(test_soak_lights_never_doze_early);
+  return UNITY_END();
+}
@@ -0,0 +1,80 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <HostArduino.h>
+#include <string>
+#include "ProgramState.h"
+#include "SerialProtocol.h"
+
+/*
+STREAM mode through the whole firmware: frames sent over Serial for longer
+than the sleep timeout, with nobody moving in front of the sensors.
+*/
+
+// From src/main.cpp
+extern ProgramState program_state;
+
+// WAKE_TO_DOZE_TIME and DOZE_TO_SLEEP_TIME in src/main.cpp
+const uint32_t DOZE_AFTER_MS = 30000;
+const uint32_t SLEEP_AFTER_MS = DOZE_AFTER_MS + 5000;
+const uint32_t FRAME_EVERY_MS = 10;
+
+static void send_frame(uint32_t timestamp_us, uint16_t red, uint16_t green, uint16_t blue) {
+  uint8_t frame[15] = {PROTOCOL_SYNC_BYTE, 10, static_cast<uint8_t>(Command::STREAM_FRAMES),
+                       static_cast<uint8_t>(timestamp_us), static_cast<uint8_t>(timestamp_us >> 8),
+                       static_cast<uint8_t>(timestamp_us >> 16), static_cast<uint8_t>(timestamp_us >> 24),
+                       static_cast<uint8_t>(red), static_cast<uint8_t>(red >> 8),
+                       static_cast<uint8_t>(green), static_cast<uint8_t>(green >> 8),
+                       static_cast<uint8_t>(blue), static_cast<uint8_t>(blue >> 8)};
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 1; i < 13; i++) {
+    crc = crc16_update(crc, frame[i]);
+  }
+  frame[13] = crc & 0xFF;
+  frame[14] = crc >> 8;
+  host_serial_feed(frame, sizeof(frame));
+}
+
+// Run the loop a millisecond at a time, streaming a frame every so often if asked
+static void run_ms(uint32_t ms, bool streaming) {
+  for (uint32_t i = 0; i < ms; i++) {
+    if (streaming && host_time_us() / 1000 % FRAME_EVERY_MS == 0) {
+      send_frame(static_cast<uint32_t>(host_time_us()), 600, 300, 100);
+    }
+    loop();
+    host_advance_us(1000);
+  }
+  host_serial_take_output();
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_long_stream_stays_awake() {
+  host_reset();
+  setup();
+  run_ms(100, true);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::STREAM), static_cast<int>(program_state.curr_mode));
+  // Not even a quick doze, the next frame would wake it but start the stream over
+  unsigned long mode_changes = program_state.mode_change_count;
+  run_ms(SLEEP_AFTER_MS + 10000, true);
+  TEST_ASSERT_EQUAL_UINT32(mode_changes, program_state.mode_change_count);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::STREAM), static_cast<int>(program_state.curr_mode));
+  TEST_ASSERT_EQUAL_UINT32(0, program_state.stream_player.underruns);
+}
+
+static void test_stopped_stream_dozes() {
+  run_ms(DOZE_AFTER_MS + 1000, false);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::SLEEP_PREP), static_cast<int>(program_state.curr_mode));
+  run_ms(SLEEP_AFTER_MS - DOZE_AFTER_MS, false);
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(Mode::OFF), static_cast<int>(program_state.curr_mode));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_long_stream_stays_awake);
+  RUN_TEST(test_stopped_stream_dozes);
+  return UNITY_END();
+}
@@ -0,0 +1,126 @@
+"""
+Compare dial filtering setups on the same ADC trace: how jittery the output
+is while the dial sits still, and how long it lags when the dial is turned.
+
+The dials are the firmware's own (SmoothAnalogInput.h: the dual EMA, One
+Euro, and the median-of-3 in front of either), built for this computer and
+loaded through tools/light_host.py, at a few different half-lives.  They're
+fed either one reading at a time, or each burst through update() and the
+ADC front end (AdcFrontEnd.h), which keeps the middle of it like on the
+board.  Either way they stretch their smoothing to suit the noise they
+measure, like on the board.
+
+With no trace it makes up a realistic one: a dial at rest, turned quickly,
+then at rest again, with a few counts of noise and occasional big spikes.
+
+    python tools/adc_filter_compare.py
+    python tools/adc_filter_compare.py --trace my_dial.csv --step-at 1.2
+    python tools/adc_filter_compare.py --noise 2
+
+A recorded trace is a CSV with one burst per line: the time in microseconds,
+then the raw readings of the burst (one or more of them).
+"""
+
+import argparse
+import random
+import statistics
+
+import light_host
+
+
+def make_trace(burst=5, interval_us=500, noise=6.0, spike_chance=0.03, seed=1):
+    """Rest at 1000, turn to 2500 over 100ms at t=1s, rest until t=2s."""
+    rng = random.Random(seed)
+    trace = []
+    for t_us in range(0, 2000000, interval_us):
+        if t_us < 1000000:
+            level = 1000.0
+        elif t_us < 1100000:
+            level = 1000.0 + 1500.0 * (t_us - 1000000) / 100000
+        else:
+            level = 2500.0
+        readings = []
+        for _ in range(burst):
+            value = level + rng.gauss(0, noise)
+            if rng.random() < spike_chance:
+                value += rng.choice((-1, 1)) * rng.uniform(200, 800)
+            readings.append(int(min(max(value, 0), 4095)))
+        trace.append((t_us, readings))
+    return trace
+
+
+def load_trace(path):
+    trace = []
+    with open(path) as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if len(fields) >= 2 and fields[0].isdigit():
+                trace.append((int(fields[0]), [int(v) for v in fields[1:]]))
+    return trace
+
+
+def run(trace, long_half_life_ms, use_median, kind="ema"):
+    dial = light_host.Dial(light_host.DIAL_KINDS[kind], trace[0][1][0], long_half_life_ms)
+    out = []
+    last_t = trace[0][0]
+    for t_us, readings in trace:
+        dt_us = max(t_us - last_t, 1)
+        if use_median:
+            dial.update(dt_us, readings)
+            value = dial.value
+        else:
+            fine, _, _, _ = dial.add([readings[0]], [dt_us])
+            value = fine[0] / 16.0
+        out.append((t_us, value))
+        last_t = t_us
+    return out
+
+
+def measure(out, step_at_us, settle_window_us=400000):
+    """Jitter at rest before the step, and the lag to 90% of the step."""
+    before = [v for t, v in out if step_at_us - settle_window_us <= t < step_at_us]
+    after = [v for t, v in out if t >= out[-1][0] - settle_window_us]
+    start, end = statistics.mean(before), statistics.mean(after)
+    shown = [int(v) for v in before]  # what the lights would see
+    target = start + 0.9 * (end - start)
+    lag_ms = None
+    for t, v in out:
+        if t >= step_at_us and (v - target) * (end - start) >= 0:
+            lag_ms = (t - step_at_us) / 1000.0
+            break
+    return statistics.pstdev(before), max(shown) - min(shown), lag_ms
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--trace", help="recorded CSV trace, otherwise a made-up one")
+    parser.add_argument("--step-at", type=float, default=1.0,
+                        help="when the dial starts turning, in seconds")
+    parser.add_argument("--noise", type=float, default=6.0,
+                        help="noise sigma of the made-up trace, in counts")
+    args = parser.parse_args()
+
+    trace = load_trace(args.trace) if args.trace else make_trace(noise=args.noise)
+    step_at_us = int(args.step_at * 1e6)
+
+    print("%-38s %10s %10s %10s" % ("setup", "jitter sd", "jitter p-p", "lag to 90%"))
+    setups = [("ema, single reading, 50ms", "ema", 50, False),
+              ("ema, single reading, 30ms", "ema", 30, False),
+              ("ema, median of burst, 50ms", "ema", 50, True),
+              ("ema, median of burst, 30ms", "ema", 30, True),
+              ("ema, median of burst, 20ms", "ema", 20, True),
+              ("median3+ema, median of burst, 50ms", "median3+ema", 50, True),
+              ("euro, median of burst, 100ms", "euro", 100, True),
+              ("euro, median of burst, 200ms", "euro", 200, True),
+              ("median3+euro, median of burst, 100ms", "median3+euro", 100, True)]
+    # The burst median and the ADC correction, like setup() does
+    light_host.adc_begin()
+    for name, kind, half_life, use_median in setups:
+        sd, peak_to_peak, lag_ms = measure(run(trace, half_life, use_median, kind), step_at_us)
+        lag = "%.1f ms" % lag_ms if lag_ms is not None else "never"
+        print("%-38s %10.2f %10d %10s" % (name, sd, peak_to_peak, lag))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,173 @@
+"""
+Read the on-device benchmark results and compare them with the saved baseline.
+
+The benchmarks are on-device tests (see include/Benchmark.h).  Run them and
+keep the log, then check it, no Arduino needed for that part:
+
+    pio test -e embedded -v > bench.txt
+    python tools/check_benchmarks.py --log bench.txt
+
+Or flash them and read the port directly, pressing reset if nothing shows up:
+
+    python tools/check_benchmarks.py /dev/ttyACM0
+
+Exits with 1 if any benchmark's median got slower than the baseline by more
+than the tolerance, if any benchmark has no baseline to go by (a new one, or
+one with a null median in tools/benchmark_baseline.json, which is how the
+names are listed before anyone has run them on a board), or if any of the
+correctness checks (BENCH_CHECK lines,
+like the torn read check on the snapshot hand-off) saw a failure.  After a change that is meant to be slower (or faster!),
+save the new numbers with --update.
+
+The flicker and response numbers from the quality checks (QUALITY lines, see
+include/QualityBench.h), and the raw ADC noise with and without the PWM
+staggering (include/AdcNoiseBench.h), are printed too, but not judged, since which way is
+better depends on what the change was for.  Save everything as one JSON file
+to compare two builds side by side:
+
+    python tools/check_benchmarks.py /dev/ttyACM0 --report before.json
+"""
+
+import argparse
+import json
+import os
+import sys
+import time
+
+BASELINE_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                             "benchmark_baseline.json")
+
+
+def parse_lines(lines):
+    """Pick the BENCH and QUALITY lines out of the serial output.
+    Returns (results, checks, quality, cpu_mhz)."""
+    results = {}
+    checks = {}
+    quality = {}
+    cpu_mhz = None
+    for line in lines:
+        fields = line.strip().split(",")
+        if fields[0] == "BENCH" and len(fields) == 5:
+            name, samples, low, median = fields[1], int(fields[2]), int(fields[3]), int(fields[4])
+            results[name] = {"samples": samples, "min": low, "median": median}
+        elif fields[0] == "BENCH_CHECK" and len(fields) == 4:
+            checks[fields[1]] = (int(fields[2]), int(fields[3]))
+        elif fields[0] == "QUALITY" and len(fields) == 4:
+            quality.setdefault(fields[1], {})[fields[2]] = float(fields[3])
+        elif fields[0] == "BENCH_DONE" and len(fields) == 2:
+            cpu_mhz = int(fields[1])
+            break
+    return results, checks, quality, cpu_mhz
+
+
+def read_serial(port, timeout_s):
+    import serial  # only needed when talking to the Arduino
+    lines = []
+    with serial.Serial(port, 115200, timeout=0.5) as link:
+        deadline = time.time() + timeout_s
+        while time.time() < deadline:
+            line = link.readline().decode("ascii", errors="replace")
+            if line:
+                lines.append(line)
+                if line.startswith("BENCH_DONE"):
+                    break
+    return lines
+
+
+def compare(results, baseline, tolerance):
+    """Print a table, return the names of anything that regressed, and of
+    anything that has no baseline median to compare with."""
+    regressions = []
+    unjudged = []
+    print("%-24s %10s %10s %8s" % ("benchmark", "median", "baseline", "change"))
+    for name in sorted(results):
+        median = results[name]["median"]
+        base = baseline.get(name, {}).get("median")
+        if base is None:
+            unjudged.append(name)
+            print("%-24s %10d %10s %8s" % (name, median, "-", "new"))
+            continue
+        change = (median - base) / float(max(base, 1))
+        flag = ""
+        if change > tolerance:
+            regressions.append(name)
+            flag = "  SLOWER"
+        print("%-24s %10d %10d %+7.1f%%%s" % (name, median, base, 100 * change, flag))
+    for name in sorted(set(baseline) - set(results)):
+        base = baseline[name].get("median")
+        print("%-24s %10s %10s %8s" % (name, "-", "-" if base is None else base, "missing"))
+    return regressions, unjudged
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?")
+    parser.add_argument("--log", help="read results from a saved serial log instead")
+    parser.add_argument("--baseline", default=BASELINE_PATH)
+    parser.add_argument("--tolerance", type=float, default=0.15,
+                        help="allowed slowdown as a fraction (default 0.15)")
+    parser.add_argument("--timeout", type=float, default=300.0)
+    parser.add_argument("--update", action="store_true",
+                        help="save these results as the new baseline")
+    parser.add_argument("--report", help="also save all the results to this JSON file")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log) as log:
+            lines = log.readlines()
+    elif args.port:
+        lines = read_serial(args.port, args.timeout)
+    else:
+        parser.error("give a serial port or --log")
+
+    results, checks, quality, cpu_mhz = parse_lines(lines)
+    if cpu_mhz is None:
+        print("Never saw BENCH_DONE, is the benchmark firmware flashed?")
+        return 1
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    print("CPU at %d MHz" % cpu_mhz)
+    regressions, unjudged = compare(results, baseline, args.tolerance)
+
+    failed_checks = []
+    for name in sorted(checks):
+        runs, failures = checks[name]
+        print("%-24s %d of %d failed" % (name, failures, runs))
+        if failures:
+            failed_checks.append(name)
+    for pattern in sorted(quality):
+        for metric in sorted(quality[pattern]):
+            print("%-30s %10.4f" % (pattern + " " + metric, quality[pattern][metric]))
+
+    if args.report:
+        report = {"cpu_mhz": cpu_mhz, "benchmarks": results, "quality": quality,
+                  "checks": {name: {"runs": runs, "failures": failures}
+                             for name, (runs, failures) in checks.items()}}
+        with open(args.report, "w") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+        print("Saved the report to " + args.report)
+    if failed_checks:
+        print("Checks failed: " + ", ".join(failed_checks))
+        return 1
+
+    if args.update:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print("Saved the baseline to " + args.baseline)
+        return 0
+    if regressions:
+        print("Slower than the baseline: " + ", ".join(regressions))
+        return 1
+    if unjudged:
+        print("No baseline for: " + ", ".join(unjudged) +
+              ", save one from a known-good build with --update")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
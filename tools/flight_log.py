@@ -0,0 +1,103 @@
+"""
+Read the flight recorder and print what happened, as a timeline.
+
+The device keeps the last 256 mode changes, sleep steps, button presses and
+motion changes in memory that survives resets (see include/FlightRecorder.h).
+After the lights did something odd, plug in and run:
+
+    python tools/flight_log.py /dev/ttyACM0
+
+Each boot starts a new section, with the reason for the reset, so a
+watchdog reset or a brownout shows up right after whatever led to it.
+Save the raw events to look at later, or decode a saved file:
+
+    python tools/flight_log.py /dev/ttyACM0 --save flight.bin
+    python tools/flight_log.py --load flight.bin
+"""
+
+import argparse
+import struct
+import sys
+
+from light_protocol import LightClient, MODE_NAMES
+
+EVENT_FORMAT = "<IBBH"  # same as FlightEvent
+EVENT_SIZE = struct.calcsize(EVENT_FORMAT)
+
+EVENT_TYPES = ["BOOT", "MODE_CHANGE", "SLEEP", "BUTTON", "MOTION"]
+SLEEP_STEPS = ["dozing off, no motion", "going to sleep", "woke up, motion"]
+BUTTON_NAMES = ["rgb", "white", "cycle", "off", "s1", "s2", "s3", "s4"]
+MOTION_SENSOR_NAMES = ["a", "b", "c"]
+
+# esp_reset_reason_t
+RESET_REASONS = ["unknown", "power on", "reset pin", "software restart", "crash",
+                 "interrupt watchdog", "task watchdog", "other watchdog",
+                 "deep sleep", "brownout", "SDIO"]
+
+
+def name(names, index):
+    return names[index] if index < len(names) else str(index)
+
+
+def sensors(bits):
+    on = [n for i, n in enumerate(MOTION_SENSOR_NAMES) if bits & (1 << i)]
+    return "+".join(on) if on else "none"
+
+
+def describe(event_type, a, b):
+    kind = name(EVENT_TYPES, event_type)
+    if kind == "MODE_CHANGE":
+        return "mode %s -> %s" % (name(MODE_NAMES, b), name(MODE_NAMES, a))
+    if kind == "SLEEP":
+        return "%s (was %s)" % (name(SLEEP_STEPS, a), name(MODE_NAMES, b))
+    if kind == "BUTTON":
+        return "button %s %s" % (name(BUTTON_NAMES, a), "pressed" if b else "released")
+    if kind == "MOTION":
+        return "motion sensors %s -> %s" % (sensors(b), sensors(a))
+    return "%s a=%d b=%d" % (kind, a, b)
+
+
+def print_timeline(records, out=sys.stdout):
+    boots = [i for i, record in enumerate(records) if record[4] == 0]
+    for i, record in enumerate(records):
+        time_ms, event_type, a, b = struct.unpack(EVENT_FORMAT, record)
+        if event_type == 0:
+            current = " (this boot)" if i == boots[-1] else ""
+            out.write("\n--- boot %d, reset by %s%s ---\n" % (b, name(RESET_REASONS, a), current))
+            continue
+        out.write("%10.3f s  %s\n" % (time_ms / 1000.0, describe(event_type, a, b)))
+    if records and records[0][4] != 0:
+        out.write("\n(the oldest events have been written over, the log starts mid-boot)\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?")
+    parser.add_argument("--save", help="also write the raw events to this file")
+    parser.add_argument("--load", help="decode a saved file instead of reading the device")
+    args = parser.parse_args()
+
+    if args.load:
+        with open(args.load, "rb") as f:
+            data = f.read()
+        records = [data[i:i + EVENT_SIZE] for i in range(0, len(data) - EVENT_SIZE + 1, EVENT_SIZE)]
+    elif args.port:
+        client = LightClient(args.port)
+        try:
+            records = client.get_flight_log()
+        finally:
+            client.close()
+    else:
+        parser.error("give a serial port or --load")
+
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(b"".join(records))
+    print("%d events" % len(records))
+    print_timeline(records)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,31 @@
+#include <Arduino.h>
+#include <HostArduino.h>
+
+/*
+The whole firmware on the made-up board (lib/host_arduino), talking over a
+pseudo-terminal instead of the USB port, so the serial tools can be tried
+without an Arduino.  Built and started by tools/light_host.py.
+
+    host_firmware [speed]
+
+Prints the terminal's path on the first line, then runs setup() and loop()
+for good on the computer's clock, sped up by speed (default 1).
+*/
+
+int main(int argc, char** argv) {
+  double speed = argc > 1 ? atof(argv[1]) : 1.0;
+  const char* port = host_serial_open_pty();
+  if (port == nullptr || speed <= 0) {
+    fprintf(stderr, "Couldn't open a pseudo-terminal\n");
+    return 1;
+  }
+  printf("%s\n", port);
+  fflush(stdout);
+
+  host_follow_real_time(speed);
+  setup();
+  while (true) {
+    host_poll();
+    loop();
+  }
+}
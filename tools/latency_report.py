@@ -0,0 +1,174 @@
+"""
+Press-to-light latency: read what the benchmark firmware measured (see
+include/LatencyBench.h), or time the same presses on this computer, through
+the real firmware on a made-up clock.
+
+    python tools/latency_report.py /dev/ttyACM0
+    python tools/latency_report.py --log latency.txt
+    python tools/latency_report.py --simulate
+    python tools/latency_report.py --simulate --loop-us 800
+    python tools/latency_report.py --log latency.txt --simulate
+
+The measurement runs once at startup, after the benchmarks, and only with
+the jumper in (see LatencyBench.h), so press reset if nothing shows up.
+Given both a device and --simulate, the simulated numbers go next to the
+measured ones for the same input and mode.
+
+--simulate builds the benchmark firmware for this computer (tools/light_host.py,
+light_press_latencies() in tools/light_host_api.cpp) and presses the pins of
+the made-up board from setup() and loop(), the way LatencyBench.cpp does on
+the board: debouncing, sleep checks, enter_mode() and the dithering timer
+are all the firmware's own.  To try a different debounce, change it in the
+code and run this again, it rebuilds.  Two things differ from the board:
+------
+  sensing    there's no sensing task, so the inputs are read at the top of
+             every loop() pass instead of every millisecond
+  loop       passes take --loop-us each (give or take half), the same in
+             every mode; the board's are in `light_protocol.py /dev/ttyACM0 loop`
+------
+Where each press lands in the millisecond and how long each pass takes are
+drawn at random, from a fixed seed.
+"""
+
+import argparse
+import math
+import statistics
+import sys
+import time
+
+from light_protocol import MODE_NAMES
+
+# Keep these the same as in src/LatencyBench.cpp
+BUTTONS = ["rgb", "white", "cycle", "off", "s1", "s2", "s3", "s4"]
+BUTTON_MODES = ["OFF", "RGB", "WHITE", "CUSTOM_1", "CUSTOM_3", "CUSTOM_6", "HSV"]
+WAKE_MODES = ["RGB", "WHITE", "CUSTOM_1", "HSV"]
+
+
+def pressed_mode(button, start):
+    """The mode a press goes to, None for CYCLE (always somewhere else)."""
+    if button == "cycle":
+        return None
+    if button == "off":
+        return "OFF"
+    if button == "white":
+        return "WHITE"
+    if button == "rgb":
+        return "HSV" if start == "RGB" else "RGB"
+    return "CUSTOM_" + button[1]
+
+
+def scenarios(inputs):
+    """(input, starting mode) pairs, like the firmware runs them."""
+    found = []
+    for name in inputs:
+        if name == "motion":
+            # Always from dozing, listed by the mode it wakes back up to
+            found += [(name, mode) for mode in WAKE_MODES]
+        else:
+            found += [(name, mode) for mode in BUTTON_MODES if pressed_mode(name, mode) != mode]
+    return found
+
+
+def simulate(args, pairs):
+    import light_host  # only needed for --simulate
+    results = {}
+    for seed, (name, mode) in enumerate(pairs, 1):
+        if name == "motion":
+            # Dozing, after the mode it wakes back up to
+            button, start, came_from = light_host.BUTTON_COUNT, "SLEEP_PREP", mode
+        else:
+            button, start, came_from = BUTTONS.index(name), mode, "OFF"
+        latencies = light_host.press_latencies(button, MODE_NAMES.index(start),
+                                               MODE_NAMES.index(came_from), args.loop_us,
+                                               args.samples, seed)
+        results[(name, mode)] = summarize(sorted(v for v in latencies if v > 0))
+    return results
+
+
+def summarize(samples):
+    """(samples, min, median, p90, max), in us."""
+    if not samples:
+        return (0, 0, 0, 0, 0)
+    return (len(samples), samples[0], statistics.median(samples),
+            samples[math.ceil(0.9 * len(samples)) - 1], samples[-1])
+
+
+def parse_lines(lines):
+    """LATENCY lines -> {(input, mode): ((samples, min, median, p90, max), unchanged)}"""
+    results = {}
+    for line in lines:
+        fields = line.strip().split(",")
+        if fields[0] == "LATENCY" and len(fields) == 9:
+            mode = int(fields[2])
+            mode = MODE_NAMES[mode] if mode < len(MODE_NAMES) else str(mode)
+            count, unchanged, low, median, p90, high = [int(v) for v in fields[3:]]
+            results[(fields[1], mode)] = ((count, low, median, p90, high), unchanged)
+    return results
+
+
+def read_serial(port, timeout_s):
+    import serial  # only needed when talking to the Arduino
+    lines = []
+    with serial.Serial(port, 115200, timeout=0.5) as link:
+        deadline = time.time() + timeout_s
+        while time.time() < deadline:
+            line = link.readline().decode("ascii", errors="replace")
+            if line:
+                lines.append(line)
+                if line.startswith("LATENCY_DONE"):
+                    break
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?")
+    parser.add_argument("--log", help="read results from a saved serial log instead")
+    parser.add_argument("--timeout", type=float, default=600.0)
+    parser.add_argument("--simulate", action="store_true",
+                        help="time the presses on the host firmware too")
+    parser.add_argument("--samples", type=int, default=100, help="simulated presses per scenario")
+    parser.add_argument("--loop-us", type=int, default=400)
+    args = parser.parse_args()
+
+    measured = None
+    if args.log:
+        with open(args.log) as log:
+            measured = parse_lines(log.readlines())
+    elif args.port:
+        measured = parse_lines(read_serial(args.port, args.timeout))
+    elif not args.simulate:
+        parser.error("give a serial port, --log or --simulate")
+    if measured is not None and not measured:
+        print("No latency results, is the jumper in (see include/LatencyBench.h)?")
+        return 1
+
+    if measured:
+        pairs = list(measured)
+    else:
+        pairs = scenarios(BUTTONS + ["motion"])
+    simulated = simulate(args, pairs) if args.simulate else {}
+
+    header = "%-8s %-11s" % ("input", "mode")
+    if measured:
+        header += " %7s %9s %7s %9s %7s %7s" % ("samples", "unchanged", "min_ms", "median_ms",
+                                                 "p90_ms", "max_ms")
+    if simulated:
+        header += " %13s %10s" % ("sim_median_ms", "sim_p90_ms")
+    print(header)
+    for name, mode in pairs:
+        row = "%-8s %-11s" % (name, mode)
+        if measured:
+            (count, low, median, p90, high), unchanged = measured[(name, mode)]
+            row += " %7d %9d %7.1f %9.1f %7.1f %7.1f" % (count, unchanged, low / 1000.0, median / 1000.0,
+                                                         p90 / 1000.0, high / 1000.0)
+        if simulated:
+            _, _, median, p90, _ = simulated[(name, mode)]
+            row += " %13.1f %10.1f" % (median / 1000.0, p90 / 1000.0)
+        print(row)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,262 @@
+"""
+Assembler for the light programs that run in the CUSTOM modes.
+
+Write a program as text, one instruction per line, and this turns it into
+the bytecode the device runs (see include/LightVM.h for how it works), and
+can send it straight to a slot:
+
+    python tools/light_asm.py tools/programs/breathe.lasm --list
+    python tools/light_asm.py tools/programs/breathe.lasm --upload /dev/ttyACM0 --slot 1
+    python tools/light_asm.py --clear /dev/ttyACM0 --slot 1
+
+Slot 1 is CUSTOM_1, up to slot 8.  The program runs from the top each time
+round the loop, and stops at `end`.  The language:
+
+    ; a comment, to the end of the line
+    top:            a label, somewhere to jump to
+    .var count      give the next variable (0-7) a name
+    push 300        put a number on the stack (-32768 to 32767)
+    dial white      dials are red, green, blue, white (or 0-3), 0-4095
+    button s1       buttons are rgb, white, cycle, off, s1-s4 (or 0-7)
+    load count      push a variable, they're kept from one pass to the next
+    store count     pop into a variable
+    jmp top         always jump
+    jz top          pop, jump if it was 0
+
+and the rest take their inputs off the stack: dup drop swap over add sub
+mul div mod min max and or xor shl shr lt gt eq not neg sin random time
+rgb hsv end.  `rgb` takes red, green and blue (0-1023), `hsv` takes hue
+(0-1535), saturation (0-255) and brightness (0-1023).
+
+The same checks the device does are done here first, so mistakes come
+back with a line number instead of just a code.
+"""
+
+import argparse
+import struct
+import sys
+
+STACK_SIZE = 16
+VARIABLES = 8
+PROGRAM_SIZE = 256
+
+# In the same order as Op in include/LightVM.h: name, pops, pushes, operand
+OPS = [
+    ("end", 0, 0, None),
+    ("push8", 0, 1, "i8"),
+    ("push16", 0, 1, "i16"),
+    ("dup", 1, 2, None),
+    ("drop", 1, 0, None),
+    ("swap", 2, 2, None),
+    ("over", 2, 3, None),
+    ("add", 2, 1, None),
+    ("sub", 2, 1, None),
+    ("mul", 2, 1, None),
+    ("div", 2, 1, None),
+    ("mod", 2, 1, None),
+    ("min", 2, 1, None),
+    ("max", 2, 1, None),
+    ("and", 2, 1, None),
+    ("or", 2, 1, None),
+    ("xor", 2, 1, None),
+    ("shl", 2, 1, None),
+    ("shr", 2, 1, None),
+    ("lt", 2, 1, None),
+    ("gt", 2, 1, None),
+    ("eq", 2, 1, None),
+    ("not", 1, 1, None),
+    ("neg", 1, 1, None),
+    ("sin", 1, 1, None),
+    ("random", 1, 1, None),
+    ("load", 0, 1, "var"),
+    ("store", 1, 0, "var"),
+    ("jmp", 0, 0, "label"),
+    ("jz", 1, 0, "label"),
+    ("dial", 0, 1, "dial"),
+    ("button", 0, 1, "button"),
+    ("time", 0, 1, None),
+    ("rgb", 3, 0, None),
+    ("hsv", 3, 0, None),
+]
+OPCODES = {name: code for code, (name, _, _, _) in enumerate(OPS)}
+OPERAND_BYTES = {None: 0, "i8": 1, "i16": 2, "var": 1, "label": 2, "dial": 1, "button": 1}
+
+DIAL_NAMES = ["red", "green", "blue", "white"]
+BUTTON_NAMES = ["rgb", "white", "cycle", "off", "s1", "s2", "s3", "s4"]
+
+
+class AsmError(Exception):
+    def __init__(self, line_number, message):
+        Exception.__init__(self, "line %d: %s" % (line_number, message))
+
+
+def parse_number(text):
+    try:
+        return int(text, 0)
+    except ValueError:
+        return None
+
+
+def named(text, names, line_number, what):
+    value = parse_number(text)
+    if value is None and text.lower() in names:
+        value = names.index(text.lower())
+    if value is None or not 0 <= value < len(names):
+        raise AsmError(line_number, "no %s called %s" % (what, text))
+    return value
+
+
+def parse(source):
+    """Turn the text into a list of (line number, opcode, operand text)."""
+    instructions = []
+    labels = {}
+    variables = {}
+    address = 0
+    for line_number, line in enumerate(source.splitlines(), 1):
+        words = line.split(";")[0].split()
+        while words and words[0].endswith(":"):
+            label = words.pop(0)[:-1]
+            if label in labels:
+                raise AsmError(line_number, "label %s is already used" % label)
+            labels[label] = address
+        if not words:
+            continue
+        name, operands = words[0].lower(), words[1:]
+        if name == ".var":
+            if len(operands) != 1 or len(variables) >= VARIABLES:
+                raise AsmError(line_number, ".var takes one name, and there are %d" % VARIABLES)
+            variables[operands[0]] = len(variables)
+            continue
+        if name == "push":
+            if len(operands) != 1 or parse_number(operands[0]) is None:
+                raise AsmError(line_number, "push takes one number")
+            value = parse_number(operands[0])
+            if not -32768 <= value <= 32767:
+                raise AsmError(line_number, "%d doesn't fit, numbers go from -32768 to 32767" % value)
+            name = "push8" if -128 <= value <= 127 else "push16"
+        if name not in OPCODES:
+            raise AsmError(line_number, "don't know %s" % name)
+        opcode = OPCODES[name]
+        kind = OPS[opcode][3]
+        if len(operands) != (1 if kind else 0):
+            raise AsmError(line_number, "%s takes %s" % (name, "one operand" if kind else "no operands"))
+        instructions.append((line_number, address, opcode, operands[0] if kind else None))
+        address += 1 + OPERAND_BYTES[kind]
+    return instructions, labels, variables
+
+
+def assemble(source):
+    """Returns (bytecode, listing lines)."""
+    instructions, labels, variables = parse(source)
+    code = bytearray()
+    listing = []
+    for line_number, address, opcode, text in instructions:
+        kind = OPS[opcode][3]
+        if kind in ("i8", "i16"):
+            operand = struct.pack("<b" if kind == "i8" else "<h", parse_number(text))
+        elif kind == "var":
+            value = variables.get(text, parse_number(text))
+            if value is None or not 0 <= value < VARIABLES:
+                raise AsmError(line_number, "no variable called %s" % text)
+            operand = bytes([value])
+        elif kind == "label":
+            if text not in labels:
+                raise AsmError(line_number, "no label called %s" % text)
+            operand = struct.pack("<H", labels[text])
+        elif kind == "dial":
+            operand = bytes([named(text, DIAL_NAMES, line_number, "dial")])
+        elif kind == "button":
+            operand = bytes([named(text, BUTTON_NAMES, line_number, "button")])
+        else:
+            operand = b""
+        code += bytes([opcode]) + operand
+        listing.append("%04x  %-10s %-7s %s" % (address, (bytes([opcode]) + operand).hex(),
+                                                OPS[opcode][0], text or ""))
+    if len(code) > PROGRAM_SIZE:
+        raise AsmError(instructions[-1][0], "the program is %d bytes, only %d fit"
+                       % (len(code), PROGRAM_SIZE))
+    check(code, {address: line for line, address, _, _ in instructions})
+    return bytes(code), listing
+
+
+def check(code, lines):
+    """The stack depth check from LightVM::check(), with line numbers."""
+    if not code:
+        raise AsmError(0, "the program is empty")
+    depths = {0: 0}
+    pending = [0]
+    while pending:
+        address = pending.pop()
+        opcode = code[address]
+        name, pops, pushes, kind = OPS[opcode]
+        line = lines[address]
+        depth = depths[address]
+        if depth < pops:
+            raise AsmError(line, "%s needs %d on the stack, there could be %d" % (name, pops, depth))
+        depth += pushes - pops
+        if depth > STACK_SIZE:
+            raise AsmError(line, "the stack only holds %d" % STACK_SIZE)
+        following = address + 1 + OPERAND_BYTES[kind]
+        targets = []
+        if name in ("jmp", "jz"):
+            targets.append(struct.unpack_from("<H", code, address + 1)[0])
+        if name not in ("end", "jmp"):
+            if following >= len(code):
+                raise AsmError(line, "runs off the end, finish with end or jmp")
+            targets.append(following)
+        for target in targets:
+            if target not in depths:
+                depths[target] = depth
+                pending.append(target)
+            elif depths[target] != depth:
+                raise AsmError(lines[target], "the stack is %d deep one way here, %d another"
+                               % (depths[target], depth))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", nargs="?", help="the program, as text")
+    parser.add_argument("--out", help="write the bytecode to this file")
+    parser.add_argument("--list", action="store_true", help="print the bytecode next to the code")
+    parser.add_argument("--upload", metavar="PORT", help="send it to the device")
+    parser.add_argument("--clear", metavar="PORT", help="empty the slot instead")
+    parser.add_argument("--slot", type=int, default=1, help="1-8, for CUSTOM_1 to CUSTOM_8")
+    args = parser.parse_args()
+
+    if not 1 <= args.slot <= 8:
+        parser.error("slots go from 1 to 8")
+    code = b""
+    if not args.clear:
+        if not args.source:
+            parser.error("give a program to assemble, or --clear")
+        with open(args.source) as f:
+            try:
+                code, listing = assemble(f.read())
+            except AsmError as error:
+                print("%s: %s" % (args.source, error))
+                return 1
+        print("%d bytes" % len(code))
+        if args.list:
+            print("\n".join(listing))
+        if args.out:
+            with open(args.out, "wb") as f:
+                f.write(code)
+
+    port = args.clear or args.upload
+    if port:
+        from light_protocol import LightClient
+        client = LightClient(port)
+        try:
+            result, position = client.write_program(args.slot, code)
+        finally:
+            client.close()
+        if result != "OK":
+            print("The device turned it down: %s at %04x" % (result, position))
+            return 1
+        print("Cleared slot %d" % args.slot if args.clear else "Saved to slot %d" % args.slot)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,361 @@
+"""
+The real firmware, built for this computer on the made-up board in
+lib/host_arduino, for the tools that want to try something without an
+Arduino.  Needs a C++ compiler (c++, or set CXX), nothing else.
+
+    from light_host import HostFirmware
+    from light_protocol import LightClient
+
+    with HostFirmware() as board:
+        client = LightClient(board.link)
+        print(client.get_state())
+
+HostFirmware builds tools/host_firmware.cpp with everything in src/ (again
+only if something changed, under .pio/host), starts it, and opens the
+pseudo-terminal it talks over.  The firmware follows this computer's clock,
+so timings through it are the computer's and the terminal's, not the chip's.
+
+The tuning and replay tools want the firmware's classes one at a time
+instead, on a made-up clock that only moves when they say so.  Those are in
+a shared library (tools/light_host_api.cpp, built the same way), loaded
+here with ctypes:
+
+    from light_host import Dial, DIAL_EMA
+
+    dial = Dial(DIAL_EMA, first_reading=1000)
+    fine, speed, velocity, idle = dial.add([1000, 1003, 998])
+
+press_latencies() times presses through the whole benchmark firmware, on
+the same made-up clock, from a second build of the library with
+LIGHT_BENCHMARK.
+
+One process is one made-up board, so tools that run several replays side by
+side do it with multiprocessing.
+"""
+
+import array
+import ctypes
+import errno
+import os
+import select
+import subprocess
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUILD_DIR = os.path.join(ROOT, ".pio", "host")
+
+
+def _sources(directory, extensions):
+    return [os.path.join(directory, name) for name in sorted(os.listdir(directory))
+            if name.endswith(extensions)]
+
+
+def build(name, main_sources, extra_flags=()):
+    """Build the firmware's sources with main_sources into .pio/host/name,
+    unless it's already newer than all of them.  Returns the path.  With
+    -shared in extra_flags it's a library (everything gets -fPIC too)."""
+    sources = (_sources(os.path.join(ROOT, "src"), (".cpp",)) +
+               _sources(os.path.join(ROOT, "lib", "host_arduino", "src"), (".cpp",)) +
+               list(main_sources))
+    headers = (_sources(os.path.join(ROOT, "include"), (".h",)) +
+               _sources(os.path.join(ROOT, "lib", "host_arduino", "src"), (".h",)))
+    output = os.path.join(BUILD_DIR, name)
+    if os.path.exists(output):
+        built = os.path.getmtime(output)
+        if all(os.path.getmtime(path) < built for path in sources + headers):
+            return output
+    if not os.path.isdir(BUILD_DIR):
+        os.makedirs(BUILD_DIR)
+    command = ([os.environ.get("CXX", "c++"), "-std=gnu++11", "-O2", "-DLIGHT_HOST",
+                "-I" + os.path.join(ROOT, "lib", "host_arduino", "src"),
+                "-I" + os.path.join(ROOT, "include")] +
+               (["-fPIC"] if "-shared" in extra_flags else []) +
+               list(extra_flags) + sources + ["-o", output])
+    subprocess.check_call(command)
+    return output
+
+
+class PtyLink:
+    """The tool's end of the pseudo-terminal, with the read()/write() that
+    LightClient wants from a serial port."""
+
+    def __init__(self, path, timeout=0.01):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        self.timeout = timeout
+
+    def read(self, size):
+        ready, _, _ = select.select([self.fd], [], [], self.timeout)
+        if not ready:
+            return b""
+        try:
+            return os.read(self.fd, size)
+        except OSError as error:
+            if error.errno == errno.EAGAIN:
+                return b""
+            raise
+
+    def write(self, data):
+        left = memoryview(data)
+        while len(left):
+            try:
+                left = left[os.write(self.fd, left):]
+            except OSError as error:
+                if error.errno != errno.EAGAIN:
+                    raise
+                select.select([], [self.fd], [], 0.1)
+        return len(data)
+
+    def close(self):
+        if self.fd is not None:
+            os.close(self.fd)
+            self.fd = None
+
+
+class HostFirmware:
+    """The firmware running on this computer, sped up by speed."""
+
+    def __init__(self, speed=1.0):
+        self.speed = speed
+        self.process = None
+        self.link = None
+
+    def start(self):
+        executable = build("firmware", [os.path.join(ROOT, "tools", "host_firmware.cpp")])
+        self.process = subprocess.Popen([executable, repr(self.speed)],
+                                        stdout=subprocess.PIPE)
+        port = self.process.stdout.readline().decode().strip()
+        if not port:
+            self.stop()
+            raise RuntimeError("the host firmware didn't start")
+        self.link = PtyLink(port)
+        return self
+
+    def stop(self):
+        if self.link is not None:
+            self.link.close()
+            self.link = None
+        if self.process is not None:
+            self.process.kill()
+            self.process.wait()
+            self.process = None
+
+    def __enter__(self):
+        return self.start()
+
+    def __exit__(self, *exception):
+        self.stop()
+
+
+###########################################################
+# The firmware's classes, through tools/light_host_api.cpp
+###########################################################
+
+# LightDialKind, the same choices as ProgramState.h has
+DIAL_EMA, DIAL_EURO, DIAL_MEDIAN_EMA, DIAL_MEDIAN_EURO = range(4)
+DIAL_KINDS = {"ema": DIAL_EMA, "euro": DIAL_EURO,
+              "median3+ema": DIAL_MEDIAN_EMA, "median3+euro": DIAL_MEDIAN_EURO}
+# LightChangeCause
+CAUSE_DIALS, CAUSE_SLEEP, CAUSE_PRESS = range(3)
+DIAL_COUNT = 4
+BUTTON_COUNT = 8
+
+_api = None
+_bench_api = None
+
+
+def _as_array(values, typecode):
+    """values as an array.array, without copying if it already is one."""
+    if isinstance(values, array.array) and values.typecode == typecode:
+        return values
+    return array.array(typecode, values)
+
+
+def _pointer(values, kind):
+    """A ctypes pointer into an array.array, or None for None."""
+    if values is None:
+        return None
+    return ctypes.cast((kind * len(values)).from_buffer(values), ctypes.POINTER(kind))
+
+
+def api():
+    """The library, built if need be.  Load it before starting any worker
+    processes, so they don't all build it at once."""
+    global _api
+    if _api is not None:
+        return _api
+    path = build("light_api.so", [os.path.join(ROOT, "tools", "light_host_api.cpp")], ["-shared"])
+    lib = ctypes.CDLL(path)
+    u8, u16, u32, f32 = ctypes.c_uint8, ctypes.c_uint16, ctypes.c_uint32, ctypes.c_float
+    p = ctypes.POINTER
+    lib.light_dial_new.restype = ctypes.c_void_p
+    lib.light_dial_new.argtypes = [u8, u16, u16, u16]
+    lib.light_dial_free.argtypes = [ctypes.c_void_p]
+    lib.light_dial_add.argtypes = [ctypes.c_void_p, u32, p(u16), p(u32), p(u16), p(f32), p(f32), p(u8)]
+    lib.light_dial_update.restype = u32
+    lib.light_dial_update.argtypes = [ctypes.c_void_p, u32, p(u16), u8, p(u16), p(f32), p(f32), p(u8)]
+    lib.light_replay_buttons.restype = u32
+    lib.light_replay_buttons.argtypes = [u32, p(u32), p(u8), p(u8), p(u8), u32, u8, p(u32)]
+    lib.light_replay_checks.restype = u32
+    lib.light_replay_checks.argtypes = [u32, p(f32), p(f32), p(u8), p(u8), f32, f32, u32, u32,
+                                        p(u32), p(u8), p(u8), u32]
+    _api = lib
+    return lib
+
+
+def bench_api():
+    """The library built with LIGHT_BENCHMARK, for press_latencies()."""
+    global _bench_api
+    if _bench_api is not None:
+        return _bench_api
+    path = build("light_bench_api.so", [os.path.join(ROOT, "tools", "light_host_api.cpp")],
+                 ["-shared", "-DLIGHT_BENCHMARK"])
+    lib = ctypes.CDLL(path)
+    u8, u32 = ctypes.c_uint8, ctypes.c_uint32
+    lib.light_press_latencies.argtypes = [u8, u8, u8, u32, u32, u32, ctypes.POINTER(u32)]
+    _bench_api = lib
+    return lib
+
+
+def reset():
+    """Put the made-up board back the way it starts (the clock keeps going)."""
+    api().light_reset()
+
+
+def adc_begin():
+    """Build the ADC correction table, so update() takes a burst like on the board."""
+    api().light_adc_begin()
+
+
+class Dial:
+    """One of the firmware's dials (BasicSmoothAnalogInput), on the made-up
+    clock.  Half-lives of 0 are the filter's own defaults."""
+
+    def __init__(self, kind=DIAL_EMA, first_reading=0, long_half_life_ms=0, short_half_life_ms=0):
+        self._lib = api()
+        self._dial = self._lib.light_dial_new(kind, first_reading, long_half_life_ms,
+                                              short_half_life_ms)
+        self._fine = array.array("H", [0])
+        self._speed = array.array("f", [0.0])
+        self._velocity = array.array("f", [0.0])
+        self._idle = array.array("B", [0])
+        self._queued = array.array("H", [0, 0])
+        # Made once, update() gets called a lot
+        c = ctypes
+        self._outputs = (_pointer(self._fine, c.c_uint16), _pointer(self._speed, c.c_float),
+                         _pointer(self._velocity, c.c_float), _pointer(self._idle, c.c_uint8))
+        self._queued_pointer = _pointer(self._queued, c.c_uint16)
+
+    def __del__(self):
+        if getattr(self, "_dial", None):
+            self._lib.light_dial_free(self._dial)
+            self._dial = None
+
+    def add(self, readings, steps_us=None):
+        """add_reading() for each reading, a millisecond apart unless steps_us
+        says otherwise.  Returns arrays of get_smoothed_fine(),
+        get_smooth_deriv(), get_velocity() and is_idle() after each one."""
+        readings = _as_array(readings, "H")
+        count = len(readings)
+        steps = array.array("I", steps_us) if steps_us is not None else None
+        fine = array.array("H", bytes(2 * count))
+        speed = array.array("f", bytes(4 * count))
+        velocity = array.array("f", bytes(4 * count))
+        idle = array.array("B", bytes(count))
+        c = ctypes
+        self._lib.light_dial_add(self._dial, count, _pointer(readings, c.c_uint16),
+                                 _pointer(steps, c.c_uint32), _pointer(fine, c.c_uint16),
+                                 _pointer(speed, c.c_float), _pointer(velocity, c.c_float),
+                                 _pointer(idle, c.c_uint8))
+        return fine, speed, velocity, idle
+
+    def update(self, step_us, readings):
+        """Move the clock on by step_us and update(), with the ADC reads
+        giving readings in turn (the last one over and over).  Returns how
+        many ADC reads it took, 0 if it wasn't time."""
+        if len(readings) == len(self._queued):
+            for i, reading in enumerate(readings):
+                self._queued[i] = reading
+            queued = self._queued_pointer
+        else:
+            queued = _pointer(array.array("H", readings), ctypes.c_uint16)
+        return self._lib.light_dial_update(self._dial, step_us, queued, len(readings),
+                                           *self._outputs)
+
+    # As of the last update()
+    @property
+    def fine(self):
+        return self._fine[0]
+
+    @property
+    def value(self):
+        """get_smoothed_fine() on the 12-bit scale."""
+        return self._fine[0] / 16.0
+
+    @property
+    def speed(self):
+        return self._speed[0]
+
+    @property
+    def velocity(self):
+        return self._velocity[0]
+
+    @property
+    def idle(self):
+        return bool(self._idle[0])
+
+
+def replay_checks(speeds, velocities, motion, present, wake_speed, grab_speed, doze_ms, sleep_ms):
+    """ProgramState::check_dials() and handle_sleep() over a replay, one
+    entry a millisecond (speeds and velocities DIAL_COUNT per entry), see
+    light_replay_checks().  Returns the mode changes as (ms, mode number,
+    cause)."""
+    count = len(motion)
+    speeds = _as_array(speeds, "f")
+    velocities = _as_array(velocities, "f")
+    motion = _as_array(motion, "B")
+    present = _as_array(present, "B")
+    room = 256
+    while True:
+        at = array.array("I", bytes(4 * room))
+        modes = array.array("B", bytes(room))
+        causes = array.array("B", bytes(room))
+        c = ctypes
+        changes = api().light_replay_checks(count, _pointer(speeds, c.c_float),
+                                            _pointer(velocities, c.c_float),
+                                            _pointer(motion, c.c_uint8), _pointer(present, c.c_uint8),
+                                            wake_speed, grab_speed, doze_ms, sleep_ms,
+                                            _pointer(at, c.c_uint32), _pointer(modes, c.c_uint8),
+                                            _pointer(causes, c.c_uint8), room)
+        if changes <= room:
+            return list(zip(at[:changes], modes[:changes], causes[:changes]))
+        room = changes
+
+
+def press_latencies(button, start_mode, came_from, loop_us, count, seed=1):
+    """Press an input count times in start_mode (having come from
+    came_from), through setup() and loop(), see light_press_latencies().
+    button is a Button number, or BUTTON_COUNT for motion.  Returns the
+    latencies in microseconds, 0 where the lights didn't change."""
+    latencies = array.array("I", bytes(4 * count))
+    bench_api().light_press_latencies(button, start_mode, came_from, int(loop_us), count, seed,
+                                      _pointer(latencies, ctypes.c_uint32))
+    return list(latencies)
+
+
+def replay_buttons(changes, press_starts, end_ms, idle_polling):
+    """Raw button changes (ms, Button number, pressed) through the
+    firmware's debouncing, polled like the sensing task does, see
+    light_replay_buttons().  press_starts says which changes start a real
+    press.  Returns (polls, {change index: ms until the press came through}),
+    leaving out the presses that never did."""
+    count = len(changes)
+    at = array.array("I", [change[0] for change in changes])
+    which = array.array("B", [change[1] for change in changes])
+    pressed = array.array("B", [change[2] for change in changes])
+    starts = array.array("B", press_starts)
+    latencies = array.array("I", bytes(4 * count))
+    c = ctypes
+    polls = api().light_replay_buttons(count, _pointer(at, c.c_uint32), _pointer(which, c.c_uint8),
+                                       _pointer(pressed, c.c_uint8), _pointer(starts, c.c_uint8),
+                                       end_ms, idle_polling, _pointer(latencies, c.c_uint32))
+    return polls, dict((i, latencies[i]) for i in range(count)
+                       if starts[i] and latencies[i] != 0xFFFFFFFF)
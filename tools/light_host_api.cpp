@@ -0,0 +1,463 @@
+#include <Arduino.h>
+#include <HostArduino.h>
+#include "AdcFrontEnd.h"
+#include "Clock.h"
+#include "DebounceInput.h"
+#include "ProgramState.h"
+#include "SensingTask.h"
+#include "SmoothAnalogInput.h"
+#ifdef LIGHT_BENCHMARK
+#include "OutputController.h"
+#endif
+
+/*
+The firmware's own classes behind plain C functions, for the Python tools
+to drive through ctypes instead of keeping copies of them.  Built as a
+shared library with the rest of src/, on the made-up board, by
+tools/light_host.py, which also wraps these for Python.
+
+Everything runs on the made-up clock (HostArduino.h), which only moves
+when one of these moves it.  One process is one board, so tools that want
+several at once use several processes.  Built with LIGHT_BENCHMARK, it
+also has the whole firmware's press-to-light timing (light_press_latencies()).
+*/
+
+extern "C" {
+
+// Which BasicSmoothAnalogInput, the same choices as ProgramState.h has
+enum LightDialKind : uint8_t {
+  LIGHT_DIAL_EMA,          // SmoothAnalogInput
+  LIGHT_DIAL_EURO,         // OneEuroAnalogInput
+  LIGHT_DIAL_MEDIAN_EMA,   // MedianSmoothAnalogInput
+  LIGHT_DIAL_MEDIAN_EURO   // MedianOneEuroAnalogInput
+};
+
+// Why the mode changed in light_replay_checks()
+enum LightChangeCause : uint8_t {
+  LIGHT_CAUSE_DIALS,  // check_dials()
+  LIGHT_CAUSE_SLEEP,  // handle_sleep()
+  LIGHT_CAUSE_PRESS   // someone there turned the lights back on
+};
+
+}
+
+// From src/main.cpp
+extern DebounceInput buttons[BUTTON_COUNT];
+
+// The dial picked at run time, the firmware picks at compile time
+class HostDial {
+public:
+  virtual ~HostDial() {
+  }
+  virtual void add_reading(uint16_t reading, uint32_t time_since_last_read_us) = 0;
+  virtual bool update() = 0;
+  virtual uint16_t fine() const = 0;
+  virtual float speed() const = 0;
+  virtual float velocity() const = 0;
+  virtual bool idle() const = 0;
+};
+
+template <class Input, class Filter>
+class HostDialOf : public HostDial {
+private:
+  Input _input;
+
+public:
+  HostDialOf(uint16_t long_half_life_ms, uint16_t short_half_life_ms)
+    : _input(A0, long_half_life_ms > 0 ? long_half_life_ms : Filter::DEFAULT_LONG_HALF_LIFE_MS,
+             short_half_life_ms > 0 ? short_half_life_ms : Filter::DEFAULT_SHORT_HALF_LIFE_MS) {
+  }
+  void add_reading(uint16_t reading, uint32_t time_since_last_read_us) {
+    _input.add_reading(reading, time_since_last_read_us);
+  }
+  bool update() {
+    return _input.update();
+  }
+  uint16_t fine() const {
+    return _input.get_smoothed_fine();
+  }
+  float speed() const {
+    return _input.get_smooth_deriv();
+  }
+  float velocity() const {
+    return _input.get_velocity();
+  }
+  bool idle() const {
+    return _input.is_idle();
+  }
+};
+
+// What the ADC gives light_dial_update(), one after another, the last one repeated
+static const uint16_t* queued_readings = nullptr;
+static uint8_t queued_count = 0;
+static uint8_t queued_taken = 0;
+
+static uint16_t queued_reading(uint8_t pin, uint64_t time_us, void* context) {
+  uint8_t index = queued_taken < queued_count ? queued_taken : queued_count - 1;
+  queued_taken++;
+  return queued_readings[index];
+}
+
+static void note_outputs(const HostDial* dial, uint32_t i, uint16_t* fine, float* speed,
+                         float* velocity, uint8_t* idle) {
+  if (fine != nullptr) {
+    fine[i] = dial->fine();
+  }
+  if (speed != nullptr) {
+    speed[i] = dial->speed();
+  }
+  if (velocity != nullptr) {
+    velocity[i] = dial->velocity();
+  }
+  if (idle != nullptr) {
+    idle[i] = dial->idle();
+  }
+}
+
+extern "C" {
+
+/**
+ * Put the made-up board back the way it starts, see host_reset()
+ */
+void light_reset() {
+  host_reset();
+}
+
+/**
+ * Build the ADC correction table, so the dials' update() takes a burst and
+ * keeps the middle of it like on the board.  Without it each reading is one
+ * plain ADC read.
+ */
+void light_adc_begin() {
+  adc_front_end_begin();
+}
+
+/**
+ * Make a dial, on the made-up board's clock as it is now
+ *
+ * @param kind A LightDialKind
+ * @param first_reading What the ADC says when it's set up
+ * @param long_half_life_ms The filter's long half-life, 0 for the filter's own default
+ * @param short_half_life_ms The same for the short one
+ * @return The dial, for light_dial_free() when done
+ */
+void* light_dial_new(uint8_t kind, uint16_t first_reading, uint16_t long_half_life_ms,
+                     uint16_t short_half_life_ms) {
+  host_set_analog(A0, first_reading);
+  switch (kind) {
+    case LIGHT_DIAL_EMA:
+      return new HostDialOf<SmoothAnalogInput, DualEmaFilter>(long_half_life_ms, short_half_life_ms);
+    case LIGHT_DIAL_EURO:
+      return new HostDialOf<OneEuroAnalogInput, OneEuroFilter>(long_half_life_ms, short_half_life_ms);
+    case LIGHT_DIAL_MEDIAN_EMA:
+      return new HostDialOf<MedianSmoothAnalogInput, Median3Filter<DualEmaFilter> >(
+        long_half_life_ms, short_half_life_ms);
+    case LIGHT_DIAL_MEDIAN_EURO:
+      return new HostDialOf<MedianOneEuroAnalogInput, Median3Filter<OneEuroFilter> >(
+        long_half_life_ms, short_half_life_ms);
+  }
+  return nullptr;
+}
+
+void light_dial_free(void* dial) {
+  delete static_cast<HostDial*>(dial);
+}
+
+/**
+ * Run readings through a dial with add_reading(), no ADC and no clock
+ * The outputs get one entry per reading, and any of them can be null.
+ *
+ * @param dial From light_dial_new()
+ * @param count How many readings
+ * @param readings The readings, as the filter gets them (after the burst median)
+ * @param steps_us Microseconds before each reading, or null for every millisecond
+ * @param fine get_smoothed_fine() after each one
+ * @param speed get_smooth_deriv() after each one
+ * @param velocity get_velocity() after each one
+ * @param idle is_idle() after each one
+ */
+void light_dial_add(void* dial, uint32_t count, const uint16_t* readings, const uint32_t* steps_us,
+                    uint16_t* fine, float* speed, float* velocity, uint8_t* idle) {
+  HostDial* input = static_cast<HostDial*>(dial);
+  for (uint32_t i = 0; i < count; i++) {
+    input->add_reading(readings[i], steps_us != nullptr ? steps_us[i] : 1000);
+    note_outputs(input, i, fine, speed, velocity, idle);
+  }
+}
+
+/**
+ * Move the clock on, then update() a dial the way the sensing task does
+ * The outputs are single values, and any of them can be null.
+ *
+ * @param dial From light_dial_new()
+ * @param step_us How far to move the clock first
+ * @param readings What each ADC read gives, in turn, the last one over and over
+ * @param count How many readings, at least one
+ * @return How many ADC reads update() took, 0 if it wasn't time for a reading
+ */
+uint32_t light_dial_update(void* dial, uint32_t step_us, const uint16_t* readings, uint8_t count,
+                           uint16_t* fine, float* speed, float* velocity, uint8_t* idle) {
+  HostDial* input = static_cast<HostDial*>(dial);
+  host_advance_us(step_us);
+  queued_readings = readings;
+  queued_count = count;
+  queued_taken = 0;
+  host_set_analog_source(queued_reading, nullptr);
+  input->update();
+  host_set_analog_source(nullptr, nullptr);
+  note_outputs(input, 0, fine, speed, velocity, idle);
+  return queued_taken;
+}
+
+/**
+ * Replay the dial checks and the sleep through a ProgramState, the way
+ * loop() does them: check_dials() every millisecond, handle_sleep() every
+ * ten.  It starts out in WHITE.  If it goes all the way to OFF with
+ * someone still there, they turn it back on (to the mode before it dozed)
+ * the next time they move or turn a dial.
+ *
+ * @param count Milliseconds to replay
+ * @param speeds DIAL_COUNT smoothed speeds (get_smooth_deriv()) per millisecond
+ * @param velocities DIAL_COUNT fitted speeds (get_velocity()) per millisecond
+ * @param motion Motion sensor bits per millisecond, as the sensing task has them
+ * @param present Whether someone's really there, per millisecond
+ * @param wake_speed, grab_speed The check_dials() thresholds
+ * @param doze_ms, sleep_ms The ProgramState sleep timings
+ * @param change_ms, change_mode, change_cause Set to each mode change: when
+ *        (the millisecond), the new Mode and a LightChangeCause
+ * @param max_changes Room in those
+ * @return How many mode changes there were, even past max_changes
+ */
+uint32_t light_replay_checks(uint32_t count, const float* speeds, const float* velocities,
+                             const uint8_t* motion, const uint8_t* present,
+                             float wake_speed, float grab_speed, uint32_t doze_ms, uint32_t sleep_ms,
+                             uint32_t* change_ms, uint8_t* change_mode, uint8_t* change_cause,
+                             uint32_t max_changes) {
+  ProgramState state(A0, A1, A2, A3, Mode::CUSTOM_6, doze_ms, sleep_ms);
+  state.update_mode(Mode::WHITE);
+  Mode lit_mode = state.curr_mode;
+  uint32_t changes = 0;
+  InputSnapshot inputs;
+  memset(&inputs, 0, sizeof(inputs));
+  for (uint32_t ms = 0; ms < count; ms++) {
+    for (uint8_t dial = 0; dial < DIAL_COUNT; dial++) {
+      inputs.dial_speed[dial] = speeds[ms * DIAL_COUNT + dial];
+      inputs.dial_velocity[dial] = velocities[ms * DIAL_COUNT + dial];
+    }
+    inputs.motion_sensors = motion[ms];
+    inputs.occupied = motion[ms] != 0;
+    state.take_inputs(inputs);
+
+    uint8_t cause = LIGHT_CAUSE_DIALS;
+    bool changed = state.check_dials(wake_speed, grab_speed);
+    if (!changed && ms % 10 == 0) {
+      cause = LIGHT_CAUSE_SLEEP;
+      changed = state.handle_sleep(inputs.occupied);
+    }
+    if (!changed && state.curr_mode == Mode::OFF && present[ms]) {
+      bool turning = false;
+      for (uint8_t dial = 0; dial < DIAL_COUNT; dial++) {
+        turning = turning || fabsf(inputs.dial_speed[dial]) > wake_speed;
+      }
+      if (inputs.occupied || turning) {
+        cause = LIGHT_CAUSE_PRESS;
+        state.update_mode(lit_mode);
+        state.manual_motion_update();
+        changed = true;
+      }
+    }
+    if (changed) {
+      if (changes < max_changes) {
+        change_ms[changes] = ms;
+        change_mode[changes] = static_cast<uint8_t>(state.curr_mode);
+        change_cause[changes] = cause;
+      }
+      changes++;
+      if (state.curr_mode != Mode::SLEEP_PREP && state.curr_mode != Mode::OFF) {
+        lit_mode = state.curr_mode;
+      }
+    }
+    host_advance_us(1000);
+  }
+  // handle_sleep() says what it's doing, nobody's listening
+  host_serial_take_output();
+  return changes;
+}
+
+/**
+ * Replay raw button changes through DebounceInput, on the buttons' own
+ * pins, with a sensing pass every millisecond that polls them when
+ * SensingTask::buttons_due() says to (or every pass, without idle_polling)
+ *
+ * @param count How many changes
+ * @param change_ms When each one happens, in order, milliseconds from the start
+ * @param change_button Which Button
+ * @param change_pressed 1 for pressed, 0 for let go
+ * @param press_start 1 for the changes that start a real press, not a bounce
+ * @param end_ms How long to replay
+ * @param idle_polling Whether the buttons go idle like in the firmware
+ * @param press_latency_ms Set, for each press start, to how long until the
+ *        debouncing let the press through, UINT32_MAX if it never did
+ * @return How many passes polled the buttons
+ */
+uint32_t light_replay_buttons(uint32_t count, const uint32_t* change_ms, const uint8_t* change_button,
+                              const uint8_t* change_pressed, const uint8_t* press_start,
+                              uint32_t end_ms, uint8_t idle_polling, uint32_t* press_latency_ms) {
+  for (uint8_t b = 0; b < BUTTON_COUNT; b++) {
+    host_release_pin(buttons[b].getPin());
+  }
+  // Fresh ones on the same pins, the firmware's are left alone
+  DebounceInput replayed[BUTTON_COUNT];
+  uint32_t pressed_change[BUTTON_COUNT];
+  for (uint8_t b = 0; b < BUTTON_COUNT; b++) {
+    replayed[b] = DebounceInput(buttons[b].getPin(), buttons[b].getButtonName());
+    pressed_change[b] = UINT32_MAX;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    press_latency_ms[i] = UINT32_MAX;
+  }
+
+  uint64_t start_us = clock_us();
+  // On buttons_due()'s clock the replay starts a while after anything
+  // happened, so the buttons start out idle
+  uint64_t busy_ms = 0;
+  uint64_t last_poll_ms = BUTTON_IDLE_AFTER_MS;
+  uint32_t polls = 0;
+  uint32_t next = 0;
+  for (uint32_t ms = 1; ms < end_ms; ms++) {
+    uint64_t now_ms = BUTTON_IDLE_AFTER_MS + ms;
+    bool idle;
+    if (idle_polling && !SensingTask::buttons_due(now_ms, busy_ms, last_poll_ms, idle)) {
+      continue;
+    }
+    for (; next < count && change_ms[next] <= ms; next++) {
+      uint8_t b = change_button[next];
+      host_set_pin(replayed[b].getPin(), change_pressed[next] ? LOW : HIGH);
+      if (press_start[next]) {
+        pressed_change[b] = next;
+      }
+    }
+    uint64_t at_us = start_us + static_cast<uint64_t>(ms) * 1000;
+    if (at_us > clock_us()) {
+      host_jump_us(at_us - clock_us());
+    }
+    last_poll_ms = now_ms;
+    polls++;
+    for (uint8_t b = 0; b < BUTTON_COUNT; b++) {
+      if (replayed[b].update() && replayed[b].isActive() && pressed_change[b] != UINT32_MAX) {
+        press_latency_ms[pressed_change[b]] = ms - change_ms[pressed_change[b]];
+        pressed_change[b] = UINT32_MAX;
+      }
+      if (!replayed[b].isSettled()) {
+        busy_ms = now_ms;
+      }
+    }
+  }
+  for (uint8_t b = 0; b < BUTTON_COUNT; b++) {
+    host_release_pin(buttons[b].getPin());
+  }
+  return polls;
+}
+
+#ifdef LIGHT_BENCHMARK
+
+}
+
+// From src/main.cpp
+extern ProgramState program_state;
+extern OutputController output_controller;
+
+// The same waits as src/LatencyBench.cpp
+const uint32_t LIGHT_SETTLE_MS = 150;
+const uint32_t LIGHT_TIMEOUT_MS = 500;
+const uint32_t LIGHT_RELEASE_MS = 150;
+const uint32_t LIGHT_COOLDOWN_MS = 4500;
+
+static bool light_firmware_started = false;
+static uint32_t light_random = 1;
+
+// xorshift32, so a seed gives the same presses every time
+static uint32_t light_next_random() {
+  light_random ^= light_random << 13;
+  light_random ^= light_random >> 17;
+  light_random ^= light_random << 5;
+  return light_random;
+}
+
+// One pass of loop(), then the rest of a pass loop_us long, give or take half
+static void light_loop_pass(uint32_t loop_us) {
+  loop();
+  host_advance_us(loop_us / 2 + light_next_random() % (loop_us + 1));
+}
+
+static void light_loop_for_ms(uint32_t ms, uint32_t loop_us) {
+  uint64_t until_us = clock_us() + static_cast<uint64_t>(ms) * 1000;
+  while (clock_us() < until_us) {
+    light_loop_pass(loop_us);
+  }
+}
+
+extern "C" {
+
+/**
+ * Time presses all the way to the PWM, the way src/LatencyBench.cpp does on
+ * the board, but through the whole firmware (setup() and loop()) on the
+ * made-up board.  On the host there's no sensing task, so the inputs are
+ * read at the top of every loop() pass rather than every millisecond.
+ * The first call starts the firmware, with the dials at four different levels.
+ *
+ * @param input A Button, or BUTTON_COUNT for the first motion sensor
+ * @param start_mode The Mode to press it in (SLEEP_PREP for motion)
+ * @param came_from The Mode to have gone there from (what motion wakes back up to)
+ * @param loop_us How long a loop() pass takes, give or take half
+ * @param count How many presses
+ * @param seed For where each press lands and how long each pass is
+ * @param latencies_us Set to each press's latency, 0 if the lights didn't change
+ */
+void light_press_latencies(uint8_t input, uint8_t start_mode, uint8_t came_from, uint32_t loop_us,
+                           uint32_t count, uint32_t seed, uint32_t* latencies_us) {
+  if (!light_firmware_started) {
+    // All different, so WHITE and RGB aren't the same lights
+    host_set_analog(A0, 3000);
+    host_set_analog(A1, 2000);
+    host_set_analog(A2, 1000);
+    host_set_analog(A3, 2500);
+    setup();
+    light_firmware_started = true;
+  }
+  light_random = seed != 0 ? seed : 1;
+  bool motion = input >= BUTTON_COUNT;
+  uint8_t pin = motion ? program_state.motion_detector_a.pin() : buttons[input].getPin();
+  TemporalDither &dither = output_controller.dither();
+
+  for (uint32_t i = 0; i < count; i++) {
+    // What latency_bench_poll() does
+    program_state.update_mode(static_cast<Mode>(came_from));
+    program_state.update_mode(static_cast<Mode>(start_mode));
+    program_state.manual_motion_update();
+    output_controller.enter_mode(program_state);
+    light_loop_for_ms(LIGHT_SETTLE_MS, loop_us);
+
+    // Somewhere random in the millisecond, part way through a pass
+    host_advance_us(light_next_random() % 1000);
+    uint32_t marks = dither.marks_written();
+    uint32_t pressed_us = clock_us32();
+    host_set_pin(pin, motion ? HIGH : LOW);
+    latencies_us[i] = 0;
+    while (clock_us32() - pressed_us < LIGHT_TIMEOUT_MS * 1000) {
+      light_loop_pass(loop_us);
+      if (dither.marks_written() != marks) {
+        latencies_us[i] = dither.mark_written_us() - pressed_us;
+        break;
+      }
+    }
+    host_release_pin(pin);
+    light_loop_for_ms(motion ? LIGHT_COOLDOWN_MS : LIGHT_RELEASE_MS, loop_us);
+  }
+  // Nobody's listening to what it says
+  host_serial_take_output();
+}
+
+#endif
+
+}
@@ -0,0 +1,341 @@
+"""
+Host-side client for the light controls serial protocol.
+
+See include/SerialProtocol.h for the frame layout.  Needs pyserial:
+
+    pip install pyserial
+
+Quick use from the command line:
+
+    python tools/light_protocol.py /dev/ttyACM0 state
+    python tools/light_protocol.py /dev/ttyACM0 mode 3
+    python tools/light_protocol.py /dev/ttyACM0 rgb 512 0 200
+    python tools/light_protocol.py /dev/ttyACM0 white 300
+    python tools/light_protocol.py /dev/ttyACM0 counters
+    python tools/light_protocol.py /dev/ttyACM0 filter 255 50 5
+    python tools/light_protocol.py /dev/ttyACM0 stream_stats
+    python tools/light_protocol.py /dev/ttyACM0 power
+    python tools/light_protocol.py /dev/ttyACM0 budget 20000
+    python tools/light_protocol.py /dev/ttyACM0 energy
+    python tools/light_protocol.py /dev/ttyACM0 loop
+    python tools/light_protocol.py /dev/ttyACM0 sensing
+    python tools/light_protocol.py /dev/ttyACM0 program 1
+"""
+
+import struct
+import sys
+import time
+
+SYNC = 0xA5
+REPLY_FLAG = 0x80
+MAX_PAYLOAD = 64
+
+PING = 0x01
+GET_STATE = 0x02
+SET_MODE = 0x03
+SET_RGB = 0x04
+SET_WHITE = 0x05
+GET_COUNTERS = 0x06
+SET_FILTER = 0x07
+STREAM_FRAMES = 0x08
+GET_STREAM_STATS = 0x09
+GET_POWER = 0x0A
+SET_POWER_BUDGET = 0x0B
+GET_MODE_ENERGY = 0x0C
+GET_LOOP_STATS = 0x0D
+GET_SENSING_STATS = 0x0E
+GET_FLIGHT_LOG = 0x0F
+WRITE_PROGRAM = 0x10
+COMMIT_PROGRAM = 0x11
+GET_PROGRAM_STATS = 0x12
+NACK = 0x7F
+
+LOOP_STAGE_NAMES = ["idle", "buttons", "analog", "sleep", "serial", "lights", "debug print"]
+
+MODE_NAMES = [
+    "OFF", "SLEEP_PREP", "RGB", "WHITE",
+    "CUSTOM_1", "CUSTOM_2", "CUSTOM_3", "CUSTOM_4",
+    "CUSTOM_5", "CUSTOM_6", "CUSTOM_7", "CUSTOM_8",
+    "REMOTE", "STREAM", "AUDIO", "HSV",
+]
+
+ERROR_NAMES = ["NONE", "UNKNOWN_COMMAND", "BAD_LENGTH", "BAD_VALUE"]
+
+# VmCheck, why a program was turned down (see include/LightVM.h)
+PROGRAM_CHECK_NAMES = ["OK", "TOO_BIG", "BAD_OPCODE", "TRUNCATED", "BAD_OPERAND", "BAD_JUMP",
+                       "STACK_UNDERFLOW", "STACK_OVERFLOW", "STACK_MISMATCH", "FALLS_OFF_END"]
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, matching crc16_update() on the device."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def encode_frame(command, payload=b""):
+    if len(payload) > MAX_PAYLOAD:
+        raise ValueError("payload too long")
+    body = bytes([len(payload), command]) + bytes(payload)
+    return bytes([SYNC]) + body + struct.pack("<H", crc16(body))
+
+
+class ProtocolError(Exception):
+    pass
+
+
+class FrameDecoder:
+    """Pulls frames out of a byte stream, skipping debug text in between."""
+
+    def __init__(self):
+        self._buffer = bytearray()
+
+    def feed(self, data):
+        self._buffer.extend(data)
+        frames = []
+        while True:
+            start = self._buffer.find(SYNC)
+            if start < 0:
+                self._buffer.clear()
+                break
+            del self._buffer[:start]
+            if len(self._buffer) < 2:
+                break
+            length = self._buffer[1]
+            if length > MAX_PAYLOAD:
+                del self._buffer[0]
+                continue
+            if len(self._buffer) < length + 5:
+                # Could be a real frame still arriving, or debug text that
+                # happened to contain the sync byte.  If a complete frame
+                # shows up further along, the sync here was a false one.
+                later = self._find_complete_frame(1)
+                if later < 0:
+                    break
+                del self._buffer[:later]
+                continue
+            body = bytes(self._buffer[1:3 + length])
+            (crc,) = struct.unpack_from("<H", self._buffer, 3 + length)
+            if crc != crc16(body):
+                del self._buffer[0]
+                continue
+            frames.append((body[1], body[2:]))
+            del self._buffer[:length + 5]
+        return frames
+
+    def _find_complete_frame(self, start):
+        position = self._buffer.find(SYNC, start)
+        while position >= 0:
+            if len(self._buffer) >= position + 2:
+                length = self._buffer[position + 1]
+                end = position + length + 5
+                if length <= MAX_PAYLOAD and len(self._buffer) >= end:
+                    body = bytes(self._buffer[position + 1:end - 2])
+                    (crc,) = struct.unpack_from("<H", self._buffer, end - 2)
+                    if crc == crc16(body):
+                        return position
+            position = self._buffer.find(SYNC, position + 1)
+        return -1
+
+
+class LightClient:
+    def __init__(self, port, timeout=1.0, serial_module=None):
+        if isinstance(port, str):
+            if serial_module is None:
+                import serial as serial_module
+            self.link = serial_module.Serial(port, 115200, timeout=0.01)
+        else:
+            # Anything with read()/write(), for example a pty
+            self.link = port
+        self.timeout = timeout
+        self.decoder = FrameDecoder()
+        self.pending = []
+
+    def close(self):
+        self.link.close()
+
+    def send(self, command, payload=b""):
+        self.link.write(encode_frame(command, payload))
+
+    def receive(self, command):
+        """Wait for the reply to a command, raising on a NACK."""
+        deadline = time.monotonic() + self.timeout
+        while time.monotonic() < deadline:
+            while self.pending:
+                reply_command, payload = self.pending.pop(0)
+                if reply_command == NACK | REPLY_FLAG and payload[0] == command:
+                    error = ERROR_NAMES[payload[1]] if payload[1] < len(ERROR_NAMES) else payload[1]
+                    raise ProtocolError("command 0x%02x failed: %s" % (command, error))
+                if reply_command == command | REPLY_FLAG:
+                    return payload
+            self.pending.extend(self.decoder.feed(self.link.read(256)))
+        raise TimeoutError("no reply to command 0x%02x" % command)
+
+    def transact(self, command, payload=b""):
+        self.send(command, payload)
+        return self.receive(command)
+
+    def ping(self, payload=b""):
+        return self.transact(PING, payload)
+
+    def get_state(self):
+        values = struct.unpack("<BB4H4hI", self.transact(GET_STATE))
+        return {
+            "mode": MODE_NAMES[values[0]] if values[0] < len(MODE_NAMES) else values[0],
+            "last_mode": MODE_NAMES[values[1]] if values[1] < len(MODE_NAMES) else values[1],
+            "pots": dict(zip(("red", "green", "blue", "white"), values[2:6])),
+            "dial_speeds": dict(zip(("red", "green", "blue", "white"),
+                                    (v / 100.0 for v in values[6:10]))),
+            "ms_since_motion": values[10],
+        }
+
+    def set_mode(self, mode):
+        if isinstance(mode, str):
+            mode = MODE_NAMES.index(mode.upper())
+        self.transact(SET_MODE, bytes([mode]))
+
+    def set_rgb(self, red, green, blue):
+        self.transact(SET_RGB, struct.pack("<3H", red, green, blue))
+
+    def set_white(self, level):
+        self.transact(SET_WHITE, struct.pack("<H", level))
+
+    def get_counters(self):
+        names = ("frames_ok", "crc_errors", "length_errors", "unknown_commands",
+                 "mode_changes", "uptime_ms")
+        return dict(zip(names, struct.unpack("<6I", self.transact(GET_COUNTERS))))
+
+    def set_filter(self, pot, long_half_life_ms, short_half_life_ms):
+        """pot is 0-3 for red, green, blue, white, or 255 for all of them."""
+        self.transact(SET_FILTER, struct.pack("<BHH", pot, long_half_life_ms,
+                                              short_half_life_ms))
+
+    def stream_frames(self, frames):
+        """frames is a list of (timestamp_us, red, green, blue), up to 6 of them.
+
+        There is no reply, the device just plays them out."""
+        payload = b"".join(struct.pack("<I3H", t & 0xFFFFFFFF, r, g, b)
+                           for t, r, g, b in frames)
+        self.send(STREAM_FRAMES, payload)
+
+    def get_stream_stats(self):
+        names = ("frames_received", "late_frames", "dropped_frames", "underruns",
+                 "buffered")
+        return dict(zip(names, struct.unpack("<4IB", self.transact(GET_STREAM_STATS))))
+
+    def get_power(self):
+        names = ("draw_mw", "budget_mw", "energy_mwh", "limit_events")
+        return dict(zip(names, struct.unpack("<4I", self.transact(GET_POWER))))
+
+    def set_power_budget(self, budget_mw):
+        """Most the strip may draw in milliwatts, 0 for no limit."""
+        self.transact(SET_POWER_BUDGET, struct.pack("<I", budget_mw))
+
+    def get_mode_energy(self):
+        payload = self.transact(GET_MODE_ENERGY)
+        values = struct.unpack("<%dI" % (len(payload) // 4), payload)
+        return {(MODE_NAMES[i] if i < len(MODE_NAMES) else i): mwh
+                for i, mwh in enumerate(values)}
+
+    def get_loop_stats(self):
+        """Loop timing overruns this boot, and what was left from before the last reset."""
+        values = struct.unpack("<6I3BI2B2IB", self.transact(GET_LOOP_STATS))
+        names = ("budget_us", "iterations", "overruns", "last_overrun_ms",
+                 "last_overrun_us", "worst_us", "last_overrun_stage", "worst_stage",
+                 "reset_reason", "boot_count", "have_previous", "previous_stage",
+                 "previous_overruns", "previous_worst_us", "previous_worst_stage")
+        stats = dict(zip(names, values))
+        for key in ("last_overrun_stage", "worst_stage", "previous_stage", "previous_worst_stage"):
+            if stats[key] < len(LOOP_STAGE_NAMES):
+                stats[key] = LOOP_STAGE_NAMES[stats[key]]
+        return stats
+
+    def get_sensing_stats(self):
+        """The sensing task on the other core, and how long inputs take to reach the lights."""
+        values = struct.unpack("<7IB2IB", self.transact(GET_SENSING_STATS))
+        names = ("passes", "worst_pass_us", "reads", "read_retries", "last_latency_us",
+                 "average_latency_us", "worst_latency_us", "running", "dial_reads",
+                 "button_polls", "idle_inputs")
+        return dict(zip(names, values))
+
+    def get_flight_log(self):
+        """All the events in the flight recorder, oldest first, as raw 8-byte records.
+
+        See tools/flight_log.py to turn them into something readable."""
+        events = []
+        count = None
+        while count is None or len(events) < count:
+            payload = self.transact(GET_FLIGHT_LOG, struct.pack("<H", len(events)))
+            count, _ = struct.unpack_from("<HH", payload)
+            records = payload[4:]
+            if not records:
+                break
+            events.extend(records[i:i + 8] for i in range(0, len(records), 8))
+        return events
+
+    def write_program(self, slot, code, chunk=60):
+        """Send a program and save it to a slot, 1-8 for CUSTOM_1 to CUSTOM_8.
+
+        An empty program clears the slot.  Returns (check, position): "OK",
+        or why the device turned it down and where."""
+        for offset in range(0, len(code), chunk):
+            self.transact(WRITE_PROGRAM, struct.pack("<H", offset) + code[offset:offset + chunk])
+        result, position = struct.unpack("<BH", self.transact(
+            COMMIT_PROGRAM, struct.pack("<BH", slot - 1, len(code))))
+        name = PROGRAM_CHECK_NAMES[result] if result < len(PROGRAM_CHECK_NAMES) else result
+        return name, position
+
+    def get_program_stats(self, slot):
+        """How a slot's program has been running, slot 1-8."""
+        values = struct.unpack("<H3I", self.transact(GET_PROGRAM_STATS, bytes([slot - 1])))
+        return dict(zip(("length", "passes", "overruns", "instructions"), values))
+
+
+def main(argv):
+    if len(argv) < 3:
+        print(__doc__)
+        return 1
+    client = LightClient(argv[1])
+    command, args = argv[2], [int(a) for a in argv[3:]]
+    try:
+        if command == "ping":
+            print(client.ping(b"hello"))
+        elif command == "state":
+            print(client.get_state())
+        elif command == "mode":
+            client.set_mode(args[0])
+        elif command == "rgb":
+            client.set_rgb(*args)
+        elif command == "white":
+            client.set_white(args[0])
+        elif command == "counters":
+            print(client.get_counters())
+        elif command == "filter":
+            client.set_filter(*args)
+        elif command == "stream_stats":
+            print(client.get_stream_stats())
+        elif command == "power":
+            print(client.get_power())
+        elif command == "budget":
+            client.set_power_budget(args[0])
+        elif command == "energy":
+            print(client.get_mode_energy())
+        elif command == "loop":
+            print(client.get_loop_stats())
+        elif command == "sensing":
+            print(client.get_sensing_stats())
+        elif command == "program":
+            print(client.get_program_stats(args[0]))
+        else:
+            print("Unknown command: " + command)
+            return 1
+    finally:
+        client.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
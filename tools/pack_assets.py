@@ -0,0 +1,195 @@
+"""
+Build the animation image for the assets flash partition.
+
+Animations are described in a JSON file (see tools/assets/assets.json):
+
+    {"animations": [
+      {"name": "custom8", "keyframes": [[0, 0, 0, 0], [60000, 1023, 500, 80]]},
+      {"name": "custom5", "frames": "heartbeat.csv", "frame_ms": 50, "loop": true}
+    ]}
+
+Keyframes are [time in ms, red, green, blue], with straight fades between
+them.  Frames come from a CSV file with one "red,green,blue" line per frame.
+Colors are 0-1023, like everywhere else, and are stored as 16-bit levels.
+A looping keyframe animation can have a "duration_ms" past its last
+keyframe, to fade back into the first.  An animation named "custom1" to
+"custom8" plays in that CUSTOM mode (unless a program is loaded there).
+
+    python tools/pack_assets.py tools/assets/assets.json --out assets.bin
+    python tools/pack_assets.py tools/assets/assets.json --flash /dev/ttyACM0
+    python tools/pack_assets.py --show assets.bin
+
+Add --bench to also pack a long animation of made-up frames called "bench",
+big enough that the playback benchmarks (include/Benchmark.h) see what a
+flash cache miss costs.
+
+The image goes in its own partition (partitions.csv), written with esptool,
+so it can change without rebuilding the firmware.  The layout is described
+in include/AnimationAssets.h; keep the two the same.
+"""
+
+import argparse
+import csv
+import json
+import os
+import struct
+import subprocess
+import sys
+import zlib
+
+MAGIC = 0x5341544C  # "LTAS"
+VERSION = 1
+HEADER_FORMAT = "<IHHII"
+ENTRY_FORMAT = "<16sIIIBBH"
+FRAME_FORMAT = "<3H"
+KEYFRAME_FORMAT = "<I4H"
+KIND_FRAMES = 0
+KIND_KEYFRAMES = 1
+FLAG_LOOP = 0x01
+
+PARTITIONS_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "partitions.csv")
+
+
+def level(value):
+    """0-1023, like a PWM duty, to the 16-bit level stored in the image."""
+    value = int(value)
+    if not 0 <= value <= 1023:
+        raise ValueError("colors go from 0 to 1023, not %d" % value)
+    return value << 6
+
+
+def read_frames(path):
+    frames = []
+    with open(path) as f:
+        for row in csv.reader(f):
+            if not row or row[0].strip().startswith("#"):
+                continue
+            frames.append(tuple(level(v) for v in row[:3]))
+    return frames
+
+
+def pack_animation(animation, base_dir):
+    """Returns (kind, count, duration_ms, frame_ms, flags, data) for one animation."""
+    flags = FLAG_LOOP if animation.get("loop") else 0
+    if "levels" in animation:
+        # Made up here, already 16-bit, the same level on every channel
+        data = b"".join(struct.pack(FRAME_FORMAT, v, v, v) for v in animation["levels"])
+        count = len(animation["levels"])
+        return KIND_FRAMES, count, count * animation["frame_ms"], animation["frame_ms"], flags, data
+    if "frames" in animation:
+        frames = read_frames(os.path.join(base_dir, animation["frames"]))
+        frame_ms = int(animation.get("frame_ms", 20))
+        if not frames or not 0 < frame_ms < 65536:
+            raise ValueError("%s needs some frames and a frame_ms" % animation["name"])
+        data = b"".join(struct.pack(FRAME_FORMAT, *frame) for frame in frames)
+        return KIND_FRAMES, len(frames), len(frames) * frame_ms, frame_ms, flags, data
+    keyframes = sorted(animation["keyframes"], key=lambda k: k[0])
+    if not keyframes:
+        raise ValueError("%s needs frames or keyframes" % animation["name"])
+    duration_ms = int(animation.get("duration_ms", keyframes[-1][0]))
+    duration_ms = max(duration_ms, keyframes[-1][0], 1)
+    data = b"".join(struct.pack(KEYFRAME_FORMAT, int(t), level(r), level(g), level(b), 0)
+                    for t, r, g, b in keyframes)
+    return KIND_KEYFRAMES, len(keyframes), duration_ms, 0, flags, data
+
+
+def bench_animation(frames=32768):
+    """About 200 KB of noise, far more than the flash cache holds."""
+    state = 1
+    data = []
+    for _ in range(frames):
+        state = (state * 1103515245 + 12345) & 0x7FFFFFFF
+        data.append((state >> 6) & 0xFFFF)
+    return data
+
+
+def build_image(manifest, base_dir, bench=False):
+    animations = list(manifest["animations"])
+    if bench:
+        animations.append({"name": "bench", "frame_ms": 10, "loop": True, "levels": bench_animation()})
+    directory_end = struct.calcsize(HEADER_FORMAT) + len(animations) * struct.calcsize(ENTRY_FORMAT)
+    entries = b""
+    body = b""
+    for animation in animations:
+        name = animation["name"].encode("ascii")
+        if len(name) > 16:
+            raise ValueError("%s: names can be 16 letters at most" % animation["name"])
+        kind, count, duration_ms, frame_ms, flags, data = pack_animation(animation, base_dir)
+        offset = directory_end + len(body)
+        entries += struct.pack(ENTRY_FORMAT, name, offset, count, duration_ms, kind, flags, frame_ms)
+        # Keep everything 4-byte aligned, the device reads it in place
+        body += data + b"\0" * (-len(data) % 4)
+    rest = entries + body
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(animations),
+                         struct.calcsize(HEADER_FORMAT) + len(rest), zlib.crc32(rest) & 0xFFFFFFFF)
+    return header + rest
+
+
+def show_image(image):
+    magic, version, count, size, crc = struct.unpack_from(HEADER_FORMAT, image)
+    if magic != MAGIC:
+        print("Not an asset image")
+        return 1
+    good = size == len(image) and zlib.crc32(image[16:]) & 0xFFFFFFFF == crc
+    print("version %d, %d animations, %d bytes, CRC %s" % (version, count, size, "good" if good else "BAD"))
+    for i in range(count):
+        fields = struct.unpack_from(ENTRY_FORMAT, image, 16 + i * struct.calcsize(ENTRY_FORMAT))
+        name, offset, items, duration_ms, kind, flags, frame_ms = fields
+        what = "%d frames of %d ms" % (items, frame_ms) if kind == KIND_FRAMES else "%d keyframes" % items
+        print("  %-16s %-22s %8.1f s%s  at %d" % (name.rstrip(b"\0").decode(), what, duration_ms / 1000.0,
+                                                  ", loops" if flags & FLAG_LOOP else "", offset))
+    return 0 if good else 1
+
+
+def assets_partition(path):
+    """(offset, size) of the assets partition in the partition table."""
+    with open(path) as f:
+        for line in f:
+            fields = [field.strip() for field in line.split("#")[0].split(",")]
+            if fields[0] == "assets":
+                return int(fields[3], 0), int(fields[4], 0)
+    raise ValueError("no assets partition in " + path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("manifest", nargs="?", help="the JSON file listing the animations")
+    parser.add_argument("--out", default="assets.bin")
+    parser.add_argument("--partitions", default=PARTITIONS_PATH)
+    parser.add_argument("--flash", metavar="PORT", help="write the image to the device with esptool")
+    parser.add_argument("--show", metavar="IMAGE", help="list what's in an image instead")
+    parser.add_argument("--bench", action="store_true", help="add a big animation for the benchmarks")
+    args = parser.parse_args()
+
+    if args.show:
+        with open(args.show, "rb") as f:
+            return show_image(f.read())
+    if not args.manifest:
+        parser.error("give a manifest, or --show an image")
+
+    with open(args.manifest) as f:
+        manifest = json.load(f)
+    try:
+        image = build_image(manifest, os.path.dirname(os.path.abspath(args.manifest)), args.bench)
+    except (KeyError, ValueError) as error:
+        print("%s: %s" % (args.manifest, error))
+        return 1
+    offset, size = assets_partition(args.partitions)
+    if len(image) > size:
+        print("The image is %d bytes, the partition only holds %d" % (len(image), size))
+        return 1
+    with open(args.out, "wb") as f:
+        f.write(image)
+    show_image(image)
+
+    command = [sys.executable, "-m", "esptool", "--chip", "esp32s3", "--port", args.flash or "PORT",
+               "write_flash", hex(offset), args.out]
+    if not args.flash:
+        print("To write it: esptool.py " + " ".join(command[3:]))
+        return 0
+    return subprocess.call(command)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,117 @@
+"""
+How fast the serial protocol goes: round-trip times for PING at a few
+payload sizes, then how many frames a second get through with several in
+flight, and whether any were lost or garbled on the way.
+
+    python tools/protocol_bench.py
+    python tools/protocol_bench.py /dev/ttyACM0
+
+With no port it runs against the firmware built for this computer, over a
+pseudo-terminal (see tools/light_host.py), which needs no Arduino and is
+quick enough to run before every change to the parser or the loop.  Those
+numbers are the computer's and the terminal's, so compare them with each
+other, not with the board's; the board's need pyserial and a port.
+
+Exits with 1 if a reply went missing or didn't match what was sent, or if the
+device counted any CRC or length errors.
+"""
+
+import argparse
+import statistics
+import struct
+import sys
+import time
+
+from light_protocol import LightClient, PING
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def echo_payload(sequence, size):
+    """A payload that says which ping it was, padded out to size."""
+    head = struct.pack("<I", sequence)
+    return (head + bytes((sequence + i) & 0xFF for i in range(max(size - 4, 0))))[:max(size, 4)]
+
+
+def round_trips(client, size, count):
+    """Send pings one at a time, returns the round-trip times in microseconds."""
+    times = []
+    for sequence in range(count):
+        payload = echo_payload(sequence, size)
+        start = time.perf_counter()
+        reply = client.transact(PING, payload)
+        times.append((time.perf_counter() - start) * 1e6)
+        if reply != payload:
+            raise ValueError("ping %d came back as %r" % (sequence, reply))
+    return times
+
+
+def throughput(client, size, count, in_flight):
+    """Keep in_flight pings going, returns frames per second each way."""
+    start = time.perf_counter()
+    sent = 0
+    received = 0
+    while received < count:
+        while sent < count and sent - received < in_flight:
+            client.send(PING, echo_payload(sent, size))
+            sent += 1
+        reply = client.receive(PING)
+        if reply != echo_payload(received, size):
+            raise ValueError("ping %d came back as %r" % (received, reply))
+        received += 1
+    return count / (time.perf_counter() - start)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?", help="a real device, instead of the host firmware")
+    parser.add_argument("--count", type=int, default=500, help="pings per size")
+    parser.add_argument("--sizes", type=int, nargs="+", default=[4, 16, 64],
+                        help="payload sizes to try, 4-64 bytes")
+    parser.add_argument("--in-flight", type=int, default=4,
+                        help="pings sent ahead of the replies for the throughput")
+    args = parser.parse_args()
+
+    board = None
+    if args.port:
+        client = LightClient(args.port)
+    else:
+        from light_host import HostFirmware
+        board = HostFirmware().start()
+        client = LightClient(board.link)
+    try:
+        # Let setup() finish, and clear out anything it printed
+        client.ping(b"hello")
+        before = client.get_counters()
+
+        print("%-8s %10s %10s %10s %12s" % ("payload", "median us", "p99 us", "max us",
+                                            "frames/s"))
+        for size in args.sizes:
+            times = round_trips(client, size, args.count)
+            rate = throughput(client, size, args.count, args.in_flight)
+            print("%-8d %10.0f %10.0f %10.0f %12.0f" % (
+                size, statistics.median(times), percentile(times, 0.99), max(times), rate))
+
+        after = client.get_counters()
+        errors = {name: after[name] - before[name]
+                  for name in ("crc_errors", "length_errors", "unknown_commands")}
+        print("Frames the device took: %d, errors: %s" % (
+            after["frames_ok"] - before["frames_ok"], errors))
+        if any(errors.values()):
+            return 1
+    except (ValueError, TimeoutError) as error:
+        print("Failed: %s" % error)
+        return 1
+    finally:
+        client.close()
+        if board is not None:
+            board.stop()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,291 @@
+"""
+Replay a made-up day at the desk through the idle sampling (see
+SmoothAnalogInput.h and SensingTask.h), and count what it saves and what it
+costs.
+
+A dial that sits still for two seconds drops from a reading every
+millisecond to one every 25, and the buttons drop to a poll every 20 ms
+once nothing has happened to them for a second.  Over a day the inputs sit
+still almost all of the time, so that's most of the sensing core's ADC
+work gone.  The price is that a dial or button touched while idle is
+noticed a little later.  This prints:
+------
+  dial reads     ADC bursts per dial per day, idle sampling against every millisecond
+  button polls   passes that polled the buttons, the same way
+  core time      sensing-core time those take, from --read-us and --poll-us
+  dial latency   added time for a quick turn to go past the mode grab speed (mean, 90th percentile, worst)
+  press latency  added time for a press to come out of the debouncing (the same)
+------
+Every turn and press is replayed both ways, on the same noise.  It exits
+with 1 if the worst added latency, dials or buttons, is over --target-ms,
+or if the idle sampling misses a grab the full rate caught.
+
+The day: nobody from 23:00 to 07:00, and in between, sessions at the desk
+(10 to 60 minutes, an hour and a half apart on average) of dial turns and
+button presses every so often.  The noise and spikes are the same as
+tools/tune_params.py's made-up traces.  The dials and buttons are the
+firmware's own, through tools/light_host.py: SmoothAnalogInput (what the
+dials use) deciding for itself when to read, and DebounceInput polled when
+SensingTask::buttons_due() says.  Each dial is replayed on its own core.
+
+    python tools/sampling_replay.py
+    python tools/sampling_replay.py --hours 4 --seed 3
+    python tools/sampling_replay.py --target-ms 20
+"""
+
+import argparse
+import math
+import multiprocessing
+import random
+import statistics
+import sys
+
+import light_host
+from tune_params import DIALS
+
+BUTTONS = ("rgb", "white", "cycle", "off", "s1", "s2")
+DAY_START_H = 8    # the replay starts at 08:00
+AWAKE_H = (7, 23)  # nobody at the desk outside these
+
+# SmoothAnalogInput.h: a reading every sensing pass, or this often once idle.
+# Nothing happens between an idle dial's readings, so the replay skips to the
+# next one instead of asking every millisecond.
+FULL_INTERVAL_MS = 1
+IDLE_INTERVAL_MS = 25
+
+GRAB_SPEED = 1.85  # mode_grab_dial_deriv_threshold in main.cpp
+GRAB_LATE_MS = 100  # a grab this long after the turn ends still counts
+# Only turns this much over the grab speed are scored.  The fitted speed
+# wobbles by about 0.15 with the noise, so nearer the grab speed than this
+# it's luck whether a turn grabs at all, and when, at any sampling rate.
+GRAB_CLEAR = 1.25
+
+NOISE_TABLE = 1 << 16
+
+
+def make_day(seed, hours):
+    """Sessions at the desk: dial turns (dial, start ms, end ms, from, to)
+    and raw button changes (ms, button, state) with the contact bounce."""
+    rng = random.Random(seed)
+    end_ms = int(hours * 3600000)
+    levels = [rng.uniform(300, 3500) for _ in DIALS]
+    first = list(levels)
+    turns = [[] for _ in DIALS]
+    changes = []
+    presses = []  # (ms, button), when each press starts
+    t = rng.uniform(0, 30) * 60000
+    while t < end_ms:
+        hour = (DAY_START_H + t / 3600000.0) % 24
+        if not AWAKE_H[0] <= hour < AWAKE_H[1]:
+            t += 10 * 60000
+            continue
+        session_end = min(t + rng.uniform(10, 60) * 60000, end_ms - 5000)
+        t += rng.uniform(1, 10) * 1000
+        next_press = t + rng.uniform(5, 120) * 1000
+        while t < session_end:
+            if t >= next_press:
+                button = rng.randrange(len(BUTTONS))
+                start = int(t)
+                hold = int(rng.uniform(80, 400))
+                presses.append((start, button))
+                for edge, state in ((start, 1), (start + hold, 0)):
+                    changes.append((edge, button, state))
+                    # A few ms of chatter after each edge
+                    for bounce in range(rng.randrange(4)):
+                        changes.append((edge + 2 * bounce + 1, button, 1 - state))
+                        changes.append((edge + 2 * bounce + 2, button, state))
+                next_press = t + rng.uniform(10, 120) * 1000
+                t += hold + rng.uniform(1, 5) * 1000
+                continue
+            dial = rng.randrange(len(DIALS))
+            length = int(rng.uniform(150, 1000))
+            target = rng.uniform(100, 3900)
+            turns[dial].append((int(t), int(t) + length, levels[dial], target))
+            levels[dial] = target
+            t += length + rng.uniform(3, 60) * 1000
+        t = session_end + rng.expovariate(1 / 90.0) * 60000
+    changes.sort()
+    return end_ms, first, turns, changes, presses
+
+
+def noise_tables(seed):
+    rng = random.Random(seed * 7919 + 1)
+    noise = [rng.gauss(0, 3) for _ in range(NOISE_TABLE)]
+    for i in range(NOISE_TABLE):
+        if rng.random() < 0.004:  # what's left of the spikes after the burst median
+            noise[i] += rng.choice((-1, 1)) * rng.uniform(100, 500)
+    return noise
+
+
+class DialLevel:
+    """Where the knob is at any millisecond, and what the ADC says."""
+
+    def __init__(self, first, turns, noise, dial):
+        self.first = first
+        self.turns = turns
+        self.noise = noise
+        self.offset = dial * 15013
+        self.next_turn = 0
+
+    def reading(self, ms, extra=0):
+        # Replayed in time order, so walk the turns along with it
+        while self.next_turn < len(self.turns) and self.turns[self.next_turn][1] <= ms:
+            self.next_turn += 1
+        if self.next_turn < len(self.turns) and self.turns[self.next_turn][0] <= ms:
+            start, end, was, to = self.turns[self.next_turn]
+            level = was + (to - was) * (ms - start) / float(end - start)
+        elif self.next_turn > 0:
+            level = self.turns[self.next_turn - 1][3]
+        else:
+            level = self.first
+        value = level + self.noise[(ms + self.offset + extra * 40009) % NOISE_TABLE]
+        return int(min(max(value, 0), 4095))
+
+
+def note_grab(turn, ms, speed, grabs):
+    """Note the first time each turn goes past the grab speed."""
+    start, end = turn[0], turn[1]
+    if start <= ms <= end + GRAB_LATE_MS and grabs.get(start) is None and abs(speed) > GRAB_SPEED:
+        grabs[start] = ms - start
+
+
+def replay_dial(job):
+    seed, hours, dial = job
+    end_ms, first, turns, _, _ = make_day(seed, hours)
+    noise = noise_tables(seed)
+    turns = turns[dial]
+
+    # Idle sampling, the whole day
+    level = DialLevel(first[dial], turns, noise, dial)
+    pot = light_host.Dial(light_host.DIAL_EMA, level.reading(0))
+    bursts = 0
+    idle_ms = 0
+    idle_grabs = {}
+    next_turn = 0
+    ms = 0
+    while ms < end_ms:
+        was_idle = pot.idle
+        dt_ms = IDLE_INTERVAL_MS if was_idle else FULL_INTERVAL_MS
+        ms += dt_ms
+        # The second reading is only taken if an idle dial doesn't look steady
+        reads = pot.update(dt_ms * 1000, (level.reading(ms), level.reading(ms, 1)))
+        while not reads and ms < end_ms:
+            ms += FULL_INTERVAL_MS
+            dt_ms += FULL_INTERVAL_MS
+            reads = pot.update(FULL_INTERVAL_MS * 1000, (level.reading(ms), level.reading(ms, 1)))
+        if was_idle:
+            idle_ms += dt_ms
+        bursts += reads
+        while next_turn < len(turns) and turns[next_turn][1] + GRAB_LATE_MS < ms:
+            next_turn += 1
+        if next_turn < len(turns):
+            note_grab(turns[next_turn], ms, pot.velocity, idle_grabs)
+
+    # Every millisecond, just around each turn
+    full_grabs = {}
+    for turn in turns:
+        level = DialLevel(first[dial], turns, noise, dial)
+        window = range(turn[0] - 300, turn[1] + GRAB_LATE_MS + 1)
+        readings = [level.reading(ms) for ms in window]
+        _, _, velocities, _ = light_host.Dial(light_host.DIAL_EMA, level.reading(window[0] - 1)).add(readings)
+        for ms, velocity in zip(window, velocities):
+            note_grab(turn, ms, velocity, full_grabs)
+
+    added = []
+    missed = scored = 0
+    for turn in turns:
+        start, end, was, to = turn
+        if abs(to - was) / float(end - start) < GRAB_SPEED * GRAB_CLEAR:
+            continue  # not meant to grab
+        scored += 1
+        full, idle = full_grabs.get(start), idle_grabs.get(start)
+        if full is None:
+            continue
+        if idle is None:
+            missed += 1
+        else:
+            added.append(idle - full)
+    return dial, end_ms, bursts, idle_ms, added, missed, scored
+
+
+def replay_buttons(job):
+    seed, hours, idle_polling = job
+    end_ms, _, _, changes, presses = make_day(seed, hours)
+    # BUTTONS are the first few in the firmware's Button order
+    starts = set(presses)
+    press_starts = [1 if state and (ms, button) in starts else 0 for ms, button, state in changes]
+    polls, latencies = light_host.replay_buttons(changes, press_starts, end_ms, idle_polling)
+    return idle_polling, end_ms, polls, dict((changes[i][0], ms) for i, ms in latencies.items())
+
+
+def spread(values):
+    if not values:
+        return "-"
+    ordered = sorted(values)
+    return "%.1f / %.1f / %.1f" % (statistics.mean(ordered), ordered[math.ceil(0.9 * len(ordered)) - 1],
+                                   ordered[-1])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--hours", type=float, default=24, help="how long a day to replay")
+    parser.add_argument("--seed", type=int, default=1, help="which made-up day")
+    parser.add_argument("--target-ms", type=float, default=30,
+                        help="most latency the idle sampling may add")
+    parser.add_argument("--read-us", type=float, default=60,
+                        help="sensing-core time for one dial reading (the burst and its quiet waits)")
+    parser.add_argument("--poll-us", type=float, default=3,
+                        help="sensing-core time for polling all the buttons once")
+    args = parser.parse_args()
+
+    jobs = [(args.seed, args.hours, dial) for dial in range(len(DIALS))]
+    light_host.api()  # built once, before the workers start
+    with multiprocessing.Pool() as pool:
+        button_runs = pool.map_async(replay_buttons, [(args.seed, args.hours, False),
+                                                      (args.seed, args.hours, True)])
+        dial_runs = pool.map(replay_dial, jobs)
+        button_runs = button_runs.get()
+
+    end_ms = dial_runs[0][1]
+    days = end_ms / 86400000.0
+    full_reads = end_ms // FULL_INTERVAL_MS
+    print("Replayed %.1f hours from %02d:00, seed %d" % (args.hours, DAY_START_H, args.seed))
+    print()
+    print("%-8s %14s %14s %7s %7s %12s %24s" % ("dial", "reads/day", "full rate", "saved", "idle",
+                                               "quick turns", "added ms (mean/p90/max)"))
+    all_added = []
+    missed = 0
+    idle_reads = 0
+    for dial, _, bursts, idle_ms, added, dial_missed, turn_count in dial_runs:
+        idle_reads += bursts
+        all_added += added
+        missed += dial_missed
+        print("%-8s %14d %14d %6.1f%% %6.1f%% %12d %24s" % (
+            DIALS[dial], bursts / days, full_reads / days, 100.0 * (1 - bursts / float(full_reads)),
+            100.0 * idle_ms / end_ms, turn_count, spread(added)))
+
+    full_polls, idle_polls = button_runs[0][2], button_runs[1][2]
+    full_latencies, idle_latencies = button_runs[0][3], button_runs[1][3]
+    added_press = [idle_latencies[start] - full_latencies[start]
+                   for start in full_latencies if start in idle_latencies]
+    missed_presses = sum(1 for start in full_latencies if start not in idle_latencies)
+    print("%-8s %14d %14d %6.1f%% %7s %12d %24s" % (
+        "buttons", idle_polls / days, full_polls / days, 100.0 * (1 - idle_polls / float(full_polls)),
+        "", len(full_latencies), spread(added_press)))
+    print()
+
+    full_us = len(DIALS) * full_reads * args.read_us + full_polls * args.poll_us
+    idle_us = idle_reads * args.read_us + idle_polls * args.poll_us
+    print("Sensing-core time: %.0f s/day at full rate, %.0f s/day idling (%.1f%% saved)" % (
+        full_us / 1e6 / days, idle_us / 1e6 / days, 100.0 * (1 - idle_us / full_us)))
+
+    worst = max(all_added + added_press + [0])
+    failed = worst > args.target_ms or missed or missed_presses
+    print("Worst added latency %.0f ms, target %.0f ms; %d grabs and %d presses missed: %s" % (
+        worst, args.target_ms, missed, missed_presses, "FAIL" if failed else "ok"))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
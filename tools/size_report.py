@@ -0,0 +1,103 @@
+"""
+Build-time report of how much flash and RAM each source file takes.
+
+PlatformIO runs this after linking (see extra_scripts in platformio.ini).  It
+measures each compiled object file and prints a table, and fails the build
+if a module has grown past its budget below.  The numbers are from before
+the linker throws out unused functions, so they are a bit on the high side,
+which is fine for catching something that grew by accident.
+
+If a module grew on purpose, raise its budget here in the same change.
+"""
+
+import os
+import subprocess
+
+Import("env")  # noqa: F821, provided by PlatformIO
+
+# Module: (flash bytes, RAM bytes)
+BUDGETS = {
+    "AdcFrontEnd": (2048, 640),
+    "AdcNoiseBench": (2048, 4352),
+    "AnimationAssets": (2048, 64),
+    "AudioAnalyzer": (6144, 1024),
+    "Benchmark": (9216, 3072),
+    "Clock": (512, 64),
+    "ColorMath": (4096, 256),
+    "DebounceInput": (1024, 64),
+    "FlightRecorder": (1024, 2176),
+    "LatencyBench": (3072, 256),
+    "LightVM": (4096, 64),
+    "LoopMonitor": (3072, 256),
+    "MotionSensorState": (1024, 64),
+    "OutputController": (8704, 256),
+    "PowerBudget": (1536, 64),
+    "ProgramState": (4096, 64),
+    "PwmPhase": (1024, 64),
+    "QualityBench": (4096, 20608),
+    "SensingTask": (3584, 64),
+    "SerialProtocol": (8192, 256),
+    "SmoothAnalogInput": (7168, 64),
+    "StatusLed": (2048, 64),
+    "StreamPlayer": (3072, 64),
+    "TemporalDither": (1536, 64),
+    "main": (10240, 6656),
+}
+
+# Section name prefixes.  Initialized data lives in flash and gets copied
+# into RAM at startup, so it counts against both.  Code in IRAM does too.
+FLASH_ONLY = (".text", ".literal", ".rodata", ".irom", ".flash")
+FLASH_AND_RAM = (".data", ".sdata", ".dram", ".iram")
+RAM_ONLY = (".bss", ".sbss", ".noinit", ".rtc", "COMMON")
+
+
+def section_sizes(size_tool, path):
+    """Add up the sections of one object file.  Returns (flash, ram)."""
+    output = subprocess.check_output([size_tool, "-A", path]).decode()
+    flash = ram = 0
+    for line in output.splitlines()[2:]:
+        fields = line.split()
+        if len(fields) < 2 or not fields[1].isdigit():
+            continue
+        name, size = fields[0], int(fields[1])
+        if name.startswith(FLASH_ONLY):
+            flash += size
+        elif name.startswith(FLASH_AND_RAM):
+            flash += size
+            ram += size
+        elif name.startswith(RAM_ONLY):
+            ram += size
+    return flash, ram
+
+
+def report(source, target, env):
+    size_tool = env.subst("$SIZETOOL")
+    object_dir = os.path.join(env.subst("$BUILD_DIR"), "src")
+    over_budget = []
+
+    print("")
+    print("%-20s %8s %8s %8s %8s" % ("module", "flash", "budget", "RAM", "budget"))
+    for file_name in sorted(os.listdir(object_dir)):
+        if not file_name.endswith(".o"):
+            continue
+        module = file_name.split(".")[0]
+        flash, ram = section_sizes(size_tool, os.path.join(object_dir, file_name))
+        flash_budget, ram_budget = BUDGETS.get(module, (None, None))
+        flag = ""
+        if flash_budget is None:
+            flag = "  (no budget)"
+        elif flash > flash_budget or ram > ram_budget:
+            flag = "  OVER BUDGET"
+            over_budget.append(module)
+        print("%-20s %8d %8s %8d %8s%s" % (module, flash, flash_budget or "-",
+                                           ram, ram_budget or "-", flag))
+    print("")
+
+    if over_budget:
+        print("Size budget exceeded by: " + ", ".join(over_budget))
+        print("Trim them down, or raise the budget in tools/size_report.py")
+        return 1
+    return 0
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report)  # noqa: F821
@@ -0,0 +1,91 @@
+"""
+End-to-end check of the STREAM mode over a pseudo-terminal: the firmware
+built for this computer (see tools/light_host.py) is sent a rainbow for
+longer than the sleep timeout, with nobody in the room, and has to stay in
+STREAM the whole time without starting over.  Once the frames stop, it has
+to doze off as usual.
+
+    python tools/stream_check.py
+    python tools/stream_check.py --speed 1 --seconds 45
+
+The firmware's clock runs --speed times faster than this computer's, and
+the frames are stamped on the same sped-up time, so the check takes about
+a quarter of the made-up time by default.  Exits with 1 if the mode ever
+changed while streaming, a frame went missing, or it never dozed after.
+"""
+
+import argparse
+import sys
+import time
+
+from light_host import HostFirmware
+from light_protocol import LightClient
+from stream_sender import rainbow
+
+# Keep these the same as in src/main.cpp
+DOZE_AFTER_S = 30.0
+SLEEP_AFTER_S = DOZE_AFTER_S + 5.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--speed", type=float, default=4.0,
+                        help="made-up seconds per real one")
+    parser.add_argument("--seconds", type=float, default=SLEEP_AFTER_S + 10.0,
+                        help="made-up seconds to stream for")
+    parser.add_argument("--fps", type=float, default=100.0,
+                        help="frames per made-up second")
+    args = parser.parse_args()
+
+    failures = []
+    with HostFirmware(args.speed) as board:
+        client = LightClient(board.link)
+        client.ping(b"hello")
+        start = time.monotonic()
+
+        def made_up_s():
+            return (time.monotonic() - start) * args.speed
+
+        # Stream, looking at the mode about every made-up second
+        sent = 0
+        next_check = 1.0
+        mode_changes = None
+        while made_up_s() < args.seconds:
+            now = made_up_s()
+            client.stream_frames([(int(now * 1e6),) + rainbow(now)])
+            sent += 1
+            if now >= next_check:
+                next_check += 1.0
+                mode = client.get_state()["mode"]
+                changes = client.get_counters()["mode_changes"]
+                if mode != "STREAM":
+                    failures.append("in %s after %.1f s of streaming" % (mode, now))
+                elif mode_changes is None:
+                    mode_changes = changes
+                elif changes != mode_changes:
+                    failures.append("changed mode %d times while streaming, by %.1f s" % (
+                        changes - mode_changes, now))
+                    mode_changes = changes
+            time.sleep(max(0.0, (sent / args.fps) / args.speed - (time.monotonic() - start)))
+        stats = client.get_stream_stats()
+        print("Streamed %.1f made-up seconds, sent %d frames: %s" % (made_up_s(), sent, stats))
+        if stats["frames_received"] != sent:
+            failures.append("sent %d frames, %d arrived" % (sent, stats["frames_received"]))
+
+        # Then nothing, it should doze once the timeout is up
+        stopped = made_up_s()
+        while made_up_s() - stopped < DOZE_AFTER_S + 2.0:
+            time.sleep(0.1)
+        mode = client.get_state()["mode"]
+        print("%.1f made-up seconds after the last frame: %s" % (made_up_s() - stopped, mode))
+        if mode not in ("SLEEP_PREP", "OFF"):
+            failures.append("still in %s after the frames stopped" % mode)
+
+    for failure in failures:
+        print("Failed: " + failure)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,69 @@
+"""
+Stream timestamped light frames to the device, for trying out the STREAM mode.
+
+Sends a slow rainbow at the requested frame rate, stamped with this computer's
+clock, and prints the device's stream counters every couple of seconds.
+
+    python tools/stream_sender.py /dev/ttyACM0 --fps 500 --seconds 30
+
+Use --gap-every to pause sending now and then, to watch the device hold and
+fade rather than freeze.
+"""
+
+import argparse
+import colorsys
+import time
+
+from light_protocol import LightClient
+
+
+def rainbow(t, period_s=5.0, level=900):
+    red, green, blue = colorsys.hsv_to_rgb((t / period_s) % 1.0, 1.0, 1.0)
+    return int(red * level), int(green * level), int(blue * level)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("--fps", type=float, default=200.0)
+    parser.add_argument("--seconds", type=float, default=20.0)
+    parser.add_argument("--batch", type=int, default=1,
+                        help="frames per serial packet (1-6)")
+    parser.add_argument("--gap-every", type=float, default=0.0,
+                        help="stop sending for --gap-length seconds this often")
+    parser.add_argument("--gap-length", type=float, default=2.0)
+    args = parser.parse_args()
+
+    client = LightClient(args.port)
+    period = 1.0 / args.fps
+    start = time.monotonic()
+    next_frame = start
+    next_report = start + 2.0
+    pending = []
+    try:
+        while time.monotonic() - start < args.seconds:
+            now = time.monotonic()
+            elapsed = now - start
+            if args.gap_every and (elapsed % args.gap_every) > args.gap_every - args.gap_length:
+                time.sleep(period)
+                next_frame = time.monotonic()
+                continue
+            if now < next_frame:
+                time.sleep(min(next_frame - now, 0.001))
+                continue
+            pending.append((int(next_frame * 1e6),) + rainbow(next_frame - start))
+            next_frame += period
+            if len(pending) >= args.batch:
+                client.stream_frames(pending)
+                pending = []
+            if now >= next_report:
+                next_report += 2.0
+                print(client.get_stream_stats())
+        print(client.get_stream_stats())
+    finally:
+        client.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,429 @@
+"""
+Sweep the dial filter and sleep constants over input traces, on every core
+of this computer, and print the settings that can't be beaten.
+
+The numbers in main.cpp and SmoothAnalogInput.h (the filter half-lives,
+wake_dial_deriv_threshold, mode_grab_dial_deriv_threshold and the doze
+timings) were picked by hand.  This replays traces through the firmware's
+own code, for every combination in the grid below, and scores each one on:
+------
+  flicker        10-bit duty changes per second while the dials sit still
+  settle_ms      how long after you stop turning a dial the light settles
+  false_grabs    times a dial sitting still went past the mode grab speed
+  missed_grabs   dial turns that never went past the mode grab speed
+  false_sleeps   times it started dozing off with someone in the room
+  empty_on_s     seconds the lights stayed on with nobody in the room
+------
+Lower is better for all of them, and they pull against each other, so
+there's no single best.  What comes out is the Pareto front: the settings
+where nothing else is at least as good on every score and better on one.
+The current settings are printed first for comparison.
+
+The dials are the firmware's SmoothAnalogInput (or another filter, with
+--filter), and the dial checks and the sleep are ProgramState's
+check_dials() and handle_sleep(), all built for this computer and loaded
+through tools/light_host.py.  Like loop(), the checks run every millisecond
+and the sleep every 10.  The replay starts in WHITE, so a red, green or
+blue turn should grab RGB, and a white turn then grabs WHITE back.  If it
+sleeps with someone there, they turn it back on the next time they move or
+turn a dial.  _ordinary_change_wide_sigma isn't swept any more, each dial
+works its own out from its noise (NoiseFloor).
+
+    python tools/tune_params.py                       # made-up traces
+    python tools/tune_params.py traces/*.csv --out results.csv
+    python tools/tune_params.py --quick               # small grid, quick look
+    python tools/tune_params.py --filter euro         # OneEuroAnalogInput
+
+A trace is a CSV, one line per sensing pass (every millisecond):
+------
+  time_us,red,green,blue,white,motion[,present[,turning]]
+------
+red to white are the dial readings as the filter gets them (after the
+AdcFrontEnd burst median), motion has a bit per motion sensor as the
+sensing task reports it, and present is 1 if someone was actually in the
+room (add it by hand; if it's missing we assume someone was).  turning has
+a bit per dial that was really being turned.  Without it, that's worked
+out from the trace itself by smoothing it both forwards and backwards,
+which the real filter can't do.
+"""
+
+import argparse
+import array
+import bisect
+import csv
+import itertools
+import multiprocessing
+import os
+import random
+import sys
+
+import light_host
+from light_protocol import MODE_NAMES
+
+DIALS = ("red", "green", "blue", "white")
+WHITE_DIAL = DIALS.index("white")
+RGB, HSV, OFF, SLEEP_PREP = (MODE_NAMES.index(name) for name in ("RGB", "HSV", "OFF", "SLEEP_PREP"))
+GRAB_LATE_MS = 100  # a grab this long after the turn ends still counts
+
+# What loop() and the dials use today
+CURRENT = {"long_ms": 50, "short_ms": 5,
+           "wake_speed": 1.2, "grab_speed": 1.85, "doze_s": 30, "sleep_s": 5}
+
+# Filter settings need the dials replayed, so they're what gets spread over the cores
+FILTER_GRID = {
+    "long_ms": [15, 20, 30, 50, 80],
+    "short_ms": [2, 5, 10],
+}
+# These only need the tallies, so every combination is cheap
+CHECK_GRID = {
+    "wake_speed": [0.6, 0.9, 1.2, 1.6, 2.4],
+    "grab_speed": [1.2, 1.85, 2.5, 3.5, 5.0],
+    "doze_s": [15, 30, 60, 120],
+    "sleep_s": [5, 10, 30],
+}
+QUICK_FILTER_GRID = {"long_ms": [20, 30, 50], "short_ms": [5]}
+QUICK_CHECK_GRID = {"wake_speed": [0.9, 1.2, 1.6], "grab_speed": [1.85, 3.5],
+                    "doze_s": [30], "sleep_s": [5]}
+
+SCORES = ("flicker", "settle_ms", "false_grabs", "missed_grabs", "false_sleeps", "empty_on_s")
+
+
+###########################################################
+# Traces
+###########################################################
+
+def load_trace(path):
+    rows = []
+    with open(path) as f:
+        for fields in csv.reader(f):
+            if len(fields) < 6 or not fields[0].strip().isdigit():
+                continue
+            values = [int(v) for v in fields]
+            present = values[6] if len(values) > 6 else 1
+            turning = values[7] if len(values) > 7 else None
+            rows.append((values[0], values[1:5], values[5], present, turning))
+    return rows
+
+
+def make_trace(seed, seconds=120):
+    """Someone at the desk turning dials now and then, sitting still for a
+    while (the motion sensors lose them), then leaving the room."""
+    rng = random.Random(seed)
+    leave_at = seconds * 0.7
+    still_from = rng.uniform(10, leave_at - 50)
+    still_until = still_from + rng.uniform(20, 45)
+    levels = [rng.uniform(300, 3500) for _ in DIALS]
+    turns = []  # (dial, start s, end s, where to)
+    t = 2.0
+    while t < leave_at - 3:
+        dial = rng.randrange(len(DIALS))
+        length = rng.uniform(0.15, 1.0)
+        target = rng.uniform(100, 3900)
+        turns.append((dial, t, t + length, target))
+        t += length + rng.uniform(2, 12)
+    motion_hold_until = 0.0
+    rows = []
+    for ms in range(int(seconds * 1000)):
+        now = ms / 1000.0
+        turning = 0
+        for dial, start, end, target in turns:
+            if start <= now < end:
+                step = (target - levels[dial]) / max((end - now) * 1000, 1)
+                levels[dial] += step
+                turning |= 1 << dial
+        readings = []
+        for level in levels:
+            value = level + rng.gauss(0, 3)
+            if rng.random() < 0.004:  # what's left of the spikes after the burst median
+                value += rng.choice((-1, 1)) * rng.uniform(100, 500)
+            readings.append(int(min(max(value, 0), 4095)))
+        present = now < leave_at
+        moving = present and not (still_from <= now < still_until)
+        if moving and rng.random() < 0.0015:
+            motion_hold_until = now + 4.0  # the sensor's own cooldown
+        motion = 1 if now < motion_hold_until else 0
+        rows.append((ms * 1000, readings, motion, 1 if present else 0, turning))
+    return rows
+
+
+def cleaned(trace, dial):
+    """A dial's readings with lone spikes taken out (middle of each three)."""
+    values = [row[1][dial] for row in trace]
+    return [sorted(values[max(i - 1, 0):i + 2])[len(values[max(i - 1, 0):i + 2]) // 2]
+            for i in range(len(values))]
+
+
+def centered_average(values, half_window):
+    sums = [0]
+    for v in values:
+        sums.append(sums[-1] + v)
+    count = len(values)
+    return [(sums[min(i + half_window + 1, count)] - sums[max(i - half_window, 0)]) /
+            float(min(i + half_window + 1, count) - max(i - half_window, 0))
+            for i in range(count)]
+
+
+def turning_mask(trace, dial, values, half_window=25, speed=0.3):
+    """When a dial was really being turned: the label if the trace has one,
+    otherwise from how fast a centered average moves."""
+    if trace[0][4] is not None:
+        return [bool(row[4] & (1 << dial)) for row in trace]
+    smooth = centered_average(values, half_window)
+    count = len(values)
+    return [0 < i < count - 5 and abs(smooth[min(i + 5, count - 1)] - smooth[max(i - 5, 0)]) / 10.0 > speed
+            for i in range(count)]
+
+
+def prepare(trace, grow_ms=50, settled_ms=200):
+    """The parts of a trace that don't depend on the settings."""
+    count = len(trace)
+    moving_masks = []
+    turns = []      # (dial, first index, index after), each time a dial was really turned
+    turn_ends = []  # (dial, index, where it came to rest)
+    for dial in range(len(DIALS)):
+        values = cleaned(trace, dial)
+        turning = turning_mask(trace, dial, values)
+        # Leave some room either side, the filter is allowed to catch up
+        moving = [False] * count
+        for i in range(count):
+            if turning[i]:
+                for j in range(max(i - grow_ms, 0), min(i + grow_ms, count)):
+                    moving[j] = True
+        moving_masks.append(moving)
+        start = None
+        for i in range(count + 1):
+            now = i < count and turning[i]
+            if now and start is None:
+                start = i
+            elif not now and start is not None:
+                turns.append((dial, start, i))
+                start = None
+        for i in range(1, count):
+            if turning[i - 1] and not turning[i]:
+                after = values[i:i + settled_ms]
+                turn_ends.append((dial, i, sum(after) / float(len(after))))
+
+    # How many of the milliseconds before each one nobody was there
+    absent_before = [0]
+    for row in trace:
+        absent_before.append(absent_before[-1] + (0 if row[3] else 1))
+    return {"trace": trace, "moving": moving_masks, "turns": turns, "turn_ends": turn_ends,
+            "motion": array.array("B", [row[2] for row in trace]),
+            "present": array.array("B", [1 if row[3] else 0 for row in trace]),
+            "absent_before": absent_before}
+
+
+###########################################################
+# Replay
+###########################################################
+
+def replay_dials(prepared, kind, long_ms, short_ms):
+    """Run the dials through the firmware's filter.  Returns the filter
+    scores, and every dial's speeds each millisecond for the checks."""
+    trace = prepared["trace"]
+    count = len(trace)
+    steps_us = [max(t - last_t, 1) for t, last_t in zip((row[0] for row in trace),
+                                                       [trace[0][0]] + [row[0] for row in trace])]
+    speeds = array.array("f", bytes(4 * count * len(DIALS)))
+    velocities = array.array("f", bytes(4 * count * len(DIALS)))
+    flicker_changes = 0
+    rest_us = 0
+    still = [True] * count
+    settle = []
+    for d in range(len(DIALS)):
+        dial = light_host.Dial(kind, trace[0][1][d], long_ms, short_ms)
+        fine, speed, velocity, _ = dial.add([row[1][d] for row in trace], steps_us)
+        speeds[d::len(DIALS)] = speed
+        velocities[d::len(DIALS)] = velocity
+        # Flicker: the 10-bit duty the light gets changing while the dial's still
+        moving = prepared["moving"][d]
+        duty = fine[0] >> 6
+        for i in range(count):
+            if moving[i]:
+                still[i] = False
+            else:
+                if fine[i] >> 6 != duty:
+                    flicker_changes += 1
+                duty = fine[i] >> 6
+        # Settling: after each turn ends, until the light is within 1% of where it ended up
+        for turn_dial, i, target in prepared["turn_ends"]:
+            if turn_dial != d:
+                continue
+            j = i
+            while j < count - 1 and abs(fine[j] / 16.0 - target) > 41:
+                j += 1
+            settle.append((trace[j][0] - trace[i][0]) / 1000.0)
+    rest_us = sum(step for step, now in zip(steps_us, still) if now)
+    scores = {
+        "flicker": flicker_changes / max(rest_us / 1e6, 1e-3),
+        "settle_ms": sum(settle) / len(settle) if settle else 0.0,
+    }
+    return scores, speeds, velocities
+
+
+def should_grab(dial, mode):
+    """Whether check_dials() would take the mode over for a turn of this dial."""
+    if mode in (RGB, HSV):
+        return dial == WHITE_DIAL
+    return mode != OFF and dial != WHITE_DIAL
+
+
+def replay_checks(prepared, speeds, velocities, wake_speed, grab_speed, doze_s, sleep_s):
+    """ProgramState's dial checks and sleep over the replay, scored."""
+    changes = light_host.replay_checks(speeds, velocities, prepared["motion"], prepared["present"],
+                                       wake_speed, grab_speed, int(doze_s * 1000),
+                                       int(sleep_s * 1000))
+    at = [ms for ms, _, _ in changes]
+    modes = [mode for _, mode, _ in changes]
+    present = prepared["present"]
+    moving = prepared["moving"]
+
+    false_grabs = sum(1 for ms, _, cause in changes if cause == light_host.CAUSE_DIALS and
+                      not any(moving[d][ms] for d in range(len(DIALS))))
+    false_sleeps = sum(1 for ms, mode, cause in changes if cause == light_host.CAUSE_SLEEP and
+                       mode == SLEEP_PREP and present[ms])
+    missed_grabs = 0
+    for dial, start, end in prepared["turns"]:
+        k = bisect.bisect_right(at, start - 1)
+        mode = modes[k - 1] if k > 0 else MODE_NAMES.index("WHITE")
+        if not should_grab(dial, mode):
+            continue
+        late = end + GRAB_LATE_MS
+        if not any(cause == light_host.CAUSE_DIALS and start <= ms < late for ms, _, cause in changes[k:]
+                   if ms < late):
+            missed_grabs += 1
+
+    # Lights on (anything but OFF) with nobody there
+    absent_before = prepared["absent_before"]
+    empty_on_ms = 0
+    bounds = [0] + at + [len(present)]
+    lit = [True] + [mode != OFF for mode in modes]
+    for k, on in enumerate(lit):
+        if on:
+            empty_on_ms += absent_before[bounds[k + 1]] - absent_before[bounds[k]]
+    return {"false_grabs": false_grabs, "missed_grabs": missed_grabs,
+            "false_sleeps": false_sleeps, "empty_on_s": empty_on_ms / 1e3}
+
+
+def grid(axes):
+    names = sorted(axes)
+    for values in itertools.product(*(axes[n] for n in names)):
+        yield dict(zip(names, values))
+
+
+def run_filter_setting(job):
+    """One filter setting over the whole corpus, with every check setting.
+    This is what each core gets handed."""
+    kind, filter_setting, check_grid, corpus = job
+    replays = [replay_dials(p, kind, filter_setting["long_ms"], filter_setting["short_ms"])
+               for p in corpus]
+    results = []
+    for checks in check_grid:
+        row = dict(filter_setting)
+        row.update(checks)
+        totals = dict.fromkeys(SCORES, 0.0)
+        for prepared, (filter_scores, speeds, velocities) in zip(corpus, replays):
+            scores = dict(filter_scores)
+            scores.update(replay_checks(prepared, speeds, velocities, checks["wake_speed"],
+                                        checks["grab_speed"], checks["doze_s"],
+                                        checks["sleep_s"]))
+            for name in SCORES:
+                totals[name] += scores[name]
+        # Averages for the rates, totals for the counts
+        totals["flicker"] /= len(corpus)
+        totals["settle_ms"] /= len(corpus)
+        row.update(totals)
+        results.append(row)
+    return results
+
+
+###########################################################
+# Results
+###########################################################
+
+def dominates(a, b):
+    return (all(a[s] <= b[s] for s in SCORES) and any(a[s] < b[s] for s in SCORES))
+
+
+def pareto_front(rows):
+    """Settings that nothing beats.  When several score exactly the same,
+    only the first is kept."""
+    front = []
+    for row in sorted(rows, key=lambda r: tuple(r[s] for s in SCORES)):
+        if not any(dominates(other, row) or all(other[s] == row[s] for s in SCORES)
+                   for other in front):
+            front.append(row)
+    return front
+
+
+SETTINGS = ("long_ms", "short_ms", "wake_speed", "grab_speed", "doze_s", "sleep_s")
+
+
+def print_rows(rows):
+    print(" ".join("%10s" % n for n in SETTINGS + SCORES))
+    for row in rows:
+        print(" ".join("%10s" % ("%.4g" % row[n]) for n in SETTINGS + SCORES))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("traces", nargs="*", help="trace CSVs, otherwise made-up ones")
+    parser.add_argument("--synthetic", type=int, default=4, help="how many made-up traces")
+    parser.add_argument("--quick", action="store_true", help="a small grid, for a quick look")
+    parser.add_argument("--filter", choices=sorted(light_host.DIAL_KINDS), default="ema",
+                        help="which dial filter (ema is SmoothAnalogInput, what the dials use)")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count(), help="processes to use")
+    parser.add_argument("--out", help="write every result to this CSV")
+    args = parser.parse_args()
+
+    if args.traces:
+        traces = [load_trace(path) for path in args.traces]
+    else:
+        traces = [make_trace(seed) for seed in range(args.synthetic)]
+    corpus = [prepare(trace) for trace in traces if trace]
+    if not corpus:
+        print("No trace data")
+        return 1
+
+    filter_grid = list(grid(QUICK_FILTER_GRID if args.quick else FILTER_GRID))
+    check_grid = list(grid(QUICK_CHECK_GRID if args.quick else CHECK_GRID))
+    current_filter = {k: CURRENT[k] for k in FILTER_GRID}
+    if current_filter not in filter_grid:
+        filter_grid.append(current_filter)
+    current_checks = {k: CURRENT[k] for k in CHECK_GRID}
+    if current_checks not in check_grid:
+        check_grid.append(current_checks)
+    print("%d traces, %d settings, on %d cores" % (len(corpus), len(filter_grid) * len(check_grid),
+                                                   args.jobs))
+
+    # Built before the workers start, so they don't all build it
+    light_host.api()
+    kind = light_host.DIAL_KINDS[args.filter]
+    jobs = [(kind, f, check_grid, corpus) for f in filter_grid]
+    if args.jobs > 1:
+        with multiprocessing.Pool(args.jobs) as pool:
+            batches = pool.map(run_filter_setting, jobs)
+    else:
+        batches = [run_filter_setting(job) for job in jobs]
+    rows = [row for batch in batches for row in batch]
+
+    current = [r for r in rows if all(r[k] == CURRENT[k] for k in SETTINGS)]
+    print("\nCurrent settings:")
+    print_rows(current)
+    front = pareto_front(rows)
+    print("\nPareto front (%d of %d):" % (len(front), len(rows)))
+    print_rows(front)
+
+    if args.out:
+        with open(args.out, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=SETTINGS + SCORES)
+            writer.writeheader()
+            for row in rows:
+                writer.writerow({n: row[n] for n in SETTINGS + SCORES})
+        print("\nWrote all %d results to %s" % (len(rows), args.out))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,148 @@
+"""
+Compare the two ways the firmware tells how fast a dial is turning, on the
+same dial traces: the EMA derivative (get_smooth_deriv(), one reading's
+change of the smoothed value) and the least-squares slope
+(get_velocity(), see SlidingVelocity in SmoothAnalogInput.h).
+
+loop() in main.cpp grabs the mode when a dial goes faster than
+mode_grab_dial_deriv_threshold.  For each estimator and a few thresholds,
+this measures:
+------
+  latency_ms   from a turn starting to the speed first going over (mean, 90th percentile)
+  missed       turns that never went over
+  false/min    times a dial sitting still went over, per minute of sitting still
+------
+The traces are the same as tools/tune_params.py takes (or its made-up
+ones), and "really turning" comes from there too: the label in the trace
+if it has one, otherwise a smoothing of the trace forwards and backwards.
+Both speeds come from the firmware's own dial, built for this computer and
+loaded through tools/light_host.py, so the least-squares window is the
+firmware's (VELOCITY_WINDOW, fixed when it's compiled).
+
+    python tools/velocity_compare.py
+    python tools/velocity_compare.py traces/*.csv
+    python tools/velocity_compare.py --filter euro
+"""
+
+import argparse
+import math
+import statistics
+import sys
+
+import light_host
+from tune_params import DIALS, cleaned, load_trace, make_trace, turning_mask
+
+THRESHOLDS = [1.2, 1.85, 2.5, 3.5, 5.0]
+ESTIMATORS = ("ema derivative", "least squares")
+
+
+def speeds(trace, dial, kind):
+    """get_smooth_deriv() and get_velocity() after each reading, for one dial."""
+    steps_us = [max(t - last[0], 1) for (t, _, _, _, _), last in zip(trace, [trace[0]] + trace)]
+    replay = light_host.Dial(kind, trace[0][1][dial])
+    _, speed, velocity, _ = replay.add([row[1][dial] for row in trace], steps_us)
+    return speed, velocity
+
+
+def turns(turning):
+    """(start, end) index of each stretch of really turning."""
+    found = []
+    start = None
+    for i, now in enumerate(turning + [False]):
+        if now and start is None:
+            start = i
+        elif not now and start is not None:
+            found.append((start, i))
+            start = None
+    return found
+
+
+def score(trace, turning, values, speed, threshold, grow=50, late=100):
+    """Latencies of the turns caught, turns missed, false triggers and
+    microseconds sitting still, for one dial.  Only turns that really went
+    faster than the threshold (by a quarter) have to be caught."""
+    count = len(trace)
+    near_turn = [False] * count
+    stretches = turns(turning)
+    for start, end in stretches:
+        for i in range(max(start - grow, 0), min(end + grow, count)):
+            near_turn[i] = True
+    latencies = []
+    missed = 0
+    for start, end in stretches:
+        duration_ms = max((trace[end - 1][0] - trace[start][0]) / 1000.0, 1.0)
+        if abs(values[end - 1] - values[start]) / duration_ms < threshold * 1.25:
+            continue
+        for i in range(start, min(end + late, count)):
+            if abs(speed[i]) > threshold:
+                latencies.append((trace[i][0] - trace[start][0]) / 1000.0)
+                break
+        else:
+            missed += 1
+    false_triggers = 0
+    over = False
+    still_us = 0
+    for i in range(1, count):
+        now_over = abs(speed[i]) > threshold
+        if not near_turn[i]:
+            still_us += trace[i][0] - trace[i - 1][0]
+            if now_over and not over:
+                false_triggers += 1
+        over = now_over
+    return latencies, missed, false_triggers, still_us
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("traces", nargs="*", help="trace CSVs, otherwise made-up ones")
+    parser.add_argument("--synthetic", type=int, default=4, help="how many made-up traces")
+    parser.add_argument("--filter", choices=sorted(light_host.DIAL_KINDS), default="ema",
+                        help="which dial filter (ema is SmoothAnalogInput, what the dials use)")
+    args = parser.parse_args()
+
+    if args.traces:
+        traces = [load_trace(path) for path in args.traces]
+    else:
+        traces = [make_trace(seed) for seed in range(args.synthetic)]
+    traces = [trace for trace in traces if trace]
+    if not traces:
+        print("No trace data")
+        return 1
+
+    # Replay each dial once, then every threshold is just counting
+    kind = light_host.DIAL_KINDS[args.filter]
+    runs = []
+    for trace in traces:
+        for dial in range(len(DIALS)):
+            values = cleaned(trace, dial)
+            turning = turning_mask(trace, dial, values)
+            runs.append((trace, turning, values, speeds(trace, dial, kind)))
+
+    print("%-20s %9s %10s %10s %8s %10s" % ("estimator", "threshold", "latency_ms", "p90_ms",
+                                            "missed", "false/min"))
+    for e, name in enumerate(ESTIMATORS):
+        for threshold in THRESHOLDS:
+            latencies = []
+            missed = false_triggers = still_us = turn_count = 0
+            for trace, turning, values, replayed in runs:
+                caught, dial_missed, dial_false, dial_still = score(trace, turning, values, replayed[e],
+                                                                    threshold)
+                latencies += caught
+                missed += dial_missed
+                false_triggers += dial_false
+                still_us += dial_still
+                turn_count += len(caught) + dial_missed
+            if latencies:
+                mean = "%.1f" % statistics.mean(latencies)
+                p90 = "%.1f" % sorted(latencies)[math.ceil(0.9 * len(latencies)) - 1]
+            else:
+                mean = p90 = "-"
+            print("%-20s %9.2f %10s %10s %4d/%-3d %10.2f" % (
+                name, threshold, mean, p90, missed, turn_count,
+                false_triggers / max(still_us / 60e6, 1e-6)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())